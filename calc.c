@@ -4,13 +4,19 @@
 *	Description	:	calculator source file
 *******************************************************************************/
 #include <assert.h> /* assert		*/
-#include <stdlib.h>	/* strtod */
+#include <stdlib.h>	/* malloc, free */
 #include <string.h>	/* strlen */
 #include <ctype.h>	/* isdigit */
-#include <math.h>	/* pow, isnan */
+#include <limits.h>	/* UCHAR_MAX */
+#include <math.h>	/* isnan */
+#include <pthread.h> /* pthread_once */
 
 #include "calc.h"
-#include "stack/stack.h"
+#include "calc_prog.h"
+#include "calc_number.h"
+#include "calc_lex.h"
+#include "calc_stats.h"
+#include "stack/typed_stack.h"
 
 /******************************* MACROS ***************************************/
 #define UNUSED(x) ((void) x)
@@ -19,7 +25,34 @@
 #define SIZE_OF_CHAR (sizeof(char))
 #define RESULT_WHEN_ERROR -1
 
-#define ASCII_TABLE_SIZE 128
+#define EVENTS_LUT_SIZE (UCHAR_MAX + 1)	/* an event for every byte */
+
+/* the stacks start on the call stack, ~220 elements each - no malloc unless
+   an input nests deeper than that */
+#define LOCAL_BUFFER_SIZE 2048
+
+/* the dispatch of the state machine is chosen at build time - define one of:
+   CALC_DISPATCH_TABLE	- an indirect call through g_action_funcs_lut per event
+   CALC_DISPATCH_SWITCH	- one switch over (state, event), actions inlined
+   CALC_DISPATCH_GOTO	- computed goto (GCC, Clang), actions inlined and a
+   						  jump per action - each one predicted on its own
+   the default is computed goto where the compiler has it, a switch elsewhere */
+#if !defined(CALC_DISPATCH_TABLE) && !defined(CALC_DISPATCH_SWITCH) && \
+    !defined(CALC_DISPATCH_GOTO)
+#define CALC_DISPATCH_GOTO
+#endif
+
+#if defined(CALC_DISPATCH_GOTO) && !defined(__GNUC__)
+#undef CALC_DISPATCH_GOTO
+#define CALC_DISPATCH_SWITCH
+#endif
+
+/* a call waits on the op stack, under its '(', as the opcode of its
+   function with this bit set - no char of an input is an op like it */
+#define FUNC_MARK 0x80
+
+/* a case of the switch dispatch */
+#define DISPATCH_KEY(state, event) ((state) * MAX_EVENTS + (event))
 
 /******************************* enums ****************************************/
 typedef enum boolean
@@ -47,33 +80,63 @@ enum events
 	SPACE,
 	OPEN_PARENTHESES,
 	CLOSE_PARENTHESES,
+	LETTER,			/* a char of a variable name */
+	LETTER_X,		/* 'x' - a variable name, or a multiplication after a number */
+	COMMA,			/* between the arguments of a function */
 	END_OF_STRING,
 	INVALID_CHAR,
 	MAX_EVENTS
 };
 
 /*************************** structs & typedefs *******************************/
+/* the stacks of the calculation - numbers and pending ops */
+DEFINE_TYPED_STACK(num_stack, NumStack, double)
+DEFINE_TYPED_STACK(op_stack, OpStack, char)
+
 /* arguments pack to be passed to the action funcs. */
 typedef struct calculator_s
 {
     enum states cur_state;  /* the current state of the calculator */
     char* runner;           /* runner on the user-input string */
-    stack_t* num_st;        /* stack for numbers */
-    stack_t* op_st;         /* stack for operation */
+    const char* end;        /* end of the user-input string */
+    num_stack_t num_st;     /* stack for numbers */
+    op_stack_t op_st;       /* stack for operation */
     result_t result;        /* result value to be returned to the user */
+    calc_program_t* program;/* compile target - NULL when calculating */
+    bool vars_bound;        /* variable slots are fixed by the caller */
 }calculator_t;
 
+/* caller-owned scratch memory, reused by every calculation on it */
+struct calc_arena_s
+{
+	void* buffer;	/* room for both stacks */
+	size_t size;	/* bytes in 'buffer' */
+};
+
+/* on-stack scratch memory, aligned as malloc memory is */
+typedef union local_buffer_u
+{
+	double align_double;
+	void* align_ptr;
+	char bytes[LOCAL_BUFFER_SIZE];
+}local_buffer_t;
+
 /* the type common to all the functions in the action funcs table */
 typedef void (*action_func_t)(calculator_t* calculator);
 
 /************************* internal functions *********************************/
 /* init funcs */
+static void InitLuts(void);
+#ifdef CALC_DISPATCH_TABLE
 static void InitActionFuncsLut(void);
+#endif
 static void  InitEventsLut(void);
 
 /* action funcs */
 static void GetNumber(calculator_t* calculator);
 static void GetOperation(calculator_t* calculator);
+static void GetVariable(calculator_t* calculator);
+static void NextArgument(calculator_t* calculator);
 static void SkipSpace(calculator_t* calculator);
 static void PushParentheses(calculator_t* calculator);
 static void CalcParentheses(calculator_t* calculator);
@@ -81,14 +144,38 @@ static void GetResult(calculator_t* calculator);
 static void Error(calculator_t* calculator);
 
 /* other funcs */
+static void RunCalculator(calculator_t* calculator, const char* str,
+                          size_t len, calc_arena_t* arena, 
+                          const calc_limits_t* limits);
+static void RunInput(calculator_t* calculator, const char* str, size_t len,
+                     calc_arena_t* arena, const calc_limits_t* limits);
+static void ReleaseStacks(calculator_t* calculator, calc_arena_t* arena,
+                          size_t capacity);
+static void RunStateMachine(calculator_t* calculator);
+static int EventAt(const calculator_t* calculator, const char* ptr);
+static void GrowArena(calc_arena_t* arena, size_t size);
 static void ExecuteLastOp(calculator_t* calculator);
+static void PushCall(calculator_t* calculator, int opcode, const char* open);
+static void ExecuteCall(calculator_t* calculator, unsigned int opcode,
+                        size_t args);
+static void CompileOperand(calculator_t* calculator, unsigned int opcode,
+                           unsigned int arg, double num);
+static void CompileOperation(calculator_t* calculator, char op_sign);
 static result_t PerformOperation(double num1, double num2, char op_sign);
 static bool OpHasHigherPriority(char op1, char op2);
+static bool IsBarrier(char op);
+static bool IsSpaceKept(const char* out, size_t out_len, char right);
+static bool IsWordChar(char c);
 
 
 /************************* global variable ************************************/
-static char 			g_events_lut[ASCII_TABLE_SIZE];
+/* built once (by InitLuts) and read-only from then on - calculations on
+   several threads at once never race on them */
+static char 			g_events_lut[EVENTS_LUT_SIZE];
+#ifdef CALC_DISPATCH_TABLE
 static action_func_t 	g_action_funcs_lut[MAX_STATES][MAX_EVENTS] = {NULL};
+#endif
+static pthread_once_t 	g_luts_once = PTHREAD_ONCE_INIT;
 
 
 /******************************************************************************
@@ -100,59 +187,561 @@ static action_func_t 	g_action_funcs_lut[MAX_STATES][MAX_EVENTS] = {NULL};
 result_t Calculate(const char* str)
 {
 	calculator_t calculator = {0};
-	size_t stack_max_limit  = 0;
-	int cur_event 		    = 0;
 	
 	assert(str);
 	
-	InitEventsLut();
-	InitActionFuncsLut();
+	RunCalculator(&calculator, str, strlen(str), NULL, NULL);
+	
+	return (calculator.result);
+}
+
+
+/******************************************************************************
+*								CalcN
+*******************************************************************************/
+result_t CalcN(const char* str, size_t len)
+{
+	calculator_t calculator = {0};
+	
+	assert(str || 0 == len);
+	
+	RunCalculator(&calculator, str, len, NULL, NULL);
+	
+	return (calculator.result);
+}
+
+
+/******************************************************************************
+*								CalculateArena
+*******************************************************************************/
+result_t CalculateArena(const char* str, calc_arena_t* arena)
+{
+	calculator_t calculator = {0};
+	
+	assert(str);
+	assert(arena);
+	
+	RunCalculator(&calculator, str, strlen(str), arena, NULL);
+	
+	return (calculator.result);
+}
+
+
+/******************************************************************************
+*								CalcNArena
+*******************************************************************************/
+result_t CalcNArena(const char* str, size_t len, calc_arena_t* arena)
+{
+	calculator_t calculator = {0};
+	
+	assert(str || 0 == len);
+	assert(arena);
+	
+	RunCalculator(&calculator, str, len, arena, NULL);
+	
+	return (calculator.result);
+}
+
+
+/******************************************************************************
+*								CalcNLimited
+*******************************************************************************/
+result_t CalcNLimited(const char* str, size_t len, const calc_limits_t* limits,
+                      calc_arena_t* arena)
+{
+	calculator_t calculator = {0};
+	
+	assert(str || 0 == len);
+	
+	RunCalculator(&calculator, str, len, arena, limits);
 	
-	/* allocate surely enough sapce in the stacks - push can never fail */
-	stack_max_limit = strlen(str);
-	calculator.num_st = StackCreate(stack_max_limit, SIZE_OF_DOUBLE);
-	calculator.op_st = StackCreate(stack_max_limit, SIZE_OF_CHAR);
+	return (calculator.result);
+}
+
+
+/******************************************************************************
+*								CalcArenaCreate
+*******************************************************************************/
+calc_arena_t* CalcArenaCreate(size_t size)
+{
+	calc_arena_t* arena = (calc_arena_t*)malloc(sizeof(calc_arena_t));
+	
+	if (arena == NULL)
+	{
+		return (NULL);
+	}
+	
+	arena->size = size;
+	arena->buffer = (size > 0) ? malloc(size) : NULL;
+	
+	if (size > 0 && arena->buffer == NULL)
+	{
+		free(arena);
+		return (NULL);
+	}
+	
+	return (arena);
+}
+
+
+/******************************************************************************
+*								CalcArenaDestroy
+*******************************************************************************/
+void CalcArenaDestroy(calc_arena_t* arena)
+{
+	if (arena != NULL)
+	{
+		free(arena->buffer);
+		free(arena);
+	}
+}
+
+
+/******************************************************************************
+*								CalcCompile
+*******************************************************************************/
+calc_program_t *CalcCompile(const char* str, int* status)
+{
+	return (CalcCompileVars(str, NULL, 0, status));
+}
+
+
+/******************************************************************************
+*								CalcCompileVars
+*******************************************************************************/
+calc_program_t *CalcCompileVars(const char* str, const char* const* names,
+                                size_t count, int* status)
+{
+	calculator_t calculator = {0};
+	size_t i = 0;
 	
-	/* makes sure both stacks have been created successfuly */
-	if (calculator.num_st != NULL && calculator.op_st != NULL)
+	assert(str);
+	assert(names || 0 == count);
+	
+	/* the same state-machine runs, but ops are emitted instead of executed */
+	calculator.program = ProgramCreate();
+	calculator.vars_bound = (names != NULL);
+	calculator.result.status = (calculator.program != NULL) ? 
+	                           CALC_SUCCESS : APPLICATION_ERROR;
+	
+	/* the binding table takes the first slots, in its own order */
+	for (i = 0; i < count && calculator.result.status == CALC_SUCCESS; ++i)
 	{
-		/* init calculator pack */
-		calculator.cur_state = WAIT_FOR_NUM; /* start-state of calculator */
-		calculator.runner = (char*)str;
-		calculator.result.status = CALC_SUCCESS;
+		assert(-1 == ProgramFindVar(calculator.program, names[i], 
+		                            strlen(names[i])));
 		
-		/*** main loop ***/
-		while (calculator.cur_state != END)
+		if (ProgramAddVar(calculator.program, names[i], strlen(names[i])) < 0)
 		{
-			cur_event = g_events_lut[(unsigned char)*(calculator.runner)];
-			g_action_funcs_lut[calculator.cur_state][cur_event](&calculator);
+			calculator.result.status = APPLICATION_ERROR;
 		}
 	}
-	else
+	
+	if (calculator.result.status == CALC_SUCCESS)
 	{
-		calculator.result.status = APPLICATION_ERROR;
+		RunCalculator(&calculator, str, strlen(str), NULL, NULL);
 	}
 	
-	/* clean-ups if needed */
-	if (calculator.op_st != NULL)
+	if (calculator.result.status != CALC_SUCCESS)
 	{
-		StackDestroy(calculator.op_st);
-		calculator.op_st = NULL;
+		CalcProgramDestroy(calculator.program);
+		calculator.program = NULL;
 	}
 	
-	if (calculator.num_st != NULL)
+	if (status != NULL)
 	{
-		StackDestroy(calculator.num_st);
-		calculator.num_st = NULL;
+		*status = calculator.result.status;
 	}
 	
-	return (calculator.result);
+	return (calculator.program);
+}
+
+
+/******************************************************************************
+*								LexNormalize
+*******************************************************************************/
+size_t LexNormalize(const char* str, size_t len, char* out, size_t out_size)
+{
+	const char* end = str + len;
+	size_t out_len = 0;
+	bool is_space_pending = FALSE;
+	
+	assert(str || 0 == len);
+	assert(out || 0 == out_size);
+	
+	pthread_once(&g_luts_once, InitLuts);
+	
+	for (; str < end; ++str)
+	{
+		/* a run of spaces - decided on by the chars around it */
+		if (g_events_lut[(unsigned char)*str] == SPACE)
+		{
+			is_space_pending = (out_len > 0);
+			continue;
+		}
+		
+		if (is_space_pending && IsSpaceKept(out, out_len, *str))
+		{
+			if (out_len == out_size)
+			{
+				return (LEX_TOO_LONG);
+			}
+			out[out_len++] = ' ';
+		}
+		is_space_pending = FALSE;
+		
+		if (out_len == out_size)
+		{
+			return (LEX_TOO_LONG);
+		}
+		out[out_len++] = *str;
+	}
+	
+	return (out_len);
+}
+
+
+/******************************************************************************
+*								RunCalculator
+*******************************************************************************/
+static void RunCalculator(calculator_t* calculator, const char* str,
+                          size_t len, calc_arena_t* arena, 
+                          const calc_limits_t* limits)
+{
+	CALC_STATS_BEGIN(CALC_PHASE_TOTAL);
+	
+	RunInput(calculator, str, len, arena, limits);
+	
+	CALC_STATS_END(CALC_PHASE_TOTAL);
+}
+
+
+/******************************************************************************
+*								RunInput
+*******************************************************************************/
+static void RunInput(calculator_t* calculator, const char* str, size_t len,
+                     calc_arena_t* arena, const calc_limits_t* limits)
+{
+	local_buffer_t local_buffer;
+	char* scratch 		    = local_buffer.bytes;
+	size_t scratch_size	    = sizeof(local_buffer.bytes);
+	size_t capacity 	    = 0;
+	size_t depth 		    = 0;
+	int is_valid 		    = 0;
+	
+	CALC_STATS_BEGIN(CALC_PHASE_INIT);
+	pthread_once(&g_luts_once, InitLuts);
+	CALC_STATS_END(CALC_PHASE_INIT);
+	
+	/* over the limits - rejected before reading a single char */
+	if (limits != NULL && limits->max_length != 0 && len > limits->max_length)
+	{
+		calculator->result.status = LIMIT_ERROR;
+		Error(calculator);
+		return;
+	}
+	
+	/* invalid chars and unbalanced parentheses - rejected before any work */
+	CALC_STATS_BEGIN(CALC_PHASE_LEX);
+	is_valid = (LexValidate(str, len, &depth) == 0);
+	CALC_STATS_END(CALC_PHASE_LEX);
+	if (!is_valid)
+	{
+		Error(calculator);
+		return;
+	}
+	
+	if (limits != NULL && limits->max_depth != 0 && depth > limits->max_depth)
+	{
+		calculator->result.status = LIMIT_ERROR;
+		Error(calculator);
+		return;
+	}
+	
+	/* the stacks start in the arena or on the call stack, and grow on the
+	   heap only as deep as the input nests - not as long as it is.
+	   the doubles go first, so both stacks are aligned */
+	CALC_STATS_BEGIN(CALC_PHASE_STACKS);
+	if (arena != NULL && arena->size > scratch_size)
+	{
+		scratch = arena->buffer;
+		scratch_size = arena->size;
+	}
+	capacity = scratch_size / (SIZE_OF_DOUBLE + SIZE_OF_CHAR);
+	NumStackInit(&calculator->num_st, (double*)scratch, capacity);
+	OpStackInit(&calculator->op_st, scratch + capacity * SIZE_OF_DOUBLE, 
+	            capacity);
+	CALC_STATS_END(CALC_PHASE_STACKS);
+	
+	/* init calculator pack */
+	calculator->cur_state = WAIT_FOR_NUM; /* start-state of calculator */
+	calculator->runner = (char*)str;
+	calculator->end = str + len;
+	calculator->result.status = CALC_SUCCESS;
+	
+	RunStateMachine(calculator);
+	
+	ReleaseStacks(calculator, arena, capacity);
+}
+
+
+/******************************************************************************
+*								ReleaseStacks
+*******************************************************************************/
+static void ReleaseStacks(calculator_t* calculator, calc_arena_t* arena,
+                          size_t capacity)
+{
+	size_t peak = 0;
+	
+	CALC_STATS_BEGIN(CALC_PHASE_STACKS);
+	
+	/* clean-ups - the stacks that grew are on the heap */
+	peak = NumStackCapacity(&calculator->num_st);
+	if (OpStackCapacity(&calculator->op_st) > peak)
+	{
+		peak = OpStackCapacity(&calculator->op_st);
+	}
+	NumStackDestroy(&calculator->num_st);
+	OpStackDestroy(&calculator->op_st);
+	
+	/* the arena keeps the peak, so the next such input doesn't grow */
+	if (arena != NULL && peak > capacity)
+	{
+		GrowArena(arena, peak * (SIZE_OF_DOUBLE + SIZE_OF_CHAR));
+	}
+	
+	CALC_STATS_END(CALC_PHASE_STACKS);
+}
+
+
+/******************************************************************************
+*								RunStateMachine
+*******************************************************************************/
+#if defined(CALC_DISPATCH_TABLE)
+
+static void RunStateMachine(calculator_t* calculator)
+{
+	int cur_event = 0;
+	
+	/*** main loop ***/
+	while (calculator->cur_state != END)
+	{
+		cur_event = EventAt(calculator, calculator->runner);
+		g_action_funcs_lut[calculator->cur_state][cur_event](calculator);
+	}
+}
+
+#elif defined(CALC_DISPATCH_SWITCH)
+
+static void RunStateMachine(calculator_t* calculator)
+{
+	int cur_event = 0;
+	
+	/*** main loop - the same table as InitActionFuncsLut, as cases ***/
+	while (calculator->cur_state != END)
+	{
+		cur_event = EventAt(calculator, calculator->runner);
+		
+		switch (DISPATCH_KEY(calculator->cur_state, cur_event))
+		{
+			case DISPATCH_KEY(WAIT_FOR_NUM, DIGIT):
+			case DISPATCH_KEY(WAIT_FOR_NUM, MINUS):
+				GetNumber(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_NUM, SPACE):
+			case DISPATCH_KEY(WAIT_FOR_OP, SPACE):
+				SkipSpace(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_NUM, OPEN_PARENTHESES):
+				PushParentheses(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_NUM, LETTER):
+			case DISPATCH_KEY(WAIT_FOR_NUM, LETTER_X):
+				GetVariable(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_OP, OP):
+			case DISPATCH_KEY(WAIT_FOR_OP, MINUS):
+			case DISPATCH_KEY(WAIT_FOR_OP, LETTER_X):
+				GetOperation(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_OP, CLOSE_PARENTHESES):
+				CalcParentheses(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_OP, COMMA):
+				NextArgument(calculator);
+				break;
+			
+			case DISPATCH_KEY(WAIT_FOR_OP, END_OF_STRING):
+				GetResult(calculator);
+				break;
+			
+			/* every other event, and every event in ERROR state */
+			default:
+				Error(calculator);
+				break;
+		}
+	}
+}
+
+#else /* CALC_DISPATCH_GOTO */
+
+/* labels as values and 'goto *' are GNU C - on purpose here */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+static void RunStateMachine(calculator_t* calculator)
+{
+	/* the same table as InitActionFuncsLut, as labels - END leaves */
+	static const void* const actions[MAX_STATES][MAX_EVENTS] =
+	{
+		[WAIT_FOR_NUM] =
+		{
+			[DIGIT]				= &&get_number,
+			[OP]				= &&error,
+			[MINUS]				= &&get_number,
+			[SPACE]				= &&skip_space,
+			[OPEN_PARENTHESES]	= &&push_parentheses,
+			[CLOSE_PARENTHESES]	= &&error,
+			[LETTER]			= &&get_variable,
+			[LETTER_X]			= &&get_variable,
+			[COMMA]				= &&error,
+			[END_OF_STRING]		= &&error,
+			[INVALID_CHAR]		= &&error
+		},
+		[WAIT_FOR_OP] =
+		{
+			[DIGIT]				= &&error,
+			[OP]				= &&get_operation,
+			[MINUS]				= &&get_operation,
+			[SPACE]				= &&skip_space,
+			[OPEN_PARENTHESES]	= &&error,
+			[CLOSE_PARENTHESES]	= &&calc_parentheses,
+			[LETTER]			= &&error,
+			[LETTER_X]			= &&get_operation,
+			[COMMA]				= &&next_argument,
+			[END_OF_STRING]		= &&get_result,
+			[INVALID_CHAR]		= &&error
+		},
+		[END] =
+		{
+			&&end, &&end, &&end, &&end, &&end, &&end,
+			&&end, &&end, &&end, &&end, &&end
+		},
+		[ERROR] =
+		{
+			&&error, &&error, &&error, &&error, &&error, &&error,
+			&&error, &&error, &&error, &&error, &&error
+		}
+	};
+	
+/* every action ends in a jump of its own to the next one */
+#define NEXT_ACTION goto *actions[calculator->cur_state] \
+                             [EventAt(calculator, calculator->runner)]
+	
+	NEXT_ACTION;
+	
+get_number:
+	GetNumber(calculator);
+	NEXT_ACTION;
+	
+get_operation:
+	GetOperation(calculator);
+	NEXT_ACTION;
+	
+get_variable:
+	GetVariable(calculator);
+	NEXT_ACTION;
+	
+skip_space:
+	SkipSpace(calculator);
+	NEXT_ACTION;
+	
+push_parentheses:
+	PushParentheses(calculator);
+	NEXT_ACTION;
+	
+calc_parentheses:
+	CalcParentheses(calculator);
+	NEXT_ACTION;
+	
+next_argument:
+	NextArgument(calculator);
+	NEXT_ACTION;
+	
+get_result:
+	GetResult(calculator);
+	NEXT_ACTION;
+	
+error:
+	Error(calculator);
+	NEXT_ACTION;
+	
+end:
+	return;
+
+#undef NEXT_ACTION
+}
+
+#pragma GCC diagnostic pop
+
+#endif /* CALC_DISPATCH_GOTO */
+
+
+/******************************************************************************
+*								EventAt
+*******************************************************************************/
+static int EventAt(const calculator_t* calculator, const char* ptr)
+{
+	/* the end of the input is found by its position - not by a '\0' */
+	if (ptr == calculator->end)
+	{
+		return (END_OF_STRING);
+	}
+	
+	return (g_events_lut[(unsigned char)*ptr]);
+}
+
+
+/******************************************************************************
+*								GrowArena
+*******************************************************************************/
+static void GrowArena(calc_arena_t* arena, size_t size)
+{
+	size_t new_size = 0;
+	
+	/* the arena grows geometrically, so it soon stops allocating at all */
+	if (size > arena->size)
+	{
+		new_size = (2 * arena->size > size) ? 2 * arena->size : size;
+		
+		free(arena->buffer);
+		arena->buffer = malloc(new_size);
+		arena->size = (arena->buffer != NULL) ? new_size : 0;
+	}
+}
+
+
+/******************************************************************************
+*								InitLuts
+*******************************************************************************/
+static void InitLuts(void)
+{
+	InitEventsLut();
+#ifdef CALC_DISPATCH_TABLE
+	InitActionFuncsLut();
+#endif
 }
 
 
 /******************************************************************************
 *								InitActionFuncsLut
 *******************************************************************************/
+#ifdef CALC_DISPATCH_TABLE
 static void InitActionFuncsLut(void)
 {
 	g_action_funcs_lut[WAIT_FOR_NUM][DIGIT]				= GetNumber;
@@ -161,6 +750,9 @@ static void InitActionFuncsLut(void)
 	g_action_funcs_lut[WAIT_FOR_NUM][SPACE]				= SkipSpace;
 	g_action_funcs_lut[WAIT_FOR_NUM][OPEN_PARENTHESES]	= PushParentheses;
 	g_action_funcs_lut[WAIT_FOR_NUM][CLOSE_PARENTHESES]	= Error;
+	g_action_funcs_lut[WAIT_FOR_NUM][LETTER]			= GetVariable;
+	g_action_funcs_lut[WAIT_FOR_NUM][LETTER_X]			= GetVariable;
+	g_action_funcs_lut[WAIT_FOR_NUM][COMMA]				= Error;
 	g_action_funcs_lut[WAIT_FOR_NUM][END_OF_STRING]		= Error;
 	g_action_funcs_lut[WAIT_FOR_NUM][INVALID_CHAR]		= Error;
 	
@@ -170,6 +762,9 @@ static void InitActionFuncsLut(void)
 	g_action_funcs_lut[WAIT_FOR_OP][SPACE]				= SkipSpace;
 	g_action_funcs_lut[WAIT_FOR_OP][OPEN_PARENTHESES]	= Error;
 	g_action_funcs_lut[WAIT_FOR_OP][CLOSE_PARENTHESES]	= CalcParentheses;
+	g_action_funcs_lut[WAIT_FOR_OP][LETTER]				= Error;
+	g_action_funcs_lut[WAIT_FOR_OP][LETTER_X]			= GetOperation;
+	g_action_funcs_lut[WAIT_FOR_OP][COMMA]				= NextArgument;
 	g_action_funcs_lut[WAIT_FOR_OP][END_OF_STRING]		= GetResult;
 	g_action_funcs_lut[WAIT_FOR_OP][INVALID_CHAR]		= Error;
 	
@@ -179,12 +774,16 @@ static void InitActionFuncsLut(void)
 	g_action_funcs_lut[ERROR][SPACE]					= Error;
 	g_action_funcs_lut[ERROR][OPEN_PARENTHESES]			= Error;
 	g_action_funcs_lut[ERROR][CLOSE_PARENTHESES]		= Error;
+	g_action_funcs_lut[ERROR][LETTER]					= Error;
+	g_action_funcs_lut[ERROR][LETTER_X]					= Error;
+	g_action_funcs_lut[ERROR][COMMA]					= Error;
 	g_action_funcs_lut[ERROR][END_OF_STRING]			= Error;
 	g_action_funcs_lut[ERROR][INVALID_CHAR]				= Error;
 	
 	/* Note: END state ends loop and can't get any input(events).
 	   therefore - not initialized */
 }
+#endif
 
 
 /******************************************************************************
@@ -195,28 +794,37 @@ static void InitEventsLut(void)
 	int i = 0;
 	
 	/* default - all chars are invalid */
-	for (i = 0; i < ASCII_TABLE_SIZE; ++i)
+	for (i = 0; i < EVENTS_LUT_SIZE; ++i)
 	{
 		g_events_lut[i] = INVALID_CHAR;
 	}
 	
 	/* exception for digits 0-9 */
-	for (i = '0'; i < '9'; ++i)
+	for (i = '0'; i <= '9'; ++i)
 	{
 		g_events_lut[i] = DIGIT;
 	}
 	
+	/* exception for variable names */
+	for (i = 'a'; i <= 'z'; ++i)
+	{
+		g_events_lut[i] = LETTER;
+		g_events_lut[i - 'a' + 'A'] = LETTER;
+	}
+	g_events_lut['_']  = LETTER;
+	
 	/* exception for operations & others */
 	g_events_lut['-']  = MINUS;/* NOTE: minus has double meaning */
 	g_events_lut['+']  = OP;
 	g_events_lut['*']  = OP;
-	g_events_lut['x']  = OP;
+	g_events_lut['x']  = LETTER_X;/* NOTE: x has double meaning */
 	g_events_lut['/']  = OP;
 	g_events_lut[':']  = OP;
 	g_events_lut['^']  = OP;
 	
 	g_events_lut['(']  = OPEN_PARENTHESES;
 	g_events_lut[')']  = CLOSE_PARENTHESES;
+	g_events_lut[',']  = COMMA;
 	
 	g_events_lut[' ']  = SPACE;
 	g_events_lut['\t'] = SPACE;
@@ -225,7 +833,7 @@ static void InitEventsLut(void)
 	g_events_lut['\r'] = SPACE;
 	g_events_lut['\v'] = SPACE;
 	
-	g_events_lut['\0'] = END_OF_STRING;
+	/* Note: END_OF_STRING is not a char - see EventAt */
 }
 
 
@@ -235,45 +843,82 @@ static void InitEventsLut(void)
 static void GetNumber(calculator_t* calculator)
 {
 	double num = 0;
+	const char* number_end = NULL;
 	
 	/* if the event is MINUS and the next char isnt a digit - thats an error */
-	if (g_events_lut[(unsigned char)*(calculator->runner)] == MINUS && 
-		!isdigit(*(calculator->runner + 1)))
+	if (EventAt(calculator, calculator->runner) == MINUS && 
+		(calculator->runner + 1 == calculator->end ||
+		 !isdigit((unsigned char)*(calculator->runner + 1))))
 	{
 		calculator->cur_state = ERROR;
+		return;
 	}
-	else
+	
+	/* gets the whole number, reading no further than the end of input */
+	CALC_STATS_BEGIN(CALC_PHASE_NUMBER);
+	number_end = NumberParse(calculator->runner, calculator->end, &num);
+	CALC_STATS_END(CALC_PHASE_NUMBER);
+	if (number_end == NULL)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	/* the stack is full and can't grow */
+	if (NumStackPush(&calculator->num_st, num) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	/* brings runner to the end of the number */
+	calculator->runner = (char*)number_end;
+	calculator->cur_state = WAIT_FOR_OP;
+	
+	if (calculator->program != NULL)
 	{
-		/* gets the whole number + brings runner to the end of the number */
-		num = strtod(calculator->runner, &(calculator->runner));
-		StackPush(calculator->num_st, &num);
-		calculator->cur_state = WAIT_FOR_OP;
+		CompileOperand(calculator, OPC_CONST, 0, num);
 	}
 }
 
+
 /******************************************************************************
 *								GetOperation
 *******************************************************************************/
 static void GetOperation(calculator_t* calculator)
 {
 	char current_op = *(calculator->runner);
-	unsigned char* last_op_ptr = StackPeek(calculator->op_st);
+	char last_op = 0;
 	
-	/* makes sure the last op isn't NULL or open-parentheses */
-	if (	           last_op_ptr != NULL  			&&
-		g_events_lut[*last_op_ptr] != OPEN_PARENTHESES	&&
-		!OpHasHigherPriority(current_op,* last_op_ptr))
+	/* every pending op of the same or higher priority runs first - so at
+	   most one op per priority waits on each level of parentheses, and the
+	   stacks stay as deep as the nesting */
+	while (OpStackSize(&calculator->op_st) > 0 &&
+	       calculator->result.status == CALC_SUCCESS)
 	{
+		last_op = OpStackPeek(&calculator->op_st);
+		
+		/* stops at open-parentheses (or a comma), or at a lower priority op */
+		if (IsBarrier(last_op) || OpHasHigherPriority(current_op, last_op))
+		{
+			break;
+		}
+		
 		/* pop out last op and 2 last numbers, calc, and push result */
 		ExecuteLastOp(calculator);
 	}
 	
-	StackPush(calculator->op_st, &current_op);
+	if (OpStackPush(&calculator->op_st, current_op) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+	}
 	++(calculator->runner);
 	calculator->cur_state = WAIT_FOR_NUM;
 	
-	/* math errors case */
-	if (calculator->result.status == MATH_ERROR)
+	/* math errors case (or a failure to compile / push the op) */
+	if (calculator->result.status != CALC_SUCCESS)
 	{
 		calculator->cur_state = ERROR;
 	}
@@ -281,14 +926,108 @@ static void GetOperation(calculator_t* calculator)
 
 
 /******************************************************************************
-*								SkipSpace
+*								GetVariable
 *******************************************************************************/
-static void SkipSpace(calculator_t* calculator)
+static void GetVariable(calculator_t* calculator)
 {
-	while (g_events_lut[(unsigned char)*(calculator->runner)] == SPACE)
+	char* name = calculator->runner;
+	const char* open = NULL;
+	size_t len = 0;
+	long slot = -1;
+	int opcode = -1;
+	int event = 0;
+	double placeholder = 0;
+	
+	/* a name is letters, digits and '_', not starting with a digit */
+	do
 	{
-		++(calculator->runner);
+		++len;
+		event = EventAt(calculator, name + len);
+	} while (event == LETTER || event == LETTER_X || event == DIGIT);
+	
+	/* a built-in function followed by '(' is a call - 'sqrt(x)'. elsewhere
+	   its name is a variable, as any other */
+	opcode = ProgramFindFunc(name, len);
+	if (opcode >= 0)
+	{
+		open = LexSkipSpace(name + len, calculator->end);
+		if (EventAt(calculator, open) == OPEN_PARENTHESES)
+		{
+			PushCall(calculator, opcode, open);
+			return;
+		}
+	}
+	
+	/* a plain calculation has no values to bind the name to */
+	if (calculator->program == NULL)
+	{
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	slot = calculator->vars_bound ? 
+	       ProgramFindVar(calculator->program, name, len) :
+	       ProgramAddVar(calculator->program, name, len);
+	
+	if (slot < 0)
+	{
+		/* unknown name with a binding table, or allocation failure */
+		if (!calculator->vars_bound)
+		{
+			calculator->result.status = APPLICATION_ERROR;
+		}
+		calculator->cur_state = ERROR;
+		return;
 	}
+	
+	if (NumStackPush(&calculator->num_st, placeholder) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	calculator->runner += len;
+	calculator->cur_state = WAIT_FOR_OP;
+	
+	CompileOperand(calculator, OPC_VAR, (unsigned int)slot, 0);
+}
+
+
+/******************************************************************************
+*								NextArgument
+*******************************************************************************/
+static void NextArgument(calculator_t* calculator)
+{
+	/* the argument before the comma is calculated whole */
+	while (OpStackSize(&calculator->op_st) > 0 &&
+	       !IsBarrier(OpStackPeek(&calculator->op_st)))
+	{
+		ExecuteLastOp(calculator);
+	}
+	
+	/* the comma stays as a barrier between the arguments - CalcParentheses
+	   counts them. one outside of any parentheses is an error */
+	if (OpStackSize(&calculator->op_st) == 0 ||
+	    OpStackPush(&calculator->op_st, ',') != 0)
+	{
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	++(calculator->runner);
+	calculator->cur_state = (calculator->result.status == CALC_SUCCESS) ?
+	                        WAIT_FOR_NUM : ERROR;
+}
+
+
+/******************************************************************************
+*								SkipSpace
+*******************************************************************************/
+static void SkipSpace(calculator_t* calculator)
+{
+	calculator->runner = (char*)LexSkipSpace(calculator->runner, 
+	                                         calculator->end);
 }
 
 
@@ -297,7 +1036,13 @@ static void SkipSpace(calculator_t* calculator)
 *******************************************************************************/
 static void PushParentheses(calculator_t* calculator)
 {
-	StackPush(calculator->op_st, calculator->runner);
+	if (OpStackPush(&calculator->op_st, *(calculator->runner)) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
 	++(calculator->runner);
 	calculator->cur_state = WAIT_FOR_NUM;
 }
@@ -308,26 +1053,51 @@ static void PushParentheses(calculator_t* calculator)
 *******************************************************************************/
 static void CalcParentheses(calculator_t* calculator)
 {
-	unsigned char* last_op_ptr = NULL;
-	
-	last_op_ptr = StackPeek(calculator->op_st);
+	size_t args = 1;
+	unsigned char call = 0;
 	
-	while (g_events_lut[*last_op_ptr] != OPEN_PARENTHESES &&
-					    last_op_ptr   != NULL)
+	/* executes the ops in the parentheses, up to the open-parentheses - the
+	   commas of a call are counted on the way */
+	while (OpStackSize(&calculator->op_st) > 0 &&
+	       g_events_lut[(unsigned char)OpStackPeek(&calculator->op_st)] != 
+	       OPEN_PARENTHESES)
 	{
+		if (OpStackPeek(&calculator->op_st) == ',')
+		{
+			OpStackPop(&calculator->op_st);
+			++args;
+			continue;
+		}
+		
 		ExecuteLastOp(calculator);
-		/* checks next GetOperation in stack */
-		last_op_ptr = StackPeek(calculator->op_st);
+	}
+	
+	/* case a matched parentheses wasn't found */
+	if (OpStackSize(&calculator->op_st) == 0)
+	{
+		calculator->cur_state = ERROR;
+		return;
 	}
 	
 	/* pop the open-parentheses at the top */
-	StackPop(calculator->op_st);
+	OpStackPop(&calculator->op_st);
 	++(calculator->runner);
 	calculator->cur_state = WAIT_FOR_OP;
 	
-	/* case a matched parentheses wasn't found */
-	if (last_op_ptr == NULL)
+	/* the parentheses of a call - the function runs on its arguments */
+	if (OpStackSize(&calculator->op_st) > 0)
+	{
+		call = (unsigned char)OpStackPeek(&calculator->op_st);
+	}
+	
+	if (call & FUNC_MARK)
 	{
+		OpStackPop(&calculator->op_st);
+		ExecuteCall(calculator, call & ~FUNC_MARK, args);
+	}
+	else if (args > 1)
+	{
+		/* '(1, 2)' - commas out of a call */
 		calculator->cur_state = ERROR;
 	}
 }
@@ -341,19 +1111,19 @@ static void GetResult(calculator_t* calculator)
 	double final_result = 0;
 	
 	/* execute all operations untill the stack is empty + checks next op isn't
-	   open parentheses */
-	while ((StackSize(calculator->op_st) > 0) &&
-		   (g_events_lut[*(unsigned char* )StackPeek(calculator->op_st)] !=
-		   OPEN_PARENTHESES))
+	   open parentheses (or a comma) */
+	while ((OpStackSize(&calculator->op_st) > 0) &&
+		   !IsBarrier(OpStackPeek(&calculator->op_st)))
 	{
 		ExecuteLastOp(calculator);
 	}
 	
 	/* case of success */
-	if (StackSize(calculator->op_st) == 0 && StackSize(calculator->num_st) && 
+	if (OpStackSize(&calculator->op_st) == 0 && 
+		NumStackSize(&calculator->num_st) > 0 && 
 		(calculator->result.status == CALC_SUCCESS))
 	{
-		final_result = *(double* )StackPeek(calculator->num_st);
+		final_result = NumStackPeek(&calculator->num_st);
 		calculator->result.result = final_result;
 		calculator->cur_state = END;
 	}
@@ -373,7 +1143,7 @@ static void GetResult(calculator_t* calculator)
 static void Error(calculator_t* calculator)
 {
 	/* defines default error status */
-	if (calculator->result.status != MATH_ERROR)
+	if (calculator->result.status == CALC_SUCCESS)
 	{
 		calculator->result.status = SYNTAX_ERROR;
 	}
@@ -394,24 +1164,175 @@ static void ExecuteLastOp(calculator_t* calculator)
 	double num1 = 0;
 	double num2 = 0;
 	char op_sign = 0;
+	result_t op_result = {0};
 	
-	op_sign = *(char* )StackPeek(calculator->op_st);
-	StackPop(calculator->op_st);
-	
-	num2 = *(double* )StackPeek(calculator->num_st);
-	StackPop(calculator->num_st);
+	/* two numbers out, one in - the pushes below never grow the stack */
+	op_sign = OpStackPop(&calculator->op_st);
+	num2 = NumStackPop(&calculator->num_st);
+	num1 = NumStackPop(&calculator->num_st);
 	
-	num1 = *(double* )StackPeek(calculator->num_st);
-	StackPop(calculator->num_st);
+	/* compile mode - num1 stays as a placeholder for the op's result */
+	if (calculator->program != NULL)
+	{
+		CompileOperation(calculator, op_sign);
+		NumStackPush(&calculator->num_st, num1);
+		
+		return;
+	}
 	
 	/* calc + push result */
-	calculator->result = PerformOperation(num1, num2, op_sign);
-	StackPush(calculator->num_st, &calculator->result.result);
+	CALC_STATS_BEGIN(CALC_PHASE_EXECUTE);
+	op_result = PerformOperation(num1, num2, op_sign);
+	CALC_STATS_END(CALC_PHASE_EXECUTE);
+	NumStackPush(&calculator->num_st, op_result.result);
+	
+	/* keeps the first error - a later successful op mustn't hide it */
+	calculator->result.result = op_result.result;
+	if (calculator->result.status == CALC_SUCCESS)
+	{
+		calculator->result.status = op_result.status;
+	}
+	
+	return;
+}
+
+
+/******************************************************************************
+*								PushCall
+*******************************************************************************/
+static void PushCall(calculator_t* calculator, int opcode, const char* open)
+{
+	/* the function waits under its parentheses until they close */
+	if (OpStackPush(&calculator->op_st, (char)(FUNC_MARK | opcode)) != 0 ||
+	    OpStackPush(&calculator->op_st, '(') != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	calculator->runner = (char*)open + 1;
+	calculator->cur_state = WAIT_FOR_NUM;
+}
+
+
+/******************************************************************************
+*								ExecuteCall
+*******************************************************************************/
+static void ExecuteCall(calculator_t* calculator, unsigned int opcode,
+                        size_t args)
+{
+	double num1 = 0;
+	double num2 = 0;
+	double result = 0;
+	
+	if (args != (size_t)ProgramArity(opcode))
+	{
+		calculator->cur_state = ERROR;
+		return;
+	}
+	
+	/* the arguments out, one value in - the push never grows the stack */
+	if (args == 2)
+	{
+		num2 = NumStackPop(&calculator->num_st);
+	}
+	num1 = NumStackPop(&calculator->num_st);
+	
+	/* compile mode - num1 stays as a placeholder for the call's result */
+	if (calculator->program != NULL)
+	{
+		NumStackPush(&calculator->num_st, num1);
+		if (ProgramEmit(calculator->program, opcode, 0, 0) != 0)
+		{
+			calculator->result.status = APPLICATION_ERROR;
+			calculator->cur_state = ERROR;
+		}
+		
+		return;
+	}
+	
+	CALC_STATS_BEGIN(CALC_PHASE_EXECUTE);
+	result = ProgramCall(opcode, num1, num2);
+	CALC_STATS_END(CALC_PHASE_EXECUTE);
+	NumStackPush(&calculator->num_st, result);
+	
+	/* a NaN is a math error, as out of '^' */
+	if (isnan(result) && calculator->result.status == CALC_SUCCESS)
+	{
+		calculator->result.status = MATH_ERROR;
+		calculator->cur_state = ERROR;
+	}
 	
 	return;
 }
 
 
+/******************************************************************************
+*								CompileOperand
+*******************************************************************************/
+static void CompileOperand(calculator_t* calculator, unsigned int opcode,
+                           unsigned int arg, double num)
+{
+	calc_program_t* program = calculator->program;
+	size_t depth = NumStackSize(&calculator->num_st);
+	
+	/* operands are the only instructions that deepen the evaluation stack */
+	if (depth > program->max_depth)
+	{
+		program->max_depth = depth;
+	}
+	
+	if (ProgramEmit(program, opcode, arg, num) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+		calculator->cur_state = ERROR;
+	}
+}
+
+
+/******************************************************************************
+*								CompileOperation
+*******************************************************************************/
+static void CompileOperation(calculator_t* calculator, char op_sign)
+{
+	unsigned int opcode = OPC_ADD;
+	
+	switch (op_sign)
+	{
+		case '+':
+			opcode = OPC_ADD;
+			break;
+		
+		case '-':
+			opcode = OPC_SUB;
+			break;
+		
+		case '*':
+		case 'x':
+			opcode = OPC_MUL;
+			break;
+		
+		case '/':
+		case ':':
+			opcode = OPC_DIV;
+			break;
+		
+		case '^':
+			opcode = OPC_POW;
+			break;
+		
+		default:
+			break;
+	}
+	
+	if (ProgramEmit(calculator->program, opcode, 0, 0) != 0)
+	{
+		calculator->result.status = APPLICATION_ERROR;
+	}
+}
+
+
 /******************************************************************************
 *								PerformOperation
 *******************************************************************************/
@@ -461,7 +1382,7 @@ static result_t PerformOperation(double num1, double num2, char op_sign)
 			break;
 			
 		case '^':
-			ret_val.result = pow(num1, num2);
+			ret_val.result = ProgramPow(num1, num2);
 			
 			if (isnan(ret_val.result))
 			{
@@ -500,11 +1421,71 @@ static bool OpHasHigherPriority(char op1, char op2)
 }
 
 
+/******************************************************************************
+*								IsBarrier
+*******************************************************************************/
+static bool IsBarrier(char op)
+{
+	/* the ops after an open-parentheses, or after a comma, wait for the
+	   parentheses or the argument to end */
+	return (g_events_lut[(unsigned char)op] == OPEN_PARENTHESES || op == ',');
+}
 
 
+/******************************************************************************
+*								IsSpaceKept
+*******************************************************************************/
+static bool IsSpaceKept(const char* out, size_t out_len, char right)
+{
+	char left = out[out_len - 1];
+	int left_event = g_events_lut[(unsigned char)left];
+	int right_event = g_events_lut[(unsigned char)right];
+	int before_event = OP;	/* the token before 'left' - none is as an op */
+	
+	/* "5 7", "a b", "1 .5" - two tokens, where no space makes one */
+	if (IsWordChar(left) && IsWordChar(right))
+	{
+		return (TRUE);
+	}
+	
+	/* "1e +5" is an error, "1e+5" a number */
+	if ((left_event == LETTER || left_event == LETTER_X) &&
+		(right_event == OP || right_event == MINUS))
+	{
+		return (TRUE);
+	}
+	
+	/* a sign - after an op, '(', ',' or an 'x' - must touch its number: "- 3" is
+	   an error, "-3" a number. so must the sign of an exponent ("1e+ 5").
+	   a binary minus needs no space - "5 - -3" is "5--3" */
+	if (left_event == MINUS || left_event == OP)
+	{
+		if (out_len >= 2)
+		{
+			before_event = g_events_lut[(unsigned char)out[out_len - 2]];
+		}
+		if (before_event == SPACE && out_len >= 3)
+		{
+			before_event = g_events_lut[(unsigned char)out[out_len - 3]];
+		}
+		
+		return (before_event == LETTER || before_event == LETTER_X ||
+		        (left_event == MINUS && (before_event == OP ||
+		         before_event == MINUS || before_event == OPEN_PARENTHESES ||
+		         before_event == COMMA)));
+	}
+	
+	return (FALSE);
+}
 
 
-
-
-
-
+/******************************************************************************
+*								IsWordChar
+*******************************************************************************/
+static bool IsWordChar(char c)
+{
+	int event = g_events_lut[(unsigned char)c];
+	
+	/* chars of numbers and names */
+	return (event == DIGIT || event == LETTER || event == LETTER_X || c == '.');
+}
@@ -7,6 +7,8 @@
 #ifndef __CALC_H__
 #define __CALC_H__
 
+#include <stddef.h> /* size_t */
+
 struct result_s
 {
     double result;
@@ -17,6 +19,8 @@ typedef struct result_s result_t;
 
 enum calc_status
 {
+    CYCLE_ERROR       = -5,	/* a formula depending on itself - calc_formula.h */
+    LIMIT_ERROR       = -4,	/* over the limits of CalcNLimited */
     APPLICATION_ERROR = -3,
     SYNTAX_ERROR      = -2,
     MATH_ERROR        = -1,
@@ -39,6 +43,12 @@ enum calc_status
  *						power '^' - only on positive bases.
  *						floating point numbers '3.14'
  *						minus as sign before numbers '5 + -3'.
+ *						functions 'name(arg, ...)' - sqrt, log, exp, sin
+ *						and abs of one argument, min and max of two
+ *						('min(2, sqrt(9)) ^ 2'). a NaN result (e.g.
+ *						'log(-1)') is a math error.
+ *						variable names are not supported here (SYNTAX_ERROR) -
+ *						see CalcCompile.
  *
  *	Return Values    :	result_t -
  *	                  	If calculation succeeds, member 'result' will
@@ -56,4 +66,211 @@ enum calc_status
  */
 result_t Calculate(const char *str);
 
+
+/*********************************** CalcN ***********************************/
+/*	Description      :	Same as Calculate, on the 'len' chars at 'str' - a
+ *	                  	slice of a larger buffer (mmapped file, network
+ *	                  	frame). no NUL is needed or looked for: the input
+ *	                  	ends after 'len' chars and nothing past them is read,
+ *	                  	so expressions are parsed in place, with no copy.
+ *	                  	a '\0' inside the slice is an invalid char.
+ *
+ *	Return Values    :	as Calculate.
+ */
+result_t CalcN(const char *str, size_t len);
+
+
+/* opaque handle of a caller-owned scratch arena */
+typedef struct calc_arena_s calc_arena_t;
+
+/*********************************** CalculateArena **************************/
+/*	Description      :	Same as Calculate, but the calculation's scratch
+ *	                  	memory comes from 'arena' instead of the heap.
+ *	                  	the arena grows when an input nests deeper than it
+ *	                  	has room for, so once it fits the deepest input the
+ *	                  	calls do no heap allocation at all.
+ *	                  	(Calculate itself allocates only for inputs nested
+ *	                  	more than ~200 levels deep - scratch memory follows
+ *	                  	the depth of the input, not its length.)
+ *
+ *	Input            :	char* str = string, as in Calculate.
+ *	                  	arena - from CalcArenaCreate. an arena may be used
+ *	                  	by one thread at a time - give each thread its own.
+ *
+ *	Return Values    :	as Calculate.
+ */
+result_t CalculateArena(const char *str, calc_arena_t *arena);
+
+/*********************************** CalcNArena ******************************/
+/*	Description      :	CalcN with the scratch memory of CalculateArena.
+ */
+result_t CalcNArena(const char *str, size_t len, calc_arena_t *arena);
+
+/*********************************** CalcArenaCreate *************************/
+/*	Description      :	Creates a scratch arena of 'size' initial bytes
+ *	                  	(0 is allowed - it will grow on first use).
+ *	                  	returns NULL on allocation failure.
+ */
+calc_arena_t *CalcArenaCreate(size_t size);
+
+/*********************************** CalcArenaDestroy ************************/
+/*	Description      :	Releases an arena. NULL is allowed and ignored.
+ */
+void CalcArenaDestroy(calc_arena_t *arena);
+
+/* limits on an untrusted input - 0 is no limit */
+typedef struct calc_limits_s
+{
+	size_t max_length;	/* chars */
+	size_t max_depth;	/* nesting of parentheses */
+}calc_limits_t;
+
+/*********************************** CalcNLimited ****************************/
+/*	Description      :	CalcN for inputs from outside - machine-generated
+ *	                  	expressions of any length and nesting. an input
+ *	                  	over a limit is rejected before any calculation.
+ *	                  	every input, limited or not, takes O(n) time and
+ *	                  	O(depth) memory - n is its length, depth its
+ *	                  	nesting - and no recursion, so neither a long nor
+ *	                  	a deep input can exhaust the call stack.
+ *
+ *	Input            :	limits - may be NULL (no limits).
+ *	                  	arena - optional (may be NULL), as in CalcNArena.
+ *
+ *	Return Values    :	as Calculate, or LIMIT_ERROR (result -1) if the
+ *	                  	input is longer or deeper than the limits.
+ *
+ *	Time Complexity  : O(n)
+ *
+ *  Space Complexity : O(depth)
+ */
+result_t CalcNLimited(const char *str, size_t len, const calc_limits_t *limits,
+                      calc_arena_t *arena);
+
+
+/* opaque handle of a compiled expression */
+typedef struct calc_program_s calc_program_t;
+
+/*********************************** CalcCompile *****************************/
+/*	Description      :	Parses an expression once, into a flat postfix
+ *	                  	program that can be evaluated many times by
+ *	                  	CalcEval without re-parsing the string.
+ *
+ *	Input            :	char* str = string. same syntax as Calculate, plus
+ *	                  	variable names - letters, digits and '_', not
+ *	                  	starting with a digit ('price * qty - discount').
+ *	                  	each name gets a slot in the variables array
+ *	                  	passed to CalcEval, in order of first appearance.
+ *	                  	a function name followed by '(' is a call; any
+ *	                  	other use of it ('log + 1') is a variable.
+ *
+ *	                  	NOTE: 'x' is the multiplication sign wherever an
+ *	                  	operator is expected, and a name (or the start of
+ *	                  	one) wherever a number is expected:
+ *	                  	'x x 2' = x * 2, '2x3' = 2 * 3, 'xy' is one name.
+ *	                  	a name can't follow a name or a number directly,
+ *	                  	so 'a x b' = a * b but 'ax b' is a syntax error.
+ *
+ *	                  	int* status = optional (may be NULL). receives
+ *	                  	CALC_SUCCESS, SYNTAX_ERROR or APPLICATION_ERROR.
+ *
+ *	Return Values    :	the compiled program, or NULL on failure.
+ *	                  	math errors (e.g. '1/0') are not detected here -
+ *	                  	they are reported by CalcEval.
+ *	                  	the program must be released by CalcProgramDestroy.
+ *
+ *	Time Complexity  : O(n)
+ *
+ *  Space Complexity : O(n)
+ */
+calc_program_t *CalcCompile(const char *str, int *status);
+
+/********************************* CalcCompileVars ***************************/
+/*	Description      :	Same as CalcCompile, but with a binding table -
+ *	                  	names[i] is variable slot i, so many programs can
+ *	                  	share one variables array (e.g. a row of inputs).
+ *
+ *	Input            :	names - 'count' distinct variable names.
+ *	                  	a name missing from the table is a SYNTAX_ERROR.
+ *	                  	names == NULL behaves like CalcCompile.
+ *
+ *	Return Values    :	as CalcCompile. CalcVarCount is always 'count'.
+ */
+calc_program_t *CalcCompileVars(const char *str, const char *const *names,
+                                size_t count, int *status);
+
+/*********************************** CalcEval ********************************/
+/*	Description      :	Evaluates a compiled program.
+ *
+ *	Input            :	program - a program returned by CalcCompile.
+ *	                  	vars - value of each variable slot (see
+ *	                  	CalcVarIndex). may be NULL if there are none.
+ *
+ *	Return Values    :	result_t - same result and status Calculate returns
+ *	                  	for the compiled string, with the values in place
+ *	                  	of the names.
+ *	                  	does not modify the program - a program may be
+ *	                  	evaluated by several threads at once.
+ *
+ *	Time Complexity  : O(n) - n is the program length
+ *
+ *  Space Complexity : O(1) for typical programs (evaluation stack lives on
+ *	                   the call stack), O(n) for very deep ones.
+ */
+result_t CalcEval(const calc_program_t *program, const double *vars);
+
+/* a result of CalcEvalExact */
+typedef struct calc_exact_s
+{
+	long long integer;	/* the result, if is_integer */
+	double result;		/* the result as a double - always set */
+	int is_integer;		/* calculated in integers all the way */
+	int status;
+}calc_exact_t;
+
+/********************************* CalcEvalExact *****************************/
+/*	Description      :	Evaluates a compiled program in 64-bit integers,
+ *	                  	exact, for as long as it can: while the constants
+ *	                  	and variables are whole numbers (up to 2^53, the
+ *	                  	whole numbers a double holds), and every '+', '-',
+ *	                  	'*', '/' and '^' of them is an integer with no
+ *	                  	overflow - '7 / 2' and '2 ^ 64' are not, nor is any
+ *	                  	negative exponent. from the first one that isn't,
+ *	                  	its subexpression goes on in doubles, as CalcEval.
+ *
+ *	                  	so '3 ^ 39' is 4052555153018976267 exactly, where
+ *	                  	CalcEval rounds it to 4052555153018976256.
+ *
+ *	Return Values    :	calc_exact_t - 'integer' is the exact result when
+ *	                  	'is_integer' is 1. 'result' is always the result as
+ *	                  	a double. errors are CalcEval's, with -1 in both.
+ *
+ *	Time Complexity  : O(n) - n is the program length
+ */
+calc_exact_t CalcEvalExact(const calc_program_t *program, const double *vars);
+
+/******************************* CalcProgramDestroy **************************/
+/*	Description      :	Releases a program returned by CalcCompile.
+ *	                  	NULL is allowed and ignored.
+ */
+void CalcProgramDestroy(calc_program_t *program);
+
+/********************************** CalcVarCount *****************************/
+/*	Description      :	Returns the number of variable slots of a program -
+ *	                  	the length of the variables array CalcEval reads.
+ */
+size_t CalcVarCount(const calc_program_t *program);
+
+/********************************** CalcVarName ******************************/
+/*	Description      :	Returns the name bound to slot 'index', or NULL if
+ *	                  	index >= CalcVarCount.
+ */
+const char *CalcVarName(const calc_program_t *program, size_t index);
+
+/********************************** CalcVarIndex *****************************/
+/*	Description      :	Returns the slot of variable 'name', or -1 if the
+ *	                  	program doesn't use such a variable.
+ */
+long CalcVarIndex(const calc_program_t *program, const char *name);
+
 #endif     /* __CALC_H__ */
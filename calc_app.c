@@ -3,18 +3,146 @@
 *	Developer	:	Eyal Weizman
 *	Description	:	calculator application
 *******************************************************************************/
-#include <stdio.h> 		/* printf, fgets */
-#include <string.h>     /* strcmp */
+#include <stdio.h> 		/* printf, fgets, fread, fwrite */
+#include <stdlib.h> 	/* malloc, realloc, free, strtoul */
+#include <string.h>     /* strcmp, memchr, memmove */
+#include <time.h>     	/* clock_gettime */
+#include <fcntl.h>     	/* open */
+#include <unistd.h>     /* close */
+#include <sys/stat.h>   /* fstat */
+#include <sys/mman.h>   /* mmap, madvise, munmap */
 
 #include "calc.h"
+#include "calc_stats.h"
 
 /******************************* MACROS ***************************************/
 #define MAX_CHARS 100
 
+#define NS_IN_SEC 1000000000.0
+
+/* streaming mode buffers */
+#define READ_CHUNK (1 << 20)
+#define WRITE_BUFFER_SIZE (1 << 16)
+#define MAX_RESULT_CHARS 64
+
+/*************************** structs & typedefs *******************************/
+/* buffered writer of the results - one fwrite per WRITE_BUFFER_SIZE bytes */
+typedef struct writer_s
+{
+	FILE *file;
+	size_t used;
+	char buffer[WRITE_BUFFER_SIZE];
+}writer_t;
+
+/* state of a streaming run */
+typedef struct stream_s
+{
+	calc_arena_t *arena;	/* scratch memory, reused by every line */
+	calc_limits_t limits;	/* of every line */
+	writer_t writer;
+	unsigned long lines;
+	size_t bytes;
+}stream_t;
+
+/************************* internal functions *********************************/
+static int Interactive(void);
+static int ParseStreamArgs(int argc, char *argv[], calc_limits_t *limits,
+                           const char **file_name, int *print_stats);
+static int Stream(const char *file_name, const calc_limits_t *limits,
+                  int print_stats);
+static int StreamMapped(const char *file_name, stream_t *stream);
+static int StreamChunks(FILE *input, stream_t *stream);
+static const char *StreamLines(const char *begin, const char *end,
+                               stream_t *stream);
+static void StreamLine(const char *line, size_t len, stream_t *stream);
+static void WriteResult(writer_t *writer, result_t result);
+static void FlushWriter(writer_t *writer);
+static double GetTimeSec(void);
+
+
 /******************************************************************************
 *								main
 *******************************************************************************/
-int main(void)
+int main(int argc, char *argv[])
+{
+	calc_limits_t limits = {0};
+	const char *file_name = NULL;
+	int print_stats = 0;
+	
+	// calc.out --stream [--max-length N] [--max-depth N] [--stats] [file] -
+	// one expression per line, one result per line
+	if (argc > 1 && strcmp(argv[1], "--stream") == 0 &&
+	    ParseStreamArgs(argc - 2, argv + 2, &limits, &file_name, 
+	                    &print_stats) == 0)
+	{
+		return (Stream(file_name, &limits, print_stats));
+	}
+	
+	if (argc > 1)
+	{
+		fprintf(stderr, "usage: %s [--stream [--max-length N] "
+		                "[--max-depth N] [--stats] [file]]\n", argv[0]);
+		return (1);
+	}
+	
+	return (Interactive());
+}
+
+
+/******************************************************************************
+*								ParseStreamArgs
+*******************************************************************************/
+static int ParseStreamArgs(int argc, char *argv[], calc_limits_t *limits,
+                           const char **file_name, int *print_stats)
+{
+	size_t *limit = NULL;
+	char *end = NULL;
+	int i = 0;
+	
+	for (i = 0; i < argc; ++i)
+	{
+		limit = (strcmp(argv[i], "--max-length") == 0) ? &limits->max_length :
+		        (strcmp(argv[i], "--max-depth") == 0) ? &limits->max_depth :
+		        NULL;
+		
+		// a limit takes the next arg, a number
+		if (limit != NULL)
+		{
+			if (++i == argc)
+			{
+				return (-1);
+			}
+			
+			*limit = strtoul(argv[i], &end, 10);
+			if (end == argv[i] || *end != '\0')
+			{
+				return (-1);
+			}
+		}
+		// the counters of the instrumentation, to stderr at the end
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			*print_stats = 1;
+		}
+		// anything else is the file - one at most
+		else if (*file_name == NULL)
+		{
+			*file_name = argv[i];
+		}
+		else
+		{
+			return (-1);
+		}
+	}
+	
+	return (0);
+}
+
+
+/******************************************************************************
+*								Interactive
+*******************************************************************************/
+static int Interactive(void)
 {
 	char user_input[MAX_CHARS] = {0};
 	result_t result = {0};
@@ -61,6 +189,10 @@ int main(void)
 			printf("APPLICATION ERROR. we apologize.\n");
 			break;
 		
+		case LIMIT_ERROR:
+			printf("LIMIT ERROR\n");
+			break;
+		
 		default:
 			break;
 		}
@@ -72,3 +204,260 @@ int main(void)
 	return (0);
 }
 
+
+/******************************************************************************
+*								Stream
+*******************************************************************************/
+static int Stream(const char *file_name, const calc_limits_t *limits,
+                  int print_stats)
+{
+	static stream_t stream;
+	FILE *input = stdin;
+	int ret_val = 0;
+	double start = GetTimeSec();
+	double seconds = 0;
+	
+	stream.arena = CalcArenaCreate(0);
+	stream.limits = *limits;
+	stream.writer.file = stdout;
+	if (stream.arena == NULL)
+	{
+		fprintf(stderr, "APPLICATION ERROR. we apologize.\n");
+		return (1);
+	}
+	
+	// a regular file is mapped and calculated in place - no copies at all
+	ret_val = (file_name != NULL) ? StreamMapped(file_name, &stream) : -1;
+	
+	// stdin, pipes, or a file that can't be mapped - read in chunks
+	if (ret_val < 0)
+	{
+		if (file_name != NULL && (input = fopen(file_name, "rb")) == NULL)
+		{
+			perror(file_name);
+			CalcArenaDestroy(stream.arena);
+			return (1);
+		}
+		
+		ret_val = StreamChunks(input, &stream);
+		
+		if (input != stdin)
+		{
+			fclose(input);
+		}
+	}
+	
+	FlushWriter(&stream.writer);
+	
+	seconds = GetTimeSec() - start;
+	fprintf(stderr, "%lu lines in %.3f s: %.0f lines/s, %.1f MB/s\n", 
+	        stream.lines, seconds, stream.lines / seconds, 
+	        stream.bytes / seconds / (1 << 20));
+	
+	if (print_stats)
+	{
+		CalcStatsPrint(stderr);
+	}
+	
+	CalcArenaDestroy(stream.arena);
+	
+	return (ret_val);
+}
+
+
+/******************************************************************************
+*								StreamMapped
+*******************************************************************************/
+static int StreamMapped(const char *file_name, stream_t *stream)
+{
+	struct stat file_stat;
+	const char *map = NULL;
+	const char *tail = NULL;
+	int fd = open(file_name, O_RDONLY);
+	
+	if (fd < 0 || fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) ||
+	    file_stat.st_size == 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return (-1);
+	}
+	
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return (-1);
+	}
+	
+	madvise((void *)map, file_stat.st_size, MADV_SEQUENTIAL);
+	
+	// every line is calculated straight from the mapping
+	tail = StreamLines(map, map + file_stat.st_size, stream);
+	if (tail != map + file_stat.st_size)
+	{
+		StreamLine(tail, map + file_stat.st_size - tail, stream);
+	}
+	stream->bytes += file_stat.st_size;
+	
+	munmap((void *)map, file_stat.st_size);
+	
+	return (0);
+}
+
+
+/******************************************************************************
+*								StreamChunks
+*******************************************************************************/
+static int StreamChunks(FILE *input, stream_t *stream)
+{
+	char *buffer = NULL;
+	char *new_buffer = NULL;
+	const char *tail = NULL;
+	size_t capacity = READ_CHUNK;
+	size_t used = 0;
+	size_t read_bytes = 0;
+	
+	buffer = (char *)malloc(capacity);
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "APPLICATION ERROR. we apologize.\n");
+		return (1);
+	}
+	
+	while ((read_bytes = fread(buffer + used, 1, capacity - used, input)) > 0)
+	{
+		stream->bytes += read_bytes;
+		used += read_bytes;
+		
+		tail = StreamLines(buffer, buffer + used, stream);
+		
+		// the partial last line moves to the front, for the next chunk
+		used -= tail - buffer;
+		memmove(buffer, tail, used);
+		
+		// no line fits - lines have no length limit, so the buffer grows
+		if (used == capacity)
+		{
+			new_buffer = (char *)realloc(buffer, 2 * capacity);
+			if (new_buffer == NULL)
+			{
+				fprintf(stderr, "APPLICATION ERROR. we apologize.\n");
+				free(buffer);
+				return (1);
+			}
+			buffer = new_buffer;
+			capacity *= 2;
+		}
+	}
+	
+	// a last line with no newline
+	if (used > 0)
+	{
+		StreamLine(buffer, used, stream);
+	}
+	
+	free(buffer);
+	
+	return (0);
+}
+
+
+/******************************************************************************
+*								StreamLines
+*******************************************************************************/
+static const char *StreamLines(const char *begin, const char *end,
+                               stream_t *stream)
+{
+	const char *newline = NULL;
+	
+	// calculates every complete line, returns the start of the partial one
+	while ((newline = memchr(begin, '\n', end - begin)) != NULL)
+	{
+		StreamLine(begin, newline - begin, stream);
+		begin = newline + 1;
+	}
+	
+	return (begin);
+}
+
+
+/******************************************************************************
+*								StreamLine
+*******************************************************************************/
+static void StreamLine(const char *line, size_t len, stream_t *stream)
+{
+	WriteResult(&stream->writer, 
+	            CalcNLimited(line, len, &stream->limits, stream->arena));
+	++(stream->lines);
+}
+
+
+/******************************************************************************
+*								WriteResult
+*******************************************************************************/
+static void WriteResult(writer_t *writer, result_t result)
+{
+	const char *message = NULL;
+	size_t len = 0;
+	
+	if (writer->used + MAX_RESULT_CHARS > WRITE_BUFFER_SIZE)
+	{
+		FlushWriter(writer);
+	}
+	
+	switch (result.status)
+	{
+	case CALC_SUCCESS:
+		// %.17g - the printed value reads back as the very same double
+		writer->used += sprintf(writer->buffer + writer->used, "%.17g\n",
+		                        result.result);
+		return;
+		
+	case MATH_ERROR:
+		message = "MATH ERROR\n";
+		break;
+		
+	case SYNTAX_ERROR:
+		message = "SYNTAX ERROR\n";
+		break;
+		
+	case LIMIT_ERROR:
+		message = "LIMIT ERROR\n";
+		break;
+		
+	default:
+		message = "APPLICATION ERROR\n";
+		break;
+	}
+	
+	len = strlen(message);
+	memcpy(writer->buffer + writer->used, message, len);
+	writer->used += len;
+}
+
+
+/******************************************************************************
+*								FlushWriter
+*******************************************************************************/
+static void FlushWriter(writer_t *writer)
+{
+	fwrite(writer->buffer, 1, writer->used, writer->file);
+	fflush(writer->file);
+	writer->used = 0;
+}
+
+
+/******************************************************************************
+*								GetTimeSec
+*******************************************************************************/
+static double GetTimeSec(void)
+{
+	struct timespec now = {0};
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (now.tv_sec + now.tv_nsec / NS_IN_SEC);
+}
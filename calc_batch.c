@@ -0,0 +1,1074 @@
+/*******************************************************************************
+*	Filename	:	calc_batch.c
+*	Developer	:	Eyal Weizman
+*	Description	:	columnar evaluation of compiled programs - each postfix
+*					instruction runs as a vectorized loop over a block of rows
+*******************************************************************************/
+#include <assert.h> /* assert */
+#include <stdlib.h>	/* malloc, free */
+#include <string.h>	/* memset, memcpy */
+#include <stdint.h>	/* uint64_t */
+#include <float.h>	/* DBL_MIN, DBL_MAX */
+#include <math.h>	/* sqrt, log, exp, sin, fabs, isnan */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CALC_BATCH_X86
+#include <immintrin.h> /* SSE2, AVX2 intrinsics */
+#endif
+
+#include "calc_batch.h"
+#include "calc_prog.h"
+
+/******************************* MACROS ***************************************/
+#define UNUSED(x) ((void) x)
+#define RESULT_WHEN_ERROR -1
+
+/* rows per block - a block of every stack level stays in L1/L2 */
+#define BLOCK_ROWS 256
+
+/* an elementwise kernel on n rows: dst = a <op> b (unary ops ignore b). rows
+   that hit a math error get their 'err' flag set (others are left untouched) */
+typedef void (*kernel_t)(double *dst, const double *a, const double *b,
+                         unsigned char *err, size_t n);
+
+typedef struct kernels_s
+{
+	kernel_t ops[MAX_OPCODES];	/* indexed by enum calc_opcode */
+}kernels_t;
+
+/* log, exp and sin are approximated by fdlibm's polynomials, without its
+   tables and branches, so they vectorize. every instruction set runs the
+   same operations in the same order (no fma), so they agree to the bit.
+   the arguments out of these ranges go to libm */
+#define EXP_MIN -708.0			/* below - a subnormal result */
+#define EXP_MAX 709.0			/* above - overflow */
+#define LOG_MIN DBL_MIN			/* below - subnormal, 0 and negative */
+#define LOG_MAX DBL_MAX			/* above - inf */
+#define SIN_MAX 65536.0			/* beyond - pi/2 in 4 parts isn't enough */
+#define SIN_TINY 7.450580596923828125e-09	/* 2^-27 - below, sin(x) is x */
+
+/* x + 1.5 * 2^52 rounds x to an integer, and holds it in its low bits */
+#define ROUND_MAGIC 6755399441055744.0
+#define TWO_P52 4503599627370496.0
+#define TWO_P52_BITS 0x4330000000000000ULL
+#define ONE_BITS 0x3FF0000000000000ULL
+#define EXPONENT_MASK 0xFFF0000000000000ULL
+#define SIGN_MASK 0x8000000000000000ULL
+/* the bits of 1.0 less those of sqrt(0.5) - added to the bits of x, they
+   carry into its exponent when its mantissa is over sqrt(2) */
+#define LOG_SHIFT 0x00095F6200000000ULL
+
+#define INV_LN2 1.44269504088896338700e+00
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define INV_PIO2 6.36619772367581382433e-01
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_3 2.02226624871116645580e-21
+#define PIO2_3T 8.47842766036889956997e-32
+
+#define EXP_P1 1.66666666666666019037e-01
+#define EXP_P2 -2.77777777770155933842e-03
+#define EXP_P3 6.61375632143793436117e-05
+#define EXP_P4 -1.65339022054652515390e-06
+#define EXP_P5 4.13813679705723846039e-08
+
+#define LOG_LG1 6.666666666666735130e-01
+#define LOG_LG2 3.999999999940941908e-01
+#define LOG_LG3 2.857142874366239149e-01
+#define LOG_LG4 2.222219843214978396e-01
+#define LOG_LG5 1.818357216161805012e-01
+#define LOG_LG6 1.531383769920937332e-01
+#define LOG_LG7 1.479819860511658591e-01
+
+#define SIN_S1 -1.66666666666666324348e-01
+#define SIN_S2 8.33333333332248946124e-03
+#define SIN_S3 -1.98412698298579493134e-04
+#define SIN_S4 2.75573137070700676789e-06
+#define SIN_S5 -2.50507602534068634195e-08
+#define SIN_S6 1.58969099521155010221e-10
+
+#define COS_C1 4.16666666666666019037e-02
+#define COS_C2 -1.38888888888741095749e-03
+#define COS_C3 2.48015872894767294178e-05
+#define COS_C4 -2.75573143513906633035e-07
+#define COS_C5 2.08757232129817482790e-09
+#define COS_C6 -1.13596475577881948265e-11
+
+
+/************************* approximations *************************************/
+static uint64_t ToBits(double x)
+{
+	uint64_t bits = 0;
+
+	memcpy(&bits, &x, sizeof(bits));
+
+	return (bits);
+}
+
+static double FromBits(uint64_t bits)
+{
+	double x = 0;
+
+	memcpy(&x, &bits, sizeof(x));
+
+	return (x);
+}
+
+/* exp(x) = 2^k * exp(r), |r| <= ln2 / 2 - fdlibm's e_exp.c */
+static double ApproxExp(double x)
+{
+	double t = x * INV_LN2 + ROUND_MAGIC;
+	double k = t - ROUND_MAGIC;
+	double hi = x - k * LN2_HI;
+	double lo = k * LN2_LO;
+	double r = hi - lo;
+	double z = r * r;
+	double c = r - z * (EXP_P1 + z * (EXP_P2 + z * (EXP_P3 + z * (EXP_P4 +
+	                    z * EXP_P5))));
+	double y = 1 - ((lo - (r * c) / (2 - c)) - hi);
+
+	/* y * 2^k - k is in the low bits of t */
+	return (y * FromBits((ToBits(t) + 1023) << 52));
+}
+
+/* log(x) = k * ln2 + log(1 + f), 1 + f in [sqrt(0.5), sqrt(2)) - fdlibm's
+   e_log.c */
+static double ApproxLog(double x)
+{
+	uint64_t bits = ToBits(x);
+	uint64_t u = bits + LOG_SHIFT;
+	double k = FromBits((u >> 52) | TWO_P52_BITS) - (TWO_P52 + 1023);
+	double f = FromBits(bits - (u & EXPONENT_MASK) + ONE_BITS) - 1;
+	double s = f / (2 + f);
+	double z = s * s;
+	double w = z * z;
+	double r = z * (LOG_LG1 + w * (LOG_LG3 + w * (LOG_LG5 + w * LOG_LG7))) +
+	           w * (LOG_LG2 + w * (LOG_LG4 + w * LOG_LG6));
+	double hfsq = 0.5 * f * f;
+
+	return (k * LN2_HI - ((hfsq - (s * (hfsq + r) + k * LN2_LO)) - f));
+}
+
+/* sin(x) = +-sin(r) or +-cos(r), r = x - n * pi/2 - fdlibm's k_sin.c and
+   k_cos.c */
+static double ApproxSin(double x)
+{
+	double t = x * INV_PIO2 + ROUND_MAGIC;
+	double n = t - ROUND_MAGIC;
+	double r = ((x - n * PIO2_1) - n * PIO2_2) - n * PIO2_3 - n * PIO2_3T;
+	double z = r * r;
+	double sin_r = r + (z * r) * (SIN_S1 + z * (SIN_S2 + z * (SIN_S3 +
+	                   z * (SIN_S4 + z * (SIN_S5 + z * SIN_S6)))));
+	double hz = 0.5 * z;
+	double w = 1 - hz;
+	double cos_r = w + (((1 - w) - hz) + z * (z * (COS_C1 + z * (COS_C2 +
+	                    z * (COS_C3 + z * (COS_C4 + z * (COS_C5 +
+	                    z * COS_C6)))))));
+	uint64_t quadrant = ToBits(t);
+	double y = (quadrant & 1) ? cos_r : sin_r;
+
+	y = FromBits(ToBits(y) ^ ((quadrant & 2) << 62));
+
+	return ((fabs(x) < SIN_TINY) ? x : y);
+}
+
+
+/************************* scalar kernels *************************************/
+#define DEFINE_SCALAR_KERNEL(name, op)                                        \
+static void name(double *dst, const double *a, const double *b,               \
+                 unsigned char *err, size_t n)                                \
+{                                                                             \
+	size_t i = 0;                                                             \
+	UNUSED(err);                                                              \
+	for (i = 0; i < n; ++i)                                                   \
+	{                                                                         \
+		dst[i] = a[i] op b[i];                                                \
+	}                                                                         \
+}
+
+DEFINE_SCALAR_KERNEL(AddScalar, +)
+DEFINE_SCALAR_KERNEL(SubScalar, -)
+DEFINE_SCALAR_KERNEL(MulScalar, *)
+
+static void DivScalar(double *dst, const double *a, const double *b,
+                      unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		err[i] |= (0 == b[i]);
+		dst[i] = a[i] / b[i];
+	}
+}
+
+/* no vector pow - every instruction set uses this one */
+static void PowScalar(double *dst, const double *a, const double *b,
+                      unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = ProgramPow(a[i], b[i]);
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+/* a NaN square or root is a math error, as the pow they replace */
+static void SquareScalar(double *dst, const double *a, const double *b,
+                         unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	UNUSED(b);
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = a[i] * a[i];
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+static void SqrtScalar(double *dst, const double *a, const double *b,
+                       unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	UNUSED(b);
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = sqrt(a[i]);
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+/* the approximations in their ranges, libm out of them. a NaN (out of
+   libm) is a math error */
+#define DEFINE_SCALAR_MATH_KERNEL(name, approx, lo, hi, libm)                 \
+static void name(double *dst, const double *a, const double *b,               \
+                 unsigned char *err, size_t n)                                \
+{                                                                             \
+	size_t i = 0;                                                             \
+	UNUSED(b);                                                                \
+	for (i = 0; i < n; ++i)                                                   \
+	{                                                                         \
+		dst[i] = (a[i] >= (lo) && a[i] <= (hi)) ? approx(a[i]) : libm(a[i]);  \
+		err[i] |= (0 != isnan(dst[i]));                                       \
+	}                                                                         \
+}
+
+DEFINE_SCALAR_MATH_KERNEL(LogScalar, ApproxLog, LOG_MIN, LOG_MAX, log)
+DEFINE_SCALAR_MATH_KERNEL(ExpScalar, ApproxExp, EXP_MIN, EXP_MAX, exp)
+DEFINE_SCALAR_MATH_KERNEL(SinScalar, ApproxSin, -SIN_MAX, SIN_MAX, sin)
+
+static void AbsScalar(double *dst, const double *a, const double *b,
+                      unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	UNUSED(b);
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = fabs(a[i]);
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+/* as ProgramCall - the same as minpd and maxpd */
+static void MinScalar(double *dst, const double *a, const double *b,
+                      unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = (a[i] < b[i]) ? a[i] : b[i];
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+static void MaxScalar(double *dst, const double *a, const double *b,
+                      unsigned char *err, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = (a[i] > b[i]) ? a[i] : b[i];
+		err[i] |= (0 != isnan(dst[i]));
+	}
+}
+
+static const kernels_t g_scalar_kernels =
+{
+	{
+		[OPC_ADD] = AddScalar,
+		[OPC_SUB] = SubScalar,
+		[OPC_MUL] = MulScalar,
+		[OPC_DIV] = DivScalar,
+		[OPC_POW] = PowScalar,
+		[OPC_SQUARE] = SquareScalar,
+		[OPC_SQRT] = SqrtScalar,
+		[OPC_LOG] = LogScalar,
+		[OPC_EXP] = ExpScalar,
+		[OPC_SIN] = SinScalar,
+		[OPC_ABS] = AbsScalar,
+		[OPC_MIN] = MinScalar,
+		[OPC_MAX] = MaxScalar
+	}
+};
+
+
+#ifdef CALC_BATCH_X86
+/************************* SSE2 kernels ***************************************/
+#define DEFINE_SSE2_KERNEL(name, intrinsic, op)                               \
+static __attribute__((target("sse2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	size_t i = 0;                                                             \
+	UNUSED(err);                                                              \
+	for (i = 0; i + 2 <= n; i += 2)                                           \
+	{                                                                         \
+		_mm_storeu_pd(dst + i, intrinsic(_mm_loadu_pd(a + i),                 \
+		                                 _mm_loadu_pd(b + i)));               \
+	}                                                                         \
+	for (; i < n; ++i)                                                        \
+	{                                                                         \
+		dst[i] = a[i] op b[i];                                                \
+	}                                                                         \
+}
+
+DEFINE_SSE2_KERNEL(AddSse2, _mm_add_pd, +)
+DEFINE_SSE2_KERNEL(SubSse2, _mm_sub_pd, -)
+DEFINE_SSE2_KERNEL(MulSse2, _mm_mul_pd, *)
+
+static __attribute__((target("sse2")))
+void DivSse2(double *dst, const double *a, const double *b,
+             unsigned char *err, size_t n)
+{
+	const __m128d zero = _mm_setzero_pd();
+	__m128d divisor;
+	int mask = 0;
+	size_t i = 0;
+
+	for (i = 0; i + 2 <= n; i += 2)
+	{
+		divisor = _mm_loadu_pd(b + i);
+		_mm_storeu_pd(dst + i, _mm_div_pd(_mm_loadu_pd(a + i), divisor));
+
+		mask = _mm_movemask_pd(_mm_cmpeq_pd(divisor, zero));
+		err[i] 		|= mask & 1;
+		err[i + 1] 	|= (mask >> 1) & 1;
+	}
+
+	DivScalar(dst + i, a + i, b + i, err + i, n - i);
+}
+
+/* unary kernel - 'expression' of the vector x, NaN rows flagged */
+#define DEFINE_SSE2_UNARY_KERNEL(name, expression, scalar_kernel)            \
+static __attribute__((target("sse2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m128d x;                                                                \
+	int mask = 0;                                                             \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 2 <= n; i += 2)                                           \
+	{                                                                         \
+		x = _mm_loadu_pd(a + i);                                              \
+		x = (expression);                                                     \
+		_mm_storeu_pd(dst + i, x);                                            \
+		mask = _mm_movemask_pd(_mm_cmpunord_pd(x, x));                        \
+		err[i] 		|= mask & 1;                                              \
+		err[i + 1] 	|= (mask >> 1) & 1;                                       \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b, err + i, n - i);                         \
+}
+
+DEFINE_SSE2_UNARY_KERNEL(SquareSse2, _mm_mul_pd(x, x), SquareScalar)
+DEFINE_SSE2_UNARY_KERNEL(SqrtSse2, _mm_sqrt_pd(x), SqrtScalar)
+DEFINE_SSE2_UNARY_KERNEL(AbsSse2, _mm_andnot_pd(_mm_set1_pd(-0.0), x),
+                         AbsScalar)
+
+/* binary kernel, NaN rows flagged */
+#define DEFINE_SSE2_CHECKED_KERNEL(name, intrinsic, scalar_kernel)            \
+static __attribute__((target("sse2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m128d x;                                                                \
+	int mask = 0;                                                             \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 2 <= n; i += 2)                                           \
+	{                                                                         \
+		x = intrinsic(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));              \
+		_mm_storeu_pd(dst + i, x);                                            \
+		mask = _mm_movemask_pd(_mm_cmpunord_pd(x, x));                        \
+		err[i] 		|= mask & 1;                                              \
+		err[i + 1] 	|= (mask >> 1) & 1;                                       \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b + i, err + i, n - i);                     \
+}
+
+DEFINE_SSE2_CHECKED_KERNEL(MinSse2, _mm_min_pd, MinScalar)
+DEFINE_SSE2_CHECKED_KERNEL(MaxSse2, _mm_max_pd, MaxScalar)
+
+/* mask ? a : b */
+static inline __attribute__((target("sse2")))
+__m128d SelectSse2(__m128d mask, __m128d a, __m128d b)
+{
+	return (_mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)));
+}
+
+/* a * b + c - not fused, as the scalar one */
+static inline __attribute__((target("sse2")))
+__m128d MulAddSse2(__m128d a, __m128d b, double c)
+{
+	return (_mm_add_pd(_mm_mul_pd(a, b), _mm_set1_pd(c)));
+}
+
+/* ApproxExp, ApproxLog and ApproxSin - 2 at a time */
+static inline __attribute__((target("sse2")))
+__m128d ApproxExpSse2(__m128d x)
+{
+	__m128d t = MulAddSse2(x, _mm_set1_pd(INV_LN2), ROUND_MAGIC);
+	__m128d k = _mm_sub_pd(t, _mm_set1_pd(ROUND_MAGIC));
+	__m128d hi = _mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(LN2_HI)));
+	__m128d lo = _mm_mul_pd(k, _mm_set1_pd(LN2_LO));
+	__m128d r = _mm_sub_pd(hi, lo);
+	__m128d z = _mm_mul_pd(r, r);
+	__m128d c = MulAddSse2(z, _mm_set1_pd(EXP_P5), EXP_P4);
+	__m128d y;
+	__m128i scale;
+
+	c = MulAddSse2(z, c, EXP_P3);
+	c = MulAddSse2(z, c, EXP_P2);
+	c = MulAddSse2(z, c, EXP_P1);
+	c = _mm_sub_pd(r, _mm_mul_pd(z, c));
+
+	y = _mm_div_pd(_mm_mul_pd(r, c), _mm_sub_pd(_mm_set1_pd(2), c));
+	y = _mm_sub_pd(_mm_set1_pd(1), _mm_sub_pd(_mm_sub_pd(lo, y), hi));
+
+	scale = _mm_slli_epi64(_mm_add_epi64(_mm_castpd_si128(t),
+	                                     _mm_set1_epi64x(1023)), 52);
+
+	return (_mm_mul_pd(y, _mm_castsi128_pd(scale)));
+}
+
+static inline __attribute__((target("sse2")))
+__m128d ApproxLogSse2(__m128d x)
+{
+	__m128i bits = _mm_castpd_si128(x);
+	__m128i u = _mm_add_epi64(bits, _mm_set1_epi64x((long long)LOG_SHIFT));
+	__m128d k = _mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(u, 52),
+	                             _mm_set1_epi64x((long long)TWO_P52_BITS)));
+	__m128d f = _mm_castsi128_pd(_mm_add_epi64(_mm_sub_epi64(bits,
+	            _mm_and_si128(u, _mm_set1_epi64x((long long)EXPONENT_MASK))),
+	            _mm_set1_epi64x((long long)ONE_BITS)));
+	__m128d s, z, w, r, t, hfsq;
+
+	k = _mm_sub_pd(k, _mm_set1_pd(TWO_P52 + 1023));
+	f = _mm_sub_pd(f, _mm_set1_pd(1));
+	s = _mm_div_pd(f, _mm_add_pd(_mm_set1_pd(2), f));
+	z = _mm_mul_pd(s, s);
+	w = _mm_mul_pd(z, z);
+
+	r = MulAddSse2(w, _mm_set1_pd(LOG_LG7), LOG_LG5);
+	r = MulAddSse2(w, r, LOG_LG3);
+	r = MulAddSse2(w, r, LOG_LG1);
+	t = MulAddSse2(w, _mm_set1_pd(LOG_LG6), LOG_LG4);
+	t = MulAddSse2(w, t, LOG_LG2);
+	r = _mm_add_pd(_mm_mul_pd(z, r), _mm_mul_pd(w, t));
+
+	hfsq = _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(0.5), f), f);
+	t = _mm_add_pd(_mm_mul_pd(s, _mm_add_pd(hfsq, r)),
+	               _mm_mul_pd(k, _mm_set1_pd(LN2_LO)));
+	t = _mm_sub_pd(_mm_sub_pd(hfsq, t), f);
+
+	return (_mm_sub_pd(_mm_mul_pd(k, _mm_set1_pd(LN2_HI)), t));
+}
+
+static inline __attribute__((target("sse2")))
+__m128d ApproxSinSse2(__m128d x)
+{
+	const __m128i one = _mm_set1_epi64x(1);
+	__m128d t = MulAddSse2(x, _mm_set1_pd(INV_PIO2), ROUND_MAGIC);
+	__m128d n = _mm_sub_pd(t, _mm_set1_pd(ROUND_MAGIC));
+	__m128d r = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(PIO2_1)));
+	__m128d z, p, sin_r, cos_r, hz, w, odd, tiny;
+	__m128i quadrant = _mm_castpd_si128(t);
+
+	r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(PIO2_2)));
+	r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(PIO2_3)));
+	r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(PIO2_3T)));
+	z = _mm_mul_pd(r, r);
+
+	p = MulAddSse2(z, _mm_set1_pd(SIN_S6), SIN_S5);
+	p = MulAddSse2(z, p, SIN_S4);
+	p = MulAddSse2(z, p, SIN_S3);
+	p = MulAddSse2(z, p, SIN_S2);
+	p = MulAddSse2(z, p, SIN_S1);
+	sin_r = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(z, r), p));
+
+	p = MulAddSse2(z, _mm_set1_pd(COS_C6), COS_C5);
+	p = MulAddSse2(z, p, COS_C4);
+	p = MulAddSse2(z, p, COS_C3);
+	p = MulAddSse2(z, p, COS_C2);
+	p = MulAddSse2(z, p, COS_C1);
+	hz = _mm_mul_pd(_mm_set1_pd(0.5), z);
+	w = _mm_sub_pd(_mm_set1_pd(1), hz);
+	cos_r = _mm_add_pd(_mm_sub_pd(_mm_sub_pd(_mm_set1_pd(1), w), hz),
+	                   _mm_mul_pd(z, _mm_mul_pd(z, p)));
+	cos_r = _mm_add_pd(w, cos_r);
+
+	/* no 64-bit compare in SSE2 - the low half's result, on both halves */
+	odd = _mm_castsi128_pd(_mm_shuffle_epi32(_mm_cmpeq_epi32(
+	      _mm_and_si128(quadrant, one), one), _MM_SHUFFLE(2, 2, 0, 0)));
+	p = _mm_xor_pd(SelectSse2(odd, cos_r, sin_r), _mm_castsi128_pd(
+	    _mm_slli_epi64(_mm_and_si128(quadrant, _mm_set1_epi64x(2)), 62)));
+
+	tiny = _mm_cmplt_pd(_mm_andnot_pd(_mm_set1_pd(-0.0), x),
+	                    _mm_set1_pd(SIN_TINY));
+
+	return (SelectSse2(tiny, x, p));
+}
+
+/* the approximations 2 rows at a time - a pair with a row out of their
+   range goes to the scalar kernel (no NaN comes out of the approximations,
+   so only it flags rows) */
+#define DEFINE_SSE2_MATH_KERNEL(name, approx, lo, hi, scalar_kernel)          \
+static __attribute__((target("sse2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m128d x;                                                                \
+	__m128d in_range;                                                         \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 2 <= n; i += 2)                                           \
+	{                                                                         \
+		x = _mm_loadu_pd(a + i);                                              \
+		in_range = _mm_and_pd(_mm_cmpge_pd(x, _mm_set1_pd(lo)),               \
+		                      _mm_cmple_pd(x, _mm_set1_pd(hi)));              \
+		if (3 == _mm_movemask_pd(in_range))                                   \
+		{                                                                     \
+			_mm_storeu_pd(dst + i, approx(x));                                \
+		}                                                                     \
+		else                                                                  \
+		{                                                                     \
+			scalar_kernel(dst + i, a + i, b, err + i, 2);                     \
+		}                                                                     \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b, err + i, n - i);                         \
+}
+
+DEFINE_SSE2_MATH_KERNEL(LogSse2, ApproxLogSse2, LOG_MIN, LOG_MAX, LogScalar)
+DEFINE_SSE2_MATH_KERNEL(ExpSse2, ApproxExpSse2, EXP_MIN, EXP_MAX, ExpScalar)
+DEFINE_SSE2_MATH_KERNEL(SinSse2, ApproxSinSse2, -SIN_MAX, SIN_MAX, SinScalar)
+
+static const kernels_t g_sse2_kernels =
+{
+	{
+		[OPC_ADD] = AddSse2,
+		[OPC_SUB] = SubSse2,
+		[OPC_MUL] = MulSse2,
+		[OPC_DIV] = DivSse2,
+		[OPC_POW] = PowScalar,
+		[OPC_SQUARE] = SquareSse2,
+		[OPC_SQRT] = SqrtSse2,
+		[OPC_LOG] = LogSse2,
+		[OPC_EXP] = ExpSse2,
+		[OPC_SIN] = SinSse2,
+		[OPC_ABS] = AbsSse2,
+		[OPC_MIN] = MinSse2,
+		[OPC_MAX] = MaxSse2
+	}
+};
+
+
+/************************* AVX2 kernels ***************************************/
+#define DEFINE_AVX2_KERNEL(name, intrinsic, op)                               \
+static __attribute__((target("avx2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	size_t i = 0;                                                             \
+	UNUSED(err);                                                              \
+	for (i = 0; i + 4 <= n; i += 4)                                           \
+	{                                                                         \
+		_mm256_storeu_pd(dst + i, intrinsic(_mm256_loadu_pd(a + i),           \
+		                                    _mm256_loadu_pd(b + i)));         \
+	}                                                                         \
+	for (; i < n; ++i)                                                        \
+	{                                                                         \
+		dst[i] = a[i] op b[i];                                                \
+	}                                                                         \
+}
+
+DEFINE_AVX2_KERNEL(AddAvx2, _mm256_add_pd, +)
+DEFINE_AVX2_KERNEL(SubAvx2, _mm256_sub_pd, -)
+DEFINE_AVX2_KERNEL(MulAvx2, _mm256_mul_pd, *)
+
+static __attribute__((target("avx2")))
+void DivAvx2(double *dst, const double *a, const double *b,
+             unsigned char *err, size_t n)
+{
+	const __m256d zero = _mm256_setzero_pd();
+	__m256d divisor;
+	int mask = 0;
+	size_t i = 0;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		divisor = _mm256_loadu_pd(b + i);
+		_mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_loadu_pd(a + i),
+		                                        divisor));
+
+		mask = _mm256_movemask_pd(_mm256_cmp_pd(divisor, zero, _CMP_EQ_OQ));
+		err[i] 		|= mask & 1;
+		err[i + 1] 	|= (mask >> 1) & 1;
+		err[i + 2] 	|= (mask >> 2) & 1;
+		err[i + 3] 	|= (mask >> 3) & 1;
+	}
+
+	DivScalar(dst + i, a + i, b + i, err + i, n - i);
+}
+
+#define DEFINE_AVX2_UNARY_KERNEL(name, expression, scalar_kernel)            \
+static __attribute__((target("avx2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m256d x;                                                                \
+	int mask = 0;                                                             \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 4 <= n; i += 4)                                           \
+	{                                                                         \
+		x = _mm256_loadu_pd(a + i);                                           \
+		x = (expression);                                                     \
+		_mm256_storeu_pd(dst + i, x);                                         \
+		mask = _mm256_movemask_pd(_mm256_cmp_pd(x, x, _CMP_UNORD_Q));         \
+		err[i] 		|= mask & 1;                                              \
+		err[i + 1] 	|= (mask >> 1) & 1;                                       \
+		err[i + 2] 	|= (mask >> 2) & 1;                                       \
+		err[i + 3] 	|= (mask >> 3) & 1;                                       \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b, err + i, n - i);                         \
+}
+
+DEFINE_AVX2_UNARY_KERNEL(SquareAvx2, _mm256_mul_pd(x, x), SquareScalar)
+DEFINE_AVX2_UNARY_KERNEL(SqrtAvx2, _mm256_sqrt_pd(x), SqrtScalar)
+DEFINE_AVX2_UNARY_KERNEL(AbsAvx2, _mm256_andnot_pd(_mm256_set1_pd(-0.0), x),
+                         AbsScalar)
+
+#define DEFINE_AVX2_CHECKED_KERNEL(name, intrinsic, scalar_kernel)            \
+static __attribute__((target("avx2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m256d x;                                                                \
+	int mask = 0;                                                             \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 4 <= n; i += 4)                                           \
+	{                                                                         \
+		x = intrinsic(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));        \
+		_mm256_storeu_pd(dst + i, x);                                         \
+		mask = _mm256_movemask_pd(_mm256_cmp_pd(x, x, _CMP_UNORD_Q));         \
+		err[i] 		|= mask & 1;                                              \
+		err[i + 1] 	|= (mask >> 1) & 1;                                       \
+		err[i + 2] 	|= (mask >> 2) & 1;                                       \
+		err[i + 3] 	|= (mask >> 3) & 1;                                       \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b + i, err + i, n - i);                     \
+}
+
+DEFINE_AVX2_CHECKED_KERNEL(MinAvx2, _mm256_min_pd, MinScalar)
+DEFINE_AVX2_CHECKED_KERNEL(MaxAvx2, _mm256_max_pd, MaxScalar)
+
+static inline __attribute__((target("avx2")))
+__m256d MulAddAvx2(__m256d a, __m256d b, double c)
+{
+	return (_mm256_add_pd(_mm256_mul_pd(a, b), _mm256_set1_pd(c)));
+}
+
+/* ApproxExp, ApproxLog and ApproxSin - 4 at a time */
+static inline __attribute__((target("avx2")))
+__m256d ApproxExpAvx2(__m256d x)
+{
+	__m256d t = MulAddAvx2(x, _mm256_set1_pd(INV_LN2), ROUND_MAGIC);
+	__m256d k = _mm256_sub_pd(t, _mm256_set1_pd(ROUND_MAGIC));
+	__m256d hi = _mm256_sub_pd(x, _mm256_mul_pd(k, _mm256_set1_pd(LN2_HI)));
+	__m256d lo = _mm256_mul_pd(k, _mm256_set1_pd(LN2_LO));
+	__m256d r = _mm256_sub_pd(hi, lo);
+	__m256d z = _mm256_mul_pd(r, r);
+	__m256d c = MulAddAvx2(z, _mm256_set1_pd(EXP_P5), EXP_P4);
+	__m256d y;
+	__m256i scale;
+
+	c = MulAddAvx2(z, c, EXP_P3);
+	c = MulAddAvx2(z, c, EXP_P2);
+	c = MulAddAvx2(z, c, EXP_P1);
+	c = _mm256_sub_pd(r, _mm256_mul_pd(z, c));
+
+	y = _mm256_div_pd(_mm256_mul_pd(r, c),
+	                  _mm256_sub_pd(_mm256_set1_pd(2), c));
+	y = _mm256_sub_pd(_mm256_set1_pd(1),
+	                  _mm256_sub_pd(_mm256_sub_pd(lo, y), hi));
+
+	scale = _mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(t),
+	                          _mm256_set1_epi64x(1023)), 52);
+
+	return (_mm256_mul_pd(y, _mm256_castsi256_pd(scale)));
+}
+
+static inline __attribute__((target("avx2")))
+__m256d ApproxLogAvx2(__m256d x)
+{
+	__m256i bits = _mm256_castpd_si256(x);
+	__m256i u = _mm256_add_epi64(bits,
+	                             _mm256_set1_epi64x((long long)LOG_SHIFT));
+	__m256d k = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(u, 52),
+	            _mm256_set1_epi64x((long long)TWO_P52_BITS)));
+	__m256d f = _mm256_castsi256_pd(_mm256_add_epi64(_mm256_sub_epi64(bits,
+	            _mm256_and_si256(u,
+	                             _mm256_set1_epi64x((long long)EXPONENT_MASK))),
+	            _mm256_set1_epi64x((long long)ONE_BITS)));
+	__m256d s, z, w, r, t, hfsq;
+
+	k = _mm256_sub_pd(k, _mm256_set1_pd(TWO_P52 + 1023));
+	f = _mm256_sub_pd(f, _mm256_set1_pd(1));
+	s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2), f));
+	z = _mm256_mul_pd(s, s);
+	w = _mm256_mul_pd(z, z);
+
+	r = MulAddAvx2(w, _mm256_set1_pd(LOG_LG7), LOG_LG5);
+	r = MulAddAvx2(w, r, LOG_LG3);
+	r = MulAddAvx2(w, r, LOG_LG1);
+	t = MulAddAvx2(w, _mm256_set1_pd(LOG_LG6), LOG_LG4);
+	t = MulAddAvx2(w, t, LOG_LG2);
+	r = _mm256_add_pd(_mm256_mul_pd(z, r), _mm256_mul_pd(w, t));
+
+	hfsq = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), f), f);
+	t = _mm256_add_pd(_mm256_mul_pd(s, _mm256_add_pd(hfsq, r)),
+	                  _mm256_mul_pd(k, _mm256_set1_pd(LN2_LO)));
+	t = _mm256_sub_pd(_mm256_sub_pd(hfsq, t), f);
+
+	return (_mm256_sub_pd(_mm256_mul_pd(k, _mm256_set1_pd(LN2_HI)), t));
+}
+
+static inline __attribute__((target("avx2")))
+__m256d ApproxSinAvx2(__m256d x)
+{
+	const __m256i one = _mm256_set1_epi64x(1);
+	__m256d t = MulAddAvx2(x, _mm256_set1_pd(INV_PIO2), ROUND_MAGIC);
+	__m256d n = _mm256_sub_pd(t, _mm256_set1_pd(ROUND_MAGIC));
+	__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(PIO2_1)));
+	__m256d z, p, sin_r, cos_r, hz, w, odd, tiny;
+	__m256i quadrant = _mm256_castpd_si256(t);
+
+	r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(PIO2_2)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(PIO2_3)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(PIO2_3T)));
+	z = _mm256_mul_pd(r, r);
+
+	p = MulAddAvx2(z, _mm256_set1_pd(SIN_S6), SIN_S5);
+	p = MulAddAvx2(z, p, SIN_S4);
+	p = MulAddAvx2(z, p, SIN_S3);
+	p = MulAddAvx2(z, p, SIN_S2);
+	p = MulAddAvx2(z, p, SIN_S1);
+	sin_r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(z, r), p));
+
+	p = MulAddAvx2(z, _mm256_set1_pd(COS_C6), COS_C5);
+	p = MulAddAvx2(z, p, COS_C4);
+	p = MulAddAvx2(z, p, COS_C3);
+	p = MulAddAvx2(z, p, COS_C2);
+	p = MulAddAvx2(z, p, COS_C1);
+	hz = _mm256_mul_pd(_mm256_set1_pd(0.5), z);
+	w = _mm256_sub_pd(_mm256_set1_pd(1), hz);
+	cos_r = _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(_mm256_set1_pd(1), w),
+	                                    hz),
+	                      _mm256_mul_pd(z, _mm256_mul_pd(z, p)));
+	cos_r = _mm256_add_pd(w, cos_r);
+
+	odd = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+	      _mm256_and_si256(quadrant, one), one));
+	p = _mm256_xor_pd(_mm256_blendv_pd(sin_r, cos_r, odd),
+	                  _mm256_castsi256_pd(_mm256_slli_epi64(
+	                  _mm256_and_si256(quadrant, _mm256_set1_epi64x(2)), 62)));
+
+	tiny = _mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.0), x),
+	                     _mm256_set1_pd(SIN_TINY), _CMP_LT_OQ);
+
+	return (_mm256_blendv_pd(p, x, tiny));
+}
+
+#define DEFINE_AVX2_MATH_KERNEL(name, approx, lo, hi, scalar_kernel)          \
+static __attribute__((target("avx2")))                                        \
+void name(double *dst, const double *a, const double *b,                      \
+          unsigned char *err, size_t n)                                       \
+{                                                                             \
+	__m256d x;                                                                \
+	__m256d in_range;                                                         \
+	size_t i = 0;                                                             \
+	for (i = 0; i + 4 <= n; i += 4)                                           \
+	{                                                                         \
+		x = _mm256_loadu_pd(a + i);                                           \
+		in_range = _mm256_and_pd(                                             \
+		           _mm256_cmp_pd(x, _mm256_set1_pd(lo), _CMP_GE_OQ),          \
+		           _mm256_cmp_pd(x, _mm256_set1_pd(hi), _CMP_LE_OQ));         \
+		if (15 == _mm256_movemask_pd(in_range))                               \
+		{                                                                     \
+			_mm256_storeu_pd(dst + i, approx(x));                             \
+		}                                                                     \
+		else                                                                  \
+		{                                                                     \
+			scalar_kernel(dst + i, a + i, b, err + i, 4);                     \
+		}                                                                     \
+	}                                                                         \
+	scalar_kernel(dst + i, a + i, b, err + i, n - i);                         \
+}
+
+DEFINE_AVX2_MATH_KERNEL(LogAvx2, ApproxLogAvx2, LOG_MIN, LOG_MAX, LogScalar)
+DEFINE_AVX2_MATH_KERNEL(ExpAvx2, ApproxExpAvx2, EXP_MIN, EXP_MAX, ExpScalar)
+DEFINE_AVX2_MATH_KERNEL(SinAvx2, ApproxSinAvx2, -SIN_MAX, SIN_MAX, SinScalar)
+
+static const kernels_t g_avx2_kernels =
+{
+	{
+		[OPC_ADD] = AddAvx2,
+		[OPC_SUB] = SubAvx2,
+		[OPC_MUL] = MulAvx2,
+		[OPC_DIV] = DivAvx2,
+		[OPC_POW] = PowScalar,
+		[OPC_SQUARE] = SquareAvx2,
+		[OPC_SQRT] = SqrtAvx2,
+		[OPC_LOG] = LogAvx2,
+		[OPC_EXP] = ExpAvx2,
+		[OPC_SIN] = SinAvx2,
+		[OPC_ABS] = AbsAvx2,
+		[OPC_MIN] = MinAvx2,
+		[OPC_MAX] = MaxAvx2
+	}
+};
+#endif /* CALC_BATCH_X86 */
+
+
+/************************* internal functions *********************************/
+static const kernels_t *SelectKernels(enum calc_isa isa);
+static int IsSupported(const calc_program_t *program);
+static size_t FailAll(size_t rows, double *out, signed char *status);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcEvalBatch
+*******************************************************************************/
+size_t CalcEvalBatch(const calc_program_t *program,
+                     const double *const *columns, size_t rows,
+                     double *out, signed char *status)
+{
+	return (CalcEvalBatchIsa(program, columns, rows, out, status,
+	                         CALC_ISA_AUTO));
+}
+
+
+/******************************************************************************
+*								CalcEvalBatchIsa
+*******************************************************************************/
+size_t CalcEvalBatchIsa(const calc_program_t *program,
+                        const double *const *columns, size_t rows,
+                        double *out, signed char *status, enum calc_isa isa)
+{
+	const kernels_t *kernels = SelectKernels(isa);
+	const calc_instr_t *ip = NULL;
+	const calc_instr_t *end = NULL;
+	unsigned char err[BLOCK_ROWS];
+	double *scratch = NULL;		/* a block per stack level */
+	double *consts = NULL;		/* a pre-filled block per OPC_CONST */
+	const double **src = NULL;	/* the block each stack level reads from */
+	double *const_block = NULL;
+	size_t const_count = 0;
+	size_t depth = 0;
+	size_t first = 0;
+	size_t n = 0;
+	size_t i = 0;
+	size_t failed = 0;
+
+	assert(program);
+	assert(columns || 0 == program->var_count);
+	assert(out);
+
+	end = program->code + program->length;
+	for (ip = program->code; ip < end; ++ip)
+	{
+		const_count += (OPC_CONST == ip->opcode);
+	}
+
+	scratch = (double *)malloc((program->max_depth + const_count) *
+	                           BLOCK_ROWS * sizeof(double));
+	src = (const double **)malloc(program->max_depth * sizeof(double *));
+	if (NULL == scratch || NULL == src || !IsSupported(program))
+	{
+		free(scratch);
+		free(src);
+		return (FailAll(rows, out, status));
+	}
+
+	/* constants are the same in every block - fill them once */
+	consts = scratch + program->max_depth * BLOCK_ROWS;
+	const_block = consts;
+	for (ip = program->code; ip < end; ++ip)
+	{
+		if (OPC_CONST == ip->opcode)
+		{
+			for (i = 0; i < BLOCK_ROWS; ++i)
+			{
+				const_block[i] = ip->value;
+			}
+			const_block += BLOCK_ROWS;
+		}
+	}
+
+	/*** main loop - one block of rows at a time ***/
+	for (first = 0; first < rows; first += BLOCK_ROWS)
+	{
+		n = (rows - first < BLOCK_ROWS) ? (rows - first) : BLOCK_ROWS;
+		memset(err, 0, n);
+		const_block = consts;
+		depth = 0;
+
+		for (ip = program->code; ip < end; ++ip)
+		{
+			switch (ip->opcode)
+			{
+				case OPC_CONST:
+					src[depth] = const_block;
+					const_block += BLOCK_ROWS;
+					++depth;
+					break;
+
+				case OPC_VAR:
+					src[depth] = columns[ip->arg] + first;
+					++depth;
+					break;
+
+				case OPC_ADD:
+				case OPC_SUB:
+				case OPC_MUL:
+				case OPC_DIV:
+				case OPC_POW:
+				case OPC_MIN:
+				case OPC_MAX:
+					--depth;
+					kernels->ops[ip->opcode](scratch + (depth - 1) * BLOCK_ROWS,
+					                         src[depth - 1], src[depth], err, n);
+					src[depth - 1] = scratch + (depth - 1) * BLOCK_ROWS;
+					break;
+
+				case OPC_SQUARE:
+				case OPC_SQRT:
+				case OPC_LOG:
+				case OPC_EXP:
+				case OPC_SIN:
+				case OPC_ABS:
+					kernels->ops[ip->opcode](scratch + (depth - 1) * BLOCK_ROWS,
+					                         src[depth - 1], src[depth - 1], err,
+					                         n);
+					src[depth - 1] = scratch + (depth - 1) * BLOCK_ROWS;
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		for (i = 0; i < n; ++i)
+		{
+			out[first + i] = err[i] ? RESULT_WHEN_ERROR : src[0][i];
+			failed += err[i];
+
+			if (NULL != status)
+			{
+				status[first + i] = err[i] ? MATH_ERROR : CALC_SUCCESS;
+			}
+		}
+	}
+
+	free(src);
+	free(scratch);
+
+	return (failed);
+}
+
+
+/******************************************************************************
+*								SelectKernels
+*******************************************************************************/
+static const kernels_t *SelectKernels(enum calc_isa isa)
+{
+#ifdef CALC_BATCH_X86
+	__builtin_cpu_init();
+
+	if ((CALC_ISA_AUTO == isa || CALC_ISA_AVX2 == isa) &&
+	    __builtin_cpu_supports("avx2"))
+	{
+		return (&g_avx2_kernels);
+	}
+
+	if (CALC_ISA_SCALAR != isa && __builtin_cpu_supports("sse2"))
+	{
+		return (&g_sse2_kernels);
+	}
+#else
+	UNUSED(isa);
+#endif
+
+	return (&g_scalar_kernels);
+}
+
+
+/******************************************************************************
+*								IsSupported
+*******************************************************************************/
+static int IsSupported(const calc_program_t *program)
+{
+	size_t i = 0;
+
+	/* every opcode must be an operand or have a kernel */
+	for (i = 0; i < program->length; ++i)
+	{
+		if (program->code[i].opcode >= MAX_OPCODES ||
+		    (OPC_CONST != program->code[i].opcode &&
+		     OPC_VAR != program->code[i].opcode &&
+		     NULL == g_scalar_kernels.ops[program->code[i].opcode]))
+		{
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+
+/******************************************************************************
+*								FailAll
+*******************************************************************************/
+static size_t FailAll(size_t rows, double *out, signed char *status)
+{
+	size_t i = 0;
+
+	for (i = 0; i < rows; ++i)
+	{
+		out[i] = RESULT_WHEN_ERROR;
+
+		if (NULL != status)
+		{
+			status[i] = APPLICATION_ERROR;
+		}
+	}
+
+	return (rows);
+}
@@ -0,0 +1,67 @@
+/*****************************************************************************
+ *  File name  : calc_batch.h
+ *  Developer  : Eyal Weizman
+ *	Description: columnar (batch) evaluation of compiled expressions
+ *****************************************************************************/
+
+#ifndef __CALC_BATCH_H__
+#define __CALC_BATCH_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* instruction sets of the batch kernels */
+enum calc_isa
+{
+	CALC_ISA_AUTO,		/* the best one the running cpu supports */
+	CALC_ISA_SCALAR,
+	CALC_ISA_SSE2,
+	CALC_ISA_AVX2
+};
+
+/********************************** CalcEvalBatch ****************************/
+/*	Description      :	Evaluates a compiled program over 'rows' rows of
+ *	                  	input columns. each postfix instruction runs as a
+ *	                  	vectorized loop over a block of rows (AVX2 / SSE2
+ *	                  	with a scalar fallback, chosen at runtime).
+ *
+ *	Input            :	program - a program returned by CalcCompile.
+ *	                  	columns - columns[slot] is the column of values of
+ *	                  	variable 'slot' (CalcVarCount columns, 'rows' long).
+ *	                  	may be NULL if the program has no variables.
+ *	                  	out - 'rows' results.
+ *	                  	status - optional (may be NULL), 'rows' entries.
+ *	                  	receives the calc_status of each row.
+ *
+ *	Return Values    :	number of rows that failed. a failed row has -1 in
+ *	                  	'out' (as CalcEval): MATH_ERROR for division by zero
+ *	                  	or a NaN from '^' or a function, APPLICATION_ERROR
+ *	                  	for all rows if memory for the evaluation can't be
+ *	                  	allocated.
+ *
+ *	                  	NOTE: log, exp and sin run as polynomials (those of
+ *	                  	fdlibm), not libm calls, and may differ from
+ *	                  	CalcEval in the last bit: at most 1 ulp for log and
+ *	                  	exp, 1 ulp for sin on |x| <= pi and 2 ulp up to
+ *	                  	|x| = 65536 (libm beyond). the results are the same
+ *	                  	on every instruction set, and so are the errors.
+ *
+ *	Time Complexity  : O(rows * n) - n is the program length
+ *
+ *  Space Complexity : O(depth) blocks of rows
+ */
+size_t CalcEvalBatch(const calc_program_t *program,
+                     const double *const *columns, size_t rows,
+                     double *out, signed char *status);
+
+/********************************* CalcEvalBatchIsa **************************/
+/*	Description      :	Same as CalcEvalBatch, with the instruction set
+ *	                  	forced (falls back to what the cpu supports).
+ *	                  	meant for testing and benchmarking the kernels.
+ */
+size_t CalcEvalBatchIsa(const calc_program_t *program,
+                        const double *const *columns, size_t rows,
+                        double *out, signed char *status, enum calc_isa isa);
+
+#endif     /* __CALC_BATCH_H__ */
@@ -0,0 +1,2010 @@
+/******************************************************************************
+*	Filename	:	calc_bench.c
+*	Developer	:	Eyal Weizman
+*	Description	:	calculator benchmarks
+*******************************************************************************/
+#include <stdio.h> 		/* printf, sprintf */
+#include <string.h> 	/* memset, strcmp, strlen */
+#include <time.h> 		/* clock_gettime */
+#include <math.h> 		/* pow, log, exp, sin */
+#include <stdint.h> 	/* int64_t */
+#include <unistd.h> 	/* fork, sysconf, _exit */
+
+#include <stdlib.h> 	/* malloc, free, qsort, rand */
+
+#include "calc.h"
+#include "calc_batch.h"
+#include "calc_pool.h"
+#include "calc_number.h"
+#include "calc_prog.h"
+#include "calc_opt.h"
+#include "calc_cache.h"
+#include "calc_lex.h"
+#include "calc_bundle.h"
+#include "calc_jit.h"
+#include "calc_stats.h"
+#include "calc_ring.h"
+#include "calc_formula.h"
+#include "stack/stack.h"
+#include "stack/typed_stack.h"
+
+/******************************* MACROS ***************************************/
+#define NS_IN_SEC 1000000000.0
+#define ITERATIONS 1000000
+#define ROWS 1000
+#define BATCH_ROWS 1000000
+#define LONG_EXPR_TERMS 1000
+#define POOL_EXPRS 200000
+#define SPLIT_TERMS 1000000		/* about 16 MB */
+#define BUNDLE_PROGRAMS 100000
+#define BUNDLE_PATH "/tmp/calc_bench.bundle"
+#define NUMBERS 4096
+#define NUMBER_CHARS 32
+#define ZIPF_EXPRS 10000
+#define ZIPF_REQUESTS 1000000
+#define EXPR_CHARS 48
+
+/* the corpus - CORPUS_EXPRS expressions of every kind, CORPUS_ROUNDS times */
+#define CORPUS_EXPRS 2000
+#define CORPUS_ROUNDS 10
+#define CORPUS_EXPR_CHARS 4096
+
+/* lexer inputs - 'LEX_TERMS' terms, 'LEX_PADDING' spaces around padded ops */
+#define LEX_TERMS 1000
+#define LEX_PADDING 64
+#define LEX_ROUNDS 2000
+
+/* the instrumented run - CORPUS_EXPRS expressions, STATS_ROUNDS times */
+#define STATS_ROUNDS 20
+
+/* the ring - RING_REQUESTS round trips to an evaluator in another process,
+   and the same requests submitted RING_BATCH at a time */
+#define RING_PATH "/dev/shm/calc_bench.ring"
+#define RING_REQUESTS 100000
+#define RING_BATCH 64
+#define RING_POLL_SPINS ((size_t)-1)	/* never sleeps */
+
+/* the formula graph - FORMULA_LAYERS layers of FORMULA_WIDTH nodes, the
+   first of them inputs. a node uses two neighbours of the layer before */
+#define FORMULA_WIDTH 1000
+#define FORMULA_LAYERS 100
+#define FORMULA_UPDATES 1000
+#define FORMULA_THREADS 4
+
+/* stack elements pushed and popped per round */
+#define STACK_DEPTH 256
+#define STACK_ROUNDS 100000
+
+/* input sizes of the stress benchmark - 1 KB up, x4 each step. the default
+   run stops at 64 MB, bench.out --stress goes on to 1 GB */
+#define STRESS_MIN_BYTES ((size_t)1 << 10)
+#define STRESS_DEFAULT_BYTES ((size_t)1 << 26)
+#define STRESS_MAX_BYTES ((size_t)1 << 30)
+#define STRESS_BYTES_PER_SIZE ((size_t)1 << 26)	/* calculated at each size */
+
+/*************************** structs & typedefs *******************************/
+DEFINE_TYPED_STACK(num_stack, NumStack, double)
+DEFINE_TYPED_STACK(op_stack, OpStack, char)
+
+/* writes a random expression of one kind to 'str' (CORPUS_EXPR_CHARS) */
+typedef void (*generator_t)(char *str);
+
+typedef struct corpus_kind_s
+{
+	const char *name;
+	generator_t generate;
+}corpus_kind_t;
+
+/* what the corpus benchmark measures for a kind of expressions */
+typedef struct corpus_result_s
+{
+	const char *name;
+	double ns_per_expr;
+	double exprs_per_sec;
+	double bytes_per_expr;
+	double allocs_per_call;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double p999_ns;
+	double error_rate;
+}corpus_result_t;
+
+enum output_format
+{
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON
+};
+
+/************************** internal functions ********************************/
+static double GetTimeNs(void);
+static void GenerateShort(char *str);
+static void GenerateDeepParentheses(char *str);
+static void GenerateLongChain(char *str);
+static void GeneratePowerHeavy(char *str);
+static void GenerateErrorHeavy(char *str);
+static char *GenerateNumber(char *str);
+static void MeasureCorpus(const corpus_kind_t *kind, corpus_result_t *result);
+static int CompareDoubles(const void *a, const void *b);
+static void MeasureRing(char (*exprs)[EXPR_CHARS], size_t spins,
+                        double *latencies);
+static void PrintLatencies(const char *name, double *latencies, size_t n);
+static int ByteValidate(const char *str, size_t len);
+static double LexMbPerSec(const char *str, size_t len, int what);
+static void StressMeasure(const char *str, size_t len, double *ns_per_byte,
+                          double *allocs_per_call);
+static void PrintCorpus(const corpus_result_t *results, size_t count,
+                        enum output_format format);
+void CorpusBench(enum output_format format);
+void CompileEvalBench(void);
+void JitBench(void);
+void PowBench(void);
+void VariablesBench(void);
+void BatchBench(void);
+void MathBench(void);
+void ArenaBench(void);
+void PoolBench(void);
+void SplitBench(void);
+void BundleBench(void);
+void NumberBench(void);
+void OptimizeBench(void);
+void CacheBench(void);
+void LexBench(void);
+void StackBench(void);
+void StatsBench(void);
+void RingBench(void);
+void FormulasBench(void);
+void StressBench(size_t max_bytes);
+
+/* of <sys/wait.h> - which brings the stack_t of <signal.h>, clashing with
+   the one of stack/stack.h */
+pid_t waitpid(pid_t pid, int *status, int options);
+
+/* results are accumulated here so the compiler can't drop the calculations */
+static volatile double g_sink = 0;
+
+/* allocation counting - the makefile links the benchmark with
+   -Wl,--wrap=malloc (and calloc, realloc), routing the calls here */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+/* per thread - the pool benchmarks allocate on several threads at once */
+static _Thread_local size_t g_alloc_count = 0;
+
+
+/******************************************************************************
+*								main
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+	/* bench.out --csv | --json - only the corpus, for tracking over releases */
+	if (argc > 1 && 0 == strcmp(argv[1], "--csv"))
+	{
+		CorpusBench(FORMAT_CSV);
+		return (0);
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--json"))
+	{
+		CorpusBench(FORMAT_JSON);
+		return (0);
+	}
+
+	/* bench.out --stress - only the stress benchmark, up to 1 GB inputs */
+	if (argc > 1 && 0 == strcmp(argv[1], "--stress"))
+	{
+		StressBench(STRESS_MAX_BYTES);
+		return (0);
+	}
+
+	if (argc > 1)
+	{
+		fprintf(stderr, "usage: %s [--csv | --json | --stress]\n", argv[0]);
+		return (1);
+	}
+
+	printf("\n***** BENCHMARKS FOR CALCULATOR FUNCTION *****\n\n");
+	printf("\n========================================================\n\n");
+
+	CorpusBench(FORMAT_TEXT);
+	printf("\n--------------------------------------------------------\n\n");
+
+	CompileEvalBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	JitBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	PowBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	VariablesBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	BatchBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	MathBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	ArenaBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	PoolBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	SplitBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	BundleBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	NumberBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	OptimizeBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	CacheBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	LexBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	StackBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	StatsBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	RingBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	FormulasBench();
+	printf("\n--------------------------------------------------------\n\n");
+
+	StressBench(STRESS_DEFAULT_BYTES);
+	printf("\n--------------------------------------------------------\n\n");
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								GetTimeNs
+*******************************************************************************/
+static double GetTimeNs(void)
+{
+	struct timespec now = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * NS_IN_SEC + now.tv_nsec);
+}
+
+
+/************************ CompileEvalBench ************************************/
+void CompileEvalBench(void)
+{
+	const char *exprs[] = {"3 + 5x2/5*3 - 2:1",
+	                       "(4 * (2 + 8) / (5 - 3) + (10))",
+	                       "2^(-3) * 8.5 + 4 ^ 0.5 ^ 1 - 3.14 * (2.5 - 1)"};
+	calc_program_t *program = NULL;
+	double start = 0;
+	double calc_ns = 0;
+	double eval_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	printf("Calculate vs CalcCompile + CalcEval (ns/expr):\n\n");
+
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS; ++j)
+		{
+			g_sink += Calculate(exprs[i]).result;
+		}
+		calc_ns = (GetTimeNs() - start) / ITERATIONS;
+
+		program = CalcCompile(exprs[i], NULL);
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS; ++j)
+		{
+			g_sink += CalcEval(program, NULL).result;
+		}
+		eval_ns = (GetTimeNs() - start) / ITERATIONS;
+		CalcProgramDestroy(program);
+
+		printf("%-48s  calc %8.1f  eval %8.1f  x%.1f\n",
+		       exprs[i], calc_ns, eval_ns, calc_ns / eval_ns);
+	}
+}
+
+
+/************************ JitBench ********************************************/
+void JitBench(void)
+{
+	/* the same formula with values in the text, for Calculate */
+	const char *exprs[][2] =
+	{
+		{"price * qty - discount", "12.5 * 3 - 2"},
+		{"((a + 1.5) * b - c / 4) * (a - b) + c * 2",
+		 "((2.5 + 1.5) * 3 - 7 / 4) * (2.5 - 3) + 7 * 2"},
+		{"(a + 2) * b / (b - 3) - a ^ 0.5 + 2 - b",
+		 "(2.5 + 2) * 3 / (3 - 3.5) - 2.5 ^ 0.5 + 2 - 3"}
+	};
+	const double vars[] = {2.5, 3, 7};
+	calc_program_t *program = NULL;
+	calc_jit_t *jit = NULL;
+	double start = 0;
+	double calc_ns = 0;
+	double eval_ns = 0;
+	double jit_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	printf("Calculate vs CalcEval vs CalcJitEval (ns/expr):\n\n");
+
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS; ++j)
+		{
+			g_sink += Calculate(exprs[i][1]).result;
+		}
+		calc_ns = (GetTimeNs() - start) / ITERATIONS;
+
+		program = CalcCompile(exprs[i][0], NULL);
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS; ++j)
+		{
+			g_sink += CalcEval(program, vars).result;
+		}
+		eval_ns = (GetTimeNs() - start) / ITERATIONS;
+
+		/* compiled on the first call */
+		jit = CalcJitCreate(program, 0);
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS; ++j)
+		{
+			g_sink += CalcJitEval(jit, vars).result;
+		}
+		jit_ns = (GetTimeNs() - start) / ITERATIONS;
+
+		printf("%-42s  calc %6.1f  eval %5.1f  jit %5.1f  x%.1f%s\n",
+		       exprs[i][0], calc_ns, eval_ns, jit_ns, eval_ns / jit_ns,
+		       CalcJitIsNative(jit) ? "" : " (interpreted)");
+
+		CalcJitDestroy(jit);
+		CalcProgramDestroy(program);
+	}
+}
+
+
+/************************ PowBench ********************************************/
+void PowBench(void)
+{
+	const double exponents[] = {2, 10, 0.5, 7, -3, 1.5};
+	const char *bases[] = {"x.25", "2", "x.25", "3", "5", "x.25"};
+	const char *exact_expr = "(price * qty - discount) ^ 2 / 4";
+	const double vars[] = {120, 37, 8};
+	static double numbers[NUMBERS];
+	calc_program_t *program = NULL;
+	double start = 0;
+	double pow_ns = 0;
+	double fast_ns = 0;
+	double eval_ns = 0;
+	double exact_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+
+	printf("'^' - pow vs ProgramPow (ns/op):\n\n");
+
+	for (i = 0; i < sizeof(exponents) / sizeof(exponents[0]); ++i)
+	{
+		/* whole bases for 2^10, 3^7 and 5^-3, fractional for the rest */
+		for (j = 0; j < NUMBERS; ++j)
+		{
+			numbers[j] = (bases[i][0] == 'x') ? 1 + (j % 100) + 0.25 :
+			                                     bases[i][0] - '0';
+		}
+
+		start = GetTimeNs();
+		for (k = 0; k < ITERATIONS / NUMBERS; ++k)
+		{
+			for (j = 0; j < NUMBERS; ++j)
+			{
+				g_sink += pow(numbers[j], exponents[i]);
+			}
+		}
+		pow_ns = (GetTimeNs() - start) / (ITERATIONS / NUMBERS * NUMBERS);
+
+		start = GetTimeNs();
+		for (k = 0; k < ITERATIONS / NUMBERS; ++k)
+		{
+			for (j = 0; j < NUMBERS; ++j)
+			{
+				g_sink += ProgramPow(numbers[j], exponents[i]);
+			}
+		}
+		fast_ns = (GetTimeNs() - start) / (ITERATIONS / NUMBERS * NUMBERS);
+
+		printf("%-6s ^ %-4g  pow %6.1f  ProgramPow %6.1f  x%.1f\n",
+		       bases[i], exponents[i], pow_ns, fast_ns, pow_ns / fast_ns);
+	}
+
+	printf("\n'%s' - CalcEval vs CalcEvalExact (ns/expr):\n\n", exact_expr);
+
+	program = CalcCompile(exact_expr, NULL);
+
+	start = GetTimeNs();
+	for (i = 0; i < ITERATIONS; ++i)
+	{
+		g_sink += CalcEval(program, vars).result;
+	}
+	eval_ns = (GetTimeNs() - start) / ITERATIONS;
+
+	start = GetTimeNs();
+	for (i = 0; i < ITERATIONS; ++i)
+	{
+		g_sink += CalcEvalExact(program, vars).result;
+	}
+	exact_ns = (GetTimeNs() - start) / ITERATIONS;
+
+	printf("eval %6.1f  exact %6.1f\n", eval_ns, exact_ns);
+
+	CalcProgramDestroy(program);
+}
+
+
+/************************ VariablesBench **************************************/
+void VariablesBench(void)
+{
+	double rows[ROWS][3] = {{0}};
+	char expr[128] = {0};
+	calc_program_t *program = NULL;
+	double start = 0;
+	double subst_ns = 0;
+	double eval_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	for (i = 0; i < ROWS; ++i)
+	{
+		rows[i][0] = 1 + i % 100;
+		rows[i][1] = 0.25 * (i % 17);
+		rows[i][2] = i % 7;
+	}
+
+	printf("'price * qty - discount' over rows (ns/row):\n\n");
+
+	/* the old way - substitute the values as text and re-parse */
+	start = GetTimeNs();
+	for (j = 0; j < ITERATIONS / ROWS; ++j)
+	{
+		for (i = 0; i < ROWS; ++i)
+		{
+			sprintf(expr, "%.6f * %.6f - %.6f",
+			        rows[i][0], rows[i][1], rows[i][2]);
+			g_sink += Calculate(expr).result;
+		}
+	}
+	subst_ns = (GetTimeNs() - start) / ITERATIONS;
+
+	program = CalcCompile("price * qty - discount", NULL);
+	start = GetTimeNs();
+	for (j = 0; j < ITERATIONS / ROWS; ++j)
+	{
+		for (i = 0; i < ROWS; ++i)
+		{
+			g_sink += CalcEval(program, rows[i]).result;
+		}
+	}
+	eval_ns = (GetTimeNs() - start) / ITERATIONS;
+	CalcProgramDestroy(program);
+
+	printf("%-48s  subst %7.1f  eval %8.1f  x%.1f\n",
+	       "sprintf + Calculate vs CalcEval", subst_ns, eval_ns,
+	       subst_ns / eval_ns);
+}
+
+
+/************************ BatchBench ******************************************/
+void BatchBench(void)
+{
+	const char *isa_names[] = {"auto", "scalar", "sse2", "avx2"};
+	double *columns[3] = {NULL};
+	double *out = NULL;
+	signed char *status = NULL;
+	calc_program_t *program = NULL;
+	double vars[3] = {0};
+	double start = 0;
+	double ns = 0;
+	size_t i = 0;
+	int isa = 0;
+
+	for (i = 0; i < 3; ++i)
+	{
+		columns[i] = (double *)malloc(BATCH_ROWS * sizeof(double));
+	}
+	out = (double *)malloc(BATCH_ROWS * sizeof(double));
+	status = (signed char *)malloc(BATCH_ROWS);
+
+	for (i = 0; i < BATCH_ROWS; ++i)
+	{
+		columns[0][i] = 1 + i % 100;
+		columns[1][i] = 0.25 * (i % 17);
+		columns[2][i] = 1 + i % 7;
+	}
+
+	program = CalcCompile("(price * qty - discount) / qty + 2 * price", NULL);
+
+	printf("'(price * qty - discount) / qty + 2 * price' (ns/row):\n\n");
+
+	start = GetTimeNs();
+	for (i = 0; i < BATCH_ROWS; ++i)
+	{
+		vars[0] = columns[0][i];
+		vars[1] = columns[1][i];
+		vars[2] = columns[2][i];
+		g_sink += CalcEval(program, vars).result;
+	}
+	ns = (GetTimeNs() - start) / BATCH_ROWS;
+	printf("%-20s %6.2f\n", "CalcEval per row", ns);
+
+	/* warm-up - the first pass pays the page faults of 'out' and 'status' */
+	CalcEvalBatch(program, (const double *const *)columns, BATCH_ROWS,
+	              out, status);
+
+	for (isa = CALC_ISA_AUTO; isa <= CALC_ISA_AVX2; ++isa)
+	{
+		start = GetTimeNs();
+		CalcEvalBatchIsa(program, (const double *const *)columns, BATCH_ROWS,
+		                 out, status, (enum calc_isa)isa);
+		ns = (GetTimeNs() - start) / BATCH_ROWS;
+		g_sink += out[BATCH_ROWS - 1];
+		printf("batch %-14s %6.2f\n", isa_names[isa], ns);
+	}
+
+	CalcProgramDestroy(program);
+	for (i = 0; i < 3; ++i)
+	{
+		free(columns[i]);
+	}
+	free(out);
+	free(status);
+}
+
+
+/************************ MathBench *******************************************/
+void MathBench(void)
+{
+	const char *exprs[] = {"log(x)", "exp(x)", "sin(x)"};
+	double (*const libm[])(double) = {log, exp, sin};
+	const double ranges[][2] = {{0.001, 1000}, {-50, 50}, {-100, 100}};
+	const char *isa_names[] = {"scalar", "sse2", "avx2"};
+	double *x = (double *)malloc(BATCH_ROWS * sizeof(double));
+	double *out = (double *)malloc(BATCH_ROWS * sizeof(double));
+	const double *columns[1] = {NULL};
+	calc_program_t *program = NULL;
+	int64_t max_ulp = 0;
+	int64_t ulp = 0;
+	int64_t a = 0;
+	int64_t b = 0;
+	double start = 0;
+	double ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+	int isa = 0;
+
+	columns[0] = x;
+
+	printf("built-in functions - libm vs the batch kernels (ns/value), and "
+	       "the\nkernels' largest error against libm (ULP):\n\n");
+	printf("%-8s %7s %9s %8s %8s %8s %5s\n", "", "libm", "CalcEval",
+	       isa_names[0], isa_names[1], isa_names[2], "ulp");
+
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		program = CalcCompile(exprs[i], NULL);
+
+		for (j = 0; j < BATCH_ROWS; ++j)
+		{
+			x[j] = ranges[i][0] + (ranges[i][1] - ranges[i][0]) *
+			       ((double)rand() / RAND_MAX);
+		}
+
+		start = GetTimeNs();
+		for (j = 0; j < BATCH_ROWS; ++j)
+		{
+			g_sink += libm[i](x[j]);
+		}
+		ns = (GetTimeNs() - start) / BATCH_ROWS;
+		printf("%-8s %7.2f", exprs[i], ns);
+
+		start = GetTimeNs();
+		for (j = 0; j < BATCH_ROWS; ++j)
+		{
+			g_sink += CalcEval(program, x + j).result;
+		}
+		ns = (GetTimeNs() - start) / BATCH_ROWS;
+		printf(" %9.2f", ns);
+
+		for (isa = CALC_ISA_SCALAR; isa <= CALC_ISA_AVX2; ++isa)
+		{
+			start = GetTimeNs();
+			CalcEvalBatchIsa(program, columns, BATCH_ROWS, out, NULL,
+			                 (enum calc_isa)isa);
+			ns = (GetTimeNs() - start) / BATCH_ROWS;
+			g_sink += out[BATCH_ROWS - 1];
+			printf(" %8.2f", ns);
+		}
+
+		/* the distance of the ordered bit patterns - every kernel gives the
+		   same results, so the last one's are checked */
+		max_ulp = 0;
+		for (j = 0; j < BATCH_ROWS; ++j)
+		{
+			ns = libm[i](x[j]);
+			memcpy(&a, &ns, sizeof(a));
+			memcpy(&b, out + j, sizeof(b));
+			a = (a < 0) ? INT64_MIN - a : a;
+			b = (b < 0) ? INT64_MIN - b : b;
+			ulp = (a > b) ? a - b : b - a;
+			max_ulp = (ulp > max_ulp) ? ulp : max_ulp;
+		}
+		printf(" %5ld\n", (long)max_ulp);
+
+		CalcProgramDestroy(program);
+	}
+
+	free(out);
+	free(x);
+}
+
+
+/************************ ArenaBench ******************************************/
+void ArenaBench(void)
+{
+	static char long_expr[LONG_EXPR_TERMS * 4 + 1];
+	calc_arena_t *arena = CalcArenaCreate(0);
+	double start = 0;
+	double heap_ns = 0;
+	double arena_ns = 0;
+	size_t i = 0;
+
+	/* "1 + 1 + 1 ..." - too long for Calculate's on-stack buffer */
+	memset(long_expr, ' ', sizeof(long_expr) - 1);
+	for (i = 0; i < LONG_EXPR_TERMS; ++i)
+	{
+		long_expr[i * 4] = '1';
+		long_expr[i * 4 + 2] = (i + 1 < LONG_EXPR_TERMS) ? '+' : ' ';
+	}
+
+	printf("%d-term expression (ns/expr):\n\n", LONG_EXPR_TERMS);
+
+	start = GetTimeNs();
+	for (i = 0; i < ITERATIONS / 100; ++i)
+	{
+		g_sink += Calculate(long_expr).result;
+	}
+	heap_ns = (GetTimeNs() - start) / (ITERATIONS / 100);
+
+	start = GetTimeNs();
+	for (i = 0; i < ITERATIONS / 100; ++i)
+	{
+		g_sink += CalculateArena(long_expr, arena).result;
+	}
+	arena_ns = (GetTimeNs() - start) / (ITERATIONS / 100);
+
+	printf("%-48s  heap %8.1f  arena %7.1f\n",
+	       "Calculate vs CalculateArena", heap_ns, arena_ns);
+
+	CalcArenaDestroy(arena);
+}
+
+
+/************************ PoolBench *******************************************/
+void PoolBench(void)
+{
+	const char *samples[] = {"3 + 5x2/5*3 - 2:1", "(4 * (2 + 8) / (5 - 3))",
+	                         "2^(-3) * 8.5 + 4 ^ 0.5 ^ 1 - 3.14 * (2.5 - 1)",
+	                         "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 1 + 2 + 3 + 4"};
+	size_t n_threads[] = {1, 2, 4, 8, 16};
+	const char **exprs = NULL;
+	result_t *results = NULL;
+	calc_pool_t *pool = NULL;
+	double start = 0;
+	double ns = 0;
+	double single_ns = 0;
+	size_t i = 0;
+
+	exprs = (const char **)malloc(POOL_EXPRS * sizeof(char *));
+	results = (result_t *)malloc(POOL_EXPRS * sizeof(result_t));
+	for (i = 0; i < POOL_EXPRS; ++i)
+	{
+		exprs[i] = samples[i % (sizeof(samples) / sizeof(samples[0]))];
+	}
+
+	printf("CalcPoolCalculate, %d expressions:\n\n", POOL_EXPRS);
+
+	for (i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); ++i)
+	{
+		pool = CalcPoolCreate(n_threads[i]);
+
+		/* warm-up - sizes the arenas, wakes the threads */
+		CalcPoolCalculate(pool, exprs, results, POOL_EXPRS);
+
+		start = GetTimeNs();
+		CalcPoolCalculate(pool, exprs, results, POOL_EXPRS);
+		ns = GetTimeNs() - start;
+		single_ns = (1 == n_threads[i]) ? ns : single_ns;
+		g_sink += results[POOL_EXPRS - 1].result;
+
+		printf("%2lu threads  %12.0f expr/s  x%.2f\n",
+		       (unsigned long)n_threads[i], POOL_EXPRS * NS_IN_SEC / ns,
+		       single_ns / ns);
+
+		CalcPoolDestroy(pool);
+	}
+
+	free(exprs);
+	free(results);
+}
+
+
+/************************ SplitBench ******************************************/
+void SplitBench(void)
+{
+	size_t n_threads[] = {1, 2, 4, 8};
+	calc_reduce_t reduces[] = {CALC_REDUCE_ORDERED, CALC_REDUCE_FAST};
+	calc_pool_t *pool = NULL;
+	char *expr = NULL;
+	double start = 0;
+	double ns = 0;
+	double mb = 0;
+	size_t len = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	/* a generated sum of products - "3.25*x17/4 - 2*0.5^2 + ..." */
+	expr = (char *)malloc(SPLIT_TERMS * 24);
+	if (NULL == expr)
+	{
+		return;
+	}
+	for (i = 0; i < SPLIT_TERMS; ++i)
+	{
+		len += sprintf(expr + len, "%s%d.25*%d/4*0.5^2",
+		               (0 == i) ? "" : (0 == i % 2) ? "+" : " - ",
+		               (int)(i % 1000), (int)(i % 7) + 1);
+	}
+	mb = len / (1024.0 * 1024.0);
+
+	printf("CalcPoolCalcN, one %.1f MB expression (MB/s):\n\n", mb);
+
+	start = GetTimeNs();
+	g_sink += CalcN(expr, len).result;
+	ns = GetTimeNs() - start;
+	printf("CalcN       %8.1f\n\n", mb * NS_IN_SEC / ns);
+
+	printf("threads      ordered     fast\n");
+	for (i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); ++i)
+	{
+		pool = CalcPoolCreate(n_threads[i]);
+
+		printf("%2lu       ", (unsigned long)n_threads[i]);
+		for (j = 0; j < sizeof(reduces) / sizeof(reduces[0]); ++j)
+		{
+			/* warm-up - sizes the arenas, wakes the threads */
+			g_sink += CalcPoolCalcN(pool, expr, len, reduces[j]).result;
+
+			start = GetTimeNs();
+			g_sink += CalcPoolCalcN(pool, expr, len, reduces[j]).result;
+			ns = GetTimeNs() - start;
+			printf("%12.1f", mb * NS_IN_SEC / ns);
+		}
+		printf("\n");
+
+		CalcPoolDestroy(pool);
+	}
+
+	free(expr);
+}
+
+
+/************************ BundleBench *****************************************/
+void BundleBench(void)
+{
+	const char *formats[] = {"price * qty - discount * %d.5",
+	                         "(rate + %d) * (1 - tax) / (qty ^ 2 + 1)",
+	                         "((a + %d) * b - c) / (d + 0.5) + e ^ 0.5",
+	                         "%d.25 * x1 + 2 * x2 - 3 * x3 + 4 * x4 - 5"};
+	const double vars[] = {1.5, 2, 3, 4, 5};
+	static char text[EXPR_CHARS * 2];
+	char **exprs = NULL;
+	calc_program_t **programs = NULL;
+	calc_bundle_t *bundle = NULL;
+	double compile_ns = 0;
+	double open_ns = 0;
+	double start = 0;
+	size_t i = 0;
+
+	exprs = (char **)malloc(BUNDLE_PROGRAMS * sizeof(char *));
+	programs = (calc_program_t **)malloc(BUNDLE_PROGRAMS *
+	                                     sizeof(calc_program_t *));
+	if (NULL == exprs || NULL == programs)
+	{
+		free(exprs);
+		free(programs);
+		return;
+	}
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		sprintf(text, formats[i % (sizeof(formats) / sizeof(formats[0]))],
+		        (int)(i % 1000));
+		exprs[i] = (char *)malloc(strlen(text) + 1);
+		strcpy(exprs[i], text);
+	}
+
+	printf("startup of %d formulas - compile vs bundle (ms):\n\n",
+	       BUNDLE_PROGRAMS);
+
+	start = GetTimeNs();
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		programs[i] = CalcCompile(exprs[i], NULL);
+	}
+	compile_ns = GetTimeNs() - start;
+
+	CalcBundleWrite(BUNDLE_PATH, (const calc_program_t *const *)programs,
+	                BUNDLE_PROGRAMS);
+
+	/* the file is in the page cache by now - a warm start */
+	start = GetTimeNs();
+	bundle = CalcBundleOpen(BUNDLE_PATH);
+	open_ns = GetTimeNs() - start;
+
+	if (NULL != bundle)
+	{
+		g_sink += CalcEval(CalcBundleProgram(bundle, BUNDLE_PROGRAMS - 1),
+		                   vars).result;
+		printf("CalcCompile x %d   %8.1f\n", BUNDLE_PROGRAMS,
+		       compile_ns / 1e6);
+		printf("CalcBundleOpen      %8.1f   x%.1f\n", open_ns / 1e6,
+		       compile_ns / open_ns);
+	}
+
+	CalcBundleClose(bundle);
+	remove(BUNDLE_PATH);
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		CalcProgramDestroy(programs[i]);
+		free(exprs[i]);
+	}
+	free(programs);
+	free(exprs);
+}
+
+
+/************************ NumberBench *****************************************/
+void NumberBench(void)
+{
+	static char numbers[NUMBERS][NUMBER_CHARS];
+	static size_t lengths[NUMBERS];
+	const char *kinds[] = {"small integers (0 - 999)", "prices (12345.67)",
+	                       "scientific (1.234e-7)", "round-trip (%.17g)"};
+	double number = 0;
+	double start = 0;
+	double strtod_ns = 0;
+	double parse_ns = 0;
+	size_t kind = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	printf("number parsing, NumberParse vs strtod (ns/number):\n\n");
+
+	srand(1);
+	for (kind = 0; kind < sizeof(kinds) / sizeof(kinds[0]); ++kind)
+	{
+		for (i = 0; i < NUMBERS; ++i)
+		{
+			switch (kind)
+			{
+			case 0:
+				sprintf(numbers[i], "%d", rand() % 1000);
+				break;
+
+			case 1:
+				sprintf(numbers[i], "%d.%02d", rand() % 100000, rand() % 100);
+				break;
+
+			case 2:
+				sprintf(numbers[i], "%d.%03de-%d", rand() % 10, rand() % 1000,
+				        rand() % 20);
+				break;
+
+			default:
+				sprintf(numbers[i], "%.17g", (double)rand() / RAND_MAX);
+				break;
+			}
+			lengths[i] = strlen(numbers[i]);
+		}
+
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS / NUMBERS; ++j)
+		{
+			for (i = 0; i < NUMBERS; ++i)
+			{
+				g_sink += strtod(numbers[i], NULL);
+			}
+		}
+		strtod_ns = (GetTimeNs() - start) / (j * NUMBERS);
+
+		start = GetTimeNs();
+		for (j = 0; j < ITERATIONS / NUMBERS; ++j)
+		{
+			for (i = 0; i < NUMBERS; ++i)
+			{
+				NumberParse(numbers[i], numbers[i] + lengths[i], &number);
+				g_sink += number;
+			}
+		}
+		parse_ns = (GetTimeNs() - start) / (j * NUMBERS);
+
+		printf("%-32s  strtod %6.1f  NumberParse %6.1f  x%.2f\n",
+		       kinds[kind], strtod_ns, parse_ns, strtod_ns / parse_ns);
+	}
+}
+
+
+/************************ OptimizeBench ***************************************/
+void OptimizeBench(void)
+{
+	const char *exprs[] = {"(2^10) * rate / 100",
+	                       "1 * price * (1 + 17 / 100) - 0 + (2 + 3) ^ 2",
+	                       "(x - 3) ^ 2 + (y - 4) ^ 2",
+	                       "(x ^ 2 + y ^ 2) ^ 0.5 * (3.14 / 180)"};
+	double rows[ROWS][2] = {{0}};
+	calc_program_t *program = NULL;
+	calc_opt_stats_t stats = {0};
+	double start = 0;
+	double plain_ns = 0;
+	double optimized_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+
+	for (i = 0; i < ROWS; ++i)
+	{
+		rows[i][0] = 1 + i % 100;
+		rows[i][1] = 0.25 * (i % 17);
+	}
+
+	printf("CalcEval before / after CalcOptimize (ns/eval):\n\n");
+
+	for (k = 0; k < sizeof(exprs) / sizeof(exprs[0]); ++k)
+	{
+		program = CalcCompile(exprs[k], NULL);
+
+		/* second round - the optimized program */
+		for (j = 0; j < 2; ++j)
+		{
+			start = GetTimeNs();
+			for (i = 0; i < ITERATIONS; ++i)
+			{
+				g_sink += CalcEval(program, rows[i % ROWS]).result;
+			}
+			optimized_ns = (GetTimeNs() - start) / ITERATIONS;
+
+			if (0 == j)
+			{
+				plain_ns = optimized_ns;
+				CalcOptimize(program, &stats);
+			}
+		}
+
+		printf("%-48s  %2lu -> %2lu instr  %6.1f  %6.1f\n", exprs[k],
+		       (unsigned long)stats.length_before,
+		       (unsigned long)stats.length_after, plain_ns, optimized_ns);
+
+		CalcProgramDestroy(program);
+	}
+}
+
+
+/************************ CacheBench ******************************************/
+typedef struct zipf_job_s
+{
+	calc_cache_t *cache;
+	char (*exprs)[EXPR_CHARS];
+	const size_t *requests;
+}zipf_job_t;
+
+static void ZipfTask(void *arg, size_t index, size_t worker)
+{
+	zipf_job_t *job = (zipf_job_t *)arg;
+	const char *str = job->exprs[job->requests[index]];
+
+	(void)worker;
+	g_sink += (NULL != job->cache) ? CalcCacheCalculate(job->cache, str).result :
+	                                 Calculate(str).result;
+}
+
+void CacheBench(void)
+{
+	static char exprs[ZIPF_EXPRS][EXPR_CHARS];
+	static double cdf[ZIPF_EXPRS];
+	static size_t requests[ZIPF_REQUESTS];
+	double skews[] = {0.8, 1.0, 1.2};
+	size_t capacities[] = {256, 1024, 4096};
+	size_t n_threads[] = {1, 8};
+	calc_cache_stats_t stats = {0};
+	calc_pool_t *pool = NULL;
+	zipf_job_t job = {0};
+	double sum = 0;
+	double u = 0;
+	double start = 0;
+	double plain_ns = 0;
+	double ns = 0;
+	size_t low = 0;
+	size_t high = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	size_t t = 0;
+
+	/* distinct expressions, in the spacing users type them */
+	srand(1);
+	for (i = 0; i < ZIPF_EXPRS; ++i)
+	{
+		sprintf(exprs[i], "(%d + %d.%02d) * %d - %d / (%d + 1)", rand() % 1000,
+		        rand() % 100, rand() % 100, rand() % 50, rand() % 1000,
+		        rand() % 20);
+	}
+	job.exprs = exprs;
+	job.requests = requests;
+
+	printf("%d requests over %d expressions, Zipfian (ns/request):\n\n",
+	       ZIPF_REQUESTS, ZIPF_EXPRS);
+
+	for (k = 0; k < sizeof(skews) / sizeof(skews[0]); ++k)
+	{
+		/* P(rank r) ~ 1 / r^s */
+		sum = 0;
+		for (i = 0; i < ZIPF_EXPRS; ++i)
+		{
+			sum += 1 / pow(i + 1, skews[k]);
+			cdf[i] = sum;
+		}
+
+		for (i = 0; i < ZIPF_REQUESTS; ++i)
+		{
+			u = sum * rand() / ((double)RAND_MAX + 1);
+			for (low = 0, high = ZIPF_EXPRS - 1; low < high; )
+			{
+				if (cdf[(low + high) / 2] < u)
+				{
+					low = (low + high) / 2 + 1;
+				}
+				else
+				{
+					high = (low + high) / 2;
+				}
+			}
+			requests[i] = low;
+		}
+
+		for (t = 0; t < sizeof(n_threads) / sizeof(n_threads[0]); ++t)
+		{
+			pool = CalcPoolCreate(n_threads[t]);
+
+			job.cache = NULL;
+			start = GetTimeNs();
+			CalcPoolRun(pool, ZIPF_REQUESTS, ZipfTask, &job);
+			plain_ns = (GetTimeNs() - start) / ZIPF_REQUESTS;
+
+			printf("s = %.1f, %2lu threads  Calculate %28.1f\n", skews[k],
+			       (unsigned long)n_threads[t], plain_ns);
+
+			for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]); ++j)
+			{
+				job.cache = CalcCacheCreate(capacities[j]);
+
+				start = GetTimeNs();
+				CalcPoolRun(pool, ZIPF_REQUESTS, ZipfTask, &job);
+				ns = (GetTimeNs() - start) / ZIPF_REQUESTS;
+
+				CalcCacheGetStats(job.cache, &stats);
+				printf("%24s %4lu  hits %5.1f%%  %6.1f  x%.2f\n", "cache",
+				       (unsigned long)capacities[j],
+				       100.0 * stats.hits / (stats.hits + stats.misses), ns,
+				       plain_ns / ns);
+
+				CalcCacheDestroy(job.cache);
+			}
+
+			CalcPoolDestroy(pool);
+		}
+	}
+}
+
+
+/************************ CorpusBench *****************************************/
+void CorpusBench(enum output_format format)
+{
+	const corpus_kind_t kinds[] =
+	{
+		{"short", GenerateShort},
+		{"deep_parentheses", GenerateDeepParentheses},
+		{"long_chain", GenerateLongChain},
+		{"power_heavy", GeneratePowerHeavy},
+		{"error_heavy", GenerateErrorHeavy}
+	};
+	corpus_result_t results[sizeof(kinds) / sizeof(kinds[0])];
+	size_t i = 0;
+
+	/* the same corpus on every run - results compare across builds */
+	srand(1);
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i)
+	{
+		MeasureCorpus(kinds + i, results + i);
+	}
+
+	PrintCorpus(results, sizeof(kinds) / sizeof(kinds[0]), format);
+}
+
+
+/************************ MeasureCorpus ***************************************/
+static void MeasureCorpus(const corpus_kind_t *kind, corpus_result_t *result)
+{
+	static char exprs[CORPUS_EXPRS][CORPUS_EXPR_CHARS];
+	static double latencies[CORPUS_EXPRS * CORPUS_ROUNDS];
+	size_t n = CORPUS_EXPRS * CORPUS_ROUNDS;
+	size_t bytes = 0;
+	size_t errors = 0;
+	size_t allocs = 0;
+	double start = 0;
+	double total_ns = 0;
+	result_t calc_result = {0};
+	size_t i = 0;
+	size_t j = 0;
+
+	for (i = 0; i < CORPUS_EXPRS; ++i)
+	{
+		kind->generate(exprs[i]);
+		bytes += strlen(exprs[i]);
+	}
+
+	/* warm-up - caches, branch predictors, the lookup tables */
+	for (i = 0; i < CORPUS_EXPRS; ++i)
+	{
+		g_sink += Calculate(exprs[i]).result;
+	}
+
+	/* each call timed on its own, for the percentiles */
+	allocs = g_alloc_count;
+	for (j = 0; j < CORPUS_ROUNDS; ++j)
+	{
+		for (i = 0; i < CORPUS_EXPRS; ++i)
+		{
+			start = GetTimeNs();
+			calc_result = Calculate(exprs[i]);
+			latencies[j * CORPUS_EXPRS + i] = GetTimeNs() - start;
+
+			g_sink += calc_result.result;
+			errors += (CALC_SUCCESS != calc_result.status);
+		}
+	}
+	allocs = g_alloc_count - allocs;
+
+	for (i = 0; i < n; ++i)
+	{
+		total_ns += latencies[i];
+	}
+	qsort(latencies, n, sizeof(double), CompareDoubles);
+
+	result->name = kind->name;
+	result->ns_per_expr = total_ns / n;
+	result->exprs_per_sec = NS_IN_SEC * n / total_ns;
+	result->bytes_per_expr = (double)bytes / CORPUS_EXPRS;
+	result->allocs_per_call = (double)allocs / n;
+	result->p50_ns = latencies[n / 2];
+	result->p90_ns = latencies[n * 9 / 10];
+	result->p99_ns = latencies[n * 99 / 100];
+	result->p999_ns = latencies[n * 999 / 1000];
+	result->error_rate = (double)errors / n;
+}
+
+
+/************************ PrintCorpus *****************************************/
+static void PrintCorpus(const corpus_result_t *results, size_t count,
+                        enum output_format format)
+{
+	const corpus_result_t *r = NULL;
+	size_t i = 0;
+
+	switch (format)
+	{
+		case FORMAT_CSV:
+			printf("kind,ns_per_expr,exprs_per_sec,bytes_per_expr,"
+			       "allocs_per_call,p50_ns,p90_ns,p99_ns,p999_ns,"
+			       "error_rate\n");
+			for (i = 0; i < count; ++i)
+			{
+				r = results + i;
+				printf("%s,%.1f,%.0f,%.1f,%.4f,%.0f,%.0f,%.0f,%.0f,%.3f\n",
+				       r->name, r->ns_per_expr, r->exprs_per_sec,
+				       r->bytes_per_expr, r->allocs_per_call, r->p50_ns,
+				       r->p90_ns, r->p99_ns, r->p999_ns, r->error_rate);
+			}
+			break;
+
+		case FORMAT_JSON:
+			printf("[\n");
+			for (i = 0; i < count; ++i)
+			{
+				r = results + i;
+				printf("  {\"kind\": \"%s\", \"ns_per_expr\": %.1f, "
+				       "\"exprs_per_sec\": %.0f, \"bytes_per_expr\": %.1f, "
+				       "\"allocs_per_call\": %.4f, \"p50_ns\": %.0f, "
+				       "\"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+				       "\"p999_ns\": %.0f, \"error_rate\": %.3f}%s\n",
+				       r->name, r->ns_per_expr, r->exprs_per_sec,
+				       r->bytes_per_expr, r->allocs_per_call, r->p50_ns,
+				       r->p90_ns, r->p99_ns, r->p999_ns, r->error_rate,
+				       (i + 1 < count) ? "," : "");
+			}
+			printf("]\n");
+			break;
+
+		default:
+			printf("corpus, %d expressions x %d rounds per kind:\n\n",
+			       CORPUS_EXPRS, CORPUS_ROUNDS);
+			printf("%-18s %9s %11s %7s %7s %7s %7s %7s %7s %6s\n", "kind",
+			       "ns/expr", "expr/s", "B/expr", "allocs", "p50", "p90",
+			       "p99", "p99.9", "errors");
+			for (i = 0; i < count; ++i)
+			{
+				r = results + i;
+				printf("%-18s %9.1f %11.0f %7.1f %7.3f %7.0f %7.0f %7.0f "
+				       "%7.0f %5.1f%%\n", r->name, r->ns_per_expr,
+				       r->exprs_per_sec, r->bytes_per_expr, r->allocs_per_call,
+				       r->p50_ns, r->p90_ns, r->p99_ns, r->p999_ns,
+				       100 * r->error_rate);
+			}
+			break;
+	}
+}
+
+
+/************************ CompareDoubles **************************************/
+static int CompareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+
+/************************ corpus generators ***********************************/
+static char *GenerateNumber(char *str)
+{
+	/* integers, decimals and the odd exponent - as users type them */
+	switch (rand() % 4)
+	{
+		case 0:
+		case 1:
+			return (str + sprintf(str, "%d", rand() % 1000));
+
+		case 2:
+			return (str + sprintf(str, "%d.%02d", rand() % 1000, rand() % 100));
+
+		default:
+			return (str + sprintf(str, "%d.%de%d", rand() % 10, rand() % 1000,
+			                      rand() % 10 - 5));
+	}
+}
+
+/* 2 to 6 operands, one in five in parentheses - "3 + 4.25 * (2 - 1)" */
+static void GenerateShort(char *str)
+{
+	const char ops[] = "+-*/";
+	int operands = 2 + rand() % 5;
+	int i = 0;
+
+	str = GenerateNumber(str);
+	for (i = 1; i < operands; ++i)
+	{
+		str += sprintf(str, " %c ", ops[rand() % 4]);
+		if (0 == rand() % 5)
+		{
+			*str++ = '(';
+			str = GenerateNumber(str);
+			str += sprintf(str, " %c ", ops[rand() % 2]);
+			str = GenerateNumber(str);
+			*str++ = ')';
+		}
+		else
+		{
+			str = GenerateNumber(str);
+		}
+	}
+	*str = '\0';
+}
+
+/* 20 to 100 nested levels - "((((1 + 2) * 3) - 4) ..." */
+static void GenerateDeepParentheses(char *str)
+{
+	const char ops[] = "+-*";
+	int depth = 20 + rand() % 81;
+	int i = 0;
+
+	memset(str, '(', depth);
+	str += depth;
+	str = GenerateNumber(str);
+	for (i = 0; i < depth; ++i)
+	{
+		str += sprintf(str, " %c ", ops[rand() % 3]);
+		str = GenerateNumber(str);
+		*str++ = ')';
+	}
+	*str = '\0';
+}
+
+/* 100 to 500 operands, no parentheses - "1 + 2 * 3 - 4 / 5 ..." */
+static void GenerateLongChain(char *str)
+{
+	const char ops[] = "+-*/";
+	int operands = 100 + rand() % 401;
+	int i = 0;
+
+	str += sprintf(str, "%d", rand() % 100);
+	for (i = 1; i < operands; ++i)
+	{
+		str += sprintf(str, " %c %d", ops[rand() % 4], 1 + rand() % 99);
+	}
+}
+
+/* every other op a power - "2 ^ 0.5 * 3 ^ 2 + 1.5 ^ 3" */
+static void GeneratePowerHeavy(char *str)
+{
+	const char ops[] = "+-*";
+	int operands = 2 + rand() % 4;
+	int i = 0;
+
+	for (i = 0; i < operands; ++i)
+	{
+		if (0 != i)
+		{
+			str += sprintf(str, " %c ", ops[rand() % 3]);
+		}
+		str += sprintf(str, "%d.%d ^ %d.%d", 1 + rand() % 9, rand() % 10,
+		               rand() % 4, rand() % 10);
+	}
+}
+
+/* about half of them fail - syntax errors and math errors, early and late */
+static void GenerateErrorHeavy(char *str)
+{
+	const char *errors[] = {" / 0", " * * 2", " 7", " ^ -0.5 * (0 - 1) ^ 0.5",
+	                        " #", " + (", " + 1 / (2 - 2)"};
+
+	GenerateShort(str);
+	if (0 == rand() % 2)
+	{
+		strcat(str, errors[rand() % (sizeof(errors) / sizeof(errors[0]))]);
+	}
+}
+
+
+/******************************************************************************
+*						allocation counting wrappers
+*******************************************************************************/
+void *__wrap_malloc(size_t size)
+{
+	++g_alloc_count;
+	return (__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	++g_alloc_count;
+	return (__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	++g_alloc_count;
+	return (__real_realloc(ptr, size));
+}
+
+
+/************************ LexBench ********************************************/
+/* what LexMbPerSec measures */
+enum lex_measure
+{
+	MEASURE_SKIP_BYTES,
+	MEASURE_SKIP_VECTOR,
+	MEASURE_VALIDATE_BYTES,
+	MEASURE_VALIDATE_VECTOR,
+	MEASURE_CALCULATE
+};
+
+void LexBench(void)
+{
+	static char padded[LEX_TERMS * (2 * LEX_PADDING + 2)];
+	static char chain[LEX_TERMS * 8];
+	char *runner = NULL;
+	size_t padded_len = 0;
+	size_t chain_len = 0;
+	size_t i = 0;
+
+	/* "1" + spaces + "+" + spaces + "1" ... - a whitespace-padded log line */
+	runner = padded;
+	for (i = 0; i < LEX_TERMS; ++i)
+	{
+		*runner++ = '1';
+		memset(runner, ' ', LEX_PADDING);
+		runner += LEX_PADDING;
+		if (i + 1 < LEX_TERMS)
+		{
+			*runner++ = '+';
+			memset(runner, ' ', LEX_PADDING);
+			runner += LEX_PADDING;
+		}
+	}
+	*runner = '\0';
+	padded_len = runner - padded;
+
+	/* "(12+3)*4-5/(6+7)..." - a machine-generated one, no spaces */
+	runner = chain;
+	for (i = 0; i < LEX_TERMS; ++i)
+	{
+		runner += sprintf(runner, (0 == i % 4) ? "(%d+%d)" : "%d",
+		                  1 + rand() % 99, 1 + rand() % 99);
+		*runner++ = "+-*/"[rand() % 4];
+	}
+	runner += sprintf(runner, "1");
+	chain_len = runner - chain;
+
+	printf("lexer pre-pass, vectors vs a byte loop (MB/s):\n\n");
+	printf("%-32s  bytes %7.0f  vectors %7.0f  Calculate %7.0f\n",
+	       "padded, skipping spaces",
+	       LexMbPerSec(padded, padded_len, MEASURE_SKIP_BYTES),
+	       LexMbPerSec(padded, padded_len, MEASURE_SKIP_VECTOR),
+	       LexMbPerSec(padded, padded_len, MEASURE_CALCULATE));
+	printf("%-32s  bytes %7.0f  vectors %7.0f  Calculate %7.0f\n",
+	       "long chain, validating",
+	       LexMbPerSec(chain, chain_len, MEASURE_VALIDATE_BYTES),
+	       LexMbPerSec(chain, chain_len, MEASURE_VALIDATE_VECTOR),
+	       LexMbPerSec(chain, chain_len, MEASURE_CALCULATE));
+
+	/* an invalid char at the end - rejected before the stacks are set up */
+	chain[chain_len - 1] = '#';
+	printf("%-32s  %45s %7.0f\n", "long chain, '#' at the end", "Calculate",
+	       LexMbPerSec(chain, chain_len, MEASURE_CALCULATE));
+}
+
+static double LexMbPerSec(const char *str, size_t len, int what)
+{
+	const char *end = str + len;
+	const char *runner = NULL;
+	double start = GetTimeNs();
+	size_t i = 0;
+
+	for (i = 0; i < LEX_ROUNDS; ++i)
+	{
+		switch (what)
+		{
+			case MEASURE_SKIP_BYTES:
+				/* as SkipSpace used to - a byte at a time */
+				for (runner = str; runner < end; ++runner)
+				{
+					g_sink += (' ' != *runner);
+				}
+				break;
+
+			case MEASURE_SKIP_VECTOR:
+				for (runner = str; runner < end; ++runner)
+				{
+					runner = LexSkipSpace(runner, end);
+					g_sink += (runner < end);
+				}
+				break;
+
+			case MEASURE_VALIDATE_BYTES:
+				g_sink += ByteValidate(str, len);
+				break;
+
+			case MEASURE_VALIDATE_VECTOR:
+				g_sink += LexValidate(str, len, NULL);
+				break;
+
+			default:
+				g_sink += CalcN(str, len).status;
+				break;
+		}
+	}
+
+	return (len * LEX_ROUNDS / (GetTimeNs() - start) * NS_IN_SEC / 1e6);
+}
+
+/* LexValidate a byte at a time - the baseline */
+static int ByteValidate(const char *str, size_t len)
+{
+	static const char valid[] = "\t\n\v\f\r ()*+-./0123456789:"
+	                            "ABCDEFGHIJKLMNOPQRSTUVWXYZ^_"
+	                            "abcdefghijklmnopqrstuvwxyz";
+	static char is_valid[256] = {0};
+	static int is_init = 0;
+	size_t depth = 0;
+	size_t i = 0;
+
+	for (i = 0; !is_init && i < sizeof(valid) - 1; ++i)
+	{
+		is_valid[(unsigned char)valid[i]] = 1;
+	}
+	is_init = 1;
+
+	for (i = 0; i < len; ++i)
+	{
+		if (!is_valid[(unsigned char)str[i]] ||
+		    (')' == str[i] && 0 == depth))
+		{
+			return (-1);
+		}
+		depth += ('(' == str[i]) - (')' == str[i]);
+	}
+
+	return ((0 == depth) ? 0 : -1);
+}
+
+
+/************************ StackBench ******************************************/
+void StackBench(void)
+{
+	static double generic_buffer[STACK_DEPTH * 2];
+	static double nums[STACK_DEPTH];
+	static char ops[STACK_DEPTH];
+	stack_t *generic = NULL;
+	num_stack_t num_stack = {0};
+	op_stack_t op_stack = {0};
+	double num = 0;
+	char op = 0;
+	double start = 0;
+	double generic_ns = 0;
+	double typed_ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	printf("stacks, push + peek + pop (ns/element):\n\n");
+
+	/* doubles */
+	generic = StackCreateIn(generic_buffer, STACK_DEPTH, sizeof(double));
+	start = GetTimeNs();
+	for (j = 0; j < STACK_ROUNDS; ++j)
+	{
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			num = (double)i;
+			StackPush(generic, &num);
+		}
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			g_sink += *(double *)StackPeek(generic);
+			StackPop(generic);
+		}
+	}
+	generic_ns = (GetTimeNs() - start) / (STACK_ROUNDS * STACK_DEPTH);
+
+	NumStackInit(&num_stack, nums, STACK_DEPTH);
+	start = GetTimeNs();
+	for (j = 0; j < STACK_ROUNDS; ++j)
+	{
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			NumStackPush(&num_stack, (double)i);
+		}
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			g_sink += NumStackPeek(&num_stack);
+			NumStackPop(&num_stack);
+		}
+	}
+	typed_ns = (GetTimeNs() - start) / (STACK_ROUNDS * STACK_DEPTH);
+
+	printf("%-32s  stack_t %6.2f  typed %6.2f  x%.2f\n", "double",
+	       generic_ns, typed_ns, generic_ns / typed_ns);
+
+	/* ops */
+	generic = StackCreateIn(generic_buffer, STACK_DEPTH, sizeof(char));
+	start = GetTimeNs();
+	for (j = 0; j < STACK_ROUNDS; ++j)
+	{
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			op = "+-*/"[i % 4];
+			StackPush(generic, &op);
+		}
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			g_sink += *(char *)StackPeek(generic);
+			StackPop(generic);
+		}
+	}
+	generic_ns = (GetTimeNs() - start) / (STACK_ROUNDS * STACK_DEPTH);
+
+	OpStackInit(&op_stack, ops, STACK_DEPTH);
+	start = GetTimeNs();
+	for (j = 0; j < STACK_ROUNDS; ++j)
+	{
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			OpStackPush(&op_stack, "+-*/"[i % 4]);
+		}
+		for (i = 0; i < STACK_DEPTH; ++i)
+		{
+			g_sink += OpStackPeek(&op_stack);
+			OpStackPop(&op_stack);
+		}
+	}
+	typed_ns = (GetTimeNs() - start) / (STACK_ROUNDS * STACK_DEPTH);
+
+	printf("%-32s  stack_t %6.2f  typed %6.2f  x%.2f\n", "char (op)",
+	       generic_ns, typed_ns, generic_ns / typed_ns);
+}
+
+
+/************************ StatsBench ******************************************/
+void StatsBench(void)
+{
+	const corpus_kind_t kinds[] =
+	{
+		{"short", GenerateShort},
+		{"long_chain", GenerateLongChain}
+	};
+	static char exprs[CORPUS_EXPRS][CORPUS_EXPR_CHARS];
+	double start = 0;
+	double ns = 0;
+	size_t k = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	/* the same ns/expr with and without 'make stats=1' - the probes' cost */
+	printf("Instrumentation (%s):\n", CalcStatsEnabled() ? "compiled in" :
+	       "not compiled in - make stats=1");
+
+	srand(1);
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k)
+	{
+		for (i = 0; i < CORPUS_EXPRS; ++i)
+		{
+			kinds[k].generate(exprs[i]);
+		}
+
+		CalcStatsReset();
+		start = GetTimeNs();
+		for (j = 0; j < STATS_ROUNDS; ++j)
+		{
+			for (i = 0; i < CORPUS_EXPRS; ++i)
+			{
+				g_sink += Calculate(exprs[i]).result;
+			}
+		}
+		ns = (GetTimeNs() - start) / (STATS_ROUNDS * CORPUS_EXPRS);
+
+		printf("\n%s: %.1f ns/expr\n", kinds[k].name, ns);
+		if (CalcStatsEnabled())
+		{
+			CalcStatsPrint(stdout);
+		}
+	}
+}
+
+
+/************************ RingBench *******************************************/
+void RingBench(void)
+{
+	static char exprs[RING_REQUESTS][EXPR_CHARS];
+	static double latencies[RING_REQUESTS];
+	double start = 0;
+	size_t i = 0;
+
+	for (i = 0; i < RING_REQUESTS; ++i)
+	{
+		sprintf(exprs[i], "%lu * 2.5 + (%lu - 3) / 4", (unsigned long)i,
+		        (unsigned long)(i % 1000));
+	}
+
+	printf("ring - round trips to an evaluator process, against Calculate "
+	       "in this one:\n\n");
+
+	for (i = 0; i < RING_REQUESTS; ++i)
+	{
+		start = GetTimeNs();
+		g_sink += Calculate(exprs[i]).result;
+		latencies[i] = GetTimeNs() - start;
+	}
+	PrintLatencies("Calculate", latencies, RING_REQUESTS);
+
+	/* the evaluator sleeps between requests - every one a futex wake */
+	MeasureRing(exprs, 0, latencies);
+
+	/* polling needs a core for each side - on one, they take turns by
+	   the scheduler's time slice */
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+	{
+		printf("%-28s  skipped - one CPU\n", "ring, polling");
+		return;
+	}
+	MeasureRing(exprs, RING_POLL_SPINS, latencies);
+}
+
+/* the evaluator in a child process, 'spins' rounds of polling when idle */
+static void MeasureRing(char (*exprs)[EXPR_CHARS], size_t spins,
+                        double *latencies)
+{
+	calc_ring_t *ring = NULL;
+	calc_ring_t *child_ring = NULL;
+	unsigned int tickets[RING_BATCH] = {0};
+	const char *mode = (0 == spins) ? "futex" : "polling";
+	char name[64] = {0};
+	double start = 0;
+	pid_t child = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	ring = CalcRingCreate(RING_PATH, RING_BATCH, EXPR_CHARS, CALC_RING_SPSC);
+	if (NULL == ring)
+	{
+		printf("can't create %s\n", RING_PATH);
+		return;
+	}
+
+	fflush(stdout);
+	child = fork();
+	if (0 == child)
+	{
+		child_ring = CalcRingOpen(RING_PATH);
+		if (NULL != child_ring)
+		{
+			CalcRingRun(child_ring, spins);
+		}
+		_exit(NULL == child_ring);
+	}
+
+	for (i = 0; i < RING_REQUESTS && 0 < child; ++i)
+	{
+		start = GetTimeNs();
+		g_sink += CalcRingCalcN(ring, exprs[i], strlen(exprs[i])).result;
+		latencies[i] = GetTimeNs() - start;
+	}
+	sprintf(name, "ring, %s", mode);
+	PrintLatencies(name, latencies, i);
+
+	/* a batch in flight - the evaluator answers while more are written */
+	start = GetTimeNs();
+	for (i = 0; i + RING_BATCH <= RING_REQUESTS && 0 < child; i += RING_BATCH)
+	{
+		for (j = 0; j < RING_BATCH; ++j)
+		{
+			CalcRingSubmit(ring, exprs[i + j], strlen(exprs[i + j]),
+			               &tickets[j]);
+		}
+		for (j = 0; j < RING_BATCH; ++j)
+		{
+			g_sink += CalcRingWait(ring, tickets[j]).result;
+		}
+	}
+	printf("%-28s  %8.1f ns/expr\n", strcat(name, ", batched"),
+	       (GetTimeNs() - start) / RING_REQUESTS);
+
+	CalcRingStop(ring);
+	if (0 < child)
+	{
+		waitpid(child, NULL, 0);
+	}
+	CalcRingClose(ring);
+}
+
+static void PrintLatencies(const char *name, double *latencies, size_t n)
+{
+	double total_ns = 0;
+	size_t i = 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		total_ns += latencies[i];
+	}
+	qsort(latencies, n, sizeof(double), CompareDoubles);
+
+	printf("%-28s  %8.1f ns/expr  p50 %8.1f  p99 %8.1f  p99.9 %8.1f\n",
+	       name, total_ns / n, latencies[n / 2], latencies[n * 99 / 100],
+	       latencies[n * 999 / 1000]);
+}
+
+
+/************************ FormulasBench ***************************************/
+void FormulasBench(void)
+{
+	static char exprs[FORMULA_WIDTH][EXPR_CHARS];
+	calc_formulas_t *formulas = CalcFormulasCreate();
+	calc_pool_t *pool = CalcPoolCreate(FORMULA_THREADS);
+	char name[32] = {0};
+	char expr[64] = {0};
+	size_t evaluated = 0;
+	size_t layer = 0;
+	double start = 0;
+	double ns = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	if (NULL == formulas || NULL == pool)
+	{
+		printf("no memory for the formulas\n");
+		CalcPoolDestroy(pool);
+		CalcFormulasDestroy(formulas);
+		return;
+	}
+
+	printf("formulas - %d nodes, %d inputs and %d layers of formulas "
+	       "using 2 of the layer before:\n\n", FORMULA_WIDTH * FORMULA_LAYERS,
+	       FORMULA_WIDTH, FORMULA_LAYERS - 1);
+
+	srand(1);
+	start = GetTimeNs();
+	for (j = 0; j < FORMULA_WIDTH; ++j)
+	{
+		sprintf(name, "n0_%lu", (unsigned long)j);
+		CalcFormulasSet(formulas, name, rand() % 100);
+	}
+	for (layer = 1; layer < FORMULA_LAYERS; ++layer)
+	{
+		for (j = 0; j < FORMULA_WIDTH; ++j)
+		{
+			sprintf(name, "n%lu_%lu", (unsigned long)layer, (unsigned long)j);
+			sprintf(expr, "n%lu_%lu * 0.5 + n%lu_%lu / 4 - 1",
+			        (unsigned long)layer - 1, (unsigned long)j,
+			        (unsigned long)layer - 1,
+			        (unsigned long)(j + 1) % FORMULA_WIDTH);
+			CalcFormulasDefine(formulas, name, expr);
+		}
+	}
+	printf("%-36s  %10.1f ms\n", "define", (GetTimeNs() - start) / 1e6);
+
+	/* all of them - the first time, then after a change to every input */
+	start = GetTimeNs();
+	evaluated = CalcFormulasRecalc(formulas, NULL);
+	ns = GetTimeNs() - start;
+	printf("%-36s  %10.1f ms  %6.1f ns/formula\n", "first recalc",
+	       ns / 1e6, ns / evaluated);
+
+	for (i = 0; i < 2; ++i)
+	{
+		for (j = 0; j < FORMULA_WIDTH; ++j)
+		{
+			sprintf(name, "n0_%lu", (unsigned long)j);
+			CalcFormulasSet(formulas, name, rand() % 100);
+		}
+		start = GetTimeNs();
+		evaluated = CalcFormulasRecalc(formulas, (0 == i) ? NULL : pool);
+		ns = GetTimeNs() - start;
+		printf("%-36s  %10.1f ms  %6.1f ns/formula\n",
+		       (0 == i) ? "recalc all" : "recalc all, pool of 4",
+		       ns / 1e6, ns / evaluated);
+	}
+
+	/* what every update costs without the graph - a layer's expressions
+	   with the values in place of the names, parsed again each time */
+	for (j = 0; j < FORMULA_WIDTH; ++j)
+	{
+		sprintf(exprs[j], "%d * 0.5 + %d / 4 - 1", rand() % 100, rand() % 100);
+	}
+	start = GetTimeNs();
+	for (layer = 1; layer < FORMULA_LAYERS; ++layer)
+	{
+		for (j = 0; j < FORMULA_WIDTH; ++j)
+		{
+			g_sink += Calculate(exprs[j]).result;
+		}
+	}
+	ns = GetTimeNs() - start;
+	printf("%-36s  %10.1f ms  %6.1f ns/formula\n", "Calculate every formula",
+	       ns / 1e6, ns / ((FORMULA_LAYERS - 1) * FORMULA_WIDTH));
+
+	/* a single input at a time - only its cone downstream is evaluated */
+	evaluated = 0;
+	start = GetTimeNs();
+	for (i = 0; i < FORMULA_UPDATES; ++i)
+	{
+		sprintf(name, "n0_%lu", (unsigned long)(rand() % FORMULA_WIDTH));
+		CalcFormulasSet(formulas, name, 100 + i);
+		evaluated += CalcFormulasRecalc(formulas, NULL);
+	}
+	ns = GetTimeNs() - start;
+	printf("%-36s  %10.1f us  %6.0f formulas evaluated\n",
+	       "update one input", ns / FORMULA_UPDATES / 1e3,
+	       (double)evaluated / FORMULA_UPDATES);
+
+	sprintf(name, "n%d_0", FORMULA_LAYERS - 1);
+	g_sink += CalcFormulasGet(formulas, name).result;
+
+	CalcPoolDestroy(pool);
+	CalcFormulasDestroy(formulas);
+}
+
+
+/************************ StressBench *****************************************/
+void StressBench(size_t max_bytes)
+{
+	const char unit[] = "(12.5*3-(4/2+1))+";
+	char *str = NULL;
+	size_t size = 0;
+	size_t len = 0;
+	size_t depth = 0;
+	double flat_ns = 0;
+	double flat_allocs = 0;
+	double nested_ns = 0;
+	double nested_allocs = 0;
+
+	printf("stress - flat '(12.5*3-(4/2+1))+...' and nested '((((1))))', "
+	       "CalcN (ns/byte, allocations/call):\n\n");
+
+	str = (char *)malloc(max_bytes);
+	if (NULL == str)
+	{
+		printf("no memory for %lu bytes\n", (unsigned long)max_bytes);
+		return;
+	}
+
+	for (size = STRESS_MIN_BYTES; size <= max_bytes; size *= 4)
+	{
+		/* flat - 17 chars a unit, nesting 2 */
+		for (len = 0; len + sizeof(unit) <= size; len += sizeof(unit) - 1)
+		{
+			memcpy(str + len, unit, sizeof(unit) - 1);
+		}
+		str[len++] = '0';
+		StressMeasure(str, len, &flat_ns, &flat_allocs);
+
+		/* nested - as deep as the size allows */
+		depth = (size - 1) / 2;
+		memset(str, '(', depth);
+		str[depth] = '1';
+		memset(str + depth + 1, ')', depth);
+		StressMeasure(str, 2 * depth + 1, &nested_ns, &nested_allocs);
+
+		printf("%10lu bytes  flat %6.2f ns/B %6.1f allocs  "
+		       "nested %6.2f ns/B %6.1f allocs\n", (unsigned long)size,
+		       flat_ns, flat_allocs, nested_ns, nested_allocs);
+	}
+
+	free(str);
+}
+
+static void StressMeasure(const char *str, size_t len, double *ns_per_byte,
+                          double *allocs_per_call)
+{
+	size_t rounds = (STRESS_BYTES_PER_SIZE > len) ?
+	                STRESS_BYTES_PER_SIZE / len : 1;
+	size_t allocs = g_alloc_count;
+	double start = GetTimeNs();
+	size_t i = 0;
+
+	for (i = 0; i < rounds; ++i)
+	{
+		g_sink += CalcN(str, len).result;
+	}
+
+	*ns_per_byte = (GetTimeNs() - start) / (rounds * len);
+	*allocs_per_call = (double)(g_alloc_count - allocs) / rounds;
+}
@@ -0,0 +1,518 @@
+/*******************************************************************************
+*	Filename	:	calc_bundle.c
+*	Developer	:	Eyal Weizman
+*	Description	:	bundle files of compiled programs - written once, then
+*					mapped and evaluated in place
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <stdio.h>		/* fdopen, fwrite, fflush, fclose, rename */
+#include <stdlib.h>		/* malloc, calloc, free, mkstemp */
+#include <string.h>		/* memcpy, memcmp, strlen, strcpy, strcat, memchr */
+#include <stdint.h>		/* uint32_t, uint64_t */
+#include <fcntl.h>		/* open */
+#include <unistd.h>		/* close, fsync, unlink */
+#include <sys/stat.h>	/* fstat, fchmod */
+#include <sys/mman.h>	/* mmap, madvise, munmap */
+
+#include "calc_bundle.h"
+#include "calc_prog.h"
+
+/******************************* MACROS ***************************************/
+#define MAGIC "CALCBNDL"
+#define MAGIC_LEN 8
+
+/* read back as another number on a machine of the other byte order */
+#define BYTE_ORDER_MARK 0x01020304u
+
+/* every section starts on a multiple of this - the instructions are read
+   in place, and the checksum reads 8 bytes at a time */
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+/* 64-bit FNV-1a, on words instead of bytes */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*************************** structs & typedefs *******************************/
+/* the file starts with a header, then an index entry per program, then the
+   instructions of all the programs, then their variable names */
+typedef struct file_header_s
+{
+	char magic[MAGIC_LEN];
+	uint64_t checksum;		/* of all that follows it - the rest of the
+							   header too */
+	uint32_t version;		/* CALC_BUNDLE_VERSION */
+	uint32_t byte_order;	/* BYTE_ORDER_MARK */
+	uint64_t count;			/* programs */
+	uint64_t size;			/* of the whole file */
+}file_header_t;
+
+typedef struct file_program_s
+{
+	uint64_t code;			/* offset of the instructions */
+	uint64_t length;		/* instructions */
+	uint64_t names;			/* offset of the names - 'var_count' strings,
+							   NUL-terminated, one after the other */
+	uint64_t var_count;
+}file_program_t;
+
+struct calc_bundle_s
+{
+	const unsigned char *map;
+	size_t size;
+	size_t count;
+	calc_program_t *programs;	/* views of the mapped programs */
+	char **names;				/* the var_names of all of them */
+};
+
+/* the checksummed part of the file */
+#define CHECKED_START (MAGIC_LEN + sizeof(uint64_t))
+
+/* the instructions are written as they are in memory */
+_Static_assert(16 == sizeof(calc_instr_t) &&
+               0 == sizeof(file_header_t) % ALIGNMENT &&
+               0 == sizeof(file_program_t) % ALIGNMENT,
+               "the bundle layout assumes packed 8-byte aligned records");
+
+/************************* internal functions *********************************/
+static size_t NamesSize(const calc_program_t *program);
+static int WriteReplacing(const char *path, const unsigned char *image,
+                          size_t size);
+static int CheckHeader(const unsigned char *map, size_t size);
+static int MapPrograms(calc_bundle_t *bundle);
+static int CheckCode(const calc_instr_t *code, size_t length,
+                     size_t var_count, size_t *max_depth);
+static uint64_t Checksum(const unsigned char *data, size_t size);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcBundleWrite
+*******************************************************************************/
+int CalcBundleWrite(const char *path, const calc_program_t *const *programs,
+                    size_t count)
+{
+	file_header_t header = {"", 0, 0, 0, 0, 0};
+	file_program_t *index = NULL;
+	unsigned char *image = NULL;
+	size_t code_offset = 0;
+	size_t names_offset = 0;
+	size_t size = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t len = 0;
+	int ret_val = 0;
+
+	assert(path);
+	assert(programs || 0 == count);
+
+	/* the layout - the header and index, the code, the names */
+	size = sizeof(file_header_t) + count * sizeof(file_program_t);
+	for (i = 0; i < count; ++i)
+	{
+		size += programs[i]->length * sizeof(calc_instr_t);
+	}
+	names_offset = size;
+	for (i = 0; i < count; ++i)
+	{
+		size += NamesSize(programs[i]);
+	}
+
+	image = (unsigned char *)calloc(1, size);
+	if (NULL == image)
+	{
+		return (-1);
+	}
+
+	index = (file_program_t *)(image + sizeof(file_header_t));
+	code_offset = sizeof(file_header_t) + count * sizeof(file_program_t);
+	for (i = 0; i < count; ++i)
+	{
+		index[i].code = code_offset;
+		index[i].length = programs[i]->length;
+		index[i].names = names_offset;
+		index[i].var_count = programs[i]->var_count;
+
+		memcpy(image + code_offset, programs[i]->code,
+		       programs[i]->length * sizeof(calc_instr_t));
+		code_offset += programs[i]->length * sizeof(calc_instr_t);
+
+		for (j = 0; j < programs[i]->var_count; ++j)
+		{
+			len = strlen(programs[i]->var_names[j]) + 1;
+			memcpy(image + names_offset, programs[i]->var_names[j], len);
+			names_offset += len;
+		}
+		names_offset = ALIGN(names_offset);
+	}
+
+	memcpy(header.magic, MAGIC, MAGIC_LEN);
+	header.version = CALC_BUNDLE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.count = count;
+	header.size = size;
+	memcpy(image, &header, sizeof(file_header_t));
+	header.checksum = Checksum(image + CHECKED_START, size - CHECKED_START);
+	memcpy(image, &header, sizeof(file_header_t));
+
+	ret_val = WriteReplacing(path, image, size);
+
+	free(image);
+
+	return (ret_val);
+}
+
+
+/******************************************************************************
+*								CalcBundleOpen
+*******************************************************************************/
+calc_bundle_t *CalcBundleOpen(const char *path)
+{
+	calc_bundle_t *bundle = NULL;
+	struct stat file_stat = {0};
+	void *map = NULL;
+	int fd = -1;
+
+	assert(path);
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+	{
+		return (NULL);
+	}
+
+	if (0 != fstat(fd, &file_stat) ||
+	    (size_t)file_stat.st_size < sizeof(file_header_t))
+	{
+		close(fd);
+		return (NULL);
+	}
+
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map)
+	{
+		return (NULL);
+	}
+
+	/* it is all read by the checksum right away */
+	madvise(map, file_stat.st_size, MADV_WILLNEED);
+
+	bundle = (calc_bundle_t *)calloc(1, sizeof(calc_bundle_t));
+	if (NULL == bundle)
+	{
+		munmap(map, file_stat.st_size);
+		return (NULL);
+	}
+
+	bundle->map = (const unsigned char *)map;
+	bundle->size = file_stat.st_size;
+
+	if (0 != CheckHeader(bundle->map, bundle->size) ||
+	    0 != MapPrograms(bundle))
+	{
+		CalcBundleClose(bundle);
+		return (NULL);
+	}
+
+	return (bundle);
+}
+
+
+/******************************************************************************
+*								CalcBundleClose
+*******************************************************************************/
+void CalcBundleClose(calc_bundle_t *bundle)
+{
+	if (NULL == bundle)
+	{
+		return;
+	}
+
+	munmap((void *)bundle->map, bundle->size);
+	free(bundle->names);
+	free(bundle->programs);
+	free(bundle);
+}
+
+
+/******************************************************************************
+*								CalcBundleCount
+*******************************************************************************/
+size_t CalcBundleCount(const calc_bundle_t *bundle)
+{
+	assert(bundle);
+
+	return (bundle->count);
+}
+
+
+/******************************************************************************
+*								CalcBundleProgram
+*******************************************************************************/
+const calc_program_t *CalcBundleProgram(const calc_bundle_t *bundle,
+                                        size_t index)
+{
+	assert(bundle);
+
+	if (index >= bundle->count)
+	{
+		return (NULL);
+	}
+
+	return (bundle->programs + index);
+}
+
+
+/******************************************************************************
+*								NamesSize
+*******************************************************************************/
+static size_t NamesSize(const calc_program_t *program)
+{
+	size_t size = 0;
+	size_t i = 0;
+
+	for (i = 0; i < program->var_count; ++i)
+	{
+		size += strlen(program->var_names[i]) + 1;
+	}
+
+	return (ALIGN(size));
+}
+
+
+/******************************************************************************
+*								WriteReplacing
+*******************************************************************************/
+static int WriteReplacing(const char *path, const unsigned char *image,
+                          size_t size)
+{
+	char *temp_path = (char *)malloc(strlen(path) + sizeof(".XXXXXX"));
+	FILE *file = NULL;
+	int ret_val = 0;
+	int fd = -1;
+
+	if (NULL == temp_path)
+	{
+		return (-1);
+	}
+
+	/* a new file beside it, renamed over it once complete - a process that
+	   has the old bundle mapped keeps reading the old one, whole */
+	strcpy(temp_path, path);
+	strcat(temp_path, ".XXXXXX");
+	fd = mkstemp(temp_path);
+	file = (-1 == fd) ? NULL : fdopen(fd, "wb");
+	if (NULL == file)
+	{
+		if (-1 != fd)
+		{
+			close(fd);
+			unlink(temp_path);
+		}
+		free(temp_path);
+		return (-1);
+	}
+
+	if (0 != fchmod(fd, 0644) || size != fwrite(image, 1, size, file) ||
+	    0 != fflush(file) || 0 != fsync(fd))
+	{
+		ret_val = -1;
+	}
+	if (0 != fclose(file))
+	{
+		ret_val = -1;
+	}
+
+	if (0 != ret_val || 0 != rename(temp_path, path))
+	{
+		unlink(temp_path);
+		ret_val = -1;
+	}
+
+	free(temp_path);
+
+	return (ret_val);
+}
+
+
+/******************************************************************************
+*								CheckHeader
+*******************************************************************************/
+static int CheckHeader(const unsigned char *map, size_t size)
+{
+	file_header_t header = {"", 0, 0, 0, 0, 0};
+
+	memcpy(&header, map, sizeof(file_header_t));
+
+	if (0 != memcmp(header.magic, MAGIC, MAGIC_LEN) ||
+	    CALC_BUNDLE_VERSION != header.version ||
+	    BYTE_ORDER_MARK != header.byte_order ||
+	    size != header.size || 0 != size % ALIGNMENT)
+	{
+		return (-1);
+	}
+
+	/* every program has an index entry and an instruction at least */
+	if (header.count > (size - sizeof(file_header_t)) /
+	                   (sizeof(file_program_t) + sizeof(calc_instr_t)))
+	{
+		return (-1);
+	}
+
+	return ((header.checksum == Checksum(map + CHECKED_START,
+	                                     size - CHECKED_START)) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								MapPrograms
+*******************************************************************************/
+static int MapPrograms(calc_bundle_t *bundle)
+{
+	const file_program_t *index = NULL;
+	const char *name = NULL;
+	const char *end = (const char *)bundle->map + bundle->size;
+	calc_program_t *program = NULL;
+	char **names = NULL;
+	size_t total_vars = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	bundle->count = ((const file_header_t *)bundle->map)->count;
+	index = (const file_program_t *)(bundle->map + sizeof(file_header_t));
+
+	/* a name takes 2 bytes at least - a char and its NUL */
+	for (i = 0; i < bundle->count; ++i)
+	{
+		if (index[i].var_count > bundle->size / 2)
+		{
+			return (-1);
+		}
+		total_vars += index[i].var_count;
+	}
+
+	bundle->programs = (calc_program_t *)calloc(bundle->count + 1,
+	                                            sizeof(calc_program_t));
+	bundle->names = (char **)malloc((total_vars + 1) * sizeof(char *));
+	if (NULL == bundle->programs || NULL == bundle->names)
+	{
+		return (-1);
+	}
+
+	names = bundle->names;
+	for (i = 0; i < bundle->count; ++i)
+	{
+		program = bundle->programs + i;
+
+		if (0 != index[i].code % ALIGNMENT || index[i].code > bundle->size ||
+		    index[i].length > (bundle->size - index[i].code) /
+		                      sizeof(calc_instr_t) ||
+		    index[i].names > bundle->size)
+		{
+			return (-1);
+		}
+
+		/* the names must end inside the file */
+		name = (const char *)bundle->map + index[i].names;
+		for (j = 0; j < index[i].var_count; ++j)
+		{
+			if (name >= end || '\0' == *name)
+			{
+				return (-1);
+			}
+			names[j] = (char *)name;
+			name = (const char *)memchr(name, '\0', end - name);
+			if (NULL == name)
+			{
+				return (-1);
+			}
+			++name;
+		}
+
+		program->code = (calc_instr_t *)(bundle->map + index[i].code);
+		program->length = index[i].length;
+		program->capacity = index[i].length;
+		program->var_names = names;
+		program->var_count = index[i].var_count;
+		program->var_capacity = index[i].var_count;
+		names += index[i].var_count;
+
+		if (0 != CheckCode(program->code, program->length,
+		                   program->var_count, &program->max_depth))
+		{
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								CheckCode
+*******************************************************************************/
+static int CheckCode(const calc_instr_t *code, size_t length,
+                     size_t var_count, size_t *max_depth)
+{
+	size_t depth = 0;
+	size_t i = 0;
+	int arity = 0;
+
+	/* CalcEval trusts the program - every pop has a value to pop, and its
+	   stack is max_depth deep. both are found here, not read from the file */
+	*max_depth = 0;
+	for (i = 0; i < length; ++i)
+	{
+		switch (code[i].opcode)
+		{
+			case OPC_VAR:
+				if (code[i].arg >= var_count)
+				{
+					return (-1);
+				}
+				/* fall through */
+			case OPC_CONST:
+				++depth;
+				*max_depth = (depth > *max_depth) ? depth : *max_depth;
+				break;
+
+			default:
+				arity = ProgramArity(code[i].opcode);
+				if (arity < 0 || depth < (size_t)arity)
+				{
+					return (-1);
+				}
+				depth -= arity - 1;
+				break;
+		}
+	}
+
+	return ((1 == depth) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								Checksum
+*******************************************************************************/
+static uint64_t Checksum(const unsigned char *data, size_t size)
+{
+	uint64_t hash = FNV_OFFSET;
+	uint64_t word = 0;
+	size_t i = 0;
+
+	assert(0 == size % ALIGNMENT);
+
+	/* the high half is folded back, so a change high in a word reaches
+	   the low bits of the hash too */
+	for (i = 0; i < size; i += sizeof(uint64_t))
+	{
+		memcpy(&word, data + i, sizeof(uint64_t));
+		hash = (hash ^ word) * FNV_PRIME;
+		hash ^= hash >> 32;
+	}
+
+	return (hash);
+}
@@ -0,0 +1,87 @@
+/*****************************************************************************
+ *  File name  : calc_bundle.h
+ *  Developer  : Eyal Weizman
+ *	Description: compiled programs saved to a file and mapped back
+ *****************************************************************************/
+
+#ifndef __CALC_BUNDLE_H__
+#define __CALC_BUNDLE_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* version of the bundle file format - a file of another version isn't
+   opened. bumped on every change of the layout */
+#define CALC_BUNDLE_VERSION 1
+
+/* opaque handle of an open bundle */
+typedef struct calc_bundle_s calc_bundle_t;
+
+/*********************************** CalcBundleWrite *************************/
+/*	Description      :	Writes 'count' compiled programs to the file 'path'
+ *	                  	(replacing it), in the bundle format:
+ *	                  	a header (magic, version, byte order, size and a
+ *	                  	checksum of the rest), an index of the programs,
+ *	                  	their instructions and their variable names. the
+ *	                  	instructions are laid out as in memory, so an open
+ *	                  	bundle evaluates them where they are mapped.
+ *
+ *	                  	the file is in the byte order of the machine that
+ *	                  	wrote it - another byte order isn't opened.
+ *
+ *	                  	the bundle is written to a new file in the same
+ *	                  	directory and renamed over 'path' - processes that
+ *	                  	have the old one open keep it, unchanged.
+ *
+ *	Input            :	programs - returned by CalcCompile (optimized or
+ *	                  	not) or by CalcBundleProgram.
+ *
+ *	Return Values    :	0 in case of success, -1 if the file can't be
+ *	                  	written or memory can't be allocated.
+ *
+ *	Time Complexity  : O(n) - n is the total length of the programs
+ */
+int CalcBundleWrite(const char *path, const calc_program_t *const *programs,
+                    size_t count);
+
+/*********************************** CalcBundleOpen **************************/
+/*	Description      :	Maps the bundle file 'path' into memory - nothing
+ *	                  	is parsed or copied. the file is checked whole
+ *	                  	before any program is handed out: its magic,
+ *	                  	version, byte order, size and checksum, and every
+ *	                  	program - its instructions, variable slots and the
+ *	                  	depth of its evaluation stack - so a damaged file
+ *	                  	can't make CalcEval read out of bounds.
+ *
+ *	Return Values    :	the bundle, or NULL if the file can't be read or
+ *	                  	fails any of the checks.
+ *
+ *	Time Complexity  : O(file size) - a page-in and a checksum
+ */
+calc_bundle_t *CalcBundleOpen(const char *path);
+
+/*********************************** CalcBundleClose *************************/
+/*	Description      :	Unmaps the bundle. its programs can't be used from
+ *	                  	then on. NULL is allowed and ignored.
+ */
+void CalcBundleClose(calc_bundle_t *bundle);
+
+/*********************************** CalcBundleCount *************************/
+/*	Description      :	Returns the number of programs in the bundle.
+ */
+size_t CalcBundleCount(const calc_bundle_t *bundle);
+
+/*********************************** CalcBundleProgram ***********************/
+/*	Description      :	Returns program 'index' of the bundle (in the
+ *	                  	order they were written), or NULL if index >=
+ *	                  	CalcBundleCount. it is read-only and owned by the
+ *	                  	bundle - evaluated by CalcEval / CalcEvalBatch,
+ *	                  	never passed to CalcProgramDestroy or CalcOptimize.
+ *
+ *	Time Complexity  : O(1)
+ */
+const calc_program_t *CalcBundleProgram(const calc_bundle_t *bundle,
+                                        size_t index);
+
+#endif     /* __CALC_BUNDLE_H__ */
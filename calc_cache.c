@@ -0,0 +1,400 @@
+/*******************************************************************************
+*	Filename	:	calc_cache.c
+*	Developer	:	Eyal Weizman
+*	Description	:	result cache - sharded hash tables with CLOCK eviction
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* strlen, memcmp, memcpy */
+#include <stdint.h>		/* uint64_t */
+#include <pthread.h>	/* pthread_mutex_t */
+#include <stdatomic.h>	/* atomic_ulong */
+
+#include "calc_cache.h"
+#include "calc_lex.h"
+
+/******************************* MACROS ***************************************/
+#define CACHE_LINE 64
+
+/* a lock per shard - up to this many threads rarely meet on one */
+#define MAX_SHARDS 16
+
+/* smaller shards would evict by the luck of the hash, not by use */
+#define MIN_SHARD_ENTRIES 64
+
+/* longer normalized inputs are calculated, not cached */
+#define MAX_KEY 112
+
+#define NO_ENTRY ((size_t)-1)
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*************************** structs & typedefs *******************************/
+typedef struct entry_s
+{
+	uint64_t hash;
+	size_t next;				/* next entry of the bucket, or NO_ENTRY */
+	result_t result;
+	unsigned char is_referenced;/* used since the clock hand last passed */
+	unsigned char key_len;
+	char key[MAX_KEY];			/* the normalized input */
+}entry_t;
+
+typedef struct shard_s
+{
+	_Alignas(CACHE_LINE) pthread_mutex_t lock;
+	entry_t *entries;
+	size_t *buckets;			/* first entry of each bucket, or NO_ENTRY */
+	size_t bucket_mask;
+	size_t capacity;			/* entries */
+	size_t count;				/* entries in use - the first 'count' */
+	size_t hand;				/* the CLOCK hand */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+}shard_t;
+
+struct calc_cache_s
+{
+	shard_t *shards;
+	size_t n_shards;			/* a power of 2 */
+	atomic_ulong bypasses;
+};
+
+/************************* internal functions *********************************/
+static int ShardInit(shard_t *shard, size_t capacity);
+static void ShardDestroy(shard_t *shard);
+static size_t Find(const shard_t *shard, uint64_t hash, const char *key,
+                   size_t key_len);
+static void Insert(shard_t *shard, uint64_t hash, const char *key,
+                   size_t key_len, result_t result);
+static size_t Evict(shard_t *shard);
+static uint64_t Hash(const char *key, size_t key_len);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcCacheCreate
+*******************************************************************************/
+calc_cache_t *CalcCacheCreate(size_t capacity)
+{
+	calc_cache_t *cache = NULL;
+	size_t n_shards = 1;
+	size_t i = 0;
+
+	if (0 == capacity)
+	{
+		return (NULL);
+	}
+
+	/* small caches get fewer shards */
+	while (n_shards < MAX_SHARDS &&
+	       n_shards * 2 * MIN_SHARD_ENTRIES <= capacity)
+	{
+		n_shards *= 2;
+	}
+
+	cache = (calc_cache_t *)malloc(sizeof(calc_cache_t));
+	if (NULL == cache)
+	{
+		return (NULL);
+	}
+
+	cache->shards = (shard_t *)aligned_alloc(CACHE_LINE,
+	                                         n_shards * sizeof(shard_t));
+	if (NULL == cache->shards)
+	{
+		free(cache);
+		return (NULL);
+	}
+
+	cache->n_shards = n_shards;
+	atomic_init(&cache->bypasses, 0);
+
+	for (i = 0; i < n_shards; ++i)
+	{
+		if (0 != ShardInit(cache->shards + i,
+		                   (capacity + n_shards - 1) / n_shards))
+		{
+			cache->n_shards = i;
+			CalcCacheDestroy(cache);
+			return (NULL);
+		}
+	}
+
+	return (cache);
+}
+
+
+/******************************************************************************
+*								CalcCacheDestroy
+*******************************************************************************/
+void CalcCacheDestroy(calc_cache_t *cache)
+{
+	size_t i = 0;
+
+	if (NULL == cache)
+	{
+		return;
+	}
+
+	for (i = 0; i < cache->n_shards; ++i)
+	{
+		ShardDestroy(cache->shards + i);
+	}
+
+	free(cache->shards);
+	free(cache);
+}
+
+
+/******************************************************************************
+*								CalcCacheCalculate
+*******************************************************************************/
+result_t CalcCacheCalculate(calc_cache_t *cache, const char *str)
+{
+	assert(str);
+
+	return (CalcCacheCalcN(cache, str, strlen(str)));
+}
+
+
+/******************************************************************************
+*								CalcCacheCalcN
+*******************************************************************************/
+result_t CalcCacheCalcN(calc_cache_t *cache, const char *str, size_t len)
+{
+	char key[MAX_KEY];
+	shard_t *shard = NULL;
+	result_t result = {0};
+	uint64_t hash = 0;
+	size_t key_len = 0;
+	size_t entry = 0;
+
+	assert(cache);
+	assert(str || 0 == len);
+
+	key_len = LexNormalize(str, len, key, MAX_KEY);
+	if (LEX_TOO_LONG == key_len)
+	{
+		atomic_fetch_add(&cache->bypasses, 1);
+		return (CalcN(str, len));
+	}
+
+	hash = Hash(key, key_len);
+	shard = cache->shards + (hash & (cache->n_shards - 1));
+
+	pthread_mutex_lock(&shard->lock);
+	entry = Find(shard, hash, key, key_len);
+	if (NO_ENTRY != entry)
+	{
+		shard->entries[entry].is_referenced = 1;
+		result = shard->entries[entry].result;
+		++(shard->hits);
+		pthread_mutex_unlock(&shard->lock);
+
+		return (result);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	/* calculated outside the lock - other threads go on meanwhile */
+	result = CalcN(str, len);
+
+	pthread_mutex_lock(&shard->lock);
+	Insert(shard, hash, key, key_len, result);
+	++(shard->misses);
+	pthread_mutex_unlock(&shard->lock);
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								CalcCacheGetStats
+*******************************************************************************/
+void CalcCacheGetStats(calc_cache_t *cache, calc_cache_stats_t *stats)
+{
+	shard_t *shard = NULL;
+	size_t i = 0;
+
+	assert(cache);
+	assert(stats);
+
+	memset(stats, 0, sizeof(calc_cache_stats_t));
+	stats->bypasses = atomic_load(&cache->bypasses);
+
+	for (i = 0; i < cache->n_shards; ++i)
+	{
+		shard = cache->shards + i;
+
+		pthread_mutex_lock(&shard->lock);
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->entries += shard->count;
+		stats->capacity += shard->capacity;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+
+/******************************************************************************
+*								ShardInit
+*******************************************************************************/
+static int ShardInit(shard_t *shard, size_t capacity)
+{
+	size_t n_buckets = 1;
+	size_t i = 0;
+
+	/* about 2 buckets per entry - short chains */
+	while (n_buckets < 2 * capacity)
+	{
+		n_buckets *= 2;
+	}
+
+	shard->entries = (entry_t *)malloc(capacity * sizeof(entry_t));
+	shard->buckets = (size_t *)malloc(n_buckets * sizeof(size_t));
+	if (NULL == shard->entries || NULL == shard->buckets)
+	{
+		free(shard->entries);
+		free(shard->buckets);
+		return (-1);
+	}
+
+	for (i = 0; i < n_buckets; ++i)
+	{
+		shard->buckets[i] = NO_ENTRY;
+	}
+
+	pthread_mutex_init(&shard->lock, NULL);
+	shard->bucket_mask = n_buckets - 1;
+	shard->capacity = capacity;
+	shard->count = 0;
+	shard->hand = 0;
+	shard->hits = 0;
+	shard->misses = 0;
+	shard->evictions = 0;
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								ShardDestroy
+*******************************************************************************/
+static void ShardDestroy(shard_t *shard)
+{
+	pthread_mutex_destroy(&shard->lock);
+	free(shard->buckets);
+	free(shard->entries);
+}
+
+
+/******************************************************************************
+*								Find
+*******************************************************************************/
+static size_t Find(const shard_t *shard, uint64_t hash, const char *key,
+                   size_t key_len)
+{
+	const entry_t *entry = NULL;
+	size_t i = shard->buckets[(hash >> 32) & shard->bucket_mask];
+
+	for (; NO_ENTRY != i; i = entry->next)
+	{
+		entry = shard->entries + i;
+		if (entry->hash == hash && entry->key_len == key_len &&
+		    0 == memcmp(entry->key, key, key_len))
+		{
+			return (i);
+		}
+	}
+
+	return (NO_ENTRY);
+}
+
+
+/******************************************************************************
+*								Insert
+*******************************************************************************/
+static void Insert(shard_t *shard, uint64_t hash, const char *key,
+                   size_t key_len, result_t result)
+{
+	entry_t *entry = NULL;
+	size_t *bucket = NULL;
+	size_t i = 0;
+
+	/* another thread missed on it too, and was first */
+	if (NO_ENTRY != Find(shard, hash, key, key_len))
+	{
+		return;
+	}
+
+	i = (shard->count < shard->capacity) ? (shard->count)++ : Evict(shard);
+
+	entry = shard->entries + i;
+	entry->hash = hash;
+	entry->result = result;
+	entry->is_referenced = 0;
+	entry->key_len = (unsigned char)key_len;
+	memcpy(entry->key, key, key_len);
+
+	bucket = shard->buckets + ((hash >> 32) & shard->bucket_mask);
+	entry->next = *bucket;
+	*bucket = i;
+}
+
+
+/******************************************************************************
+*								Evict
+*******************************************************************************/
+static size_t Evict(shard_t *shard)
+{
+	entry_t *victim = NULL;
+	size_t *link = NULL;
+	size_t i = 0;
+
+	/* CLOCK - a used entry gets a second chance, the first unused one goes */
+	while (shard->entries[shard->hand].is_referenced)
+	{
+		shard->entries[shard->hand].is_referenced = 0;
+		shard->hand = (shard->hand + 1) % shard->capacity;
+	}
+
+	i = shard->hand;
+	victim = shard->entries + i;
+	shard->hand = (shard->hand + 1) % shard->capacity;
+
+	/* unlinks it from its bucket */
+	link = shard->buckets + ((victim->hash >> 32) & shard->bucket_mask);
+	while (*link != i)
+	{
+		link = &shard->entries[*link].next;
+	}
+	*link = victim->next;
+
+	++(shard->evictions);
+
+	return (i);
+}
+
+
+/******************************************************************************
+*								Hash
+*******************************************************************************/
+static uint64_t Hash(const char *key, size_t key_len)
+{
+	uint64_t hash = FNV_OFFSET;
+	size_t i = 0;
+
+	for (i = 0; i < key_len; ++i)
+	{
+		hash ^= (unsigned char)key[i];
+		hash *= FNV_PRIME;
+	}
+
+	return (hash);
+}
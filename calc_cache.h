@@ -0,0 +1,66 @@
+/*****************************************************************************
+ *  File name  : calc_cache.h
+ *  Developer  : Eyal Weizman
+ *	Description: bounded, thread-safe cache of calculation results
+ *****************************************************************************/
+
+#ifndef __CALC_CACHE_H__
+#define __CALC_CACHE_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* opaque handle of a result cache */
+typedef struct calc_cache_s calc_cache_t;
+
+/* counters of a cache, since its creation */
+typedef struct calc_cache_stats_s
+{
+	unsigned long hits;			/* results returned from the cache */
+	unsigned long misses;		/* results calculated and then cached */
+	unsigned long evictions;	/* entries dropped to make room */
+	unsigned long bypasses;		/* inputs too long to be cached */
+	size_t entries;				/* results in the cache now */
+	size_t capacity;			/* results the cache can hold */
+}calc_cache_stats_t;
+
+/*********************************** CalcCacheCreate *************************/
+/*	Description      :	Creates a cache of up to 'capacity' results.
+ *	                  	inputs are keyed by their whitespace-normalized text,
+ *	                  	so "3+5" and " 3 + 5 " share an entry. when full,
+ *	                  	an entry not used lately is evicted (CLOCK).
+ *
+ *	Return Values    :	the cache, or NULL on failure (capacity == 0 is a
+ *	                  	failure).
+ */
+calc_cache_t *CalcCacheCreate(size_t capacity);
+
+/*********************************** CalcCacheDestroy ************************/
+/*	Description      :	Releases the cache. NULL is allowed and ignored.
+ */
+void CalcCacheDestroy(calc_cache_t *cache);
+
+/********************************* CalcCacheCalculate ************************/
+/*	Description      :	Calculate(str), through the cache - a repeated
+ *	                  	input is not parsed again. errors are cached too.
+ *	                  	may be called from several threads at once - the
+ *	                  	cache is split into shards with a lock each.
+ *
+ *	Return Values    :	as Calculate.
+ *
+ *	Time Complexity  : O(n) - n is the length of 'str' - on a hit as well
+ */
+result_t CalcCacheCalculate(calc_cache_t *cache, const char *str);
+
+/*********************************** CalcCacheCalcN **************************/
+/*	Description      :	CalcN(str, len), through the cache.
+ */
+result_t CalcCacheCalcN(calc_cache_t *cache, const char *str, size_t len);
+
+/********************************* CalcCacheGetStats *************************/
+/*	Description      :	Fills 'stats' with the counters of the cache.
+ */
+void CalcCacheGetStats(calc_cache_t *cache, calc_cache_stats_t *stats);
+
+#endif     /* __CALC_CACHE_H__ */
@@ -0,0 +1,460 @@
+/******************************************************************************
+*	Filename	:	calc_client.c
+*	Developer	:	Eyal Weizman
+*	Description	:	load generator of the evaluation daemon - throughput and
+*					tail latency of pipelined, batched expressions
+*******************************************************************************/
+#include <stdio.h> 		/* printf, sprintf */
+#include <stdlib.h> 	/* malloc, free, strtoul, qsort, rand */
+#include <string.h>     /* strcmp, strcpy, strlen, memcpy */
+#include <errno.h>      /* errno */
+#include <time.h>     	/* clock_gettime */
+#include <unistd.h>     /* read, close */
+#include <fcntl.h>      /* fcntl */
+#include <poll.h>       /* poll */
+#include <pthread.h>    /* pthread_create, pthread_join */
+#include <sys/socket.h> /* socket, connect, send */
+#include <sys/un.h>     /* sockaddr_un */
+#include <netinet/in.h> /* sockaddr_in */
+#include <netinet/tcp.h>/* TCP_NODELAY */
+#include <arpa/inet.h>  /* htonl, htons */
+
+/******************************* MACROS ***************************************/
+#define NS_IN_SEC 1000000000.0
+#define NS_IN_USEC 1000.0
+
+#define DEFAULT_SOCKET "/tmp/calc.sock"
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_REQUESTS 1000000
+#define DEFAULT_BATCH 64
+#define DEFAULT_PIPELINE 4
+
+/* distinct batches, sent in turns */
+#define BATCH_VARIANTS 16
+#define EXPR_CHARS 48
+
+/* one in this many expressions is a division by zero */
+#define ERROR_EVERY 50
+
+#define READ_BUFFER (1 << 16)
+
+/*************************** structs & typedefs *******************************/
+typedef struct options_s
+{
+	const char *unix_path;
+	int use_tcp;
+	unsigned short tcp_port;
+	size_t connections;
+	size_t requests;		/* expressions, over all connections */
+	size_t batch;			/* expressions per write */
+	size_t pipeline;		/* batches written before their answers are read */
+}options_t;
+
+/* the load of a connection */
+typedef struct client_s
+{
+	pthread_t thread;
+	const options_t *options;
+	char *const *batches;	/* BATCH_VARIANTS texts */
+	size_t n_batches;		/* to send */
+	double *latencies;		/* ns, from writing a batch to its last answer */
+	size_t errors;			/* error answers */
+	int is_failed;
+}client_t;
+
+/************************* internal functions *********************************/
+static int ParseArgs(int argc, char *argv[], options_t *options);
+static char *MakeBatch(size_t lines);
+static void *RunClient(void *arg);
+static int Connect(const options_t *options);
+static int Exchange(client_t *client, int fd);
+static int CompareDoubles(const void *a, const void *b);
+static double GetTimeNs(void);
+
+
+/******************************************************************************
+*								main
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+	options_t options = {0};
+	char *batches[BATCH_VARIANTS] = {NULL};
+	client_t *clients = NULL;
+	double *latencies = NULL;
+	size_t n_latencies = 0;
+	size_t errors = 0;
+	size_t expressions = 0;
+	double start = 0;
+	double seconds = 0;
+	int is_failed = 0;
+	size_t i = 0;
+
+	options.connections = DEFAULT_CONNECTIONS;
+	options.requests = DEFAULT_REQUESTS;
+	options.batch = DEFAULT_BATCH;
+	options.pipeline = DEFAULT_PIPELINE;
+	if (0 != ParseArgs(argc - 1, argv + 1, &options) ||
+	    0 == options.connections || 0 == options.batch ||
+	    0 == options.pipeline)
+	{
+		fprintf(stderr, "usage: %s [--socket PATH | --tcp PORT] "
+		        "[--connections N] [--requests N] [--batch N] "
+		        "[--pipeline N]\n", argv[0]);
+		return (1);
+	}
+	if (NULL == options.unix_path && !options.use_tcp)
+	{
+		options.unix_path = DEFAULT_SOCKET;
+	}
+
+	// the same expressions on every run
+	srand(1);
+	for (i = 0; i < BATCH_VARIANTS; ++i)
+	{
+		batches[i] = MakeBatch(options.batch);
+		is_failed |= (NULL == batches[i]);
+	}
+
+	clients = (client_t *)calloc(options.connections, sizeof(client_t));
+	for (i = 0; NULL != clients && i < options.connections; ++i)
+	{
+		clients[i].options = &options;
+		clients[i].batches = batches;
+		clients[i].n_batches = (options.requests / options.connections +
+		                        options.batch - 1) / options.batch;
+		clients[i].n_batches += (0 == clients[i].n_batches);
+		clients[i].latencies = (double *)malloc(clients[i].n_batches *
+		                                        sizeof(double));
+		is_failed |= (NULL == clients[i].latencies);
+	}
+	if (NULL == clients || is_failed)
+	{
+		fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+
+	// a thread per connection, all at once
+	start = GetTimeNs();
+	for (i = 0; i < options.connections; ++i)
+	{
+		pthread_create(&clients[i].thread, NULL, RunClient, clients + i);
+	}
+	for (i = 0; i < options.connections; ++i)
+	{
+		pthread_join(clients[i].thread, NULL);
+	}
+	seconds = (GetTimeNs() - start) / NS_IN_SEC;
+
+	latencies = (double *)malloc(options.connections * clients[0].n_batches *
+	                             sizeof(double));
+	for (i = 0; NULL != latencies && i < options.connections; ++i)
+	{
+		is_failed |= clients[i].is_failed;
+		errors += clients[i].errors;
+		memcpy(latencies + n_latencies, clients[i].latencies,
+		       clients[i].n_batches * sizeof(double));
+		n_latencies += clients[i].n_batches;
+	}
+
+	if (NULL == latencies || is_failed || 0 == n_latencies)
+	{
+		fprintf(stderr, "the daemon didn't answer them all\n");
+		return (1);
+	}
+
+	qsort(latencies, n_latencies, sizeof(double), CompareDoubles);
+	expressions = n_latencies * options.batch;
+
+	printf("%lu connections, batches of %lu, %lu in flight\n",
+	       (unsigned long)options.connections, (unsigned long)options.batch,
+	       (unsigned long)options.pipeline);
+	printf("%lu expressions in %.3f s: %.0f expressions/s (%lu errors)\n",
+	       (unsigned long)expressions, seconds, expressions / seconds,
+	       (unsigned long)errors);
+	printf("batch round trip us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  "
+	       "max %.1f\n", latencies[n_latencies / 2] / NS_IN_USEC,
+	       latencies[n_latencies * 9 / 10] / NS_IN_USEC,
+	       latencies[n_latencies * 99 / 100] / NS_IN_USEC,
+	       latencies[n_latencies * 999 / 1000] / NS_IN_USEC,
+	       latencies[n_latencies - 1] / NS_IN_USEC);
+
+	for (i = 0; i < options.connections; ++i)
+	{
+		free(clients[i].latencies);
+	}
+	for (i = 0; i < BATCH_VARIANTS; ++i)
+	{
+		free(batches[i]);
+	}
+	free(latencies);
+	free(clients);
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								ParseArgs
+*******************************************************************************/
+static int ParseArgs(int argc, char *argv[], options_t *options)
+{
+	size_t number = 0;
+	char *end = NULL;
+	int i = 0;
+
+	// every option takes a value
+	for (i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == strcmp(argv[i], "--socket"))
+		{
+			options->unix_path = argv[i + 1];
+			continue;
+		}
+
+		number = strtoul(argv[i + 1], &end, 10);
+		if (end == argv[i + 1] || '\0' != *end)
+		{
+			return (-1);
+		}
+
+		if (0 == strcmp(argv[i], "--tcp") && number <= 0xFFFF)
+		{
+			options->use_tcp = 1;
+			options->tcp_port = (unsigned short)number;
+		}
+		else if (0 == strcmp(argv[i], "--connections"))
+		{
+			options->connections = number;
+		}
+		else if (0 == strcmp(argv[i], "--requests"))
+		{
+			options->requests = number;
+		}
+		else if (0 == strcmp(argv[i], "--batch"))
+		{
+			options->batch = number;
+		}
+		else if (0 == strcmp(argv[i], "--pipeline"))
+		{
+			options->pipeline = number;
+		}
+		else
+		{
+			return (-1);
+		}
+	}
+
+	return ((i == argc) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								MakeBatch
+*******************************************************************************/
+static char *MakeBatch(size_t lines)
+{
+	char *batch = (char *)malloc(lines * EXPR_CHARS + 1);
+	char *runner = batch;
+	size_t i = 0;
+
+	for (i = 0; NULL != batch && i < lines; ++i)
+	{
+		if (0 == rand() % ERROR_EVERY)
+		{
+			runner += sprintf(runner, "%d / 0\n", rand() % 100);
+			continue;
+		}
+
+		runner += sprintf(runner, "%d * (%d.5 + %d) - %d / 7 ^ 2\n",
+		                  rand() % 1000, rand() % 100, rand() % 100,
+		                  rand() % 1000);
+	}
+
+	return (batch);
+}
+
+
+/******************************************************************************
+*								RunClient
+*******************************************************************************/
+static void *RunClient(void *arg)
+{
+	client_t *client = (client_t *)arg;
+	int fd = Connect(client->options);
+
+	client->is_failed = (fd < 0 || 0 != Exchange(client, fd));
+
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+
+	return (NULL);
+}
+
+
+/******************************************************************************
+*								Connect
+*******************************************************************************/
+static int Connect(const options_t *options)
+{
+	struct sockaddr_un unix_address = {0};
+	struct sockaddr_in tcp_address = {0};
+	struct sockaddr *address = (struct sockaddr *)&unix_address;
+	socklen_t address_len = sizeof(unix_address);
+	int no_delay = 1;
+	int fd = -1;
+
+	if (options->use_tcp)
+	{
+		tcp_address.sin_family = AF_INET;
+		tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		tcp_address.sin_port = htons(options->tcp_port);
+		address = (struct sockaddr *)&tcp_address;
+		address_len = sizeof(tcp_address);
+	}
+	else if (strlen(options->unix_path) < sizeof(unix_address.sun_path))
+	{
+		unix_address.sun_family = AF_UNIX;
+		strcpy(unix_address.sun_path, options->unix_path);
+	}
+	else
+	{
+		return (-1);
+	}
+
+	fd = socket(address->sa_family, SOCK_STREAM, 0);
+	if (fd < 0 || 0 != connect(fd, address, address_len))
+	{
+		perror("connect");
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return (-1);
+	}
+
+	if (options->use_tcp)
+	{
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	}
+
+	// non-blocking - writing and reading take turns, as the socket allows
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return (fd);
+}
+
+
+/******************************************************************************
+*								Exchange
+*******************************************************************************/
+static int Exchange(client_t *client, int fd)
+{
+	static _Thread_local char buffer[READ_BUFFER];
+	const options_t *options = client->options;
+	double *sent_at = (double *)malloc(options->pipeline * sizeof(double));
+	struct pollfd poll_fd = {0};
+	const char *batch = NULL;
+	const char *runner = NULL;
+	const char *end = NULL;
+	size_t batch_len = 0;
+	size_t offset = 0;		/* of the batch being written */
+	size_t sent = 0;		/* batches written whole */
+	size_t done = 0;		/* batches answered whole */
+	size_t answers = 0;		/* lines of the next batch to be answered */
+	int is_line_start = 1;
+	ssize_t count = 0;
+
+	poll_fd.fd = fd;
+	while (NULL != sent_at && done < client->n_batches)
+	{
+		// up to 'pipeline' batches out before their answers come
+		poll_fd.events = POLLIN;
+		if (sent < client->n_batches && sent - done < options->pipeline)
+		{
+			poll_fd.events |= POLLOUT;
+		}
+
+		if (poll(&poll_fd, 1, -1) < 0 && EINTR != errno)
+		{
+			break;
+		}
+
+		if (poll_fd.revents & POLLOUT)
+		{
+			batch = client->batches[sent % BATCH_VARIANTS];
+			batch_len = strlen(batch);
+			if (0 == offset)
+			{
+				sent_at[sent % options->pipeline] = GetTimeNs();
+			}
+
+			count = send(fd, batch + offset, batch_len - offset, MSG_NOSIGNAL);
+			if (count < 0 && EAGAIN != errno && EINTR != errno)
+			{
+				break;
+			}
+			offset += (count > 0) ? count : 0;
+			if (offset == batch_len)
+			{
+				offset = 0;
+				++sent;
+			}
+		}
+
+		if (poll_fd.revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			count = read(fd, buffer, sizeof(buffer));
+			if (count <= 0 && !(count < 0 && EAGAIN == errno))
+			{
+				break;
+			}
+
+			// an answer a line - a batch is done with its last one
+			end = buffer + ((count > 0) ? count : 0);
+			for (runner = buffer; runner < end; ++runner)
+			{
+				client->errors += (is_line_start && 'A' <= *runner &&
+				                   'Z' >= *runner);
+				is_line_start = ('\n' == *runner);
+				if (is_line_start && options->batch == ++answers)
+				{
+					client->latencies[done] = GetTimeNs() -
+					                          sent_at[done % options->pipeline];
+					++done;
+					answers = 0;
+				}
+			}
+		}
+	}
+
+	free(sent_at);
+
+	return ((done == client->n_batches) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								CompareDoubles
+*******************************************************************************/
+static int CompareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+
+/******************************************************************************
+*								GetTimeNs
+*******************************************************************************/
+static double GetTimeNs(void)
+{
+	struct timespec now = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * NS_IN_SEC + now.tv_nsec);
+}
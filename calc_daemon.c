@@ -0,0 +1,205 @@
+/******************************************************************************
+*	Filename	:	calc_daemon.c
+*	Developer	:	Eyal Weizman
+*	Description	:	evaluation daemon - serves Calculate over local sockets
+*					and a shared-memory ring
+*******************************************************************************/
+#include <stdio.h> 		/* fprintf */
+#include <stdlib.h> 	/* strtoul */
+#include <string.h>     /* strcmp */
+#include <signal.h>     /* sigset_t, sigwait */
+#include <pthread.h>    /* pthread_sigmask, pthread_create */
+
+#include "calc_server.h"
+#include "calc_ring.h"
+
+/******************************* MACROS ***************************************/
+#define DEFAULT_SOCKET "/tmp/calc.sock"
+#define DEFAULT_WORKERS 4
+#define RING_CAPACITY 1024
+#define RING_MAX_LENGTH 1024
+#define RING_SPINS 20000
+
+/************************* internal functions *********************************/
+static int ParseArgs(int argc, char *argv[], calc_server_config_t *config,
+                     const char **ring_path);
+static void *RunRing(void *ring);
+static int ParseNumber(const char *str, size_t *number);
+
+
+/******************************************************************************
+*								main
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+	calc_server_config_t config = {0};
+	calc_server_stats_t stats = {0};
+	calc_server_t *server = NULL;
+	calc_ring_t *ring = NULL;
+	const char *ring_path = NULL;
+	pthread_t ring_thread;
+	sigset_t signals;
+	int signal_number = 0;
+
+	config.n_workers = DEFAULT_WORKERS;
+	if (0 != ParseArgs(argc - 1, argv + 1, &config, &ring_path))
+	{
+		fprintf(stderr, "usage: %s [--socket PATH] [--tcp PORT] "
+		                "[--ring PATH] [--workers N] [--max-length N] "
+		                "[--max-depth N]\n", argv[0]);
+		return (1);
+	}
+
+	// nothing asked for - the default socket
+	if (NULL == config.unix_path && !config.use_tcp && NULL == ring_path)
+	{
+		config.unix_path = DEFAULT_SOCKET;
+	}
+
+	// the workers start with these blocked - only sigwait below takes them
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	if (NULL != config.unix_path || config.use_tcp)
+	{
+		server = CalcServerCreate(&config);
+		if (NULL == server)
+		{
+			perror("calc daemon");
+			return (1);
+		}
+	}
+
+	// the ring has one evaluator - a thread of its own
+	if (NULL != ring_path)
+	{
+		ring = CalcRingCreate(ring_path, RING_CAPACITY,
+		                      (0 == config.limits.max_length) ?
+		                      RING_MAX_LENGTH : config.limits.max_length,
+		                      CALC_RING_MPSC);
+		if (NULL == ring || 0 != pthread_create(&ring_thread, NULL,
+		                                        RunRing, ring))
+		{
+			perror("calc daemon ring");
+			CalcRingClose(ring);
+			CalcServerDestroy(server);
+			return (1);
+		}
+	}
+
+	fprintf(stderr, "serving on%s%s%s%s",
+	        config.unix_path ? " " : "",
+	        config.unix_path ? config.unix_path : "",
+	        ring_path ? " ring " : "",
+	        ring_path ? ring_path : "");
+	if (config.use_tcp)
+	{
+		fprintf(stderr, " 127.0.0.1:%u", CalcServerTcpPort(server));
+	}
+	fprintf(stderr, "\n");
+
+	sigwait(&signals, &signal_number);
+
+	if (NULL != ring)
+	{
+		CalcRingStop(ring);
+		pthread_join(ring_thread, NULL);
+		CalcRingClose(ring);
+	}
+
+	if (NULL != server)
+	{
+		CalcServerGetStats(server, &stats);
+		CalcServerDestroy(server);
+
+		fprintf(stderr, "%lu connections, %lu expressions (%lu failed), "
+		        "%.1f expressions per read\n", stats.connections,
+		        stats.expressions, stats.errors,
+		        (0 == stats.reads) ? 0.0 :
+		        (double)stats.expressions / stats.reads);
+	}
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								ParseArgs
+*******************************************************************************/
+static int ParseArgs(int argc, char *argv[], calc_server_config_t *config,
+                     const char **ring_path)
+{
+	size_t number = 0;
+	int i = 0;
+
+	// every option takes a value
+	for (i = 0; i + 1 < argc; i += 2)
+	{
+		if (0 == strcmp(argv[i], "--socket"))
+		{
+			config->unix_path = argv[i + 1];
+			continue;
+		}
+
+		if (0 == strcmp(argv[i], "--ring"))
+		{
+			*ring_path = argv[i + 1];
+			continue;
+		}
+
+		if (0 != ParseNumber(argv[i + 1], &number))
+		{
+			return (-1);
+		}
+
+		if (0 == strcmp(argv[i], "--tcp") && number <= 0xFFFF)
+		{
+			config->use_tcp = 1;
+			config->tcp_port = (unsigned short)number;
+		}
+		else if (0 == strcmp(argv[i], "--workers"))
+		{
+			config->n_workers = number;
+		}
+		else if (0 == strcmp(argv[i], "--max-length"))
+		{
+			config->limits.max_length = number;
+		}
+		else if (0 == strcmp(argv[i], "--max-depth"))
+		{
+			config->limits.max_depth = number;
+		}
+		else
+		{
+			return (-1);
+		}
+	}
+
+	return ((i == argc) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								RunRing
+*******************************************************************************/
+static void *RunRing(void *ring)
+{
+	CalcRingRun((calc_ring_t *)ring, RING_SPINS);
+
+	return (NULL);
+}
+
+
+/******************************************************************************
+*								ParseNumber
+*******************************************************************************/
+static int ParseNumber(const char *str, size_t *number)
+{
+	char *end = NULL;
+
+	*number = strtoul(str, &end, 10);
+
+	return ((end == str || '\0' != *end) ? -1 : 0);
+}
@@ -0,0 +1,880 @@
+/*******************************************************************************
+*	Filename	:	calc_formula.c
+*	Developer	:	Eyal Weizman
+*	Description	:	named formulas in a dependency DAG - re-evaluated by
+*					depth, from a heap of the formulas a change reached
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <stdlib.h>		/* malloc, realloc, free */
+#include <string.h>		/* strlen, memcpy, memcmp, strcmp */
+#include <stdint.h>		/* uint64_t */
+#include <ctype.h>		/* isalpha, isalnum */
+
+#include "calc_formula.h"
+#include "stack/typed_stack.h"
+
+/******************************* MACROS ***************************************/
+#define NO_NODE ((size_t)-1)
+#define MIN_CAPACITY 64
+
+/* a depth with fewer formulas isn't worth waking the pool's threads */
+#define PARALLEL_MIN 256
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+/*************************** structs & typedefs *******************************/
+/* the formulas that refer to a node */
+DEFINE_TYPED_STACK(index_stack, IndexStack, size_t)
+
+/* a formula or an input. a formula is deeper than all its dependencies -
+   so the formulas of one depth don't depend on each other */
+typedef struct node_s
+{
+	char *name;
+	uint64_t hash;
+	size_t next;				/* in its hash bucket */
+	calc_program_t *program;	/* NULL for an input */
+	size_t *deps;				/* the node of each variable slot */
+	size_t n_deps;
+	index_stack_t users;
+	size_t level;				/* inputs 0 */
+	result_t value;
+	unsigned long mark;			/* of the current walk over the DAG */
+	int is_queued;
+	int is_changed;				/* by its last evaluation */
+}node_t;
+
+/* a formula in the queue - its level copied in, for the heap's compares */
+typedef struct queued_s
+{
+	size_t level;
+	size_t node;
+}queued_t;
+
+struct calc_formulas_s
+{
+	node_t *nodes;
+	size_t count;
+	size_t capacity;
+	size_t *buckets;			/* capacity of them - heads of chains */
+
+	/* 'capacity' each - a node is in each at most once */
+	queued_t *queue;			/* a heap of formulas to evaluate, by level */
+	size_t queued;
+	size_t *batch;				/* one level of the queue, or a walk's stack */
+
+	double *vars;				/* max_deps - the variables of an evaluation */
+	double *pool_vars;			/* max_deps per thread of a pool */
+	size_t pool_vars_size;
+	size_t max_deps;
+	unsigned long mark;
+};
+
+/************************* internal functions *********************************/
+static int IsValidName(const char *name);
+static uint64_t Hash(const char *name);
+static size_t Find(const calc_formulas_t *formulas, const char *name);
+static size_t FindOrAdd(calc_formulas_t *formulas, const char *name);
+static void Truncate(calc_formulas_t *formulas, size_t count);
+static int Reserve(calc_formulas_t *formulas, size_t count);
+static int ReserveVars(calc_formulas_t *formulas, size_t n_deps);
+static int DependsOn(calc_formulas_t *formulas, const size_t *deps,
+                     size_t n_deps, size_t target);
+static void RemoveUser(node_t *node, size_t user);
+static void RaiseLevel(calc_formulas_t *formulas, size_t i, size_t level);
+static void Evaluate(calc_formulas_t *formulas, size_t i, double *vars);
+static void EvaluateTask(void *arg, size_t index, size_t worker);
+static void EvaluateLevel(calc_formulas_t *formulas, size_t count,
+                          calc_pool_t *pool);
+static void QueueUsers(calc_formulas_t *formulas, size_t i);
+static void Push(calc_formulas_t *formulas, size_t i);
+static size_t Pop(calc_formulas_t *formulas);
+static void SiftDown(calc_formulas_t *formulas, size_t position);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcFormulasCreate
+*******************************************************************************/
+calc_formulas_t *CalcFormulasCreate(void)
+{
+	calc_formulas_t *formulas =
+	                (calc_formulas_t *)calloc(1, sizeof(calc_formulas_t));
+
+	if (NULL == formulas)
+	{
+		return (NULL);
+	}
+
+	if (0 != Reserve(formulas, MIN_CAPACITY))
+	{
+		CalcFormulasDestroy(formulas);
+		return (NULL);
+	}
+
+	return (formulas);
+}
+
+
+/******************************************************************************
+*								CalcFormulasDestroy
+*******************************************************************************/
+void CalcFormulasDestroy(calc_formulas_t *formulas)
+{
+	node_t *node = NULL;
+	size_t i = 0;
+
+	if (NULL == formulas)
+	{
+		return;
+	}
+
+	for (i = 0; i < formulas->count; ++i)
+	{
+		node = formulas->nodes + i;
+		free(node->name);
+		CalcProgramDestroy(node->program);
+		free(node->deps);
+		IndexStackDestroy(&node->users);
+	}
+
+	free(formulas->pool_vars);
+	free(formulas->vars);
+	free(formulas->batch);
+	free(formulas->queue);
+	free(formulas->buckets);
+	free(formulas->nodes);
+	free(formulas);
+}
+
+
+/******************************************************************************
+*								CalcFormulasDefine
+*******************************************************************************/
+int CalcFormulasDefine(calc_formulas_t *formulas, const char *name,
+                       const char *expr)
+{
+	calc_program_t *program = NULL;
+	node_t *node = NULL;
+	size_t *deps = NULL;
+	size_t n_deps = 0;
+	size_t level = 1;
+	size_t added = 0;
+	size_t count = formulas->count;
+	size_t i = 0;
+	size_t j = 0;
+	int status = CALC_SUCCESS;
+
+	assert(formulas);
+	assert(name);
+	assert(expr);
+
+	if (!IsValidName(name))
+	{
+		return (SYNTAX_ERROR);
+	}
+
+	program = CalcCompile(expr, &status);
+	if (NULL == program)
+	{
+		return (status);
+	}
+
+	/* the node of every name - the inputs of names not seen yet too, taken
+	   back below if the definition fails */
+	n_deps = CalcVarCount(program);
+	deps = (size_t *)malloc((n_deps + 1) * sizeof(size_t));
+	i = (NULL == deps) ? NO_NODE : FindOrAdd(formulas, name);
+	for (j = 0; j < n_deps && NO_NODE != i; ++j)
+	{
+		deps[j] = FindOrAdd(formulas, CalcVarName(program, j));
+		i = (NO_NODE == deps[j]) ? NO_NODE : i;
+	}
+
+	if (NO_NODE == i || 0 != ReserveVars(formulas, n_deps))
+	{
+		status = APPLICATION_ERROR;
+	}
+	else if (DependsOn(formulas, deps, n_deps, i))
+	{
+		status = CYCLE_ERROR;
+	}
+
+	/* it becomes a user of its new dependencies - then stops being one of
+	   its old ones, so those it keeps stay linked throughout */
+	for (added = 0; added < n_deps && CALC_SUCCESS == status; ++added)
+	{
+		if (0 != IndexStackPush(&formulas->nodes[deps[added]].users, i))
+		{
+			status = APPLICATION_ERROR;
+		}
+	}
+
+	if (CALC_SUCCESS != status)
+	{
+		for (j = 0; j + 1 < added; ++j)
+		{
+			RemoveUser(formulas->nodes + deps[j], i);
+		}
+		Truncate(formulas, count);
+		free(deps);
+		CalcProgramDestroy(program);
+		return (status);
+	}
+
+	node = formulas->nodes + i;
+	for (j = 0; j < node->n_deps; ++j)
+	{
+		RemoveUser(formulas->nodes + node->deps[j], i);
+	}
+	CalcProgramDestroy(node->program);
+	free(node->deps);
+	node->program = program;
+	node->deps = deps;
+	node->n_deps = n_deps;
+
+	for (j = 0; j < n_deps; ++j)
+	{
+		if (formulas->nodes[deps[j]].level >= level)
+		{
+			level = formulas->nodes[deps[j]].level + 1;
+		}
+	}
+	RaiseLevel(formulas, i, level);
+
+	Push(formulas, i);
+
+	return (CALC_SUCCESS);
+}
+
+
+/******************************************************************************
+*								CalcFormulasSet
+*******************************************************************************/
+int CalcFormulasSet(calc_formulas_t *formulas, const char *name,
+                    double value)
+{
+	node_t *node = NULL;
+	size_t i = 0;
+
+	assert(formulas);
+	assert(name);
+
+	if (!IsValidName(name))
+	{
+		return (SYNTAX_ERROR);
+	}
+
+	i = FindOrAdd(formulas, name);
+	if (NO_NODE == i || NULL != formulas->nodes[i].program)
+	{
+		return (APPLICATION_ERROR);
+	}
+
+	/* to the bit - -0 to 0 is a change (1 / x shows it), NaN to NaN isn't */
+	node = formulas->nodes + i;
+	if (0 != memcmp(&value, &node->value.result, sizeof(double)))
+	{
+		node->value.result = value;
+		QueueUsers(formulas, i);
+	}
+
+	return (CALC_SUCCESS);
+}
+
+
+/******************************************************************************
+*								CalcFormulasRecalc
+*******************************************************************************/
+size_t CalcFormulasRecalc(calc_formulas_t *formulas, calc_pool_t *pool)
+{
+	size_t evaluated = 0;
+	size_t level = 0;
+	size_t count = 0;
+	size_t i = 0;
+
+	assert(formulas);
+
+	/* a level at a time - a formula's users are deeper, so they are queued
+	   for a later level, and only if its value changed */
+	while (0 < formulas->queued)
+	{
+		level = formulas->queue[0].level;
+		for (count = 0; 0 < formulas->queued &&
+		     formulas->queue[0].level == level; ++count)
+		{
+			formulas->batch[count] = Pop(formulas);
+		}
+
+		EvaluateLevel(formulas, count, pool);
+
+		for (i = 0; i < count; ++i)
+		{
+			formulas->nodes[formulas->batch[i]].is_queued = 0;
+			if (formulas->nodes[formulas->batch[i]].is_changed)
+			{
+				QueueUsers(formulas, formulas->batch[i]);
+			}
+		}
+
+		evaluated += count;
+	}
+
+	return (evaluated);
+}
+
+
+/******************************************************************************
+*								CalcFormulasGet
+*******************************************************************************/
+result_t CalcFormulasGet(calc_formulas_t *formulas, const char *name)
+{
+	result_t result = {-1, APPLICATION_ERROR};
+	size_t i = 0;
+
+	assert(formulas);
+	assert(name);
+
+	CalcFormulasRecalc(formulas, NULL);
+
+	i = Find(formulas, name);
+	if (NO_NODE != i)
+	{
+		result = formulas->nodes[i].value;
+	}
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								IsValidName
+*******************************************************************************/
+static int IsValidName(const char *name)
+{
+	/* as CalcCompile reads them - letters, digits and '_', no digit first */
+	if (!isalpha((unsigned char)*name) && '_' != *name)
+	{
+		return (0);
+	}
+
+	for (++name; '\0' != *name; ++name)
+	{
+		if (!isalnum((unsigned char)*name) && '_' != *name)
+		{
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+
+/******************************************************************************
+*								Hash
+*******************************************************************************/
+static uint64_t Hash(const char *name)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	for (; '\0' != *name; ++name)
+	{
+		hash ^= (unsigned char)*name;
+		hash *= FNV_PRIME;
+	}
+
+	return (hash);
+}
+
+
+/******************************************************************************
+*								Find
+*******************************************************************************/
+static size_t Find(const calc_formulas_t *formulas, const char *name)
+{
+	uint64_t hash = Hash(name);
+	size_t i = formulas->buckets[hash & (formulas->capacity - 1)];
+
+	for (; NO_NODE != i; i = formulas->nodes[i].next)
+	{
+		if (formulas->nodes[i].hash == hash &&
+		    0 == strcmp(formulas->nodes[i].name, name))
+		{
+			return (i);
+		}
+	}
+
+	return (NO_NODE);
+}
+
+
+/******************************************************************************
+*								FindOrAdd
+*******************************************************************************/
+static size_t FindOrAdd(calc_formulas_t *formulas, const char *name)
+{
+	node_t *node = NULL;
+	size_t *bucket = NULL;
+	size_t i = Find(formulas, name);
+	size_t len = strlen(name);
+
+	if (NO_NODE != i)
+	{
+		return (i);
+	}
+
+	if (formulas->count == formulas->capacity &&
+	    0 != Reserve(formulas, formulas->capacity * 2))
+	{
+		return (NO_NODE);
+	}
+
+	/* a new input, of 0 */
+	i = formulas->count;
+	node = formulas->nodes + i;
+	memset(node, 0, sizeof(node_t));
+	node->name = (char *)malloc(len + 1);
+	if (NULL == node->name)
+	{
+		return (NO_NODE);
+	}
+	memcpy(node->name, name, len + 1);
+	node->hash = Hash(name);
+	IndexStackInit(&node->users, NULL, 0);
+
+	bucket = formulas->buckets + (node->hash & (formulas->capacity - 1));
+	node->next = *bucket;
+	*bucket = i;
+	++(formulas->count);
+
+	return (i);
+}
+
+
+/******************************************************************************
+*								Truncate
+*******************************************************************************/
+static void Truncate(calc_formulas_t *formulas, size_t count)
+{
+	node_t *node = NULL;
+	size_t *link = NULL;
+
+	/* the last nodes added - inputs no formula uses, unlinked from their
+	   chains wherever a rehash put them */
+	while (formulas->count > count)
+	{
+		--(formulas->count);
+		node = formulas->nodes + formulas->count;
+		link = formulas->buckets + (node->hash & (formulas->capacity - 1));
+		while (*link != formulas->count)
+		{
+			link = &formulas->nodes[*link].next;
+		}
+		*link = node->next;
+
+		free(node->name);
+		IndexStackDestroy(&node->users);
+	}
+}
+
+
+/******************************************************************************
+*								Reserve
+*******************************************************************************/
+static int Reserve(calc_formulas_t *formulas, size_t capacity)
+{
+	node_t *nodes = NULL;
+	size_t *buckets = NULL;
+	queued_t *queue = NULL;
+	size_t *batch = NULL;
+	size_t i = 0;
+
+	/* grown one by one - a failure leaves the set as it was, but larger */
+	nodes = (node_t *)realloc(formulas->nodes, capacity * sizeof(node_t));
+	if (NULL == nodes)
+	{
+		return (-1);
+	}
+	formulas->nodes = nodes;
+
+	queue = (queued_t *)realloc(formulas->queue, capacity * sizeof(queued_t));
+	if (NULL == queue)
+	{
+		return (-1);
+	}
+	formulas->queue = queue;
+
+	batch = (size_t *)realloc(formulas->batch, capacity * sizeof(size_t));
+	buckets = (size_t *)malloc(capacity * sizeof(size_t));
+	if (NULL == batch || NULL == buckets)
+	{
+		formulas->batch = (NULL == batch) ? formulas->batch : batch;
+		free(buckets);
+		return (-1);
+	}
+	formulas->batch = batch;
+
+	/* a bucket per node - the chains are rebuilt for the new mask */
+	free(formulas->buckets);
+	formulas->buckets = buckets;
+	formulas->capacity = capacity;
+	for (i = 0; i < capacity; ++i)
+	{
+		buckets[i] = NO_NODE;
+	}
+	for (i = 0; i < formulas->count; ++i)
+	{
+		nodes[i].next = buckets[nodes[i].hash & (capacity - 1)];
+		buckets[nodes[i].hash & (capacity - 1)] = i;
+	}
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								ReserveVars
+*******************************************************************************/
+static int ReserveVars(calc_formulas_t *formulas, size_t n_deps)
+{
+	double *vars = NULL;
+
+	if (n_deps <= formulas->max_deps)
+	{
+		return (0);
+	}
+
+	vars = (double *)realloc(formulas->vars, n_deps * sizeof(double));
+	if (NULL == vars)
+	{
+		return (-1);
+	}
+	formulas->vars = vars;
+	formulas->max_deps = n_deps;
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								DependsOn
+*******************************************************************************/
+static int DependsOn(calc_formulas_t *formulas, const size_t *deps,
+                     size_t n_deps, size_t target)
+{
+	const node_t *node = NULL;
+	size_t level = formulas->nodes[target].level;
+	size_t *stack = formulas->batch;
+	size_t top = 0;
+	size_t i = 0;
+
+	/* nothing uses it - only itself may close a cycle */
+	if (0 == IndexStackSize(&formulas->nodes[target].users))
+	{
+		for (i = 0; i < n_deps && target != deps[i]; ++i)
+		{
+		}
+		return (i < n_deps);
+	}
+
+	/* a depth-first walk down from the dependencies. anything depending on
+	   'target' is deeper than it - the walk doesn't go below its level.
+	   nodes are marked when pushed, so the stack holds each once at most */
+	++(formulas->mark);
+	for (i = 0; i < n_deps; ++i)
+	{
+		stack[top++] = deps[i];
+		formulas->nodes[deps[i]].mark = formulas->mark;
+	}
+
+	while (0 < top)
+	{
+		node = formulas->nodes + stack[--top];
+		if (node == formulas->nodes + target)
+		{
+			return (1);
+		}
+		if (node->level <= level)
+		{
+			continue;
+		}
+
+		for (i = 0; i < node->n_deps; ++i)
+		{
+			if (formulas->mark != formulas->nodes[node->deps[i]].mark)
+			{
+				formulas->nodes[node->deps[i]].mark = formulas->mark;
+				stack[top++] = node->deps[i];
+			}
+		}
+	}
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								RemoveUser
+*******************************************************************************/
+static void RemoveUser(node_t *node, size_t user)
+{
+	size_t *users = node->users.base;
+	size_t count = IndexStackSize(&node->users);
+	size_t i = 0;
+
+	/* one link of it - the last one takes its place */
+	for (i = 0; i < count; ++i)
+	{
+		if (user == users[i])
+		{
+			users[i] = IndexStackPop(&node->users);
+			return;
+		}
+	}
+}
+
+
+/******************************************************************************
+*								RaiseLevel
+*******************************************************************************/
+static void RaiseLevel(calc_formulas_t *formulas, size_t i, size_t level)
+{
+	node_t *nodes = formulas->nodes;
+	node_t *node = NULL;
+	size_t *stack = formulas->batch;
+	size_t *users = NULL;
+	size_t count = 0;
+	size_t top = 0;
+	size_t j = 0;
+	int is_queue_changed = 0;
+
+	if (level <= nodes[i].level)
+	{
+		return;
+	}
+
+	/* pushes every user that is no longer deeper than the node it uses.
+	   a node is on the stack once at most - unmarked when popped, it is
+	   pushed again if a longer path raises it again */
+	++(formulas->mark);
+	nodes[i].level = level;
+	nodes[i].mark = formulas->mark;
+	stack[top++] = i;
+	while (0 < top)
+	{
+		node = nodes + stack[--top];
+		node->mark = 0;
+		is_queue_changed |= node->is_queued;
+
+		users = node->users.base;
+		count = IndexStackSize(&node->users);
+		for (j = 0; j < count; ++j)
+		{
+			if (nodes[users[j]].level <= node->level)
+			{
+				nodes[users[j]].level = node->level + 1;
+				if (formulas->mark != nodes[users[j]].mark)
+				{
+					nodes[users[j]].mark = formulas->mark;
+					stack[top++] = users[j];
+				}
+			}
+		}
+	}
+
+	/* queued formulas are deeper now - back into a heap */
+	for (j = 0; j < formulas->queued && is_queue_changed; ++j)
+	{
+		formulas->queue[j].level = nodes[formulas->queue[j].node].level;
+	}
+	for (j = is_queue_changed ? formulas->queued / 2 : 0; 0 < j; --j)
+	{
+		SiftDown(formulas, j - 1);
+	}
+}
+
+
+/******************************************************************************
+*								Evaluate
+*******************************************************************************/
+static void Evaluate(calc_formulas_t *formulas, size_t i, double *vars)
+{
+	node_t *node = formulas->nodes + i;
+	const node_t *dep = NULL;
+	result_t value = {0};
+	size_t j = 0;
+
+	/* a failed dependency fails it, with its status */
+	for (j = 0; j < node->n_deps; ++j)
+	{
+		dep = formulas->nodes + node->deps[j];
+		if (CALC_SUCCESS != dep->value.status)
+		{
+			value.result = -1;
+			value.status = dep->value.status;
+			break;
+		}
+		vars[j] = dep->value.result;
+	}
+
+	if (j == node->n_deps)
+	{
+		value = CalcEval(node->program, vars);
+	}
+
+	node->is_changed = (value.status != node->value.status ||
+	                    0 != memcmp(&value.result, &node->value.result,
+	                                sizeof(double)));
+	node->value = value;
+}
+
+
+/******************************************************************************
+*								EvaluateTask
+*******************************************************************************/
+static void EvaluateTask(void *arg, size_t index, size_t worker)
+{
+	calc_formulas_t *formulas = (calc_formulas_t *)arg;
+
+	Evaluate(formulas, formulas->batch[index], (0 == formulas->max_deps) ?
+	         NULL : formulas->pool_vars + worker * formulas->max_deps);
+}
+
+
+/******************************************************************************
+*								EvaluateLevel
+*******************************************************************************/
+static void EvaluateLevel(calc_formulas_t *formulas, size_t count,
+                          calc_pool_t *pool)
+{
+	double *pool_vars = NULL;
+	size_t size = 0;
+	size_t i = 0;
+
+	/* the formulas of a level only read those of the levels before it */
+	if (NULL != pool && PARALLEL_MIN <= count && 1 < CalcPoolSize(pool))
+	{
+		size = CalcPoolSize(pool) * formulas->max_deps;
+		if (formulas->pool_vars_size < size)
+		{
+			pool_vars = (double *)realloc(formulas->pool_vars,
+			                              size * sizeof(double));
+			formulas->pool_vars = (NULL == pool_vars) ?
+			                      formulas->pool_vars : pool_vars;
+			formulas->pool_vars_size = (NULL == pool_vars) ?
+			                           formulas->pool_vars_size : size;
+		}
+
+		if (formulas->pool_vars_size >= size)
+		{
+			CalcPoolRun(pool, count, EvaluateTask, formulas);
+			return;
+		}
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		Evaluate(formulas, formulas->batch[i], formulas->vars);
+	}
+}
+
+
+/******************************************************************************
+*								QueueUsers
+*******************************************************************************/
+static void QueueUsers(calc_formulas_t *formulas, size_t i)
+{
+	const size_t *users = formulas->nodes[i].users.base;
+	size_t count = IndexStackSize(&formulas->nodes[i].users);
+	size_t j = 0;
+
+	for (j = 0; j < count; ++j)
+	{
+		Push(formulas, users[j]);
+	}
+}
+
+
+/******************************************************************************
+*								Push
+*******************************************************************************/
+static void Push(calc_formulas_t *formulas, size_t i)
+{
+	queued_t *queue = formulas->queue;
+	size_t position = formulas->queued;
+	size_t level = formulas->nodes[i].level;
+	size_t parent = 0;
+
+	if (formulas->nodes[i].is_queued)
+	{
+		return;
+	}
+	formulas->nodes[i].is_queued = 1;
+
+	/* up, while shallower than its parent */
+	for (; 0 < position; position = parent)
+	{
+		parent = (position - 1) / 2;
+		if (queue[parent].level <= level)
+		{
+			break;
+		}
+		queue[position] = queue[parent];
+	}
+	queue[position].level = level;
+	queue[position].node = i;
+	++(formulas->queued);
+}
+
+
+/******************************************************************************
+*								Pop
+*******************************************************************************/
+static size_t Pop(calc_formulas_t *formulas)
+{
+	size_t i = formulas->queue[0].node;
+
+	--(formulas->queued);
+	formulas->queue[0] = formulas->queue[formulas->queued];
+	SiftDown(formulas, 0);
+
+	return (i);
+}
+
+
+/******************************************************************************
+*								SiftDown
+*******************************************************************************/
+static void SiftDown(calc_formulas_t *formulas, size_t position)
+{
+	queued_t *queue = formulas->queue;
+	queued_t moved = {0};
+	size_t child = 0;
+
+	if (position >= formulas->queued)
+	{
+		return;
+	}
+
+	/* down, while deeper than its shallower child */
+	moved = queue[position];
+	for (child = 2 * position + 1; child < formulas->queued;
+	     child = 2 * position + 1)
+	{
+		if (child + 1 < formulas->queued &&
+		    queue[child + 1].level < queue[child].level)
+		{
+			++child;
+		}
+		if (moved.level <= queue[child].level)
+		{
+			break;
+		}
+		queue[position] = queue[child];
+		position = child;
+	}
+	queue[position] = moved;
+}
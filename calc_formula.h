@@ -0,0 +1,107 @@
+/*****************************************************************************
+ *  File name  : calc_formula.h
+ *  Developer  : Eyal Weizman
+ *	Description: named formulas that reference each other - re-evaluated
+ *	             incrementally, as the cells of a spreadsheet
+ *****************************************************************************/
+
+#ifndef __CALC_FORMULA_H__
+#define __CALC_FORMULA_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+#include "calc_pool.h"
+
+/* opaque handle of a set of formulas and their inputs */
+typedef struct calc_formulas_s calc_formulas_t;
+
+/*********************************** CalcFormulasCreate **********************/
+/*	Description      :	Creates an empty set of formulas.
+ *
+ *	                  	a set holds named values of two kinds - formulas
+ *	                  	('margin = revenue - cost') and inputs ('revenue'),
+ *	                  	which are given values. a formula refers to others
+ *	                  	and to inputs by name; a name referred to before it
+ *	                  	is defined is an input of 0 until set or defined.
+ *
+ *	                  	the set keeps the dependencies between them - a DAG
+ *	                  	- and re-evaluates, after a change, only the
+ *	                  	formulas downstream of it, each once, after all of
+ *	                  	its own dependencies. a formula whose value comes
+ *	                  	out unchanged doesn't re-evaluate those after it.
+ *
+ *	                  	a set is used by one thread at a time.
+ *
+ *	Return Values    :	the set, or NULL if memory can't be allocated.
+ */
+calc_formulas_t *CalcFormulasCreate(void);
+
+/*********************************** CalcFormulasDestroy *********************/
+/*	Description      :	Releases the set. NULL is allowed and ignored.
+ */
+void CalcFormulasDestroy(calc_formulas_t *formulas);
+
+/*********************************** CalcFormulasDefine **********************/
+/*	Description      :	Defines formula 'name' as 'expr' - an expression of
+ *	                  	CalcCompile, whose variables are the names of other
+ *	                  	formulas and inputs. redefines it if it exists, and
+ *	                  	turns an input of that name into a formula.
+ *	                  	the formula is evaluated by the next recalculation.
+ *
+ *	Input            :	name - letters, digits and '_', not starting with
+ *	                  	a digit.
+ *
+ *	Return Values    :	CALC_SUCCESS, SYNTAX_ERROR if 'name' or 'expr' is
+ *	                  	invalid, CYCLE_ERROR if 'expr' depends on 'name'
+ *	                  	itself, or APPLICATION_ERROR if memory can't be
+ *	                  	allocated. on failure, the set is left as it was.
+ *
+ *	Time Complexity  : O(n) for 'expr', plus O(formulas between 'name' and
+ *	                  	its new dependencies) for the cycle check
+ */
+int CalcFormulasDefine(calc_formulas_t *formulas, const char *name,
+                       const char *expr);
+
+/*********************************** CalcFormulasSet *************************/
+/*	Description      :	Sets input 'name' to 'value' - creating it if it
+ *	                  	doesn't exist. the formulas downstream of it are
+ *	                  	re-evaluated by the next recalculation.
+ *
+ *	Return Values    :	CALC_SUCCESS, SYNTAX_ERROR if 'name' is invalid, or
+ *	                  	APPLICATION_ERROR if 'name' is a formula or memory
+ *	                  	can't be allocated.
+ *
+ *	Time Complexity  : O(1) average
+ */
+int CalcFormulasSet(calc_formulas_t *formulas, const char *name,
+                    double value);
+
+/*********************************** CalcFormulasRecalc **********************/
+/*	Description      :	Re-evaluates the formulas affected by the changes
+ *	                  	since the last recalculation, in topological order.
+ *	                  	formulas at the same depth don't depend on each
+ *	                  	other - with a pool, large groups of them are
+ *	                  	evaluated on its threads at once.
+ *
+ *	Input            :	pool - optional (may be NULL) - from CalcPoolCreate.
+ *
+ *	Return Values    :	the number of formulas evaluated.
+ *
+ *	Time Complexity  : O(k log k) - k is the number of formulas evaluated
+ */
+size_t CalcFormulasRecalc(calc_formulas_t *formulas, calc_pool_t *pool);
+
+/*********************************** CalcFormulasGet *************************/
+/*	Description      :	Returns the value of formula or input 'name',
+ *	                  	recalculating first (on this thread) if anything
+ *	                  	changed since the last recalculation.
+ *
+ *	Return Values    :	as CalcEval, for a formula. a formula that depends
+ *	                  	on a failed one fails with the same status.
+ *	                  	APPLICATION_ERROR (result -1) if there's no such
+ *	                  	name.
+ */
+result_t CalcFormulasGet(calc_formulas_t *formulas, const char *name);
+
+#endif     /* __CALC_FORMULA_H__ */
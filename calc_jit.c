@@ -0,0 +1,501 @@
+/*******************************************************************************
+*	Filename	:	calc_jit.c
+*	Developer	:	Eyal Weizman
+*	Description	:	compiles hot programs to x86-64 SSE2 code, interprets
+*					the rest
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy */
+#include <stdint.h>		/* int32_t, uint64_t */
+#include <stdatomic.h>	/* atomic_int, atomic_size_t */
+#include <math.h>		/* log, exp, sin */
+#include <sys/mman.h>	/* mmap, mprotect, munmap */
+
+#include "calc_jit.h"
+#include "calc_prog.h"
+
+/******************************* MACROS ***************************************/
+#define RESULT_WHEN_ERROR -1
+
+/* deeper programs would need a large native frame - they are interpreted */
+#define JIT_MAX_DEPTH 4096
+
+/* bytes of native code an instruction takes, at most (POW takes 35) */
+#define MAX_INSTR_BYTES 48
+#define MAX_FRAME_BYTES 64	/* the error exit, the entry and the exit */
+
+/*************************** structs & typedefs *******************************/
+/* the native code of a program - returns a calc_status, the result through
+   'result' */
+typedef int (*native_t)(const double *vars, double *result);
+
+/* JIT_INTERPRETED -> JIT_COMPILING -> JIT_NATIVE or JIT_UNSUPPORTED */
+enum jit_state
+{
+	JIT_INTERPRETED,
+	JIT_COMPILING,		/* by one thread - the others interpret meanwhile */
+	JIT_NATIVE,
+	JIT_UNSUPPORTED		/* interpreted for good */
+};
+
+struct calc_jit_s
+{
+	const calc_program_t *program;
+	size_t threshold;
+	atomic_size_t evals;	/* interpreted so far */
+	atomic_int state;		/* enum jit_state */
+	native_t native;		/* set before state turns JIT_NATIVE */
+	void *code;				/* the executable pages */
+	size_t code_size;
+};
+
+/* native code being written */
+typedef struct emitter_s
+{
+	unsigned char *code;
+	size_t len;
+}emitter_t;
+
+/************************* internal functions *********************************/
+static void Compile(calc_jit_t *jit);
+static size_t Emit(emitter_t *out, const calc_program_t *program);
+
+#ifdef __x86_64__
+static int EmitInstr(emitter_t *out, const calc_instr_t *instr, size_t depth);
+static void EmitBytes(emitter_t *out, const char *bytes, size_t n);
+static void Emit32(emitter_t *out, int32_t value);
+static void Emit64(emitter_t *out, uint64_t value);
+static void EmitSlot(emitter_t *out, const char *opcode, size_t slot);
+static void EmitJumpToError(emitter_t *out, const char *opcode, size_t n);
+static void EmitCall(emitter_t *out, uint64_t function);
+static size_t FrameSize(size_t max_depth);
+#endif
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcJitCreate
+*******************************************************************************/
+calc_jit_t *CalcJitCreate(const calc_program_t *program, size_t threshold)
+{
+	calc_jit_t *jit = NULL;
+
+	assert(program);
+
+	jit = (calc_jit_t *)malloc(sizeof(calc_jit_t));
+	if (NULL == jit)
+	{
+		return (NULL);
+	}
+
+	jit->program = program;
+	jit->threshold = threshold;
+	atomic_init(&jit->evals, 0);
+	atomic_init(&jit->state, JIT_INTERPRETED);
+	jit->native = NULL;
+	jit->code = NULL;
+	jit->code_size = 0;
+
+	return (jit);
+}
+
+
+/******************************************************************************
+*								CalcJitDestroy
+*******************************************************************************/
+void CalcJitDestroy(calc_jit_t *jit)
+{
+	if (NULL == jit)
+	{
+		return;
+	}
+
+	if (NULL != jit->code)
+	{
+		munmap(jit->code, jit->code_size);
+	}
+
+	free(jit);
+}
+
+
+/******************************************************************************
+*								CalcJitEval
+*******************************************************************************/
+result_t CalcJitEval(calc_jit_t *jit, const double *vars)
+{
+	result_t result = {0};
+	int state = 0;
+
+	assert(jit);
+
+	/* counted only until it is compiled (or can't be) */
+	state = atomic_load_explicit(&jit->state, memory_order_acquire);
+	if (JIT_INTERPRETED == state &&
+	    atomic_fetch_add_explicit(&jit->evals, 1, memory_order_relaxed) >=
+	    jit->threshold)
+	{
+		Compile(jit);
+		state = atomic_load_explicit(&jit->state, memory_order_acquire);
+	}
+
+	if (JIT_NATIVE != state)
+	{
+		return (CalcEval(jit->program, vars));
+	}
+
+	result.status = jit->native(vars, &result.result);
+	if (CALC_SUCCESS != result.status)
+	{
+		result.result = RESULT_WHEN_ERROR;
+	}
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								CalcJitIsNative
+*******************************************************************************/
+int CalcJitIsNative(const calc_jit_t *jit)
+{
+	assert(jit);
+
+	return (JIT_NATIVE == atomic_load_explicit(&jit->state,
+	                                           memory_order_acquire));
+}
+
+
+/******************************************************************************
+*								Compile
+*******************************************************************************/
+static void Compile(calc_jit_t *jit)
+{
+	const calc_program_t *program = jit->program;
+	emitter_t out = {NULL, 0};
+	int expected = JIT_INTERPRETED;
+	size_t size = 0;
+	size_t entry = 0;
+	void *code = NULL;
+
+	/* one thread compiles */
+	if (!atomic_compare_exchange_strong(&jit->state, &expected,
+	                                    JIT_COMPILING))
+	{
+		return;
+	}
+
+	size = MAX_FRAME_BYTES + program->length * MAX_INSTR_BYTES;
+	code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == code)
+	{
+		atomic_store(&jit->state, JIT_UNSUPPORTED);
+		return;
+	}
+
+	/* written, then made executable - never both at once */
+	out.code = (unsigned char *)code;
+	entry = Emit(&out, program);
+	if (0 == entry || 0 != mprotect(code, size, PROT_READ | PROT_EXEC))
+	{
+		munmap(code, size);
+		atomic_store(&jit->state, JIT_UNSUPPORTED);
+		return;
+	}
+
+	/* ISO C has no cast from a data pointer to a function pointer */
+	code = out.code + entry;
+	memcpy(&jit->native, &code, sizeof(jit->native));
+	jit->code = out.code;
+	jit->code_size = size;
+
+	atomic_store_explicit(&jit->state, JIT_NATIVE, memory_order_release);
+}
+
+
+#ifdef __x86_64__
+/******************************************************************************
+*								Emit
+*******************************************************************************/
+static size_t Emit(emitter_t *out, const calc_program_t *program)
+{
+	char frame[sizeof(int32_t)];
+	int32_t frame_size = 0;
+	size_t max_depth = 0;
+	size_t depth = 0;
+	size_t entry = 0;
+	size_t i = 0;
+	int arity = 0;
+
+	/* the depth of the evaluation stack, and a check the program is sound -
+	   no pop of an empty stack */
+	for (i = 0; i < program->length; ++i)
+	{
+		arity = ProgramArity(program->code[i].opcode);
+		if (arity < 0 || depth < (size_t)arity)
+		{
+			return (0);
+		}
+
+		depth -= arity - 1;
+		max_depth = (depth > max_depth) ? depth : max_depth;
+	}
+	if (1 != depth || max_depth > JIT_MAX_DEPTH)
+	{
+		return (0);
+	}
+
+	/* the stack is [rsp + 8 * i], but for its top element - in xmm0 */
+	frame_size = (int32_t)FrameSize(max_depth);
+	memcpy(frame, &frame_size, sizeof(frame));
+
+	/* the error exit first, so every jump to it is backwards:
+	   mov eax, MATH_ERROR; add rsp, frame; pop r12; pop rbx; ret */
+	EmitBytes(out, "\xB8", 1);
+	Emit32(out, MATH_ERROR);
+	EmitBytes(out, "\x48\x81\xC4", 3);
+	EmitBytes(out, frame, sizeof(frame));
+	EmitBytes(out, "\x41\x5C\x5B\xC3", 4);
+
+	/* the entry: push rbx; push r12; mov rbx, rdi (vars);
+	   mov r12, rsi (result); sub rsp, frame */
+	entry = out->len;
+	EmitBytes(out, "\x53\x41\x54\x48\x89\xFB\x49\x89\xF4\x48\x81\xEC", 12);
+	EmitBytes(out, frame, sizeof(frame));
+
+	for (depth = 0, i = 0; i < program->length; ++i)
+	{
+		if (0 != EmitInstr(out, program->code + i, depth))
+		{
+			return (0);
+		}
+
+		depth -= ProgramArity(program->code[i].opcode) - 1;
+	}
+
+	/* movsd [r12], xmm0; xor eax, eax; add rsp, frame; pop r12; pop rbx;
+	   ret */
+	EmitBytes(out, "\xF2\x41\x0F\x11\x04\x24\x31\xC0\x48\x81\xC4", 11);
+	EmitBytes(out, frame, sizeof(frame));
+	EmitBytes(out, "\x41\x5C\x5B\xC3", 4);
+
+	return (entry);
+}
+
+
+/******************************************************************************
+*								EmitInstr
+*******************************************************************************/
+static int EmitInstr(emitter_t *out, const calc_instr_t *instr, size_t depth)
+{
+	uint64_t bits = 0;
+
+	switch (instr->opcode)
+	{
+		/* pushes spill the top to its slot first */
+		case OPC_CONST:
+			if (0 != depth)
+			{
+				EmitSlot(out, "\xF2\x0F\x11\x84", depth - 1);	/* movsd */
+			}
+			/* mov rax, imm64; movq xmm0, rax */
+			memcpy(&bits, &instr->value, sizeof(bits));
+			EmitBytes(out, "\x48\xB8", 2);
+			Emit64(out, bits);
+			EmitBytes(out, "\x66\x48\x0F\x6E\xC0", 5);
+			break;
+
+		case OPC_VAR:
+			if (instr->arg > INT32_MAX / sizeof(double))
+			{
+				return (-1);
+			}
+			if (0 != depth)
+			{
+				EmitSlot(out, "\xF2\x0F\x11\x84", depth - 1);
+			}
+			/* movsd xmm0, [rbx + 8 * arg] */
+			EmitBytes(out, "\xF2\x0F\x10\x83", 4);
+			Emit32(out, (int32_t)(instr->arg * sizeof(double)));
+			break;
+
+		/* a + b and a * b are b + a and b * a, to the bit */
+		case OPC_ADD:
+			EmitSlot(out, "\xF2\x0F\x58\x84", depth - 2);		/* addsd */
+			break;
+
+		case OPC_MUL:
+			EmitSlot(out, "\xF2\x0F\x59\x84", depth - 2);		/* mulsd */
+			break;
+
+		/* movsd xmm1, a; subsd xmm1, xmm0; movapd xmm0, xmm1 */
+		case OPC_SUB:
+			EmitSlot(out, "\xF2\x0F\x10\x8C", depth - 2);
+			EmitBytes(out, "\xF2\x0F\x5C\xC8\x66\x0F\x28\xC1", 8);
+			break;
+
+		/* a / 0 fails - a / NaN doesn't, as in CalcEval:
+		   xorpd xmm1, xmm1; ucomisd xmm0, xmm1; jp +6; je error */
+		case OPC_DIV:
+			EmitBytes(out, "\x66\x0F\x57\xC9\x66\x0F\x2E\xC1\x7A\x06", 10);
+			EmitJumpToError(out, "\x0F\x84", 2);
+			EmitSlot(out, "\xF2\x0F\x10\x8C", depth - 2);
+			EmitBytes(out, "\xF2\x0F\x5E\xC8\x66\x0F\x28\xC1", 8);
+			break;
+
+		/* movapd xmm1, xmm0; movsd xmm0, a; call ProgramPow.
+		   the stack slots live in this frame - the callee keeps off them */
+		case OPC_POW:
+			EmitBytes(out, "\x66\x0F\x28\xC8", 4);
+			EmitSlot(out, "\xF2\x0F\x10\x84", depth - 2);
+			EmitCall(out, (uint64_t)(uintptr_t)&ProgramPow);
+			break;
+
+		case OPC_SQUARE:
+			EmitBytes(out, "\xF2\x0F\x59\xC0", 4);			/* mulsd */
+			break;
+
+		case OPC_SQRT:
+			EmitBytes(out, "\xF2\x0F\x51\xC0", 4);			/* sqrtsd */
+			break;
+
+		/* the same libm functions ProgramCall calls - xmm0 in and out */
+		case OPC_LOG:
+			EmitCall(out, (uint64_t)(uintptr_t)&log);
+			break;
+
+		case OPC_EXP:
+			EmitCall(out, (uint64_t)(uintptr_t)&exp);
+			break;
+
+		case OPC_SIN:
+			EmitCall(out, (uint64_t)(uintptr_t)&sin);
+			break;
+
+		/* mov rax, ~sign; movq xmm1, rax; andpd xmm0, xmm1 - fabs */
+		case OPC_ABS:
+			EmitBytes(out, "\x48\xB8", 2);
+			Emit64(out, ~((uint64_t)1 << 63));
+			EmitBytes(out, "\x66\x48\x0F\x6E\xC8\x66\x0F\x54\xC1", 9);
+			break;
+
+		/* movsd xmm1, a; minsd xmm1, xmm0; movapd xmm0, xmm1 -
+		   a < b ? a : b, as ProgramCall */
+		case OPC_MIN:
+			EmitSlot(out, "\xF2\x0F\x10\x8C", depth - 2);
+			EmitBytes(out, "\xF2\x0F\x5D\xC8\x66\x0F\x28\xC1", 8);
+			break;
+
+		case OPC_MAX:
+			EmitSlot(out, "\xF2\x0F\x10\x8C", depth - 2);
+			EmitBytes(out, "\xF2\x0F\x5F\xC8\x66\x0F\x28\xC1", 8);
+			break;
+
+		default:
+			return (-1);
+	}
+
+	/* a NaN out of '^', a square, a root or a call (the opcodes from
+	   OPC_POW on) fails: ucomisd xmm0, xmm0; jp error */
+	if (OPC_POW <= instr->opcode)
+	{
+		EmitBytes(out, "\x66\x0F\x2E\xC0", 4);
+		EmitJumpToError(out, "\x0F\x8A", 2);
+	}
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								EmitBytes
+*******************************************************************************/
+static void EmitBytes(emitter_t *out, const char *bytes, size_t n)
+{
+	memcpy(out->code + out->len, bytes, n);
+	out->len += n;
+}
+
+
+/******************************************************************************
+*								Emit32
+*******************************************************************************/
+static void Emit32(emitter_t *out, int32_t value)
+{
+	memcpy(out->code + out->len, &value, sizeof(value));
+	out->len += sizeof(value);
+}
+
+
+/******************************************************************************
+*								Emit64
+*******************************************************************************/
+static void Emit64(emitter_t *out, uint64_t value)
+{
+	memcpy(out->code + out->len, &value, sizeof(value));
+	out->len += sizeof(value);
+}
+
+
+/******************************************************************************
+*								EmitSlot
+*******************************************************************************/
+static void EmitSlot(emitter_t *out, const char *opcode, size_t slot)
+{
+	/* the 4 bytes of 'opcode' end in a ModRM of [rsp + disp32] - SIB 0x24 */
+	EmitBytes(out, opcode, 4);
+	EmitBytes(out, "\x24", 1);
+	Emit32(out, (int32_t)(slot * sizeof(double)));
+}
+
+
+/******************************************************************************
+*								EmitJumpToError
+*******************************************************************************/
+static void EmitJumpToError(emitter_t *out, const char *opcode, size_t n)
+{
+	/* the error exit is at offset 0 */
+	EmitBytes(out, opcode, n);
+	Emit32(out, -(int32_t)(out->len + sizeof(int32_t)));
+}
+
+
+/******************************************************************************
+*								EmitCall
+*******************************************************************************/
+static void EmitCall(emitter_t *out, uint64_t function)
+{
+	/* mov rax, function; call rax */
+	EmitBytes(out, "\x48\xB8", 2);
+	Emit64(out, function);
+	EmitBytes(out, "\xFF\xD0", 2);
+}
+
+
+/******************************************************************************
+*								FrameSize
+*******************************************************************************/
+static size_t FrameSize(size_t max_depth)
+{
+	/* rsp is 16-aligned at every call (ProgramPow, libm): the return address and the 2
+	   pushes take 24 bytes, so the frame is 8 past a multiple of 16 */
+	return (((max_depth * sizeof(double) + 15) & ~(size_t)15) + 8);
+}
+
+#else /* __x86_64__ */
+/******************************************************************************
+*								Emit
+*******************************************************************************/
+static size_t Emit(emitter_t *out, const calc_program_t *program)
+{
+	(void)out;
+	(void)program;
+
+	/* no backend - interpreted */
+	return (0);
+}
+#endif /* __x86_64__ */
@@ -0,0 +1,64 @@
+/*****************************************************************************
+ *  File name  : calc_jit.h
+ *  Developer  : Eyal Weizman
+ *	Description: native (x86-64) code for hot compiled expressions
+ *****************************************************************************/
+
+#ifndef __CALC_JIT_H__
+#define __CALC_JIT_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* opaque handle of a program with a JIT */
+typedef struct calc_jit_s calc_jit_t;
+
+/*********************************** CalcJitCreate ***************************/
+/*	Description      :	Wraps a compiled program for CalcJitEval. the
+ *	                  	program is interpreted (CalcEval) for its first
+ *	                  	'threshold' evaluations and then compiled to
+ *	                  	native SSE2 code - only the formulas that turn out
+ *	                  	hot pay for the compilation. threshold 0 compiles
+ *	                  	it on the first evaluation.
+ *
+ *	                  	a program that can't be compiled - an unknown
+ *	                  	instruction, an evaluation stack too deep, not an
+ *	                  	x86-64 cpu, no executable memory - stays with the
+ *	                  	interpreter, with the same results.
+ *
+ *	Input            :	program - returned by CalcCompile (optimized or not)
+ *	                  	or CalcBundleProgram. it must outlive the JIT.
+ *
+ *	Return Values    :	the JIT, or NULL if memory can't be allocated.
+ */
+calc_jit_t *CalcJitCreate(const calc_program_t *program, size_t threshold);
+
+/*********************************** CalcJitDestroy **************************/
+/*	Description      :	Releases the JIT and its native code (not the
+ *	                  	program). NULL is allowed and ignored.
+ */
+void CalcJitDestroy(calc_jit_t *jit);
+
+/*********************************** CalcJitEval *****************************/
+/*	Description      :	CalcEval(program, vars), natively once the program
+ *	                  	is hot. the results are CalcEval's to the bit - the
+ *	                  	same operations in the same order, '^' by the same
+ *	                  	function, and the same errors.
+ *	                  	may be called from several threads at once - one of
+ *	                  	them compiles, the others go on interpreting
+ *	                  	meanwhile.
+ *
+ *	Return Values    :	as CalcEval.
+ *
+ *	Time Complexity  : O(n) - n is the program length
+ */
+result_t CalcJitEval(calc_jit_t *jit, const double *vars);
+
+/*********************************** CalcJitIsNative *************************/
+/*	Description      :	Returns 1 if the program runs as native code by
+ *	                  	now, 0 if it is still (or for good) interpreted.
+ */
+int CalcJitIsNative(const calc_jit_t *jit);
+
+#endif     /* __CALC_JIT_H__ */
@@ -0,0 +1,399 @@
+/*******************************************************************************
+*	Filename	:	calc_lex.c
+*	Developer	:	Eyal Weizman
+*	Description	:	lexer pre-pass - validates the input and skips runs of
+*					spaces 16 / 32 bytes at a time
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <pthread.h>	/* pthread_once */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CALC_LEX_X86
+#include <immintrin.h> /* SSE2, AVX2 intrinsics */
+#endif
+
+#include "calc_lex.h"
+
+/******************************* MACROS ***************************************/
+#define UNUSED(x) ((void) x)
+
+/* byte classes of g_byte_class */
+#define CLASS_VALID 1
+#define CLASS_SPACE 2
+
+/* most runs of spaces are a single one - not worth a vector */
+#define SHORT_RUN 8
+
+/* returned by a block scan that met an invalid byte or an unmatched ')' */
+#define SCAN_FAILED ((size_t)-1)
+
+#define VALID_RANGES (sizeof(g_valid_ranges) / sizeof(g_valid_ranges[0]))
+
+/*************************** structs & typedefs *******************************/
+/* nesting of the parentheses scanned so far */
+typedef struct parentheses_s
+{
+	size_t depth;
+	size_t max_depth;
+}parentheses_t;
+
+/* scans the whole blocks of [str, str + len), counting parentheses into
+   'parens'. returns the bytes scanned, or SCAN_FAILED */
+typedef size_t (*block_scan_t)(const char *str, size_t len,
+                               parentheses_t *parens);
+
+/* returns the first byte in [str, end) that isn't a space, or the last whole
+   block - the rest is left to the caller */
+typedef const char *(*block_skip_t)(const char *str, const char *end);
+
+/************************* internal functions *********************************/
+static void InitLex(void);
+static size_t ScanNone(const char *str, size_t len, parentheses_t *parens);
+static const char *SkipNone(const char *str, const char *end);
+static int CountParentheses(unsigned int open, unsigned int close,
+                            parentheses_t *parens);
+
+/************************* global variable ************************************/
+/* the bytes an expression may hold - those with an event other than
+   INVALID_CHAR in the calculator (calc.c, InitEventsLut), and the '.' of
+   numbers. inclusive ranges */
+static const unsigned char g_valid_ranges[][2] =
+{
+	{'\t', '\r'},	/* spaces */
+	{' ', ' '},
+	{'(', ':'},		/* ( ) * + , - . / digits : */
+	{'A', 'Z'},
+	{'^', '_'},
+	{'a', 'z'}
+};
+
+/* built once (by InitLex) and read-only from then on */
+static unsigned char g_byte_class[256];
+static block_scan_t g_block_scan = ScanNone;
+static block_skip_t g_block_skip = SkipNone;
+static pthread_once_t g_lex_once = PTHREAD_ONCE_INIT;
+
+
+#ifdef CALC_LEX_X86
+/************************* SSE2 blocks ****************************************/
+/* a mask of the bytes of 'x' in [lo, hi] */
+static inline __attribute__((target("sse2")))
+__m128i InRangeSse2(__m128i x, unsigned char lo, unsigned char hi)
+{
+	__m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8((char)lo));
+	__m128i width = _mm_set1_epi8((char)(hi - lo));
+
+	/* unsigned x - lo <= hi - lo */
+	return (_mm_cmpeq_epi8(_mm_min_epu8(shifted, width), shifted));
+}
+
+static __attribute__((target("sse2")))
+size_t ScanSse2(const char *str, size_t len, parentheses_t *parens)
+{
+	__m128i block = _mm_setzero_si128();
+	__m128i valid = _mm_setzero_si128();
+	unsigned int open = 0;
+	unsigned int close = 0;
+	size_t r = 0;
+	size_t i = 0;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		block = _mm_loadu_si128((const __m128i *)(str + i));
+
+		valid = _mm_setzero_si128();
+		for (r = 0; r < VALID_RANGES; ++r)
+		{
+			valid = _mm_or_si128(valid, InRangeSse2(block, g_valid_ranges[r][0],
+			                                        g_valid_ranges[r][1]));
+		}
+		if (0xFFFF != _mm_movemask_epi8(valid))
+		{
+			return (SCAN_FAILED);
+		}
+
+		open = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('(')));
+		close = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(')')));
+		if (0 != (open | close) && 0 != CountParentheses(open, close, parens))
+		{
+			return (SCAN_FAILED);
+		}
+	}
+
+	return (i);
+}
+
+static __attribute__((target("sse2")))
+const char *SkipSse2(const char *str, const char *end)
+{
+	__m128i block = _mm_setzero_si128();
+	unsigned int spaces = 0;
+
+	for (; end - str >= 16; str += 16)
+	{
+		block = _mm_loadu_si128((const __m128i *)str);
+		spaces = _mm_movemask_epi8(_mm_or_si128(
+		         _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+		         InRangeSse2(block, '\t', '\r')));
+		if (0xFFFF != spaces)
+		{
+			return (str + __builtin_ctz(~spaces));
+		}
+	}
+
+	return (str);
+}
+
+
+/************************* AVX2 blocks ****************************************/
+static inline __attribute__((target("avx2")))
+__m256i InRangeAvx2(__m256i x, unsigned char lo, unsigned char hi)
+{
+	__m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8((char)lo));
+	__m256i width = _mm256_set1_epi8((char)(hi - lo));
+
+	return (_mm256_cmpeq_epi8(_mm256_min_epu8(shifted, width), shifted));
+}
+
+static __attribute__((target("avx2")))
+size_t ScanAvx2(const char *str, size_t len, parentheses_t *parens)
+{
+	__m256i block = _mm256_setzero_si256();
+	__m256i valid = _mm256_setzero_si256();
+	unsigned int open = 0;
+	unsigned int close = 0;
+	size_t r = 0;
+	size_t i = 0;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		block = _mm256_loadu_si256((const __m256i *)(str + i));
+
+		valid = _mm256_setzero_si256();
+		for (r = 0; r < VALID_RANGES; ++r)
+		{
+			valid = _mm256_or_si256(valid,
+			                        InRangeAvx2(block, g_valid_ranges[r][0],
+			                                    g_valid_ranges[r][1]));
+		}
+		if (0xFFFFFFFFu != (unsigned int)_mm256_movemask_epi8(valid))
+		{
+			return (SCAN_FAILED);
+		}
+
+		open = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block,
+		                                              _mm256_set1_epi8('(')));
+		close = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block,
+		                                               _mm256_set1_epi8(')')));
+		if (0 != (open | close) && 0 != CountParentheses(open, close, parens))
+		{
+			return (SCAN_FAILED);
+		}
+	}
+
+	/* the last 16 - 31 bytes still fit a half block */
+	return (i + ScanSse2(str + i, len - i, parens));
+}
+
+static __attribute__((target("avx2")))
+const char *SkipAvx2(const char *str, const char *end)
+{
+	__m256i block = _mm256_setzero_si256();
+	unsigned int spaces = 0;
+
+	for (; end - str >= 32; str += 32)
+	{
+		block = _mm256_loadu_si256((const __m256i *)str);
+		spaces = _mm256_movemask_epi8(_mm256_or_si256(
+		         _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+		         InRangeAvx2(block, '\t', '\r')));
+		if (0xFFFFFFFFu != spaces)
+		{
+			return (str + __builtin_ctz(~spaces));
+		}
+	}
+
+	return (SkipSse2(str, end));
+}
+#endif /* CALC_LEX_X86 */
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								LexValidate
+*******************************************************************************/
+int LexValidate(const char *str, size_t len, size_t *max_depth)
+{
+	parentheses_t parens = {0};
+	size_t i = 0;
+
+	assert(str || 0 == len);
+
+	pthread_once(&g_lex_once, InitLex);
+
+	i = g_block_scan(str, len, &parens);
+	if (SCAN_FAILED == i)
+	{
+		return (-1);
+	}
+
+	/* the tail, shorter than a block */
+	for (; i < len; ++i)
+	{
+		if (!(g_byte_class[(unsigned char)str[i]] & CLASS_VALID))
+		{
+			return (-1);
+		}
+
+		if ('(' == str[i])
+		{
+			++(parens.depth);
+			parens.max_depth = (parens.depth > parens.max_depth) ?
+			                   parens.depth : parens.max_depth;
+		}
+		else if (')' == str[i])
+		{
+			if (0 == parens.depth)
+			{
+				return (-1);
+			}
+			--(parens.depth);
+		}
+	}
+
+	if (NULL != max_depth)
+	{
+		*max_depth = parens.max_depth;
+	}
+
+	return ((0 == parens.depth) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								LexSkipSpace
+*******************************************************************************/
+const char *LexSkipSpace(const char *str, const char *end)
+{
+	const char *short_end = (end - str > SHORT_RUN) ? str + SHORT_RUN : end;
+
+	assert(str <= end);
+
+	pthread_once(&g_lex_once, InitLex);
+
+	for (; str < short_end; ++str)
+	{
+		if (!(g_byte_class[(unsigned char)*str] & CLASS_SPACE))
+		{
+			return (str);
+		}
+	}
+
+	/* a long run - whole blocks, then the tail */
+	str = g_block_skip(str, end);
+	while (str < end && (g_byte_class[(unsigned char)*str] & CLASS_SPACE))
+	{
+		++str;
+	}
+
+	return (str);
+}
+
+
+/******************************************************************************
+*								InitLex
+*******************************************************************************/
+static void InitLex(void)
+{
+	size_t r = 0;
+	int i = 0;
+
+	for (r = 0; r < VALID_RANGES; ++r)
+	{
+		for (i = g_valid_ranges[r][0]; i <= g_valid_ranges[r][1]; ++i)
+		{
+			g_byte_class[i] = CLASS_VALID;
+		}
+	}
+
+	g_byte_class[' '] |= CLASS_SPACE;
+	for (i = '\t'; i <= '\r'; ++i)
+	{
+		g_byte_class[i] |= CLASS_SPACE;
+	}
+
+#ifdef CALC_LEX_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		g_block_scan = ScanAvx2;
+		g_block_skip = SkipAvx2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		g_block_scan = ScanSse2;
+		g_block_skip = SkipSse2;
+	}
+#endif
+}
+
+
+/******************************************************************************
+*								ScanNone
+*******************************************************************************/
+static size_t ScanNone(const char *str, size_t len, parentheses_t *parens)
+{
+	UNUSED(str);
+	UNUSED(len);
+	UNUSED(parens);
+
+	/* no vectors - the scalar tail does it all */
+	return (0);
+}
+
+
+/******************************************************************************
+*								SkipNone
+*******************************************************************************/
+static const char *SkipNone(const char *str, const char *end)
+{
+	UNUSED(end);
+
+	return (str);
+}
+
+
+/******************************************************************************
+*								CountParentheses
+*******************************************************************************/
+static int CountParentheses(unsigned int open, unsigned int close,
+                            parentheses_t *parens)
+{
+	unsigned int both = open | close;
+	unsigned int bit = 0;
+
+	/* in the order of the input - a ')' mustn't come before its '(' */
+	for (; 0 != both; both &= both - 1)
+	{
+		bit = both & -both;
+		if (open & bit)
+		{
+			++(parens->depth);
+			parens->max_depth = (parens->depth > parens->max_depth) ?
+			                    parens->depth : parens->max_depth;
+		}
+		else if (0 == parens->depth)
+		{
+			return (-1);
+		}
+		else
+		{
+			--(parens->depth);
+		}
+	}
+
+	return (0);
+}
@@ -0,0 +1,45 @@
+/*****************************************************************************
+ *  File name  : calc_lex.h
+ *  Developer  : Eyal Weizman
+ *	Description: lexer internals - shared by the calculator modules.
+ *	             not part of the public API (see calc.h).
+ *****************************************************************************/
+
+#ifndef __CALC_LEX_H__
+#define __CALC_LEX_H__
+
+#include <stddef.h> /* size_t */
+
+/* returned by LexNormalize when the output doesn't fit */
+#define LEX_TOO_LONG ((size_t)-1)
+
+/*  LexNormalize copies the expression [str, str + len) to 'out' in a
+ *  canonical form - spaces (by the calculator's own SPACE class) are dropped
+ *  wherever they don't change the meaning, and kept as a single ' ' where
+ *  they do ("5 7", "- 3", "1e +5"). two inputs with the same normal form
+ *  calculate to the same result.
+ *
+ *  returns the length of the normal form, or LEX_TOO_LONG if it is longer
+ *  than 'out_size'.
+ */
+size_t LexNormalize(const char *str, size_t len, char *out, size_t out_size);
+
+/*  LexValidate is the pre-pass of every calculation - it checks, 16 or 32
+ *  bytes at a time (SSE2 / AVX2, as the cpu has it), that [str, str + len)
+ *  holds only bytes an expression may have and that its parentheses are
+ *  balanced. an input it rejects is a syntax error whatever else is in it,
+ *  so the calculator reports it without running at all.
+ *  'max_depth' (optional - may be NULL) receives the deepest nesting of
+ *  parentheses, for the limits of CalcNLimited.
+ *
+ *  returns 0 if the input may be valid, -1 if it surely isn't.
+ */
+int LexValidate(const char *str, size_t len, size_t *max_depth);
+
+/*  LexSkipSpace returns the first byte in [str, end) that isn't a space (by
+ *  the calculator's SPACE class), or 'end'. long runs - padded log lines -
+ *  are skipped a block at a time.
+ */
+const char *LexSkipSpace(const char *str, const char *end);
+
+#endif     /* __CALC_LEX_H__ */
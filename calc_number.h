@@ -0,0 +1,25 @@
+/*****************************************************************************
+ *  File name  : calc_number.h
+ *  Developer  : Eyal Weizman
+ *	Description: decimal number parser of the calculator.
+ *	             not part of the public API (see calc.h).
+ *****************************************************************************/
+
+#ifndef __CALC_NUMBER_H__
+#define __CALC_NUMBER_H__
+
+/*  NumberParse reads the decimal number at the start of [begin, end) -
+ *  [-]digits[.digits][(e|E)[+|-]digits] - into 'num', correctly rounded.
+ *  an exponent counts only when digits follow it. no locale, no hex, no
+ *  inf / nan forms, and nothing past 'end' is read.
+ *
+ *  most numbers (up to 19 significant digits and a small exponent) are
+ *  converted exactly with integer and double arithmetic. the rest fall back
+ *  to an exact conversion of a bounded copy.
+ *
+ *  returns the end of the number ('begin' if there is none), or NULL if
+ *  memory for the fallback can't be allocated.
+ */
+const char *NumberParse(const char *begin, const char *end, double *num);
+
+#endif     /* __CALC_NUMBER_H__ */
@@ -0,0 +1,270 @@
+/*******************************************************************************
+*	Filename	:	calc_opt.c
+*	Developer	:	Eyal Weizman
+*	Description	:	optimizer pass - constant folding and simplification of
+*					compiled programs
+*******************************************************************************/
+#include <assert.h> /* assert */
+#include <stdlib.h>	/* malloc, free */
+#include <string.h>	/* memset, memmove */
+#include <math.h>	/* isnan, signbit */
+
+#include "calc_opt.h"
+#include "calc_prog.h"
+
+/*************************** structs & typedefs *******************************/
+/* the code of a subexpression of the rewritten program - postfix code of a
+   subexpression is contiguous, so its start is enough */
+typedef struct fragment_s
+{
+	size_t start;	/* first instruction of the subexpression */
+	size_t depth;	/* evaluation stack the subexpression needs */
+}fragment_t;
+
+/************************* internal functions *********************************/
+static int IsBinary(unsigned int opcode);
+static int Fold(unsigned int opcode, double a, double b, double *result);
+static int IsRightIdentity(unsigned int opcode, double b);
+static int IsLeftIdentity(unsigned int opcode, double a);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcOptimize
+*******************************************************************************/
+int CalcOptimize(calc_program_t *program, calc_opt_stats_t *stats)
+{
+	calc_opt_stats_t local_stats = {0};
+	calc_instr_t *code = NULL;
+	fragment_t *fragments = NULL;	/* the evaluation stack, at compile time */
+	fragment_t *left = NULL;
+	fragment_t right = {0};
+	calc_instr_t instr = {0};
+	size_t top = 0;
+	size_t out = 0;		/* the rewritten program, over the original one */
+	size_t in = 0;
+	int is_left_const = 0;
+	int is_right_const = 0;
+	double value = 0;
+
+	assert(program);
+
+	stats = (NULL != stats) ? stats : &local_stats;
+	memset(stats, 0, sizeof(calc_opt_stats_t));
+	stats->length_before = program->length;
+
+	fragments = (fragment_t *)malloc((program->max_depth + 1) *
+	                                 sizeof(fragment_t));
+	if (NULL == fragments)
+	{
+		stats->length_after = program->length;
+		return (-1);
+	}
+
+	/* every rewrite shrinks the code, so it is written over itself */
+	code = program->code;
+	for (in = 0; in < program->length; ++in)
+	{
+		instr = code[in];
+
+		/* operands */
+		if (OPC_CONST == instr.opcode || OPC_VAR == instr.opcode)
+		{
+			fragments[top].start = out;
+			fragments[top].depth = 1;
+			++top;
+			code[out++] = instr;
+			continue;
+		}
+
+		/* unary ops - only a constant operand can go */
+		if (!IsBinary(instr.opcode))
+		{
+			left = fragments + top - 1;
+			if (out == left->start + 1 && OPC_CONST == code[left->start].opcode)
+			{
+				if (0 == Fold(instr.opcode, code[left->start].value, 0, &value))
+				{
+					code[left->start].value = value;
+					++(stats->folded);
+					continue;
+				}
+				++(stats->kept_errors);
+			}
+			code[out++] = instr;
+			continue;
+		}
+
+		/* binary ops. a constant fragment is folded already - a single
+		   OPC_CONST */
+		right = fragments[--top];
+		left = fragments + top - 1;
+		is_left_const = (right.start == left->start + 1 &&
+		                 OPC_CONST == code[left->start].opcode);
+		is_right_const = (out == right.start + 1 &&
+		                  OPC_CONST == code[right.start].opcode);
+
+		if (is_left_const && is_right_const)
+		{
+			if (0 == Fold(instr.opcode, code[left->start].value,
+			              code[right.start].value, &value))
+			{
+				code[left->start].value = value;
+				out = left->start + 1;
+				++(stats->folded);
+				continue;
+			}
+			++(stats->kept_errors);
+		}
+		else if (is_right_const &&
+		         IsRightIdentity(instr.opcode, code[right.start].value))
+		{
+			/* x * 1 - the constant goes, x stays */
+			out = right.start;
+			++(stats->identities);
+			continue;
+		}
+		else if (is_left_const &&
+		         IsLeftIdentity(instr.opcode, code[left->start].value))
+		{
+			/* 1 * x - x moves over the constant */
+			memmove(code + left->start, code + right.start,
+			        (out - right.start) * sizeof(calc_instr_t));
+			--out;
+			left->depth = right.depth;
+			++(stats->identities);
+			continue;
+		}
+		else if (is_right_const && OPC_POW == instr.opcode &&
+		         2 == code[right.start].value)
+		{
+			/* x ^ 2 - the constant becomes the unary op. not x ^ 0.5 -
+			   sqrt differs from pow for -0 and -inf, and ProgramPow takes
+			   the root for the rest anyway */
+			code[right.start].opcode = OPC_SQUARE;
+			code[right.start].arg = 0;
+			code[right.start].value = 0;
+			++(stats->reduced);
+			continue;
+		}
+
+		/* nothing to do - the op stays */
+		left->depth = (left->depth > right.depth + 1) ? left->depth :
+		                                                right.depth + 1;
+		code[out++] = instr;
+	}
+
+	program->length = out;
+	program->max_depth = (top > 0) ? fragments[0].depth : 0;
+	stats->length_after = out;
+
+	free(fragments);
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								IsBinary
+*******************************************************************************/
+static int IsBinary(unsigned int opcode)
+{
+	return (2 == ProgramArity(opcode));
+}
+
+
+/******************************************************************************
+*								Fold
+*******************************************************************************/
+static int Fold(unsigned int opcode, double a, double b, double *result)
+{
+	/* as CalcEval does it - an operation that fails there isn't folded */
+	switch (opcode)
+	{
+		case OPC_ADD:
+			*result = a + b;
+			return (0);
+
+		case OPC_SUB:
+			*result = a - b;
+			return (0);
+
+		case OPC_MUL:
+			*result = a * b;
+			return (0);
+
+		case OPC_DIV:
+			*result = a / b;
+			return ((0 != b) ? 0 : -1);
+
+		case OPC_POW:
+			*result = ProgramPow(a, b);
+			break;
+
+		case OPC_SQUARE:
+			*result = a * a;
+			break;
+
+		/* 'sqrt(16)', 'max(2, 3)' - the calls of the built-in functions */
+		case OPC_SQRT:
+		case OPC_LOG:
+		case OPC_EXP:
+		case OPC_SIN:
+		case OPC_ABS:
+		case OPC_MIN:
+		case OPC_MAX:
+			*result = ProgramCall(opcode, a, b);
+			break;
+
+		default:
+			return (-1);
+	}
+
+	return (isnan(*result) ? -1 : 0);
+}
+
+
+/******************************************************************************
+*								IsRightIdentity
+*******************************************************************************/
+static int IsRightIdentity(unsigned int opcode, double b)
+{
+	/* only where x comes out to the bit - -0 + 0 is 0 and -0 - -0 is 0,
+	   so a zero is one only of its sign. not x ^ 1 - a NaN x fails there */
+	switch (opcode)
+	{
+		case OPC_ADD:
+			return (0 == b && signbit(b));
+
+		case OPC_SUB:
+			return (0 == b && !signbit(b));
+
+		case OPC_MUL:
+		case OPC_DIV:
+			return (1 == b);
+
+		default:
+			return (0);
+	}
+}
+
+
+/******************************************************************************
+*								IsLeftIdentity
+*******************************************************************************/
+static int IsLeftIdentity(unsigned int opcode, double a)
+{
+	switch (opcode)
+	{
+		case OPC_ADD:
+			return (0 == a && signbit(a));
+
+		case OPC_MUL:
+			return (1 == a);
+
+		default:
+			return (0);
+	}
+}
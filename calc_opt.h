@@ -0,0 +1,56 @@
+/*****************************************************************************
+ *  File name  : calc_opt.h
+ *  Developer  : Eyal Weizman
+ *	Description: optimizer pass over compiled expressions
+ *****************************************************************************/
+
+#ifndef __CALC_OPT_H__
+#define __CALC_OPT_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* what a CalcOptimize pass did */
+typedef struct calc_opt_stats_s
+{
+	size_t length_before;	/* instructions before the pass */
+	size_t length_after;	/* instructions after the pass */
+	size_t folded;			/* constant operations computed by the pass */
+	size_t identities;		/* x*1, 1*x, x/1, x-0 removed */
+	size_t reduced;			/* x^2 made a square */
+	size_t kept_errors;		/* constant operations left to fail at evaluation */
+}calc_opt_stats_t;
+
+/*********************************** CalcOptimize ****************************/
+/*	Description      :	Rewrites a compiled program in place, so every
+ *	                  	evaluation does less work:
+ *	                  	- constant subexpressions are computed once -
+ *	                  	  '(2^10) * rate / 100' becomes '1024 * rate / 100'.
+ *	                  	- identities are removed - 'x * 1' becomes 'x'.
+ *	                  	- 'x ^ 2' becomes a multiplication.
+ *
+ *	                  	the order of the remaining operations is kept, so
+ *	                  	results keep their rounding. errors are kept too - a
+ *	                  	constant operation that fails ('1/0', '(-4)^0.5') is
+ *	                  	not computed but left to fail at evaluation.
+ *	                  	every input gives the same result, to the bit, and
+ *	                  	the same status as before the pass - 'x + 0' stays
+ *	                  	(it is 0, not -0, for x = -0), and so do 'x ^ 1'
+ *	                  	(a MATH_ERROR for a NaN x) and 'x ^ 0.5' (pow's
+ *	                  	results for -0 and -inf, not sqrt's).
+ *
+ *	Input            :	program - a program returned by CalcCompile.
+ *	                  	stats - optional (may be NULL), receives what the
+ *	                  	pass did.
+ *
+ *	Return Values    :	0 in case of success, -1 if memory for the pass
+ *	                  	can't be allocated (the program is left as it was).
+ *
+ *	Time Complexity  : O(n) - n is the program length
+ *
+ *  Space Complexity : O(depth)
+ */
+int CalcOptimize(calc_program_t *program, calc_opt_stats_t *stats);
+
+#endif     /* __CALC_OPT_H__ */
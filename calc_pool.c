@@ -0,0 +1,565 @@
+/*******************************************************************************
+*	Filename	:	calc_pool.c
+*	Developer	:	Eyal Weizman
+*	Description	:	work-stealing thread pool
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy */
+#include <pthread.h>	/* pthread_create, mutex, cond */
+#include <stdatomic.h>	/* atomic_size_t */
+
+#include "calc_pool.h"
+#include "calc_lex.h"
+#include "stack/typed_stack.h"
+
+/******************************* MACROS ***************************************/
+#define CACHE_LINE 64
+
+/* a thread takes items in grains - about this many per share */
+#define GRAINS_PER_SHARE 64
+
+/* CalcPoolCalcN - shorter inputs aren't worth waking the threads */
+#define SPLIT_MIN_LEN (64 * 1024)
+
+/* CALC_REDUCE_FAST - runs of terms per thread, for the stealing to even out */
+#define RUNS_PER_THREAD 16
+
+/* no split position - the one before the first term, so it starts at 0 */
+#define BEFORE_START ((size_t)-1)
+
+/*************************** structs & typedefs *******************************/
+/* the items [next, end) a thread has left. anyone may take from the front */
+typedef struct share_s
+{
+	_Alignas(CACHE_LINE) atomic_size_t next;
+	size_t end;
+}share_t;
+
+typedef struct worker_s
+{
+	calc_pool_t *pool;
+	size_t id;
+	pthread_t thread;
+}worker_t;
+
+struct calc_pool_s
+{
+	size_t n_threads;
+	worker_t *workers;			/* n_threads - 1 started threads */
+	share_t *shares;			/* a share per thread */
+	calc_arena_t **arenas;		/* a scratch arena per thread */
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_ready;
+	pthread_cond_t job_done;
+	unsigned long generation;	/* bumped for every job */
+	size_t busy;				/* started threads still on the job */
+	int stop;
+
+	/* the current job */
+	calc_task_t task;
+	void *arg;
+	size_t grain;
+};
+
+/* arguments of CalcPoolCalculate's task */
+typedef struct calc_job_s
+{
+	calc_pool_t *pool;
+	const char *const *exprs;
+	result_t *results;
+}calc_job_t;
+
+/* the positions of the '+' / '-' a CalcPoolCalcN input is split at */
+DEFINE_TYPED_STACK(split_stack, SplitStack, size_t)
+
+/* arguments of CalcPoolCalcN's task. piece i is the input between
+   splits[i] and splits[i + 1] */
+typedef struct split_job_s
+{
+	calc_pool_t *pool;
+	const char *str;
+	const size_t *splits;
+	result_t *results;
+	calc_reduce_t reduce;
+}split_job_t;
+
+/************************* internal functions *********************************/
+static void *WorkerMain(void *arg);
+static void RunShares(calc_pool_t *pool, size_t worker);
+static void CalculateTask(void *arg, size_t index, size_t worker);
+static void SplitTask(void *arg, size_t index, size_t worker);
+static void CreateArenas(calc_pool_t *pool);
+static int Split(const char *str, size_t len, size_t min_piece,
+                 split_stack_t *splits);
+static result_t AddPieces(const split_job_t *job, size_t n_pieces);
+static result_t CalcNegated(const char *str, size_t len, calc_arena_t *arena);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcPoolCreate
+*******************************************************************************/
+calc_pool_t *CalcPoolCreate(size_t n_threads)
+{
+	calc_pool_t *pool = NULL;
+	size_t i = 0;
+
+	if (0 == n_threads)
+	{
+		return (NULL);
+	}
+
+	pool = (calc_pool_t *)calloc(1, sizeof(calc_pool_t));
+	if (NULL == pool)
+	{
+		return (NULL);
+	}
+
+	pool->n_threads = n_threads;
+	pool->workers = (worker_t *)calloc(n_threads, sizeof(worker_t));
+	pool->shares = (share_t *)aligned_alloc(CACHE_LINE,
+	                                        n_threads * sizeof(share_t));
+	pool->arenas = (calc_arena_t **)calloc(n_threads, sizeof(calc_arena_t *));
+	if (NULL == pool->workers || NULL == pool->shares || NULL == pool->arenas)
+	{
+		free(pool->workers);
+		free(pool->shares);
+		free(pool->arenas);
+		free(pool);
+		return (NULL);
+	}
+
+	for (i = 0; i < n_threads; ++i)
+	{
+		atomic_init(&pool->shares[i].next, 0);
+		pool->shares[i].end = 0;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_ready, NULL);
+	pthread_cond_init(&pool->job_done, NULL);
+
+	/* thread 0 is the caller of CalcPoolRun - start the rest */
+	pool->n_threads = 1;
+	for (i = 1; i < n_threads; ++i)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		if (0 != pthread_create(&pool->workers[i].thread, NULL, WorkerMain,
+		                        &pool->workers[i]))
+		{
+			CalcPoolDestroy(pool);
+			return (NULL);
+		}
+		++(pool->n_threads);
+	}
+
+	return (pool);
+}
+
+
+/******************************************************************************
+*								CalcPoolDestroy
+*******************************************************************************/
+void CalcPoolDestroy(calc_pool_t *pool)
+{
+	size_t i = 0;
+
+	if (NULL == pool)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->n_threads; ++i)
+	{
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < pool->n_threads; ++i)
+	{
+		CalcArenaDestroy(pool->arenas[i]);
+	}
+
+	pthread_cond_destroy(&pool->job_done);
+	pthread_cond_destroy(&pool->job_ready);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->arenas);
+	free(pool->shares);
+	free(pool->workers);
+	free(pool);
+}
+
+
+/******************************************************************************
+*								CalcPoolSize
+*******************************************************************************/
+size_t CalcPoolSize(const calc_pool_t *pool)
+{
+	assert(pool);
+
+	return (pool->n_threads);
+}
+
+
+/******************************************************************************
+*								CalcPoolRun
+*******************************************************************************/
+void CalcPoolRun(calc_pool_t *pool, size_t count, calc_task_t task,
+                 void *arg)
+{
+	size_t share_size = 0;
+	size_t i = 0;
+
+	assert(pool);
+	assert(task);
+
+	/* even shares - the stealing evens out uneven items */
+	share_size = (count + pool->n_threads - 1) / pool->n_threads;
+	for (i = 0; i < pool->n_threads; ++i)
+	{
+		atomic_store(&pool->shares[i].next,
+		             (i * share_size < count) ? i * share_size : count);
+		pool->shares[i].end = ((i + 1) * share_size < count) ?
+		                      (i + 1) * share_size : count;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->grain = share_size / GRAINS_PER_SHARE + 1;
+	pool->busy = pool->n_threads - 1;
+	++(pool->generation);
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the caller works too, as thread 0 */
+	RunShares(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (0 != pool->busy)
+	{
+		pthread_cond_wait(&pool->job_done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/******************************************************************************
+*								CalcPoolCalculate
+*******************************************************************************/
+void CalcPoolCalculate(calc_pool_t *pool, const char *const *exprs,
+                       result_t *results, size_t count)
+{
+	calc_job_t job = {0};
+
+	assert(pool);
+	assert(exprs || 0 == count);
+	assert(results || 0 == count);
+
+	CreateArenas(pool);
+
+	job.pool = pool;
+	job.exprs = exprs;
+	job.results = results;
+
+	CalcPoolRun(pool, count, CalculateTask, &job);
+}
+
+
+/******************************************************************************
+*								CalcPoolCalcN
+*******************************************************************************/
+result_t CalcPoolCalcN(calc_pool_t *pool, const char *str, size_t len,
+                       calc_reduce_t reduce)
+{
+	split_stack_t splits = {0};
+	split_job_t job = {0};
+	result_t result = {0};
+	size_t min_piece = 0;
+	size_t n_pieces = 0;
+
+	assert(pool);
+	assert(str || 0 == len);
+
+	/* a bad input goes to CalcN, for its exact error */
+	if (len < SPLIT_MIN_LEN || 0 != LexValidate(str, len, NULL))
+	{
+		return (CalcN(str, len));
+	}
+
+	/* ORDERED - every term a piece. FAST - pieces of about this length */
+	min_piece = (CALC_REDUCE_FAST == reduce) ?
+	            len / (pool->n_threads * RUNS_PER_THREAD) : 0;
+
+	SplitStackInit(&splits, NULL, 0);
+	if (0 != Split(str, len, min_piece, &splits))
+	{
+		SplitStackDestroy(&splits);
+		return (CalcN(str, len));
+	}
+
+	n_pieces = SplitStackSize(&splits) - 1;
+	job.results = (result_t *)malloc(n_pieces * sizeof(result_t));
+	if (NULL == job.results)
+	{
+		SplitStackDestroy(&splits);
+		return (CalcN(str, len));
+	}
+
+	CreateArenas(pool);
+
+	job.pool = pool;
+	job.str = str;
+	job.splits = splits.base;
+	job.reduce = reduce;
+
+	CalcPoolRun(pool, n_pieces, SplitTask, &job);
+	result = AddPieces(&job, n_pieces);
+
+	free(job.results);
+	SplitStackDestroy(&splits);
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								WorkerMain
+*******************************************************************************/
+static void *WorkerMain(void *arg)
+{
+	worker_t *worker = (worker_t *)arg;
+	calc_pool_t *pool = worker->pool;
+	unsigned long seen = 0;	/* no job before CalcPoolCreate returns */
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (1)
+	{
+		while (seen == pool->generation && !pool->stop)
+		{
+			pthread_cond_wait(&pool->job_ready, &pool->lock);
+		}
+
+		if (pool->stop)
+		{
+			break;
+		}
+
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		RunShares(pool, worker->id);
+
+		pthread_mutex_lock(&pool->lock);
+		if (0 == --(pool->busy))
+		{
+			pthread_cond_signal(&pool->job_done);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return (NULL);
+}
+
+
+/******************************************************************************
+*								RunShares
+*******************************************************************************/
+static void RunShares(calc_pool_t *pool, size_t worker)
+{
+	share_t *share = NULL;
+	size_t victim = 0;
+	size_t first = 0;
+	size_t last = 0;
+	size_t i = 0;
+	size_t n = 0;
+
+	/* its own share first, then the others' (stealing), round robin */
+	for (n = 0; n < pool->n_threads; ++n)
+	{
+		victim = (worker + n) % pool->n_threads;
+		share = pool->shares + victim;
+
+		while ((first = atomic_fetch_add(&share->next, pool->grain)) <
+		       share->end)
+		{
+			last = (first + pool->grain < share->end) ?
+			       first + pool->grain : share->end;
+
+			for (i = first; i < last; ++i)
+			{
+				pool->task(pool->arg, i, worker);
+			}
+		}
+	}
+}
+
+
+/******************************************************************************
+*								CalculateTask
+*******************************************************************************/
+static void CalculateTask(void *arg, size_t index, size_t worker)
+{
+	calc_job_t *job = (calc_job_t *)arg;
+	calc_arena_t *arena = job->pool->arenas[worker];
+
+	/* no arena (allocation failed) - Calculate still works, it just mallocs */
+	job->results[index] = (NULL != arena) ?
+	                      CalculateArena(job->exprs[index], arena) :
+	                      Calculate(job->exprs[index]);
+}
+
+
+/******************************************************************************
+*								SplitTask
+*******************************************************************************/
+static void SplitTask(void *arg, size_t index, size_t worker)
+{
+	split_job_t *job = (split_job_t *)arg;
+	calc_arena_t *arena = job->pool->arenas[worker];
+	const char *start = job->str + job->splits[index] + 1;
+	size_t len = job->splits[index + 1] - (job->splits[index] + 1);
+
+	/* a run of terms after a '-' - only its first term is subtracted */
+	if (CALC_REDUCE_FAST == job->reduce && 0 != index && '-' == start[-1])
+	{
+		job->results[index] = CalcNegated(start - 1, len + 1, arena);
+		return;
+	}
+
+	job->results[index] = (NULL != arena) ? CalcNArena(start, len, arena) :
+	                                        CalcN(start, len);
+}
+
+
+/******************************************************************************
+*								CalcNegated
+*******************************************************************************/
+static result_t CalcNegated(const char *str, size_t len, calc_arena_t *arena)
+{
+	result_t result = {-1, APPLICATION_ERROR};
+	char *copy = (char *)malloc(len + 1);
+
+	/* "- a + b" is calculated as "0- a + b" - a leading '-' would be the
+	   sign of the number, and '-2^2' is 4 */
+	if (NULL == copy)
+	{
+		return (result);
+	}
+
+	copy[0] = '0';
+	memcpy(copy + 1, str, len);
+
+	result = (NULL != arena) ? CalcNArena(copy, len + 1, arena) :
+	                           CalcN(copy, len + 1);
+	free(copy);
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								CreateArenas
+*******************************************************************************/
+static void CreateArenas(calc_pool_t *pool)
+{
+	size_t i = 0;
+
+	for (i = 0; i < pool->n_threads; ++i)
+	{
+		if (NULL == pool->arenas[i])
+		{
+			pool->arenas[i] = CalcArenaCreate(0);
+		}
+	}
+}
+
+
+/******************************************************************************
+*								Split
+*******************************************************************************/
+static int Split(const char *str, size_t len, size_t min_piece,
+                 split_stack_t *splits)
+{
+	size_t depth = 0;
+	size_t start = 0;	/* of the current piece */
+	size_t i = 0;
+	int is_after_operand = 0;
+	char c = 0;
+
+	if (0 != SplitStackPush(splits, BEFORE_START))
+	{
+		return (-1);
+	}
+
+	/* the input is balanced (LexValidate) - depth never goes below 0 */
+	for (i = 0; i < len; ++i)
+	{
+		c = str[i];
+		if (' ' == c || ('\t' <= c && c <= '\r'))
+		{
+			continue;
+		}
+
+		/* a '+' / '-' right after an operand is an operator, otherwise a
+		   sign - '2 * -3', '(-1)', '1e-3' */
+		if (('+' == c || '-' == c) && 0 == depth && is_after_operand &&
+		    i - start >= min_piece)
+		{
+			if (0 != SplitStackPush(splits, i))
+			{
+				return (-1);
+			}
+			start = i + 1;
+		}
+
+		depth += ('(' == c);
+		depth -= (')' == c);
+		is_after_operand = ('0' <= c && c <= '9') || '.' == c || ')' == c;
+	}
+
+	return (SplitStackPush(splits, len));
+}
+
+
+/******************************************************************************
+*								AddPieces
+*******************************************************************************/
+static result_t AddPieces(const split_job_t *job, size_t n_pieces)
+{
+	const result_t *results = job->results;
+	result_t sum = results[0];
+	size_t i = 0;
+
+	/* left to right - the order CalcN adds its terms in. the '-' of a run
+	   was applied by its task already */
+	for (i = 0; i < n_pieces; ++i)
+	{
+		if (CALC_SUCCESS != results[i].status)
+		{
+			return (results[i]);
+		}
+
+		if (0 != i)
+		{
+			sum.result = (CALC_REDUCE_ORDERED == job->reduce &&
+			              '-' == job->str[job->splits[i]]) ?
+			             sum.result - results[i].result :
+			             sum.result + results[i].result;
+		}
+	}
+
+	return (sum);
+}
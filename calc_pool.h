@@ -0,0 +1,110 @@
+/*****************************************************************************
+ *  File name  : calc_pool.h
+ *  Developer  : Eyal Weizman
+ *	Description: thread pool for evaluating large batches in parallel
+ *****************************************************************************/
+
+#ifndef __CALC_POOL_H__
+#define __CALC_POOL_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* opaque handle of a thread pool */
+typedef struct calc_pool_s calc_pool_t;
+
+/* how CalcPoolCalcN adds up the terms of an expression */
+typedef enum calc_reduce_e
+{
+	CALC_REDUCE_ORDERED,	/* term by term, left to right - exactly as CalcN */
+	CALC_REDUCE_FAST		/* runs of terms - fewer, larger tasks, reassociated */
+}calc_reduce_t;
+
+/* a task on item 'index' of a job. 'worker' (0 .. CalcPoolSize - 1) is the
+   thread running it - handy for per-thread scratch state */
+typedef void (*calc_task_t)(void *arg, size_t index, size_t worker);
+
+/*********************************** CalcPoolCreate **************************/
+/*	Description      :	Creates a pool of 'n_threads' threads - the thread
+ *	                  	calling CalcPoolRun counts as one of them, so
+ *	                  	n_threads - 1 threads are started.
+ *
+ *	Return Values    :	the pool, or NULL on failure (n_threads == 0 is a
+ *	                  	failure).
+ */
+calc_pool_t *CalcPoolCreate(size_t n_threads);
+
+/*********************************** CalcPoolDestroy *************************/
+/*	Description      :	Stops the threads and releases the pool.
+ *	                  	NULL is allowed and ignored.
+ */
+void CalcPoolDestroy(calc_pool_t *pool);
+
+/*********************************** CalcPoolSize ****************************/
+/*	Description      :	Returns the number of threads of the pool.
+ */
+size_t CalcPoolSize(const calc_pool_t *pool);
+
+/*********************************** CalcPoolRun *****************************/
+/*	Description      :	Runs task(arg, i, worker) for every i in [0, count)
+ *	                  	and returns when all of them are done.
+ *	                  	every thread starts on its own share of the items
+ *	                  	and, once done, steals from the others' shares, so
+ *	                  	uneven items keep all the threads busy.
+ *
+ *	                  	one job at a time - a pool must not be run from two
+ *	                  	threads at once.
+ */
+void CalcPoolRun(calc_pool_t *pool, size_t count, calc_task_t task,
+                 void *arg);
+
+/********************************* CalcPoolCalculate *************************/
+/*	Description      :	Calculates results[i] = Calculate(exprs[i]) for
+ *	                  	'count' expressions, in parallel. every thread has
+ *	                  	its own scratch arena, so long expressions don't
+ *	                  	contend on the heap either.
+ */
+void CalcPoolCalculate(calc_pool_t *pool, const char *const *exprs,
+                       result_t *results, size_t count);
+
+/*********************************** CalcPoolCalcN ***************************/
+/*	Description      :	CalcN(str, len) of a single huge expression - a sum
+ *	                  	of many products, say - in parallel. the input is
+ *	                  	split at its top-level '+' / '-' (outside any
+ *	                  	parentheses, and not a sign, as in '2 * -3' or
+ *	                  	'1e-3'), the terms are calculated on the pool's
+ *	                  	threads and then added up. '*', '/' and '^' bind
+ *	                  	tighter than '+' / '-', so a term never depends on
+ *	                  	its neighbours.
+ *
+ *	                  	floating-point addition is not associative - the
+ *	                  	order of the additions changes the last bits:
+ *	                  	- CALC_REDUCE_ORDERED calculates every term on its
+ *	                  	  own and adds them left to right, as CalcN does -
+ *	                  	  the result is CalcN's to the bit.
+ *	                  	- CALC_REDUCE_FAST calculates runs of terms as one
+ *	                  	  task each and adds the runs up. much less overhead
+ *	                  	  for short terms, but the sum is reassociated - it
+ *	                  	  may differ from CalcN in the last bits (and with
+ *	                  	  the pool size), though never between two calls on
+ *	                  	  the same pool.
+ *
+ *	                  	an input that fails fails with the status of its
+ *	                  	leftmost failing term. short inputs, and those the
+ *	                  	split can't get memory for, are calculated by CalcN
+ *	                  	on the calling thread.
+ *
+ *	Return Values    :	as CalcN.
+ *
+ *	Time Complexity  : O(n / threads) for the terms, plus an O(n) scan for
+ *	                  	the split on the calling thread
+ *
+ *  Space Complexity : O(terms) for CALC_REDUCE_ORDERED. O(threads) for
+ *	                  	CALC_REDUCE_FAST, plus a copy of each run of terms
+ *	                  	that follows a '-' while it is calculated
+ */
+result_t CalcPoolCalcN(calc_pool_t *pool, const char *str, size_t len,
+                       calc_reduce_t reduce);
+
+#endif     /* __CALC_POOL_H__ */
@@ -0,0 +1,822 @@
+/*******************************************************************************
+*	Filename	:	calc_prog.c
+*	Developer	:	Eyal Weizman
+*	Description	:	compiled program - storage and evaluation
+*******************************************************************************/
+#include <assert.h> /* assert */
+#include <stdlib.h>	/* malloc, realloc, free, labs, llabs */
+#include <string.h>	/* memcpy, strncmp */
+#include <limits.h>	/* LLONG_MIN */
+#include <math.h>	/* pow, sqrt, log, exp, sin, isnan, fabs, signbit */
+
+#include "calc_prog.h"
+
+/******************************* MACROS ***************************************/
+#define RESULT_WHEN_ERROR -1
+#define INITIAL_CAPACITY 16
+
+/* programs up to this depth are evaluated without any heap allocation */
+#define LOCAL_STACK_SIZE 64
+
+/* whole numbers up to this size are exact in a double - 2^53 */
+#define MAX_EXACT_DOUBLE 9007199254740992.0
+
+/* ProgramPow multiplies out integer exponents up to this one */
+#define MAX_INT_EXPONENT 64
+
+#define FUNC_COUNT (sizeof(g_funcs) / sizeof(g_funcs[0]))
+
+/*************************** structs & typedefs *******************************/
+/* a built-in function - 'name(arg, ...)' compiles to a call instruction */
+typedef struct calc_func_s
+{
+	const char *name;
+	unsigned int opcode;
+}calc_func_t;
+
+/* a value of CalcEvalExact - an integer until it can't be */
+typedef struct exact_cell_s
+{
+	long long integer;
+	double value;			/* when not is_integer */
+	int is_integer;
+}exact_cell_t;
+
+/************************* internal functions *********************************/
+static int IsExactInteger(double value);
+static void ExactPush(exact_cell_t *cell, double value);
+static int ExactOp(exact_cell_t *a, const exact_cell_t *b,
+                   unsigned int opcode);
+static int IntPow(long long base, long long exponent, long long *result);
+
+/************************* global variable ************************************/
+static const calc_func_t g_funcs[] =
+{
+	{"sqrt", OPC_SQRT},
+	{"log", OPC_LOG},
+	{"exp", OPC_EXP},
+	{"sin", OPC_SIN},
+	{"abs", OPC_ABS},
+	{"min", OPC_MIN},
+	{"max", OPC_MAX}
+};
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								ProgramCreate
+*******************************************************************************/
+calc_program_t *ProgramCreate(void)
+{
+	calc_program_t *program = NULL;
+
+	program = (calc_program_t *)malloc(sizeof(calc_program_t));
+	if (NULL == program)
+	{
+		return (NULL);
+	}
+
+	program->code = (calc_instr_t *)malloc(INITIAL_CAPACITY *
+	                                       sizeof(calc_instr_t));
+	if (NULL == program->code)
+	{
+		free(program);
+		return (NULL);
+	}
+
+	program->length 		= 0;
+	program->capacity 		= INITIAL_CAPACITY;
+	program->max_depth 		= 0;
+	program->var_names 		= NULL;
+	program->var_count 		= 0;
+	program->var_capacity 	= 0;
+
+	return (program);
+}
+
+
+/******************************************************************************
+*								ProgramEmit
+*******************************************************************************/
+int ProgramEmit(calc_program_t *program, unsigned int opcode,
+                unsigned int arg, double value)
+{
+	calc_instr_t *new_code = NULL;
+	calc_instr_t *instr = NULL;
+
+	assert(program);
+
+	/* geometric growth - keeps the emission amortized O(1) */
+	if (program->length == program->capacity)
+	{
+		new_code = (calc_instr_t *)realloc(program->code,
+		                     2 * program->capacity * sizeof(calc_instr_t));
+		if (NULL == new_code)
+		{
+			return (-1);
+		}
+
+		program->code = new_code;
+		program->capacity *= 2;
+	}
+
+	instr = program->code + program->length;
+	instr->opcode 	= opcode;
+	instr->arg 		= arg;
+	instr->value 	= value;
+	++(program->length);
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								ProgramFindVar
+*******************************************************************************/
+long ProgramFindVar(const calc_program_t *program, const char *name,
+                    size_t len)
+{
+	size_t i = 0;
+
+	assert(program);
+	assert(name);
+
+	/* variables are few - a linear search is cheaper than hashing here */
+	for (i = 0; i < program->var_count; ++i)
+	{
+		if (0 == strncmp(program->var_names[i], name, len) &&
+		    '\0' == program->var_names[i][len])
+		{
+			return ((long)i);
+		}
+	}
+
+	return (-1);
+}
+
+
+/******************************************************************************
+*								ProgramAddVar
+*******************************************************************************/
+long ProgramAddVar(calc_program_t *program, const char *name, size_t len)
+{
+	char **new_names = NULL;
+	char *name_copy = NULL;
+	size_t new_capacity = 0;
+	long slot = ProgramFindVar(program, name, len);
+
+	if (-1 != slot)
+	{
+		return (slot);
+	}
+
+	if (program->var_count == program->var_capacity)
+	{
+		new_capacity = (0 == program->var_capacity) ? 4 :
+		               2 * program->var_capacity;
+		new_names = (char **)realloc(program->var_names,
+		                             new_capacity * sizeof(char *));
+		if (NULL == new_names)
+		{
+			return (-1);
+		}
+
+		program->var_names = new_names;
+		program->var_capacity = new_capacity;
+	}
+
+	name_copy = (char *)malloc(len + 1);
+	if (NULL == name_copy)
+	{
+		return (-1);
+	}
+
+	memcpy(name_copy, name, len);
+	name_copy[len] = '\0';
+	program->var_names[program->var_count] = name_copy;
+
+	return ((long)(program->var_count)++);
+}
+
+
+/******************************************************************************
+*								ProgramArity
+*******************************************************************************/
+int ProgramArity(unsigned int opcode)
+{
+	switch (opcode)
+	{
+		case OPC_CONST:
+		case OPC_VAR:
+			return (0);
+
+		case OPC_SQUARE:
+		case OPC_SQRT:
+		case OPC_LOG:
+		case OPC_EXP:
+		case OPC_SIN:
+		case OPC_ABS:
+			return (1);
+
+		case OPC_ADD:
+		case OPC_SUB:
+		case OPC_MUL:
+		case OPC_DIV:
+		case OPC_POW:
+		case OPC_MIN:
+		case OPC_MAX:
+			return (2);
+
+		default:
+			return (-1);
+	}
+}
+
+
+/******************************************************************************
+*								ProgramFindFunc
+*******************************************************************************/
+int ProgramFindFunc(const char *name, size_t len)
+{
+	size_t i = 0;
+
+	assert(name);
+
+	for (i = 0; i < FUNC_COUNT; ++i)
+	{
+		if (0 == strncmp(g_funcs[i].name, name, len) &&
+		    '\0' == g_funcs[i].name[len])
+		{
+			return ((int)g_funcs[i].opcode);
+		}
+	}
+
+	return (-1);
+}
+
+
+/******************************************************************************
+*								ProgramCall
+*******************************************************************************/
+double ProgramCall(unsigned int opcode, double a, double b)
+{
+	switch (opcode)
+	{
+		case OPC_SQRT:
+			return (sqrt(a));
+
+		case OPC_LOG:
+			return (log(a));
+
+		case OPC_EXP:
+			return (exp(a));
+
+		case OPC_SIN:
+			return (sin(a));
+
+		case OPC_ABS:
+			return (fabs(a));
+
+		case OPC_MIN:
+			return ((a < b) ? a : b);
+
+		case OPC_MAX:
+			return ((a > b) ? a : b);
+
+		default:
+			return (NAN);
+	}
+}
+
+
+/******************************************************************************
+*								CalcProgramDestroy
+*******************************************************************************/
+void CalcProgramDestroy(calc_program_t *program)
+{
+	size_t i = 0;
+
+	if (NULL != program)
+	{
+		for (i = 0; i < program->var_count; ++i)
+		{
+			free(program->var_names[i]);
+		}
+
+		free(program->var_names);
+		free(program->code);
+		free(program);
+	}
+}
+
+
+/******************************************************************************
+*								CalcVarCount
+*******************************************************************************/
+size_t CalcVarCount(const calc_program_t *program)
+{
+	assert(program);
+
+	return (program->var_count);
+}
+
+
+/******************************************************************************
+*								CalcVarName
+*******************************************************************************/
+const char *CalcVarName(const calc_program_t *program, size_t index)
+{
+	assert(program);
+
+	if (index >= program->var_count)
+	{
+		return (NULL);
+	}
+
+	return (program->var_names[index]);
+}
+
+
+/******************************************************************************
+*								CalcVarIndex
+*******************************************************************************/
+long CalcVarIndex(const calc_program_t *program, const char *name)
+{
+	assert(name);
+
+	return (ProgramFindVar(program, name, strlen(name)));
+}
+
+
+/******************************************************************************
+*								CalcEval
+*******************************************************************************/
+result_t CalcEval(const calc_program_t *program, const double *vars)
+{
+	double local_stack[LOCAL_STACK_SIZE];
+	double *stack = local_stack;
+	double *top = NULL;	/* points to the next free cell */
+	const calc_instr_t *ip = NULL;
+	const calc_instr_t *end = NULL;
+	result_t result = {0};
+
+	assert(program);
+	assert(vars || 0 == program->var_count);
+
+	if (program->max_depth > LOCAL_STACK_SIZE)
+	{
+		stack = (double *)malloc(program->max_depth * sizeof(double));
+		if (NULL == stack)
+		{
+			result.result = RESULT_WHEN_ERROR;
+			result.status = APPLICATION_ERROR;
+			return (result);
+		}
+	}
+
+	top = stack;
+	end = program->code + program->length;
+
+	/*** main loop ***/
+	for (ip = program->code; ip < end && CALC_SUCCESS == result.status; ++ip)
+	{
+		switch (ip->opcode)
+		{
+			case OPC_CONST:
+				*top = ip->value;
+				++top;
+				break;
+
+			case OPC_VAR:
+				*top = vars[ip->arg];
+				++top;
+				break;
+
+			case OPC_ADD:
+				--top;
+				top[-1] += top[0];
+				break;
+
+			case OPC_SUB:
+				--top;
+				top[-1] -= top[0];
+				break;
+
+			case OPC_MUL:
+				--top;
+				top[-1] *= top[0];
+				break;
+
+			case OPC_DIV:
+				--top;
+				if (0 != top[0])
+				{
+					top[-1] /= top[0];
+				}
+				else
+				{
+					result.status = MATH_ERROR;
+				}
+				break;
+
+			case OPC_POW:
+				--top;
+				top[-1] = ProgramPow(top[-1], top[0]);
+				if (isnan(top[-1]))
+				{
+					result.status = MATH_ERROR;
+				}
+				break;
+
+			/* x ^ 2 after CalcOptimize - it fails as pow does */
+			case OPC_SQUARE:
+				top[-1] *= top[-1];
+				if (isnan(top[-1]))
+				{
+					result.status = MATH_ERROR;
+				}
+				break;
+
+			/* calls of the built-in functions */
+			case OPC_SQRT:
+			case OPC_LOG:
+			case OPC_EXP:
+			case OPC_SIN:
+			case OPC_ABS:
+				top[-1] = ProgramCall(ip->opcode, top[-1], 0);
+				if (isnan(top[-1]))
+				{
+					result.status = MATH_ERROR;
+				}
+				break;
+
+			case OPC_MIN:
+			case OPC_MAX:
+				--top;
+				top[-1] = ProgramCall(ip->opcode, top[-1], top[0]);
+				if (isnan(top[-1]))
+				{
+					result.status = MATH_ERROR;
+				}
+				break;
+
+			default:
+				result.status = APPLICATION_ERROR;
+				break;
+		}
+	}
+
+	if (CALC_SUCCESS == result.status)
+	{
+		result.result = top[-1];
+	}
+	else
+	{
+		result.result = RESULT_WHEN_ERROR;
+	}
+
+	if (stack != local_stack)
+	{
+		free(stack);
+	}
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								CalcEvalExact
+*******************************************************************************/
+calc_exact_t CalcEvalExact(const calc_program_t *program, const double *vars)
+{
+	exact_cell_t local_stack[LOCAL_STACK_SIZE];
+	exact_cell_t *stack = local_stack;
+	exact_cell_t *top = NULL;	/* points to the next free cell */
+	const calc_instr_t *ip = NULL;
+	const calc_instr_t *end = NULL;
+	calc_exact_t result = {0};
+
+	assert(program);
+	assert(vars || 0 == program->var_count);
+
+	if (program->max_depth > LOCAL_STACK_SIZE)
+	{
+		stack = (exact_cell_t *)malloc(program->max_depth *
+		                               sizeof(exact_cell_t));
+		if (NULL == stack)
+		{
+			result.integer = RESULT_WHEN_ERROR;
+			result.result = RESULT_WHEN_ERROR;
+			result.status = APPLICATION_ERROR;
+			return (result);
+		}
+	}
+
+	top = stack;
+	end = program->code + program->length;
+
+	/*** main loop ***/
+	for (ip = program->code; ip < end && CALC_SUCCESS == result.status; ++ip)
+	{
+		switch (ip->opcode)
+		{
+			case OPC_CONST:
+				ExactPush(top, ip->value);
+				++top;
+				break;
+
+			case OPC_VAR:
+				ExactPush(top, vars[ip->arg]);
+				++top;
+				break;
+
+			case OPC_SQUARE:
+			case OPC_SQRT:
+			case OPC_LOG:
+			case OPC_EXP:
+			case OPC_SIN:
+			case OPC_ABS:
+				result.status = ExactOp(top - 1, top - 1, ip->opcode);
+				break;
+
+			default:
+				--top;
+				result.status = ExactOp(top - 1, top, ip->opcode);
+				break;
+		}
+	}
+
+	if (CALC_SUCCESS == result.status)
+	{
+		result.is_integer = top[-1].is_integer;
+		result.integer = (top[-1].is_integer) ? top[-1].integer : 0;
+		result.result = (top[-1].is_integer) ? (double)top[-1].integer :
+		                                       top[-1].value;
+	}
+	else
+	{
+		result.integer = RESULT_WHEN_ERROR;
+		result.result = RESULT_WHEN_ERROR;
+	}
+
+	if (stack != local_stack)
+	{
+		free(stack);
+	}
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								ProgramPow
+*******************************************************************************/
+double ProgramPow(double base, double exponent)
+{
+	double result = 1;
+	double power = base;
+	long n = 0;
+
+	if (0 == exponent)
+	{
+		return (1);
+	}
+
+	if (1 == exponent)
+	{
+		return (base);
+	}
+
+	if (2 == exponent)
+	{
+		return (base * base);
+	}
+
+	/* pow(-0, 0.5) is 0 and pow(-inf, 0.5) is inf - not the root */
+	if (0.5 == exponent)
+	{
+		return (((0 == base && signbit(base)) || -INFINITY == base) ?
+		        pow(base, exponent) : sqrt(base));
+	}
+
+	if (fabs(exponent) <= MAX_INT_EXPONENT && exponent == (long)exponent &&
+	    IsExactInteger(base))
+	{
+		/* by squaring - while every step is a whole number up to 2^53 */
+		for (n = labs((long)exponent); n > 0; n >>= 1)
+		{
+			if (n & 1)
+			{
+				result *= power;
+				if (fabs(result) > MAX_EXACT_DOUBLE)
+				{
+					return (pow(base, exponent));
+				}
+			}
+
+			if (n > 1)
+			{
+				power *= power;
+				if (fabs(power) > MAX_EXACT_DOUBLE)
+				{
+					return (pow(base, exponent));
+				}
+			}
+		}
+
+		return ((exponent < 0) ? 1 / result : result);
+	}
+
+	return (pow(base, exponent));
+}
+
+
+/******************************************************************************
+*								IsExactInteger
+*******************************************************************************/
+static int IsExactInteger(double value)
+{
+	/* false for NaN too */
+	return (fabs(value) <= MAX_EXACT_DOUBLE &&
+	        value == (double)(long long)value);
+}
+
+
+/******************************************************************************
+*								ExactPush
+*******************************************************************************/
+static void ExactPush(exact_cell_t *cell, double value)
+{
+	/* -0 isn't the integer 0 - its sign shows in 1 / x, so it stays a
+	   double */
+	cell->is_integer = IsExactInteger(value) && !(0 == value &&
+	                                              signbit(value));
+	cell->integer = (cell->is_integer) ? (long long)value : 0;
+	cell->value = value;
+}
+
+
+/******************************************************************************
+*								ExactOp
+*******************************************************************************/
+static int ExactOp(exact_cell_t *a, const exact_cell_t *b,
+                   unsigned int opcode)
+{
+	long long integer = 0;
+	double x = 0;
+	double y = 0;
+
+	/* a = a <op> b. in integers while it is exact - no overflow, no
+	   remainder */
+	if (a->is_integer && b->is_integer)
+	{
+		switch (opcode)
+		{
+			case OPC_ADD:
+				if (!__builtin_add_overflow(a->integer, b->integer, &integer))
+				{
+					a->integer = integer;
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_SUB:
+				if (!__builtin_sub_overflow(a->integer, b->integer, &integer))
+				{
+					a->integer = integer;
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_MUL:
+			case OPC_SQUARE:
+				/* but not 0 by a negative - that's -0 */
+				if (!__builtin_mul_overflow(a->integer, b->integer, &integer) &&
+				    !(0 == integer && (a->integer < 0 || b->integer < 0)))
+				{
+					a->integer = integer;
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_DIV:
+				if (0 == b->integer)
+				{
+					return (MATH_ERROR);
+				}
+				if (!(LLONG_MIN == a->integer && -1 == b->integer) &&
+				    !(0 == a->integer && b->integer < 0) &&
+				    0 == a->integer % b->integer)
+				{
+					a->integer /= b->integer;
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_POW:
+				if (b->integer >= 0 &&
+				    0 == IntPow(a->integer, b->integer, &integer))
+				{
+					a->integer = integer;
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_ABS:
+				if (LLONG_MIN != a->integer)
+				{
+					a->integer = llabs(a->integer);
+					return (CALC_SUCCESS);
+				}
+				break;
+
+			case OPC_MIN:
+				a->integer = (a->integer < b->integer) ? a->integer :
+				                                         b->integer;
+				return (CALC_SUCCESS);
+
+			case OPC_MAX:
+				a->integer = (a->integer > b->integer) ? a->integer :
+				                                         b->integer;
+				return (CALC_SUCCESS);
+
+			default:
+				break;
+		}
+	}
+
+	/* promoted to double for good - from here on as CalcEval */
+	x = (a->is_integer) ? (double)a->integer : a->value;
+	y = (b->is_integer) ? (double)b->integer : b->value;
+	a->is_integer = 0;
+
+	switch (opcode)
+	{
+		case OPC_ADD:
+			a->value = x + y;
+			return (CALC_SUCCESS);
+
+		case OPC_SUB:
+			a->value = x - y;
+			return (CALC_SUCCESS);
+
+		case OPC_MUL:
+			a->value = x * y;
+			return (CALC_SUCCESS);
+
+		case OPC_DIV:
+			a->value = x / y;
+			return ((0 != y) ? CALC_SUCCESS : MATH_ERROR);
+
+		case OPC_POW:
+			a->value = ProgramPow(x, y);
+			break;
+
+		case OPC_SQUARE:
+			a->value = x * x;
+			break;
+
+		case OPC_SQRT:
+		case OPC_LOG:
+		case OPC_EXP:
+		case OPC_SIN:
+		case OPC_ABS:
+		case OPC_MIN:
+		case OPC_MAX:
+			a->value = ProgramCall(opcode, x, y);
+			break;
+
+		default:
+			return (APPLICATION_ERROR);
+	}
+
+	return (isnan(a->value) ? MATH_ERROR : CALC_SUCCESS);
+}
+
+
+/******************************************************************************
+*								IntPow
+*******************************************************************************/
+static int IntPow(long long base, long long exponent, long long *result)
+{
+	long long power = base;
+
+	/* by squaring. -1 on overflow */
+	*result = 1;
+	for (; exponent > 0; exponent >>= 1)
+	{
+		if ((exponent & 1) && __builtin_mul_overflow(*result, power, result))
+		{
+			return (-1);
+		}
+
+		if (exponent > 1 && __builtin_mul_overflow(power, power, &power))
+		{
+			return (-1);
+		}
+	}
+
+	return (0);
+}
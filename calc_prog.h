@@ -0,0 +1,112 @@
+/*****************************************************************************
+ *  File name  : calc_prog.h
+ *  Developer  : Eyal Weizman
+ *	Description: compiled-program internals - shared by the calculator modules.
+ *	             not part of the public API (see calc.h).
+ *****************************************************************************/
+
+#ifndef __CALC_PROG_H__
+#define __CALC_PROG_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* operation codes of the postfix program */
+enum calc_opcode
+{
+	OPC_CONST,	/* push 'value' */
+	OPC_VAR,	/* push variable number 'arg' */
+	OPC_ADD,
+	OPC_SUB,
+	OPC_MUL,
+	OPC_DIV,
+	OPC_POW,
+	OPC_SQUARE,	/* unary - pops 1 value and pushes its square */
+	OPC_SQRT,	/* unary - pops 1 value and pushes its square root */
+	OPC_LOG,	/* the other built-in functions - unary */
+	OPC_EXP,
+	OPC_SIN,
+	OPC_ABS,
+	OPC_MIN,	/* binary - the first argument is popped last */
+	OPC_MAX,
+	MAX_OPCODES
+};
+
+/* a single postfix instruction. binary ops pop 2 values and push 1 */
+typedef struct calc_instr_s
+{
+	unsigned int opcode;	/* one of enum calc_opcode */
+	unsigned int arg;		/* operand index, 0 when unused */
+	double value;			/* constant value of OPC_CONST */
+}calc_instr_t;
+
+struct calc_program_s
+{
+	calc_instr_t *code;		/* flat postfix array */
+	size_t length;			/* number of instructions in 'code' */
+	size_t capacity;		/* allocated instructions in 'code' */
+	size_t max_depth;		/* deepest evaluation stack the program needs */
+	char **var_names;		/* name of each variable slot */
+	size_t var_count;		/* number of variable slots */
+	size_t var_capacity;	/* allocated entries in 'var_names' */
+};
+
+/*  ProgramPow is pow(base, exponent), with fast paths for the exponents
+ *  formulas use most. every '^' goes through it - Calculate, CalcEval, the
+ *  batch kernels, the optimizer and the JIT - so they all agree:
+ *  - 0 and 1 are 1 and the base, as pow has them.
+ *  - 2 is base * base, and 0.5 the square root (but for -0 and -inf, where
+ *    pow differs). both are correctly rounded - pow may be a little off.
+ *  - other integers up to 64, on a whole base, are multiplied out by
+ *    squaring while the powers stay exact (up to 2^53) - exact, so the same
+ *    as pow. a negative one is 1 over that - a single rounding.
+ *  anything else is pow.
+ */
+double ProgramPow(double base, double exponent);
+
+/*  ProgramArity returns the number of values the instruction 'opcode' pops -
+ *  0 for the operands, 1 or 2 for the ops (each pushes 1) - or -1 if there
+ *  is no such opcode.
+ */
+int ProgramArity(unsigned int opcode);
+
+/*  ProgramFindFunc returns the opcode of the built-in function 'name' (of
+ *  'len' chars, not NUL-terminated), or -1 if there is no such function:
+ *  sqrt, log, exp, sin, abs (one argument), min and max (two).
+ */
+int ProgramFindFunc(const char *name, size_t len);
+
+/*  ProgramCall is the function of a call instruction 'opcode' on its
+ *  arguments - 'b' is ignored by the unary ones. every single call goes
+ *  through it - Calculate, CalcEval, CalcEvalExact and the optimizer - and
+ *  the JIT calls the same libm functions, so they all agree: sqrt, log, exp
+ *  and sin are libm's, abs is fabs, min(a, b) is a < b ? a : b and max(a, b)
+ *  is a > b ? a : b (minsd / maxsd). a NaN result is a math error, as a NaN
+ *  out of '^' - log(0) is -inf, not an error. the batch kernels approximate
+ *  log, exp and sin instead - see calc_batch.h.
+ */
+double ProgramCall(unsigned int opcode, double a, double b);
+
+/*  ProgramCreate creates an empty program. returns NULL on failure.
+ */
+calc_program_t *ProgramCreate(void);
+
+/*  ProgramEmit appends an instruction to the end of the program, growing it
+ *  when needed. returns 0 in case of success and -1 on allocation failure.
+ */
+int ProgramEmit(calc_program_t *program, unsigned int opcode,
+                unsigned int arg, double value);
+
+/*  ProgramFindVar returns the slot of the variable 'name' (of 'len' chars,
+ *  not NUL-terminated), or -1 if the program has no such variable.
+ */
+long ProgramFindVar(const calc_program_t *program, const char *name,
+                    size_t len);
+
+/*  ProgramAddVar returns the slot of the variable 'name', giving it the next
+ *  free slot if it is new. returns -1 on allocation failure.
+ */
+long ProgramAddVar(calc_program_t *program, const char *name, size_t len);
+
+#endif     /* __CALC_PROG_H__ */
@@ -0,0 +1,594 @@
+/*******************************************************************************
+*	Filename	:	calc_ring.c
+*	Developer	:	Eyal Weizman
+*	Description	:	shared-memory request ring - bounded slots with sequence
+*					numbers, answered in place, futexes for the sleepers
+*******************************************************************************/
+#include <assert.h> 		/* assert */
+#include <stdlib.h>			/* malloc, free */
+#include <string.h>			/* memcpy, strlen, strcpy */
+#include <stdint.h>			/* uint32_t, int32_t, uint64_t */
+#include <limits.h>			/* INT_MAX */
+#include <stdatomic.h>		/* atomic_uint */
+#include <unistd.h>			/* close, ftruncate, unlink, syscall */
+#include <fcntl.h>			/* open */
+#include <sched.h>			/* sched_yield */
+#include <sys/stat.h>		/* fstat */
+#include <sys/mman.h>		/* mmap, munmap */
+#include <sys/syscall.h>	/* SYS_futex */
+#include <linux/futex.h>	/* FUTEX_WAIT, FUTEX_WAKE */
+
+#include "calc_ring.h"
+
+/******************************* MACROS ***************************************/
+#define CACHE_LINE 64
+
+#define RING_MAGIC 0x474E4952434C4143ULL	/* "CALCRING" */
+#define MIN_CAPACITY 4
+#define MAX_CAPACITY (1UL << 24)
+
+/* rounds of polling before a waiting client sleeps - a few microseconds,
+   longer than most calculations take */
+#define WAIT_SPINS 200
+
+/* the slot of position 'pos' - its state is in its sequence number:
+   pos - free, pos + 1 - a request, pos + 2 - its result, and
+   pos + capacity once the result is taken - free for the next lap */
+#define SLOT_REQUEST(pos) ((pos) + 1)
+#define SLOT_RESULT(pos) ((pos) + 2)
+
+#define ROUND_UP(x, align) (((x) + (align) - 1) / (align) * (align))
+
+/*************************** structs & typedefs *******************************/
+/* the start of the shared file. positions run over 32 bits and wrap - they
+   are compared only by their difference */
+typedef struct ring_header_s
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t capacity;			/* slots - a power of 2 */
+	uint32_t max_length;		/* chars of a request */
+	uint32_t stride;			/* bytes of a slot */
+	uint32_t mode;				/* calc_ring_mode_t */
+	_Alignas(CACHE_LINE) atomic_uint tail;	/* the next position submitted */
+	_Alignas(CACHE_LINE) atomic_uint head;	/* the next position answered */
+	atomic_uint is_sleeping;	/* the evaluator - submits wake it */
+	atomic_uint doorbell;		/* its futex - bumped by every wake */
+	atomic_uint is_stopped;
+}ring_header_t;
+
+typedef struct slot_s
+{
+	atomic_uint seq;			/* the state - and the futex of its client */
+	atomic_uint has_waiter;		/* the client sleeps - the result wakes it */
+	uint32_t len;
+	int32_t status;
+	double result;
+	char expr[];				/* max_length chars */
+}slot_t;
+
+struct calc_ring_s
+{
+	ring_header_t *header;		/* the mapping */
+	char *slots;
+	size_t map_size;
+	char *path;					/* of the creator - removed on close */
+	calc_arena_t *arena;		/* scratch of the evaluator */
+};
+
+/************************* internal functions *********************************/
+static calc_ring_t *MapRing(int fd, size_t size);
+static slot_t *SlotAt(const calc_ring_t *ring, uint32_t pos);
+static void AnswerSlot(calc_ring_t *ring, slot_t *slot, uint32_t pos);
+static void SleepEvaluator(calc_ring_t *ring, size_t *idle);
+static void FutexWait(atomic_uint *word, uint32_t value);
+static void FutexWake(atomic_uint *word, int count);
+static void SpinPause(void);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcRingCreate
+*******************************************************************************/
+calc_ring_t *CalcRingCreate(const char *path, size_t capacity,
+                            size_t max_length, calc_ring_mode_t mode)
+{
+	calc_ring_t *ring = NULL;
+	ring_header_t *header = NULL;
+	size_t rounded = MIN_CAPACITY;
+	size_t stride = 0;
+	size_t size = 0;
+	size_t i = 0;
+	int fd = -1;
+
+	assert(path);
+
+	for (; rounded < capacity && rounded < MAX_CAPACITY; rounded *= 2)
+	{
+	}
+	stride = ROUND_UP(sizeof(slot_t) + max_length, CACHE_LINE);
+	size = ROUND_UP(sizeof(ring_header_t), CACHE_LINE) + rounded * stride;
+
+	/* a new file, never the old one truncated - a process still attached
+	   to a ring at 'path' keeps its own, whole */
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0 || max_length > UINT32_MAX / 2 || 0 != ftruncate(fd, size))
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(path);
+		}
+		return (NULL);
+	}
+
+	ring = MapRing(fd, size);
+	close(fd);
+	if (NULL != ring)
+	{
+		ring->path = (char *)malloc(strlen(path) + 1);
+	}
+	if (NULL == ring || NULL == ring->path)
+	{
+		CalcRingClose(ring);
+		unlink(path);
+		return (NULL);
+	}
+	strcpy(ring->path, path);
+
+	/* the file is new - zeros. every slot is free for its first lap */
+	header = ring->header;
+	header->version = CALC_RING_VERSION;
+	header->capacity = rounded;
+	header->max_length = max_length;
+	header->stride = stride;
+	header->mode = mode;
+	for (i = 0; i < rounded; ++i)
+	{
+		atomic_init(&SlotAt(ring, i)->seq, i);
+	}
+
+	/* last - an opener that sees the magic sees all the rest */
+	atomic_thread_fence(memory_order_release);
+	header->magic = RING_MAGIC;
+
+	return (ring);
+}
+
+
+/******************************************************************************
+*								CalcRingOpen
+*******************************************************************************/
+calc_ring_t *CalcRingOpen(const char *path)
+{
+	struct stat file_stat;
+	calc_ring_t *ring = NULL;
+	const ring_header_t *header = NULL;
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		return (NULL);
+	}
+	if (0 != fstat(fd, &file_stat) ||
+	    (size_t)file_stat.st_size < sizeof(ring_header_t))
+	{
+		close(fd);
+		return (NULL);
+	}
+
+	ring = MapRing(fd, file_stat.st_size);
+	close(fd);
+	if (NULL == ring)
+	{
+		return (NULL);
+	}
+
+	/* a ring of this layout, and as large as it says */
+	header = ring->header;
+	atomic_thread_fence(memory_order_acquire);
+	if (RING_MAGIC != header->magic || CALC_RING_VERSION != header->version ||
+	    0 == header->capacity ||
+	    0 != (header->capacity & (header->capacity - 1)) ||
+	    header->stride < sizeof(slot_t) + header->max_length ||
+	    ROUND_UP(sizeof(ring_header_t), CACHE_LINE) +
+	    (size_t)header->capacity * header->stride != ring->map_size)
+	{
+		CalcRingClose(ring);
+		return (NULL);
+	}
+
+	return (ring);
+}
+
+
+/******************************************************************************
+*								CalcRingClose
+*******************************************************************************/
+void CalcRingClose(calc_ring_t *ring)
+{
+	if (NULL == ring)
+	{
+		return;
+	}
+
+	munmap(ring->header, ring->map_size);
+	if (NULL != ring->path)
+	{
+		unlink(ring->path);
+	}
+
+	CalcArenaDestroy(ring->arena);
+	free(ring->path);
+	free(ring);
+}
+
+
+/******************************************************************************
+*								CalcRingSubmit
+*******************************************************************************/
+int CalcRingSubmit(calc_ring_t *ring, const char *str, size_t len,
+                   unsigned int *ticket)
+{
+	ring_header_t *header = NULL;
+	slot_t *slot = NULL;
+	uint32_t pos = 0;
+	int32_t lag = 0;
+
+	assert(ring);
+	assert(str || 0 == len);
+	assert(ticket);
+
+	header = ring->header;
+	if (len > header->max_length ||
+	    atomic_load_explicit(&header->is_stopped, memory_order_relaxed))
+	{
+		return (-1);
+	}
+
+	/* claims the slot at the tail - with a CAS only if others may race */
+	pos = atomic_load_explicit(&header->tail, memory_order_relaxed);
+	while (1)
+	{
+		slot = SlotAt(ring, pos);
+		lag = (int32_t)(atomic_load_explicit(&slot->seq,
+		                                     memory_order_acquire) - pos);
+		if (lag < 0)
+		{
+			/* its last lap's result isn't taken yet - the ring is full */
+			return (-1);
+		}
+
+		if (0 < lag)
+		{
+			/* another producer took it */
+			pos = atomic_load_explicit(&header->tail, memory_order_relaxed);
+		}
+		else if (CALC_RING_SPSC == header->mode)
+		{
+			atomic_store_explicit(&header->tail, pos + 1,
+			                      memory_order_relaxed);
+			break;
+		}
+		else if (atomic_compare_exchange_weak_explicit(&header->tail, &pos,
+		         pos + 1, memory_order_relaxed, memory_order_relaxed))
+		{
+			break;
+		}
+	}
+
+	memcpy(slot->expr, str, len);
+	slot->len = len;
+	atomic_store_explicit(&slot->has_waiter, 0, memory_order_relaxed);
+
+	/* published - and a sleeping evaluator woken. the store and the load
+	   are both seq_cst, so the evaluator can't miss it and sleep on */
+	atomic_store(&slot->seq, SLOT_REQUEST(pos));
+	if (atomic_load(&header->is_sleeping))
+	{
+		atomic_fetch_add(&header->doorbell, 1);
+		FutexWake(&header->doorbell, 1);
+	}
+
+	*ticket = pos;
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								CalcRingWait
+*******************************************************************************/
+result_t CalcRingWait(calc_ring_t *ring, unsigned int ticket)
+{
+	ring_header_t *header = NULL;
+	slot_t *slot = NULL;
+	result_t result = {-1, APPLICATION_ERROR};
+	size_t spins = 0;
+
+	assert(ring);
+
+	header = ring->header;
+	slot = SlotAt(ring, ticket);
+	while (SLOT_RESULT(ticket) != atomic_load_explicit(&slot->seq,
+	                                                   memory_order_acquire))
+	{
+		/* no evaluator will answer it */
+		if (atomic_load_explicit(&header->is_stopped, memory_order_relaxed))
+		{
+			return (result);
+		}
+
+		if (spins++ < WAIT_SPINS)
+		{
+			SpinPause();
+			continue;
+		}
+
+		/* the flag before the last looks - the evaluator's (and
+		   CalcRingStop's) store and look at the flag are in the other
+		   order, so one sees the other */
+		atomic_store(&slot->has_waiter, 1);
+		if (SLOT_RESULT(ticket) == atomic_load(&slot->seq))
+		{
+			break;
+		}
+		if (atomic_load(&header->is_stopped))
+		{
+			return (result);
+		}
+		FutexWait(&slot->seq, SLOT_REQUEST(ticket));
+	}
+
+	result.result = slot->result;
+	result.status = slot->status;
+
+	/* free for the next lap */
+	atomic_store_explicit(&slot->seq, ticket + ring->header->capacity,
+	                      memory_order_release);
+
+	return (result);
+}
+
+
+/******************************************************************************
+*								CalcRingCalcN
+*******************************************************************************/
+result_t CalcRingCalcN(calc_ring_t *ring, const char *str, size_t len)
+{
+	result_t result = {-1, LIMIT_ERROR};
+	unsigned int ticket = 0;
+
+	assert(ring);
+
+	if (len > ring->header->max_length)
+	{
+		return (result);
+	}
+
+	/* full - the evaluator (or the clients taking results) run meanwhile */
+	while (0 != CalcRingSubmit(ring, str, len, &ticket))
+	{
+		if (atomic_load_explicit(&ring->header->is_stopped,
+		                         memory_order_relaxed))
+		{
+			result.status = APPLICATION_ERROR;
+			return (result);
+		}
+		sched_yield();
+	}
+
+	return (CalcRingWait(ring, ticket));
+}
+
+
+/******************************************************************************
+*								CalcRingServe
+*******************************************************************************/
+size_t CalcRingServe(calc_ring_t *ring, size_t max)
+{
+	ring_header_t *header = NULL;
+	slot_t *slot = NULL;
+	uint32_t head = 0;
+	size_t count = 0;
+
+	assert(ring);
+
+	header = ring->header;
+	head = atomic_load_explicit(&header->head, memory_order_relaxed);
+	for (; count < max; ++count, ++head)
+	{
+		slot = SlotAt(ring, head);
+		if (SLOT_REQUEST(head) != atomic_load_explicit(&slot->seq,
+		                                               memory_order_acquire))
+		{
+			break;
+		}
+
+		AnswerSlot(ring, slot, head);
+	}
+
+	atomic_store_explicit(&header->head, head, memory_order_relaxed);
+
+	return (count);
+}
+
+
+/******************************************************************************
+*								CalcRingRun
+*******************************************************************************/
+void CalcRingRun(calc_ring_t *ring, size_t spins)
+{
+	size_t idle = 0;
+
+	assert(ring);
+
+	while (!atomic_load_explicit(&ring->header->is_stopped,
+	                             memory_order_relaxed))
+	{
+		if (0 < CalcRingServe(ring, ring->header->capacity))
+		{
+			idle = 0;
+		}
+		else if (idle++ < spins)
+		{
+			SpinPause();
+		}
+		else
+		{
+			SleepEvaluator(ring, &idle);
+		}
+	}
+}
+
+
+/******************************************************************************
+*								CalcRingStop
+*******************************************************************************/
+void CalcRingStop(calc_ring_t *ring)
+{
+	slot_t *slot = NULL;
+	size_t i = 0;
+
+	assert(ring);
+
+	atomic_store(&ring->header->is_stopped, 1);
+	atomic_fetch_add(&ring->header->doorbell, 1);
+	FutexWake(&ring->header->doorbell, INT_MAX);
+
+	/* and the clients asleep on their results - they see the flag */
+	for (i = 0; i < ring->header->capacity; ++i)
+	{
+		slot = SlotAt(ring, i);
+		if (atomic_load(&slot->has_waiter))
+		{
+			FutexWake(&slot->seq, INT_MAX);
+		}
+	}
+}
+
+
+/******************************************************************************
+*								MapRing
+*******************************************************************************/
+static calc_ring_t *MapRing(int fd, size_t size)
+{
+	calc_ring_t *ring = (calc_ring_t *)calloc(1, sizeof(calc_ring_t));
+	void *map = NULL;
+
+	if (NULL == ring)
+	{
+		return (NULL);
+	}
+
+	ring->arena = CalcArenaCreate(0);
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (NULL == ring->arena || MAP_FAILED == map)
+	{
+		if (MAP_FAILED != map)
+		{
+			munmap(map, size);
+		}
+		CalcArenaDestroy(ring->arena);
+		free(ring);
+		return (NULL);
+	}
+
+	ring->header = (ring_header_t *)map;
+	ring->slots = (char *)map + ROUND_UP(sizeof(ring_header_t), CACHE_LINE);
+	ring->map_size = size;
+
+	return (ring);
+}
+
+
+/******************************************************************************
+*								SlotAt
+*******************************************************************************/
+static slot_t *SlotAt(const calc_ring_t *ring, uint32_t pos)
+{
+	const ring_header_t *header = ring->header;
+
+	return ((slot_t *)(ring->slots +
+	                   (size_t)(pos & (header->capacity - 1)) * header->stride));
+}
+
+
+/******************************************************************************
+*								AnswerSlot
+*******************************************************************************/
+static void AnswerSlot(calc_ring_t *ring, slot_t *slot, uint32_t pos)
+{
+	/* the length is checked again - the slot is writable by any process */
+	uint32_t len = (slot->len <= ring->header->max_length) ?
+	               slot->len : ring->header->max_length;
+	result_t result = CalcNArena(slot->expr, len, ring->arena);
+
+	slot->result = result.result;
+	slot->status = result.status;
+
+	/* seq_cst, against the client's flag - see CalcRingWait */
+	atomic_store(&slot->seq, SLOT_RESULT(pos));
+	if (atomic_load(&slot->has_waiter))
+	{
+		FutexWake(&slot->seq, INT_MAX);
+	}
+}
+
+
+/******************************************************************************
+*								SleepEvaluator
+*******************************************************************************/
+static void SleepEvaluator(calc_ring_t *ring, size_t *idle)
+{
+	ring_header_t *header = ring->header;
+	uint32_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+	uint32_t doorbell = 0;
+
+	/* the doorbell is read before the last look at the ring - a submit
+	   after it bumps the doorbell, and the futex doesn't sleep */
+	atomic_store(&header->is_sleeping, 1);
+	doorbell = atomic_load(&header->doorbell);
+	if (SLOT_REQUEST(head) != atomic_load(&SlotAt(ring, head)->seq) &&
+	    !atomic_load(&header->is_stopped))
+	{
+		FutexWait(&header->doorbell, doorbell);
+	}
+	atomic_store(&header->is_sleeping, 0);
+
+	*idle = 0;
+}
+
+
+/******************************************************************************
+*								FutexWait
+*******************************************************************************/
+static void FutexWait(atomic_uint *word, uint32_t value)
+{
+	/* not FUTEX_PRIVATE - the word is shared between processes. returns
+	   at once if the word isn't 'value' any more */
+	syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+
+/******************************************************************************
+*								FutexWake
+*******************************************************************************/
+static void FutexWake(atomic_uint *word, int count)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+
+/******************************************************************************
+*								SpinPause
+*******************************************************************************/
+static void SpinPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
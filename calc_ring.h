@@ -0,0 +1,124 @@
+/*****************************************************************************
+ *  File name  : calc_ring.h
+ *  Developer  : Eyal Weizman
+ *	Description: shared-memory request ring - calculations across processes
+ *	             with no system call on the fast path
+ *****************************************************************************/
+
+#ifndef __CALC_RING_H__
+#define __CALC_RING_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* version of the ring layout - a ring of another version isn't opened */
+#define CALC_RING_VERSION 1
+
+/* opaque handle of a ring, mapped into this process */
+typedef struct calc_ring_s calc_ring_t;
+
+/* who may submit to a ring */
+typedef enum calc_ring_mode_e
+{
+	CALC_RING_SPSC,		/* one thread of one process - no atomic RMW */
+	CALC_RING_MPSC		/* any threads of any processes */
+}calc_ring_mode_t;
+
+/*********************************** CalcRingCreate **************************/
+/*	Description      :	Creates a ring in a new file 'path' -
+ *	                  	a file under /dev/shm keeps it in memory - and maps
+ *	                  	it. other processes attach with CalcRingOpen.
+ *	                  	a file already at 'path' is unlinked, not reused -
+ *	                  	those attached to it keep the old ring.
+ *
+ *	                  	the ring has 'capacity' slots (rounded up to a
+ *	                  	power of 2, at least 4), each holding a request of
+ *	                  	up to 'max_length' chars and then its result. a
+ *	                  	slot is free again once its result is taken.
+ *
+ *	Return Values    :	the ring, or NULL if the file can't be created or
+ *	                  	memory can't be allocated.
+ */
+calc_ring_t *CalcRingCreate(const char *path, size_t capacity,
+                            size_t max_length, calc_ring_mode_t mode);
+
+/*********************************** CalcRingOpen ****************************/
+/*	Description      :	Maps the ring created at 'path'.
+ *
+ *	Return Values    :	the ring, or NULL if the file can't be mapped or
+ *	                  	isn't a ring of this version.
+ */
+calc_ring_t *CalcRingOpen(const char *path);
+
+/*********************************** CalcRingClose ***************************/
+/*	Description      :	Unmaps the ring - the creator removes the file too.
+ *	                  	NULL is allowed and ignored.
+ */
+void CalcRingClose(calc_ring_t *ring);
+
+/*********************************** CalcRingSubmit **************************/
+/*	Description      :	Copies the 'len' chars at 'str' into a free slot
+ *	                  	and hands them to the evaluator. never blocks.
+ *
+ *	Input            :	ticket - receives the ticket of the request, for
+ *	                  	CalcRingWait.
+ *
+ *	Return Values    :	0 on success, -1 if no slot is free (the results
+ *	                  	in the ring aren't taken yet), len > max_length or
+ *	                  	the ring is stopped.
+ *
+ *	Time Complexity  : O(len)
+ */
+int CalcRingSubmit(calc_ring_t *ring, const char *str, size_t len,
+                   unsigned int *ticket);
+
+/*********************************** CalcRingWait ****************************/
+/*	Description      :	Returns the result of a submitted request and frees
+ *	                  	its slot. spins a while for it, then sleeps on a
+ *	                  	futex until the evaluator wakes it. each ticket is
+ *	                  	waited for once, by the process that submitted it.
+ *
+ *	Return Values    :	as CalcNLimited (limited by max_length), or
+ *	                  	APPLICATION_ERROR (result -1) if the ring is
+ *	                  	stopped before the result comes.
+ */
+result_t CalcRingWait(calc_ring_t *ring, unsigned int ticket);
+
+/*********************************** CalcRingCalcN ***************************/
+/*	Description      :	CalcN through the ring - submits (yielding while
+ *	                  	the ring is full) and waits.
+ *
+ *	Return Values    :	as CalcRingWait, or LIMIT_ERROR if len >
+ *	                  	max_length, or APPLICATION_ERROR if the ring is
+ *	                  	stopped while full.
+ */
+result_t CalcRingCalcN(calc_ring_t *ring, const char *str, size_t len);
+
+/*********************************** CalcRingServe ***************************/
+/*	Description      :	The evaluator: answers up to 'max' requests, in the
+ *	                  	order submitted, without waiting for more. a ring
+ *	                  	has one evaluator at a time - one thread of one
+ *	                  	process.
+ *
+ *	Return Values    :	the number of requests answered.
+ */
+size_t CalcRingServe(calc_ring_t *ring, size_t max);
+
+/*********************************** CalcRingRun *****************************/
+/*	Description      :	The evaluator, until CalcRingStop: answers requests
+ *	                  	as they come, polling for 'spins' rounds when idle
+ *	                  	before it sleeps on a futex. a submit wakes it only
+ *	                  	when it sleeps. many spins - less latency, a core
+ *	                  	kept busy.
+ */
+void CalcRingRun(calc_ring_t *ring, size_t spins);
+
+/*********************************** CalcRingStop ****************************/
+/*	Description      :	Makes CalcRingRun return, in any process, and the
+ *	                  	waits and submits of the ring fail from then on -
+ *	                  	the clients asleep on a result are woken.
+ */
+void CalcRingStop(calc_ring_t *ring);
+
+#endif     /* __CALC_RING_H__ */
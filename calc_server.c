@@ -0,0 +1,728 @@
+/*******************************************************************************
+*	Filename	:	calc_server.c
+*	Developer	:	Eyal Weizman
+*	Description	:	evaluation server - a pool of workers, each with its own
+*					epoll over its own connections
+*******************************************************************************/
+#define _GNU_SOURCE	/* accept4 */
+
+#include <assert.h> 		/* assert */
+#include <stdlib.h>			/* malloc, calloc, free */
+#include <string.h>			/* memchr, memcpy, memmove, strlen, strcpy */
+#include <stdio.h>			/* sprintf */
+#include <errno.h>			/* errno */
+#include <stdint.h>			/* uint32_t */
+#include <unistd.h>			/* read, close, unlink */
+#include <pthread.h>		/* pthread_create, pthread_join */
+#include <stdatomic.h>		/* atomic_ulong */
+#include <sys/socket.h>		/* socket, bind, listen, accept4, send */
+#include <sys/un.h>			/* sockaddr_un */
+#include <netinet/in.h>		/* sockaddr_in */
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <arpa/inet.h>		/* htonl, htons */
+#include <sys/epoll.h>		/* epoll_create1, epoll_ctl, epoll_wait */
+#include <sys/eventfd.h>	/* eventfd, eventfd_write */
+
+#include "calc_server.h"
+
+/******************************* MACROS ***************************************/
+/* bytes buffered per connection, each way */
+#define IN_BUFFER (CALC_SERVER_MAX_LINE + 1)
+#define OUT_BUFFER (1 << 16)
+
+/* the longest answer - '%.17g' of a double and a newline */
+#define MAX_RESULT_CHARS 32
+
+/* events a worker takes from epoll at a time */
+#define MAX_EVENTS 64
+
+#define LISTEN_BACKLOG 1024
+
+/*************************** enums ********************************************/
+/* what an epoll event is about */
+enum handle_kind
+{
+	HANDLE_STOP,		/* the server stops */
+	HANDLE_LISTENER,	/* a client connects */
+	HANDLE_CONNECTION	/* a client sent, or can take more */
+};
+
+/*************************** structs & typedefs *******************************/
+/* what epoll events point at */
+typedef struct handle_s
+{
+	enum handle_kind kind;
+	int fd;
+	int is_tcp;			/* of a listener - its connections get TCP_NODELAY */
+}handle_t;
+
+typedef struct connection_s
+{
+	handle_t handle;			/* first - epoll points at it */
+	struct connection_s *prev;	/* in the connections of its worker */
+	struct connection_s *next;
+	uint32_t interest;			/* EPOLLIN, or EPOLLOUT while answers wait */
+	int is_closing;				/* the client closed its side */
+	int is_discarding;			/* in a line too long - skipped to its end */
+	size_t in_used;
+	size_t out_sent;
+	size_t out_used;
+	char in[IN_BUFFER];
+	char out[OUT_BUFFER];
+}connection_t;
+
+typedef struct worker_s
+{
+	pthread_t thread;
+	int epoll_fd;
+	calc_server_t *server;
+	calc_arena_t *arena;		/* scratch of its calculations */
+	connection_t *connections;	/* its own - no other thread touches them */
+	atomic_ulong connections_count;
+	atomic_ulong expressions;
+	atomic_ulong errors;
+	atomic_ulong reads;
+	atomic_ulong writes;
+}worker_t;
+
+struct calc_server_s
+{
+	handle_t stop;				/* an eventfd - readable once stopping */
+	handle_t unix_listener;		/* fd -1 - none */
+	handle_t tcp_listener;
+	unsigned short tcp_port;
+	char *unix_path;
+	calc_limits_t limits;
+	worker_t *workers;
+	size_t n_workers;
+	size_t n_started;			/* workers whose thread runs */
+};
+
+/************************* internal functions *********************************/
+static int ListenUnix(calc_server_t *server, const char *path);
+static int ListenTcp(calc_server_t *server, unsigned short port);
+static int StartWorker(calc_server_t *server, worker_t *worker);
+static int Watch(int epoll_fd, handle_t *handle, uint32_t events);
+static void *WorkerLoop(void *arg);
+static void Accept(worker_t *worker, const handle_t *listener);
+static void Serve(worker_t *worker, connection_t *conn, uint32_t events);
+static int Answer(worker_t *worker, connection_t *conn);
+static void AnswerLine(worker_t *worker, connection_t *conn, const char *line,
+                       size_t len);
+static void WriteResult(connection_t *conn, result_t result);
+static int Flush(worker_t *worker, connection_t *conn);
+static void Close(worker_t *worker, connection_t *conn);
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+/******************************************************************************
+*								CalcServerCreate
+*******************************************************************************/
+calc_server_t *CalcServerCreate(const calc_server_config_t *config)
+{
+	calc_server_t *server = NULL;
+	size_t i = 0;
+
+	assert(config);
+
+	server = (calc_server_t *)calloc(1, sizeof(calc_server_t));
+	if (NULL == server)
+	{
+		return (NULL);
+	}
+
+	server->stop.kind = HANDLE_STOP;
+	server->unix_listener.kind = HANDLE_LISTENER;
+	server->unix_listener.fd = -1;
+	server->tcp_listener.kind = HANDLE_LISTENER;
+	server->tcp_listener.fd = -1;
+	server->tcp_listener.is_tcp = 1;
+	server->limits = config->limits;
+	server->n_workers = (0 == config->n_workers) ? 1 : config->n_workers;
+
+	server->stop.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	server->workers = (worker_t *)calloc(server->n_workers, sizeof(worker_t));
+	for (i = 0; NULL != server->workers && i < server->n_workers; ++i)
+	{
+		server->workers[i].epoll_fd = -1;
+	}
+
+	if (server->stop.fd < 0 || NULL == server->workers ||
+	    (NULL != config->unix_path &&
+	     0 != ListenUnix(server, config->unix_path)) ||
+	    (config->use_tcp && 0 != ListenTcp(server, config->tcp_port)))
+	{
+		CalcServerDestroy(server);
+		return (NULL);
+	}
+
+	for (i = 0; i < server->n_workers; ++i)
+	{
+		if (0 != StartWorker(server, server->workers + i))
+		{
+			CalcServerDestroy(server);
+			return (NULL);
+		}
+		++(server->n_started);
+	}
+
+	return (server);
+}
+
+
+/******************************************************************************
+*								CalcServerDestroy
+*******************************************************************************/
+void CalcServerDestroy(calc_server_t *server)
+{
+	worker_t *worker = NULL;
+	size_t i = 0;
+
+	if (NULL == server)
+	{
+		return;
+	}
+
+	/* never read - it stays readable, and wakes every worker */
+	if (server->stop.fd >= 0)
+	{
+		eventfd_write(server->stop.fd, 1);
+	}
+
+	for (i = 0; i < server->n_started; ++i)
+	{
+		pthread_join(server->workers[i].thread, NULL);
+	}
+
+	/* the workers that started closed their connections on the way out */
+	for (i = 0; NULL != server->workers && i < server->n_workers; ++i)
+	{
+		worker = server->workers + i;
+		if (worker->epoll_fd >= 0)
+		{
+			close(worker->epoll_fd);
+		}
+		CalcArenaDestroy(worker->arena);
+	}
+
+	if (server->unix_listener.fd >= 0)
+	{
+		close(server->unix_listener.fd);
+		unlink(server->unix_path);
+	}
+	if (server->tcp_listener.fd >= 0)
+	{
+		close(server->tcp_listener.fd);
+	}
+	if (server->stop.fd >= 0)
+	{
+		close(server->stop.fd);
+	}
+
+	free(server->unix_path);
+	free(server->workers);
+	free(server);
+}
+
+
+/******************************************************************************
+*								CalcServerTcpPort
+*******************************************************************************/
+unsigned short CalcServerTcpPort(const calc_server_t *server)
+{
+	assert(server);
+
+	return (server->tcp_port);
+}
+
+
+/******************************************************************************
+*								CalcServerGetStats
+*******************************************************************************/
+void CalcServerGetStats(calc_server_t *server, calc_server_stats_t *stats)
+{
+	worker_t *worker = NULL;
+	size_t i = 0;
+
+	assert(server);
+	assert(stats);
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < server->n_workers; ++i)
+	{
+		worker = server->workers + i;
+		stats->connections += atomic_load(&worker->connections_count);
+		stats->expressions += atomic_load(&worker->expressions);
+		stats->errors += atomic_load(&worker->errors);
+		stats->reads += atomic_load(&worker->reads);
+		stats->writes += atomic_load(&worker->writes);
+	}
+}
+
+
+/******************************************************************************
+*								ListenUnix
+*******************************************************************************/
+static int ListenUnix(calc_server_t *server, const char *path)
+{
+	struct sockaddr_un address = {0};
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		return (-1);
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	server->unix_path = (char *)malloc(strlen(path) + 1);
+	if (NULL == server->unix_path)
+	{
+		return (-1);
+	}
+	strcpy(server->unix_path, path);
+
+	server->unix_listener.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+	                                           SOCK_CLOEXEC, 0);
+	if (server->unix_listener.fd < 0)
+	{
+		return (-1);
+	}
+
+	/* a socket file left by a server that didn't get to remove it */
+	unlink(path);
+
+	return ((0 == bind(server->unix_listener.fd, (struct sockaddr *)&address,
+	                   sizeof(address)) &&
+	         0 == listen(server->unix_listener.fd, LISTEN_BACKLOG)) ? 0 : -1);
+}
+
+
+/******************************************************************************
+*								ListenTcp
+*******************************************************************************/
+static int ListenTcp(calc_server_t *server, unsigned short port)
+{
+	struct sockaddr_in address = {0};
+	socklen_t address_len = sizeof(address);
+	int reuse = 1;
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+
+	server->tcp_listener.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+	                                          SOCK_CLOEXEC, 0);
+	if (server->tcp_listener.fd < 0 ||
+	    0 != setsockopt(server->tcp_listener.fd, SOL_SOCKET, SO_REUSEADDR,
+	                    &reuse, sizeof(reuse)) ||
+	    0 != bind(server->tcp_listener.fd, (struct sockaddr *)&address,
+	              sizeof(address)) ||
+	    0 != listen(server->tcp_listener.fd, LISTEN_BACKLOG) ||
+	    0 != getsockname(server->tcp_listener.fd, (struct sockaddr *)&address,
+	                     &address_len))
+	{
+		return (-1);
+	}
+
+	/* the port given, or the one picked for port 0 */
+	server->tcp_port = ntohs(address.sin_port);
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								StartWorker
+*******************************************************************************/
+static int StartWorker(calc_server_t *server, worker_t *worker)
+{
+	worker->server = server;
+	worker->arena = CalcArenaCreate(0);
+	worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (NULL == worker->arena || worker->epoll_fd < 0)
+	{
+		return (-1);
+	}
+
+	/* every worker waits on every listener - EPOLLEXCLUSIVE wakes only one
+	   of them per connection, not the whole pool */
+	if (0 != Watch(worker->epoll_fd, &server->stop, EPOLLIN) ||
+	    (server->unix_listener.fd >= 0 &&
+	     0 != Watch(worker->epoll_fd, &server->unix_listener,
+	                EPOLLIN | EPOLLEXCLUSIVE)) ||
+	    (server->tcp_listener.fd >= 0 &&
+	     0 != Watch(worker->epoll_fd, &server->tcp_listener,
+	                EPOLLIN | EPOLLEXCLUSIVE)))
+	{
+		return (-1);
+	}
+
+	return ((0 == pthread_create(&worker->thread, NULL, WorkerLoop, worker)) ?
+	        0 : -1);
+}
+
+
+/******************************************************************************
+*								Watch
+*******************************************************************************/
+static int Watch(int epoll_fd, handle_t *handle, uint32_t events)
+{
+	struct epoll_event event = {0};
+
+	event.events = events;
+	event.data.ptr = handle;
+
+	return (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handle->fd, &event));
+}
+
+
+/******************************************************************************
+*								WorkerLoop
+*******************************************************************************/
+static void *WorkerLoop(void *arg)
+{
+	struct epoll_event events[MAX_EVENTS];
+	worker_t *worker = (worker_t *)arg;
+	handle_t *handle = NULL;
+	int is_running = 1;
+	int count = 0;
+	int i = 0;
+
+	while (is_running)
+	{
+		count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+		if (count < 0 && EINTR != errno)
+		{
+			break;
+		}
+
+		for (i = 0; i < count; ++i)
+		{
+			handle = (handle_t *)events[i].data.ptr;
+			switch (handle->kind)
+			{
+			case HANDLE_STOP:
+				is_running = 0;
+				break;
+
+			case HANDLE_LISTENER:
+				Accept(worker, handle);
+				break;
+
+			default:
+				Serve(worker, (connection_t *)handle, events[i].events);
+				break;
+			}
+		}
+	}
+
+	while (NULL != worker->connections)
+	{
+		Close(worker, worker->connections);
+	}
+
+	return (NULL);
+}
+
+
+/******************************************************************************
+*								Accept
+*******************************************************************************/
+static void Accept(worker_t *worker, const handle_t *listener)
+{
+	connection_t *conn = NULL;
+	int no_delay = 1;
+	int fd = -1;
+
+	/* all waiting - the listener is non-blocking */
+	while ((fd = accept4(listener->fd, NULL, NULL,
+	                     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		/* the buffers aren't cleared - only what was received is read */
+		conn = (connection_t *)malloc(sizeof(connection_t));
+		if (NULL == conn)
+		{
+			close(fd);
+			continue;
+		}
+		memset(conn, 0, offsetof(connection_t, in));
+		conn->handle.kind = HANDLE_CONNECTION;
+		conn->handle.fd = fd;
+		conn->interest = EPOLLIN;
+
+		/* answers go out as soon as they are written */
+		if (listener->is_tcp)
+		{
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+			           sizeof(no_delay));
+		}
+
+		if (0 != Watch(worker->epoll_fd, &conn->handle, EPOLLIN))
+		{
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		conn->next = worker->connections;
+		if (NULL != conn->next)
+		{
+			conn->next->prev = conn;
+		}
+		worker->connections = conn;
+		atomic_fetch_add_explicit(&worker->connections_count, 1,
+		                          memory_order_relaxed);
+	}
+}
+
+
+/******************************************************************************
+*								Serve
+*******************************************************************************/
+static void Serve(worker_t *worker, connection_t *conn, uint32_t events)
+{
+	struct epoll_event event = {0};
+	uint32_t interest = EPOLLIN;
+	ssize_t got = 0;
+
+	/* read only when all that was read before is answered - a client that
+	   doesn't read its answers stops being read */
+	if (EPOLLIN == conn->interest &&
+	    (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+	{
+		got = read(conn->handle.fd, conn->in + conn->in_used,
+		           IN_BUFFER - conn->in_used);
+		if (got > 0)
+		{
+			conn->in_used += got;
+			atomic_fetch_add_explicit(&worker->reads, 1, memory_order_relaxed);
+		}
+		else if (0 == got)
+		{
+			conn->is_closing = 1;
+		}
+		else if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+		{
+			Close(worker, conn);
+			return;
+		}
+	}
+
+	if (0 != Answer(worker, conn))
+	{
+		Close(worker, conn);
+		return;
+	}
+
+	if (conn->out_sent < conn->out_used)
+	{
+		interest = EPOLLOUT;
+	}
+	else if (conn->is_closing)
+	{
+		Close(worker, conn);
+		return;
+	}
+
+	if (interest != conn->interest)
+	{
+		conn->interest = interest;
+		event.events = interest;
+		event.data.ptr = &conn->handle;
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->handle.fd, &event);
+	}
+}
+
+
+/******************************************************************************
+*								Answer
+*******************************************************************************/
+static int Answer(worker_t *worker, connection_t *conn)
+{
+	const char *line = conn->in;
+	const char *end = conn->in + conn->in_used;
+	const char *newline = NULL;
+
+	while (line < end)
+	{
+		/* no room for another answer - out with those written so far */
+		if (OUT_BUFFER - conn->out_used < MAX_RESULT_CHARS)
+		{
+			if (0 != Flush(worker, conn))
+			{
+				return (-1);
+			}
+			if (OUT_BUFFER - conn->out_used < MAX_RESULT_CHARS)
+			{
+				break;
+			}
+		}
+
+		newline = memchr(line, '\n', end - line);
+		if (NULL != newline)
+		{
+			/* the end of a line too long - its answer is out already */
+			if (!conn->is_discarding)
+			{
+				AnswerLine(worker, conn, line, newline - line);
+			}
+			conn->is_discarding = 0;
+			line = newline + 1;
+		}
+		/* a whole buffer and no newline - too long a line */
+		else if (line == conn->in && IN_BUFFER == conn->in_used)
+		{
+			if (!conn->is_discarding)
+			{
+				WriteResult(conn, (result_t){-1, LIMIT_ERROR});
+				atomic_fetch_add_explicit(&worker->expressions, 1,
+				                          memory_order_relaxed);
+				atomic_fetch_add_explicit(&worker->errors, 1,
+				                          memory_order_relaxed);
+			}
+			conn->is_discarding = 1;
+			line = end;
+		}
+		/* the last line of a client that closed, with no newline */
+		else if (conn->is_closing)
+		{
+			if (!conn->is_discarding)
+			{
+				AnswerLine(worker, conn, line, end - line);
+			}
+			line = end;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	/* the partial line waits at the front for the rest of it */
+	conn->in_used = end - line;
+	memmove(conn->in, line, conn->in_used);
+
+	return (Flush(worker, conn));
+}
+
+
+/******************************************************************************
+*								AnswerLine
+*******************************************************************************/
+static void AnswerLine(worker_t *worker, connection_t *conn, const char *line,
+                       size_t len)
+{
+	result_t result = CalcNLimited(line, len, &worker->server->limits,
+	                               worker->arena);
+
+	WriteResult(conn, result);
+
+	atomic_fetch_add_explicit(&worker->expressions, 1, memory_order_relaxed);
+	if (CALC_SUCCESS != result.status)
+	{
+		atomic_fetch_add_explicit(&worker->errors, 1, memory_order_relaxed);
+	}
+}
+
+
+/******************************************************************************
+*								WriteResult
+*******************************************************************************/
+static void WriteResult(connection_t *conn, result_t result)
+{
+	const char *message = NULL;
+	size_t len = 0;
+
+	assert(OUT_BUFFER - conn->out_used >= MAX_RESULT_CHARS);
+
+	switch (result.status)
+	{
+	case CALC_SUCCESS:
+		/* %.17g - the printed value reads back as the very same double */
+		conn->out_used += sprintf(conn->out + conn->out_used, "%.17g\n",
+		                          result.result);
+		return;
+
+	case MATH_ERROR:
+		message = "MATH ERROR\n";
+		break;
+
+	case SYNTAX_ERROR:
+		message = "SYNTAX ERROR\n";
+		break;
+
+	case LIMIT_ERROR:
+		message = "LIMIT ERROR\n";
+		break;
+
+	default:
+		message = "APPLICATION ERROR\n";
+		break;
+	}
+
+	len = strlen(message);
+	memcpy(conn->out + conn->out_used, message, len);
+	conn->out_used += len;
+}
+
+
+/******************************************************************************
+*								Flush
+*******************************************************************************/
+static int Flush(worker_t *worker, connection_t *conn)
+{
+	ssize_t sent = 0;
+
+	while (conn->out_sent < conn->out_used)
+	{
+		/* MSG_NOSIGNAL - a client gone is an error here, not a SIGPIPE */
+		sent = send(conn->handle.fd, conn->out + conn->out_sent,
+		            conn->out_used - conn->out_sent, MSG_NOSIGNAL);
+		if (sent > 0)
+		{
+			conn->out_sent += sent;
+			atomic_fetch_add_explicit(&worker->writes, 1, memory_order_relaxed);
+		}
+		else if (EAGAIN == errno || EWOULDBLOCK == errno)
+		{
+			/* the rest goes out when the client reads - EPOLLOUT */
+			return (0);
+		}
+		else if (EINTR != errno)
+		{
+			return (-1);
+		}
+	}
+
+	conn->out_sent = 0;
+	conn->out_used = 0;
+
+	return (0);
+}
+
+
+/******************************************************************************
+*								Close
+*******************************************************************************/
+static void Close(worker_t *worker, connection_t *conn)
+{
+	/* closing the fd takes it out of the epoll too */
+	close(conn->handle.fd);
+
+	if (NULL != conn->prev)
+	{
+		conn->prev->next = conn->next;
+	}
+	else
+	{
+		worker->connections = conn->next;
+	}
+	if (NULL != conn->next)
+	{
+		conn->next->prev = conn->prev;
+	}
+
+	free(conn);
+}
@@ -0,0 +1,81 @@
+/*****************************************************************************
+ *  File name  : calc_server.h
+ *  Developer  : Eyal Weizman
+ *	Description: evaluation server - expressions over local sockets
+ *****************************************************************************/
+
+#ifndef __CALC_SERVER_H__
+#define __CALC_SERVER_H__
+
+#include <stddef.h> /* size_t */
+
+#include "calc.h"
+
+/* the longest line a connection takes - a longer one is a LIMIT ERROR */
+#define CALC_SERVER_MAX_LINE ((1 << 16) - 1)
+
+/* opaque handle of a running server */
+typedef struct calc_server_s calc_server_t;
+
+/* where and how a server listens */
+typedef struct calc_server_config_s
+{
+	const char *unix_path;	/* a Unix-domain socket, NULL - none */
+	int use_tcp;			/* also listen on 127.0.0.1 */
+	unsigned short tcp_port;/* 0 - any free port (CalcServerTcpPort) */
+	size_t n_workers;		/* threads, each with its own epoll. 0 is 1 */
+	calc_limits_t limits;	/* of every expression, as in CalcNLimited */
+}calc_server_config_t;
+
+/* counters of a server, since its creation */
+typedef struct calc_server_stats_s
+{
+	unsigned long connections;	/* accepted */
+	unsigned long expressions;	/* calculated */
+	unsigned long errors;		/* expressions that failed */
+	unsigned long reads;		/* read calls that brought data */
+	unsigned long writes;		/* write calls that sent data */
+}calc_server_stats_t;
+
+/*********************************** CalcServerCreate ************************/
+/*	Description      :	Starts a server - listens on the sockets of
+ *	                  	'config' and serves them on n_workers threads.
+ *	                  	a stale file at unix_path is replaced.
+ *
+ *	                  	the protocol is that of 'calc.out --stream': a
+ *	                  	client writes expressions, one per line, and reads
+ *	                  	a line per expression - '%.17g' of the result or
+ *	                  	the error ("SYNTAX ERROR", "MATH ERROR", "LIMIT
+ *	                  	ERROR", "APPLICATION ERROR"), in the same order.
+ *	                  	a client may pipeline - write many lines before
+ *	                  	reading any; every line a read brings is answered
+ *	                  	in a single write. a connection is served by one
+ *	                  	worker for its whole life, and while its answers
+ *	                  	aren't read it isn't read from either.
+ *
+ *	Return Values    :	the server, or NULL if a socket can't be opened or
+ *	                  	resources can't be allocated.
+ */
+calc_server_t *CalcServerCreate(const calc_server_config_t *config);
+
+/*********************************** CalcServerDestroy ***********************/
+/*	Description      :	Stops the workers, closes every connection and
+ *	                  	socket (removing unix_path) and releases the
+ *	                  	server. NULL is allowed and ignored.
+ */
+void CalcServerDestroy(calc_server_t *server);
+
+/*********************************** CalcServerTcpPort ***********************/
+/*	Description      :	Returns the TCP port the server listens on, or 0
+ *	                  	if it doesn't listen on TCP.
+ */
+unsigned short CalcServerTcpPort(const calc_server_t *server);
+
+/********************************* CalcServerGetStats ************************/
+/*	Description      :	Fills 'stats' with the counters of the server.
+ *	                  	expressions / reads is the batching - lines
+ *	                  	answered per system call.
+ */
+void CalcServerGetStats(calc_server_t *server, calc_server_stats_t *stats);
+
+#endif     /* __CALC_SERVER_H__ */
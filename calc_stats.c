@@ -0,0 +1,446 @@
+/*******************************************************************************
+*	Filename	:	calc_stats.c
+*	Developer	:	Eyal Weizman
+*	Description	:	instrumentation - per-thread phase counters and latency
+*					histograms, summed up when read
+*******************************************************************************/
+#include <assert.h> 	/* assert */
+#include <string.h>		/* memset, memcpy */
+#include <time.h>		/* clock_gettime */
+#include <pthread.h>	/* pthread_mutex_t, pthread_key_t, pthread_once */
+#include <stdatomic.h>	/* atomic_ullong */
+
+#include "calc_stats.h"
+
+/******************************* MACROS ***************************************/
+#define NS_IN_SEC 1000000000ULL
+
+/* the tick is measured against the clock for this long */
+#define CALIBRATION_NS 10000000ULL
+
+/* the histogram is log-linear (as HdrHistogram): each power of 2 is split
+   into SUB_COUNT buckets, so a bucket is at most 1/SUB_COUNT of its values
+   wide. the values below SUB_COUNT have a bucket each */
+#define SUB_BITS 5
+#define SUB_COUNT (1ULL << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+/*************************** structs & typedefs *******************************/
+/* the counters of a thread - written by it alone, read by CalcStatsGet */
+typedef struct stats_block_s
+{
+	atomic_ullong calls[CALC_PHASE_COUNT];
+	atomic_ullong ticks[CALC_PHASE_COUNT];
+	atomic_ullong latency[BUCKETS];
+	struct stats_block_s *next;	/* in g_blocks */
+	int is_listed;
+}stats_block_t;
+
+/* counters summed up over threads */
+typedef struct stats_sums_s
+{
+	unsigned long long calls[CALC_PHASE_COUNT];
+	unsigned long long ticks[CALC_PHASE_COUNT];
+	unsigned long long latency[BUCKETS];
+}stats_sums_t;
+
+/************************* internal functions *********************************/
+#ifdef CALC_STATS
+static void InitKey(void);
+static void Register(stats_block_t *block);
+static void Unregister(void *block);
+static void AddBlock(stats_sums_t *sums, stats_block_t *block);
+static void Bump(atomic_ullong *counter, unsigned long long amount);
+static size_t BucketOf(unsigned long long value);
+static unsigned long long BucketHighest(size_t bucket);
+static unsigned long long Percentile(const stats_sums_t *sums,
+                                     unsigned long long count, double part);
+static void CalibrateTick(void);
+static unsigned long long NowNs(void);
+#endif
+
+/************************* global variable ************************************/
+#ifdef CALC_STATS
+/* the counters of each thread, in its own thread-local storage - its hot
+   path takes no lock and shares no cache line */
+static _Thread_local stats_block_t t_block;
+
+/* the threads that have calculated, and the sums of those that ended.
+   the lock is taken only to join or leave the list and to read it */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_block_t *g_blocks = NULL;
+static stats_sums_t g_ended;
+static stats_sums_t g_baseline;	/* the sums at the last CalcStatsReset */
+
+/* its destructor takes an ending thread off the list */
+static pthread_key_t g_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+static double g_ns_per_tick = 1;
+static pthread_once_t g_tick_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/******************************************************************************
+****************************	functions	***********************************
+*******************************************************************************/
+#ifdef CALC_STATS
+
+/******************************************************************************
+*								CalcStatsEnabled
+*******************************************************************************/
+int CalcStatsEnabled(void)
+{
+	return (1);
+}
+
+
+/******************************************************************************
+*								StatsAdd
+*******************************************************************************/
+void StatsAdd(enum calc_phase phase, unsigned long long ticks)
+{
+	assert(phase < CALC_PHASE_COUNT);
+
+	if (!t_block.is_listed)
+	{
+		Register(&t_block);
+	}
+
+	Bump(&t_block.calls[phase], 1);
+	Bump(&t_block.ticks[phase], ticks);
+
+	if (CALC_PHASE_TOTAL == phase)
+	{
+		Bump(&t_block.latency[BucketOf(ticks)], 1);
+	}
+}
+
+
+/******************************************************************************
+*								CalcStatsGet
+*******************************************************************************/
+void CalcStatsGet(calc_stats_t *stats)
+{
+	stats_sums_t sums = {0};
+	stats_block_t *block = NULL;
+	unsigned long long count = 0;
+	size_t i = 0;
+
+	assert(stats);
+
+	pthread_once(&g_tick_once, CalibrateTick);
+
+	pthread_mutex_lock(&g_lock);
+
+	sums = g_ended;
+	for (block = g_blocks; NULL != block; block = block->next)
+	{
+		AddBlock(&sums, block);
+	}
+
+	/* the counters only grow - since the reset is the difference */
+	for (i = 0; i < CALC_PHASE_COUNT; ++i)
+	{
+		sums.calls[i] -= g_baseline.calls[i];
+		sums.ticks[i] -= g_baseline.ticks[i];
+	}
+	for (i = 0; i < BUCKETS; ++i)
+	{
+		sums.latency[i] -= g_baseline.latency[i];
+		count += sums.latency[i];
+	}
+
+	pthread_mutex_unlock(&g_lock);
+
+	memset(stats, 0, sizeof(*stats));
+	memcpy(stats->calls, sums.calls, sizeof(stats->calls));
+	memcpy(stats->ticks, sums.ticks, sizeof(stats->ticks));
+	stats->ns_per_tick = g_ns_per_tick;
+	stats->p50 = Percentile(&sums, count, 0.5);
+	stats->p90 = Percentile(&sums, count, 0.9);
+	stats->p99 = Percentile(&sums, count, 0.99);
+	stats->p999 = Percentile(&sums, count, 0.999);
+	stats->max = Percentile(&sums, count, 1);
+}
+
+
+/******************************************************************************
+*								CalcStatsReset
+*******************************************************************************/
+void CalcStatsReset(void)
+{
+	stats_block_t *block = NULL;
+
+	pthread_mutex_lock(&g_lock);
+
+	g_baseline = g_ended;
+	for (block = g_blocks; NULL != block; block = block->next)
+	{
+		AddBlock(&g_baseline, block);
+	}
+
+	pthread_mutex_unlock(&g_lock);
+}
+
+#else /* no CALC_STATS */
+
+/******************************************************************************
+*								CalcStatsEnabled
+*******************************************************************************/
+int CalcStatsEnabled(void)
+{
+	return (0);
+}
+
+
+/******************************************************************************
+*								CalcStatsGet
+*******************************************************************************/
+void CalcStatsGet(calc_stats_t *stats)
+{
+	assert(stats);
+
+	memset(stats, 0, sizeof(*stats));
+}
+
+
+/******************************************************************************
+*								CalcStatsReset
+*******************************************************************************/
+void CalcStatsReset(void)
+{
+}
+
+#endif /* CALC_STATS */
+
+
+/******************************************************************************
+*								CalcStatsPrint
+*******************************************************************************/
+void CalcStatsPrint(FILE *file)
+{
+	static const char *const names[CALC_PHASE_COUNT] =
+	{
+		"total", "init", "lex", "stacks", "number", "execute"
+	};
+	calc_stats_t stats = {0};
+	double ns_per_call = 0;
+	double share = 0;
+	size_t i = 0;
+
+	assert(file);
+
+	if (!CalcStatsEnabled())
+	{
+		fprintf(file, "stats: not compiled in (make stats=1)\n");
+		return;
+	}
+
+	CalcStatsGet(&stats);
+
+	fprintf(file, "%-10s %14s %12s %8s\n", "phase", "calls", "ns/call",
+	        "share");
+	for (i = 0; i < CALC_PHASE_COUNT; ++i)
+	{
+		ns_per_call = (0 == stats.calls[i]) ? 0 :
+		              stats.ns_per_tick * stats.ticks[i] / stats.calls[i];
+		share = (0 == stats.ticks[CALC_PHASE_TOTAL]) ? 0 :
+		        100.0 * stats.ticks[i] / stats.ticks[CALC_PHASE_TOTAL];
+		fprintf(file, "%-10s %14llu %12.1f %7.1f%%\n", names[i],
+		        stats.calls[i], ns_per_call, share);
+	}
+
+	fprintf(file, "latency ns: p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  "
+	        "max %.0f\n", stats.ns_per_tick * stats.p50,
+	        stats.ns_per_tick * stats.p90, stats.ns_per_tick * stats.p99,
+	        stats.ns_per_tick * stats.p999, stats.ns_per_tick * stats.max);
+}
+
+
+#ifdef CALC_STATS
+/******************************************************************************
+*								InitKey
+*******************************************************************************/
+static void InitKey(void)
+{
+	pthread_key_create(&g_key, Unregister);
+}
+
+
+/******************************************************************************
+*								Register
+*******************************************************************************/
+static void Register(stats_block_t *block)
+{
+	pthread_once(&g_key_once, InitKey);
+
+	pthread_mutex_lock(&g_lock);
+	block->next = g_blocks;
+	g_blocks = block;
+	block->is_listed = 1;
+	pthread_mutex_unlock(&g_lock);
+
+	/* any non-NULL value - the destructor runs only for those */
+	pthread_setspecific(g_key, block);
+}
+
+
+/******************************************************************************
+*								Unregister
+*******************************************************************************/
+static void Unregister(void *block)
+{
+	stats_block_t **link = &g_blocks;
+
+	/* the thread ends - its counters move to g_ended, the totals stay */
+	pthread_mutex_lock(&g_lock);
+
+	AddBlock(&g_ended, block);
+	while (*link != block)
+	{
+		link = &(*link)->next;
+	}
+	*link = (*link)->next;
+
+	pthread_mutex_unlock(&g_lock);
+}
+
+
+/******************************************************************************
+*								AddBlock
+*******************************************************************************/
+static void AddBlock(stats_sums_t *sums, stats_block_t *block)
+{
+	size_t i = 0;
+
+	for (i = 0; i < CALC_PHASE_COUNT; ++i)
+	{
+		sums->calls[i] += atomic_load_explicit(&block->calls[i],
+		                                       memory_order_relaxed);
+		sums->ticks[i] += atomic_load_explicit(&block->ticks[i],
+		                                       memory_order_relaxed);
+	}
+
+	for (i = 0; i < BUCKETS; ++i)
+	{
+		sums->latency[i] += atomic_load_explicit(&block->latency[i],
+		                                         memory_order_relaxed);
+	}
+}
+
+
+/******************************************************************************
+*								Bump
+*******************************************************************************/
+static void Bump(atomic_ullong *counter, unsigned long long amount)
+{
+	/* a single writer - a plain load and store, no locked instruction */
+	atomic_store_explicit(counter, amount +
+	                      atomic_load_explicit(counter, memory_order_relaxed),
+	                      memory_order_relaxed);
+}
+
+
+/******************************************************************************
+*								BucketOf
+*******************************************************************************/
+static size_t BucketOf(unsigned long long value)
+{
+	unsigned int shift = 0;
+
+	if (value < SUB_COUNT)
+	{
+		return (value);
+	}
+
+	/* the top SUB_BITS + 1 bits of the value pick the bucket */
+	shift = (63 - __builtin_clzll(value)) - SUB_BITS;
+
+	return ((shift + 1) * SUB_COUNT + ((value >> shift) - SUB_COUNT));
+}
+
+
+/******************************************************************************
+*								BucketHighest
+*******************************************************************************/
+static unsigned long long BucketHighest(size_t bucket)
+{
+	unsigned int shift = 0;
+
+	if (bucket < SUB_COUNT)
+	{
+		return (bucket);
+	}
+
+	shift = bucket / SUB_COUNT - 1;
+
+	/* the bucket holds [(SUB_COUNT + sub) << shift, the next one's start) */
+	return (((SUB_COUNT + bucket % SUB_COUNT + 1) << shift) - 1);
+}
+
+
+/******************************************************************************
+*								Percentile
+*******************************************************************************/
+static unsigned long long Percentile(const stats_sums_t *sums,
+                                     unsigned long long count, double part)
+{
+	unsigned long long rank = 0;
+	unsigned long long seen = 0;
+	size_t i = 0;
+
+	if (0 == count)
+	{
+		return (0);
+	}
+
+	/* the value 'part' of the runs are at or below - the rank-th smallest */
+	rank = (unsigned long long)(part * count + 0.5);
+	rank = (0 == rank) ? 1 : rank;
+
+	for (i = 0; i < BUCKETS; ++i)
+	{
+		seen += sums->latency[i];
+		if (seen >= rank)
+		{
+			break;
+		}
+	}
+
+	return (BucketHighest(i));
+}
+
+
+/******************************************************************************
+*								CalibrateTick
+*******************************************************************************/
+static void CalibrateTick(void)
+{
+	unsigned long long start_ns = NowNs();
+	unsigned long long start_ticks = StatsTicks();
+	unsigned long long ns = 0;
+
+	do
+	{
+		ns = NowNs() - start_ns;
+	}
+	while (ns < CALIBRATION_NS);
+
+	g_ns_per_tick = (double)ns / (StatsTicks() - start_ticks);
+}
+
+
+/******************************************************************************
+*								NowNs
+*******************************************************************************/
+static unsigned long long NowNs(void)
+{
+	struct timespec now = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((unsigned long long)now.tv_sec * NS_IN_SEC + now.tv_nsec);
+}
+
+#endif /* CALC_STATS */
@@ -0,0 +1,121 @@
+/*****************************************************************************
+ *  File name  : calc_stats.h
+ *  Developer  : Eyal Weizman
+ *	Description: optional instrumentation of the calculator's hot path
+ *****************************************************************************/
+
+#ifndef __CALC_STATS_H__
+#define __CALC_STATS_H__
+
+#include <stdio.h> /* FILE */
+
+/* the instrumentation is compiled in only with CALC_STATS defined
+   (make stats=1). without it the probes below are empty and the functions
+   report nothing */
+
+/* phases of a calculation, timed on their own */
+enum calc_phase
+{
+	CALC_PHASE_TOTAL,		/* a whole run of the parser, start to result */
+	CALC_PHASE_INIT,		/* the once-built tables (InitLuts) */
+	CALC_PHASE_LEX,			/* the validating pre-pass (LexValidate) */
+	CALC_PHASE_STACKS,		/* setting up and releasing the stacks */
+	CALC_PHASE_NUMBER,		/* reading a number (NumberParse) */
+	CALC_PHASE_EXECUTE,		/* the arithmetic of an op or a function */
+	CALC_PHASE_COUNT
+};
+
+/* counters of all threads, since the start or the last CalcStatsReset */
+typedef struct calc_stats_s
+{
+	unsigned long long calls[CALC_PHASE_COUNT];	/* timed sections */
+	unsigned long long ticks[CALC_PHASE_COUNT];	/* spent in them */
+	double ns_per_tick;		/* the tick (cpu timestamp) in nanoseconds */
+
+	/* latency of a whole run (CALC_PHASE_TOTAL), in ticks - the highest
+	   value of its histogram bucket, at most 1/32 above the real one */
+	unsigned long long p50;
+	unsigned long long p90;
+	unsigned long long p99;
+	unsigned long long p999;
+	unsigned long long max;
+}calc_stats_t;
+
+/*********************************** CalcStatsEnabled ************************/
+/*	Description      :	Returns 1 if the instrumentation is compiled in,
+ *	                  	0 if not.
+ */
+int CalcStatsEnabled(void);
+
+/*********************************** CalcStatsGet ****************************/
+/*	Description      :	Fills 'stats' with the counters of every thread
+ *	                  	that has calculated - those that ended too. the
+ *	                  	threads' own counters are read as they run, with
+ *	                  	no lock on their hot path. all zeros when the
+ *	                  	instrumentation isn't compiled in.
+ *	                  	the first call measures the tick for ~10 ms.
+ *
+ *	Time Complexity  : O(threads)
+ */
+void CalcStatsGet(calc_stats_t *stats);
+
+/*********************************** CalcStatsReset **************************/
+/*	Description      :	Starts the counters over - CalcStatsGet reports
+ *	                  	only what comes after.
+ */
+void CalcStatsReset(void);
+
+/*********************************** CalcStatsPrint **************************/
+/*	Description      :	Writes the counters to 'file', readable - a line
+ *	                  	per phase (calls, ns per call, share of the total)
+ *	                  	and the latency percentiles in ns. writes a single
+ *	                  	line saying so if the instrumentation isn't
+ *	                  	compiled in.
+ */
+void CalcStatsPrint(FILE *file);
+
+
+/************************* probes of the library ******************************/
+/* CALC_STATS_BEGIN(phase) starts timing a section of the calling function,
+   CALC_STATS_END(phase) adds it to the thread's counters. one section of a
+   phase at a time in a function */
+#ifdef CALC_STATS
+
+#define CALC_STATS_BEGIN(phase) \
+	const unsigned long long stats_begin_##phase = StatsTicks()
+#define CALC_STATS_END(phase) \
+	StatsAdd((phase), StatsTicks() - stats_begin_##phase)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> /* __rdtsc */
+#else
+#include <time.h> /* clock_gettime */
+#endif
+
+/*  StatsTicks returns the cpu timestamp counter - nanoseconds where there is
+	none */
+static inline unsigned long long StatsTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__rdtsc());
+#else
+	struct timespec now = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec);
+#endif
+}
+
+/*  StatsAdd adds a section of 'ticks' to the phase counters of the calling
+	thread, and a whole run to its latency histogram too */
+void StatsAdd(enum calc_phase phase, unsigned long long ticks);
+
+#else
+
+#define CALC_STATS_BEGIN(phase)
+#define CALC_STATS_END(phase)
+
+#endif /* CALC_STATS */
+
+#endif     /* __CALC_STATS_H__ */
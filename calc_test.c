@@ -4,8 +4,62 @@
 *	Description	:	calc test file
 *******************************************************************************/
 #include <stdio.h> 		/* printf */
+#include <stddef.h> 	/* size_t */
+#include <string.h> 	/* memset, strcpy */
+#include <stdlib.h> 	/* strtod, rand */
+#include <stdint.h> 	/* int64_t */
+#include <stdatomic.h> 	/* atomic_size_t */
+#include <math.h> 		/* fabs, log, exp, sin */
+#include <unistd.h> 	/* close, read, write, access */
+#include <pthread.h> 	/* pthread_create, pthread_join */
+#include <sys/socket.h> /* socket, connect, shutdown */
+#include <sys/un.h> 	/* sockaddr_un */
+#include <netinet/in.h> /* sockaddr_in */
+#include <arpa/inet.h> 	/* htonl, htons */
 
 #include "calc.h"
+#include "calc_batch.h"
+#include "calc_pool.h"
+#include "calc_opt.h"
+#include "calc_cache.h"
+#include "calc_bundle.h"
+#include "calc_jit.h"
+#include "calc_stats.h"
+#include "calc_server.h"
+#include "calc_ring.h"
+#include "calc_formula.h"
+#include "stack/stack.h"
+
+/******************************* MACROS ***************************************/
+#define BATCH_ROWS 1001
+#define LONG_EXPR_TERMS 200
+#define POOL_EXPRS 10000
+#define RANDOM_NUMBERS 100000
+#define CACHE_CAPACITY 64
+#define MAX_SPACE_RUN 100
+#define PEAK_EXPR_TERMS 2000000
+#define PEAK_DEPTH 100000
+#define MIXED_TERMS 100000
+#define SPLIT_TERMS 20000
+#define SPLIT_TERM_CHARS 32
+#define BUNDLE_PROGRAMS 6
+#define JIT_THRESHOLD 3
+#define JIT_DEEP_TERMS 5000
+#define MATH_ROWS 100003	/* odd - the kernels' tails too */
+#define SIN_WIDE_ULP 2		/* calc_batch.h - the bounds of the kernels */
+#define STATS_EXPRS 1000
+#define SERVER_LINES 20000
+#define SERVER_LINE_CHARS 16
+#define RING_CAPACITY 8
+#define RING_MAX_LENGTH 32
+#define RING_THREADS 4
+#define RING_EXPRS 5000
+#define RING_IDLE_SPINS 100	/* few - the evaluator sleeps, and is woken */
+#define FORMULA_CHAIN 100000
+#define FORMULA_WIDTH 1000		/* nodes per layer of the layered graph */
+#define FORMULA_LAYERS 20
+#define STACK_ELEMENTS 10000
+#define FORMULA_THREADS 4
 
 /************************** internal functions ********************************/
 void AddSubtructTest(void);
@@ -14,6 +68,47 @@ void ErrorsTest(void);
 void ParenthesesTest(void);
 void PowerTest(void);
 void FloatingPointTest(void);
+void CompileEvalTest(void);
+void VariablesTest(void);
+void BatchTest(void);
+void AllocationTest(void);
+void PoolTest(void);
+void SliceTest(void);
+void NumbersTest(void);
+void OptimizeTest(void);
+void CacheTest(void);
+void LexTest(void);
+void MemoryPeakTest(void);
+void LimitsTest(void);
+void SplitTest(void);
+void BundleTest(void);
+void JitTest(void);
+void ExactTest(void);
+void FunctionsTest(void);
+void MathBatchTest(void);
+void StatsTest(void);
+void ServerTest(void);
+void RingTest(void);
+void FormulasTest(void);
+void StackTest(void);
+
+/* of <sys/wait.h> - which brings the stack_t of <signal.h>, clashing with
+   the one of stack/stack.h */
+pid_t waitpid(pid_t pid, int *status, int options);
+
+/* allocation counting - the makefile links the test with
+   -Wl,--wrap=malloc (and calloc, realloc), routing the calls here */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+/* per thread - the pool, ring and formula tests allocate on several threads
+   at once, and the counts are checked on the thread that allocates */
+static _Thread_local size_t g_alloc_count = 0;
+static _Thread_local size_t g_largest_alloc = 0;	/* bytes, of a single call */
 
 
 /******************************************************************************
@@ -42,6 +137,75 @@ int main(void)
 	FloatingPointTest();
 	printf("\n\n--------------------------------------------------------\n\n");
 	
+	CompileEvalTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	VariablesTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	BatchTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	AllocationTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	PoolTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	SliceTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	NumbersTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	OptimizeTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	CacheTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	LexTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	MemoryPeakTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	LimitsTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	SplitTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	BundleTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	JitTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	ExactTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	FunctionsTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	MathBatchTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	StatsTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	ServerTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	RingTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	FormulasTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
+	StackTest();
+	printf("\n\n--------------------------------------------------------\n\n");
+	
 	return (0);
 }
 
@@ -159,3 +323,2147 @@ void FloatingPointTest(void)
 	printf("SUCCESS") : printf("FAIL");
 }
 
+
+
+/************************ CompileEvalTest *************************************/
+void CompileEvalTest(void)
+{
+	const char *valid[] = {" 5+\n3  -\t4 -\v1 ", " 3 + 5x2/5*3 - 2:1",
+	                       "(4 * (2 + 8) / (5 - 3) + (10))",
+	                       "2^(-3) * 8 + 4 ^ 0.5 ^ 1", "3.5 + 4.5*2/3 ",
+	                       "3/0", "-1^0.5", "2 + 1/0", "(2 + 1/0) * 3"};
+	const char *invalid[] = {"3#5 -1", "3 + * 1", "3 + 5 7 - 1", "(3"};
+	calc_program_t *program = NULL;
+	result_t expected = {0};
+	result_t result = {0};
+	int status = CALC_SUCCESS;
+	int is_ok = 1;
+	size_t i = 0;
+	
+	printf("Compile + Eval test:\t\t\t");
+	
+	/* a compiled program must return exactly what Calculate returns */
+	for (i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i)
+	{
+		program = CalcCompile(valid[i], &status);
+		expected = Calculate(valid[i]);
+		
+		if (NULL == program || CALC_SUCCESS != status)
+		{
+			is_ok = 0;
+			continue;
+		}
+		
+		/* evaluating twice must not change the program */
+		result = CalcEval(program, NULL);
+		result = CalcEval(program, NULL);
+		
+		is_ok = is_ok && (expected.result == result.result) &&
+		                 (expected.status == result.status);
+		
+		CalcProgramDestroy(program);
+	}
+	
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+	{
+		program = CalcCompile(invalid[i], &status);
+		
+		is_ok = is_ok && (NULL == program) && (SYNTAX_ERROR == status);
+	}
+	
+	/* a later op must not hide an earlier math error */
+	result = Calculate("2 + 1/0");
+	is_ok = is_ok && (MATH_ERROR == result.status) && (-1 == result.result);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ VariablesTest ***************************************/
+void VariablesTest(void)
+{
+	const char *names[] = {"qty", "price", "discount"};
+	double row[] = {3, 2.5, 1};
+	double vars[3] = {0};
+	calc_program_t *program = NULL;
+	result_t result = {0};
+	int status = CALC_SUCCESS;
+	int is_ok = 1;
+	
+	printf("Variables test:\t\t\t\t");
+	
+	/* slots in order of first appearance */
+	program = CalcCompile("price * qty - discount_2", &status);
+	is_ok = is_ok && (NULL != program) && (3 == CalcVarCount(program)) &&
+	        (0 == CalcVarIndex(program, "price")) &&
+	        (2 == CalcVarIndex(program, "discount_2")) &&
+	        (-1 == CalcVarIndex(program, "discount"));
+	vars[0] = 2.5;
+	vars[1] = 3;
+	vars[2] = 1;
+	result = CalcEval(program, vars);
+	is_ok = is_ok && (6.5 == result.result) && (CALC_SUCCESS == result.status);
+	CalcProgramDestroy(program);
+	
+	/* 'x' - a name where a number is expected, multiplication otherwise */
+	program = CalcCompile("x x 2 + 2x3 - xy", &status);
+	is_ok = is_ok && (NULL != program) && (2 == CalcVarCount(program));
+	vars[0] = 4;
+	vars[1] = 1;
+	result = CalcEval(program, vars);
+	is_ok = is_ok && (13 == result.result);
+	CalcProgramDestroy(program);
+	
+	program = CalcCompile("ax b", &status);
+	is_ok = is_ok && (NULL == program) && (SYNTAX_ERROR == status);
+	
+	/* binding table - shared slots, unknown names rejected */
+	program = CalcCompileVars("(price - discount) / qty", names, 3, &status);
+	is_ok = is_ok && (NULL != program) && (3 == CalcVarCount(program));
+	result = CalcEval(program, row);
+	is_ok = is_ok && (0.5 == result.result);
+	row[0] = 0;
+	result = CalcEval(program, row);
+	is_ok = is_ok && (MATH_ERROR == result.status);
+	CalcProgramDestroy(program);
+	
+	program = CalcCompileVars("price * tax", names, 3, &status);
+	is_ok = is_ok && (NULL == program) && (SYNTAX_ERROR == status);
+	
+	/* plain Calculate has nothing to bind names to */
+	result = Calculate("2 * a");
+	is_ok = is_ok && (SYNTAX_ERROR == result.status);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ BatchTest *******************************************/
+void BatchTest(void)
+{
+	static double a[BATCH_ROWS];
+	static double b[BATCH_ROWS];
+	static double out[BATCH_ROWS];
+	static signed char status[BATCH_ROWS];
+	const double *columns[2] = {a, b};
+	enum calc_isa isas[] = {CALC_ISA_SCALAR, CALC_ISA_SSE2, CALC_ISA_AVX2,
+	                        CALC_ISA_AUTO};
+	calc_program_t *program = NULL;
+	result_t expected = {0};
+	double vars[2] = {0};
+	size_t failed = 0;
+	size_t expected_failed = 0;
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Batch test:\t\t\t\t");
+	
+	/* division by zero every 7 rows, negative base every 5 rows */
+	for (i = 0; i < BATCH_ROWS; ++i)
+	{
+		a[i] = (0 == i % 5) ? -1.5 : 0.5 * i;
+		b[i] = (0 == i % 7) ? 3 : (double)(i % 13);
+	}
+	
+	program = CalcCompile("(a + 2) * b / (b - 3) - a ^ 0.5 + 2 - b", NULL);
+	
+	/* every instruction set must match the scalar evaluator, row by row */
+	for (j = 0; j < sizeof(isas) / sizeof(isas[0]); ++j)
+	{
+		failed = CalcEvalBatchIsa(program, columns, BATCH_ROWS, out, status,
+		                          isas[j]);
+		expected_failed = 0;
+		
+		for (i = 0; i < BATCH_ROWS; ++i)
+		{
+			vars[0] = a[i];
+			vars[1] = b[i];
+			expected = CalcEval(program, vars);
+			expected_failed += (CALC_SUCCESS != expected.status);
+			
+			is_ok = is_ok && (expected.result == out[i]) &&
+			                 (expected.status == status[i]);
+		}
+		
+		is_ok = is_ok && (failed == expected_failed) && (0 < failed);
+	}
+	
+	CalcProgramDestroy(program);
+	
+	/* no variables, no status column */
+	program = CalcCompile("2 * (3 + 4)", NULL);
+	failed = CalcEvalBatch(program, NULL, 3, out, NULL);
+	is_ok = is_ok && (0 == failed) && (14 == out[0]) && (14 == out[2]);
+	CalcProgramDestroy(program);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ AllocationTest **************************************/
+void AllocationTest(void)
+{
+	char long_expr[LONG_EXPR_TERMS * 4 + 1] = {0};
+	calc_arena_t *arena = NULL;
+	calc_program_t *program = NULL;
+	result_t short_result = {0};
+	result_t long_result = {0};
+	result_t eval_result = {0};
+	double vars[2] = {1, 2};
+	size_t allocs = 0;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Allocation test:\t\t\t");
+	
+	/* "1 + 1 + 1 ..." - too long for the on-stack buffer */
+	memset(long_expr, ' ', sizeof(long_expr) - 1);
+	for (i = 0; i < LONG_EXPR_TERMS; ++i)
+	{
+		long_expr[i * 4] = '1';
+		long_expr[i * 4 + 2] = (i + 1 < LONG_EXPR_TERMS) ? '+' : ' ';
+	}
+	
+	/* the first call sizes the arena */
+	arena = CalcArenaCreate(0);
+	long_result = CalculateArena(long_expr, arena);
+	program = CalcCompile("(a + 2) * b", NULL);
+	
+	allocs = g_alloc_count;
+	for (i = 0; i < 100; ++i)
+	{
+		short_result = Calculate(" 3 + 5x2/5*3 - 2:1");
+		long_result = CalculateArena(long_expr, arena);
+		eval_result = CalcEval(program, vars);
+	}
+	
+	/* steady state - not a single heap allocation */
+	is_ok = (g_alloc_count == allocs) && 
+	        (7 == short_result.result) && (6 == eval_result.result) &&
+	        (LONG_EXPR_TERMS == long_result.result);
+	
+	/* Calculate without an arena allocates only for deeply nested inputs -
+	   a long flat one needs short stacks */
+	allocs = g_alloc_count;
+	long_result = Calculate(long_expr);
+	is_ok = is_ok && (g_alloc_count == allocs) &&
+	        (LONG_EXPR_TERMS == long_result.result);
+	
+	memset(long_expr, 0, sizeof(long_expr));
+	memset(long_expr, '(', LONG_EXPR_TERMS * 2 - 1);
+	long_expr[LONG_EXPR_TERMS * 2 - 1] = '7';
+	memset(long_expr + LONG_EXPR_TERMS * 2, ')', LONG_EXPR_TERMS * 2 - 1);
+	long_result = Calculate(long_expr);
+	is_ok = is_ok && (g_alloc_count > allocs) && (7 == long_result.result);
+	
+	/* ...and with an arena only the first time */
+	long_result = CalculateArena(long_expr, arena);
+	allocs = g_alloc_count;
+	long_result = CalculateArena(long_expr, arena);
+	is_ok = is_ok && (g_alloc_count == allocs) && (7 == long_result.result);
+	
+	CalcProgramDestroy(program);
+	CalcArenaDestroy(arena);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ SliceTest *******************************************/
+void SliceTest(void)
+{
+	/* no NUL anywhere - CalcN must stop at the length */
+	const char line[] = {'1', '2', '+', '3', '4', '*', '2'};
+	const char number[] = {'1', '.', '5', 'e', '2', '5'};
+	result_t result_1 = {0};
+	result_t result_2 = {0};
+	result_t result_3 = {0};
+	result_t result_4 = {0};
+	result_t result_5 = {0};
+	
+	printf("Slice test:\t\t\t\t");
+	result_1 = CalcN(line, 4);
+	result_2 = CalcN(line, sizeof(line));
+	result_3 = CalcN(number, 5);
+	result_4 = CalcN("3+\0" "4", 4);
+	result_5 = CalcN(line, 0);
+	
+	(15 			== result_1.result)	&&
+	(CALC_SUCCESS	== result_1.status)	&&
+	(80 			== result_2.result)	&&
+	(CALC_SUCCESS	== result_2.status)	&&
+	(150 			== result_3.result)	&&
+	(CALC_SUCCESS	== result_3.status)	&&
+	(SYNTAX_ERROR	== result_4.status)	&&
+	(SYNTAX_ERROR	== result_5.status)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ NumbersTest *****************************************/
+static int IsParsedAsStrtod(const char *str)
+{
+	result_t result = Calculate(str);
+	
+	return ((CALC_SUCCESS == result.status) && 
+	        (strtod(str, NULL) == result.result));
+}
+
+void NumbersTest(void)
+{
+	/* exact halfway cases, 9s, long mantissas, extreme exponents */
+	const char *numbers[] = {"9", "99.99", "0.1", "0.3", "1e23", "8.5e-5",
+	                         "9007199254740993", "9007199254740992.5", 
+	                         "123456789012345678901234567890", 
+	                         "0.000000000000000000000000000001234", 
+	                         "2.2250738585072011e-308", "4.9e-324", "1e-400",
+	                         "1.7976931348623157e308", "1e400", "12e25",
+	                         "000000000000000000000000000000000001.5",
+	                         "3.14159265358979323846264338327950288"};
+	char str[64] = {0};
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Numbers test:\t\t\t\t");
+	
+	for (i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+	{
+		is_ok = is_ok && IsParsedAsStrtod(numbers[i]);
+	}
+	
+	/* random mantissas and exponents - both the fast path and the fallback */
+	srand(1);
+	for (i = 0; i < RANDOM_NUMBERS; ++i)
+	{
+		sprintf(str, "%d%d.%de%d", rand(), rand() % 1000, rand(),
+		        rand() % 80 - 40);
+		is_ok = is_ok && IsParsedAsStrtod(str);
+		
+		sprintf(str, "%d.%02d", rand() % 100000, rand() % 100);
+		is_ok = is_ok && IsParsedAsStrtod(str);
+	}
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ OptimizeTest ****************************************/
+void OptimizeTest(void)
+{
+	static double batch_a[BATCH_ROWS];
+	static double batch_b[BATCH_ROWS];
+	static double out[BATCH_ROWS];
+	static signed char status[BATCH_ROWS];
+	const char *exprs[] = {"(2^10) * rate / 100", "1 * a + 0 - b / 1 ^ 1",
+	                       "a ^ 2 + b ^ 0.5 * (3 - 1) ^ 0.5", "0 + 1 * (a - 0)",
+	                       "a * (1 / 0) + b", "(1 - 2) ^ 0.5 + a", "2 ^ 3 ^ 2",
+	                       "a - 1 * (1 * (1 * (1 * b)))", "a + -0 - 0 ^ 1",
+	                       "-0 + a - 0 * -1"};
+	const char *names[] = {"a", "b", "rate"};
+	/* and -0, -inf and NaN - where sqrt, 'x + 0' and 'x ^ 1' would differ */
+	double values[] = {-2.5, -1, 0, 0.5, 3, 7.25, -0.0, -INFINITY, NAN};
+	size_t lengths[] = {5, 5, 8, 3, 7, 5, 1, 3, 1, 3};
+	const double *columns[2] = {batch_a, batch_b};
+	enum calc_isa isas[] = {CALC_ISA_SCALAR, CALC_ISA_SSE2, CALC_ISA_AVX2};
+	calc_program_t *program = NULL;
+	calc_program_t *optimized = NULL;
+	calc_opt_stats_t stats = {0};
+	result_t expected = {0};
+	result_t result = {0};
+	double vars[3] = {0};
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Optimize test:\t\t\t\t");
+	
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		program = CalcCompileVars(exprs[i], names, 3, NULL);
+		optimized = CalcCompileVars(exprs[i], names, 3, NULL);
+		is_ok = is_ok && (0 == CalcOptimize(optimized, &stats)) &&
+		        (lengths[i] == stats.length_after);
+		
+		/* same results, to the bit, and same errors, on every input */
+		for (j = 0; j < sizeof(values) / sizeof(values[0]); ++j)
+		{
+			vars[0] = values[j];
+			vars[1] = values[(j + 1) % (sizeof(values) / sizeof(values[0]))];
+			vars[2] = values[(j + 2) % (sizeof(values) / sizeof(values[0]))];
+			expected = CalcEval(program, vars);
+			result = CalcEval(optimized, vars);
+			
+			is_ok = is_ok && (0 == memcmp(&expected.result, &result.result,
+			                              sizeof(double))) &&
+			                 (expected.status == result.status);
+		}
+		
+		CalcProgramDestroy(program);
+		CalcProgramDestroy(optimized);
+	}
+	
+	/* the square and square root kernels of every instruction set */
+	program = CalcCompile("a ^ 2 + sqrt(b) * 2", NULL);
+	CalcOptimize(program, &stats);
+	is_ok = is_ok && (1 == stats.reduced);
+	for (i = 0; i < BATCH_ROWS; ++i)
+	{
+		batch_a[i] = 0.25 * i - 3;
+		batch_b[i] = 7.5 - 0.5 * i;
+	}
+	for (j = 0; j < sizeof(isas) / sizeof(isas[0]); ++j)
+	{
+		CalcEvalBatchIsa(program, columns, BATCH_ROWS, out, status, isas[j]);
+		for (i = 0; i < BATCH_ROWS; ++i)
+		{
+			vars[0] = batch_a[i];
+			vars[1] = batch_b[i];
+			expected = CalcEval(program, vars);
+			is_ok = is_ok && (expected.result == out[i]) &&
+			                 (expected.status == status[i]);
+		}
+	}
+	CalcProgramDestroy(program);
+	
+	/* the folded '1/0' still fails */
+	program = CalcCompile("3 + 1/0 * 2", NULL);
+	is_ok = is_ok && (0 == CalcOptimize(program, &stats)) &&
+	        (1 == stats.kept_errors) &&
+	        (MATH_ERROR == CalcEval(program, NULL).status);
+	CalcProgramDestroy(program);
+	
+	/* a constant expression is a single constant */
+	program = CalcCompile("(2 + 3) * (4 ^ 0.5) - 1 * 1", NULL);
+	is_ok = is_ok && (0 == CalcOptimize(program, NULL)) &&
+	        (9 == CalcEval(program, NULL).result);
+	CalcOptimize(program, &stats);
+	is_ok = is_ok && (1 == stats.length_before) && (1 == stats.length_after);
+	CalcProgramDestroy(program);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ CacheTest *******************************************/
+typedef struct cache_job_s
+{
+	calc_cache_t *cache;
+	atomic_size_t wrong;	/* results that differ from Calculate's */
+}cache_job_t;
+
+static void CacheTask(void *arg, size_t index, size_t worker)
+{
+	cache_job_t *job = (cache_job_t *)arg;
+	size_t n = index % (2 * CACHE_CAPACITY);
+	char str[32] = {0};
+	result_t result = {0};
+	
+	(void)worker;
+	sprintf(str, "%lu * 2 + 1", (unsigned long)n);
+	result = CalcCacheCalculate(job->cache, str);
+	
+	if ((double)n * 2 + 1 != result.result)
+	{
+		atomic_fetch_add(&job->wrong, 1);
+	}
+}
+
+void CacheTest(void)
+{
+	/* pairs of inputs with the same meaning, and pairs of different ones */
+	const char *same[][2] = {{" 3 + 5x2 ", "3+5x2"}, {"(4 *\t2)", "( 4*2 )"},
+	                         {"5 - -3", "5--3"}, {"2 ^ 3", "2^3"}};
+	const char *different[][2] = {{"5 7", "57"}, {"- 3", "-3"},
+	                              {"1e +5", "1e+5"}, {"a b", "ab"},
+	                              {"1 .5", "1.5"}};
+	calc_cache_t *cache = NULL;
+	calc_cache_stats_t stats = {0};
+	cache_job_t job = {0};
+	char long_expr[LONG_EXPR_TERMS * 4 + 2] = {0};
+	calc_pool_t *pool = NULL;
+	result_t expected = {0};
+	result_t result = {0};
+	char str[32] = {0};
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Cache test:\t\t\t\t");
+	
+	cache = CalcCacheCreate(CACHE_CAPACITY);
+	is_ok = (NULL != cache) && (NULL == CalcCacheCreate(0));
+	
+	/* the second of a pair hits the entry of the first */
+	for (i = 0; i < sizeof(same) / sizeof(same[0]); ++i)
+	{
+		expected = Calculate(same[i][1]);
+		CalcCacheCalculate(cache, same[i][0]);
+		result = CalcCacheCalculate(cache, same[i][1]);
+		is_ok = is_ok && (expected.result == result.result) &&
+		                 (expected.status == result.status);
+	}
+	CalcCacheGetStats(cache, &stats);
+	is_ok = is_ok && (4 == stats.hits) && (4 == stats.misses);
+	
+	/* ... and never the entry of a different one */
+	for (i = 0; i < sizeof(different) / sizeof(different[0]); ++i)
+	{
+		CalcCacheCalculate(cache, different[i][0]);
+		expected = Calculate(different[i][1]);
+		result = CalcCacheCalculate(cache, different[i][1]);
+		is_ok = is_ok && (expected.result == result.result) &&
+		                 (expected.status == result.status);
+	}
+	CalcCacheGetStats(cache, &stats);
+	is_ok = is_ok && (4 == stats.hits) && (14 == stats.misses) &&
+	        (0 == stats.evictions);
+	
+	/* more inputs than room - it stays bounded */
+	for (i = 0; i < 4 * CACHE_CAPACITY; ++i)
+	{
+		sprintf(str, "%lu + 0.5", (unsigned long)i);
+		result = CalcCacheCalculate(cache, str);
+		is_ok = is_ok && (i + 0.5 == result.result);
+	}
+	CalcCacheGetStats(cache, &stats);
+	is_ok = is_ok && (stats.entries <= stats.capacity) && 
+	        (stats.capacity >= CACHE_CAPACITY) && (0 < stats.evictions) &&
+	        (stats.entries + stats.evictions == stats.misses);
+	
+	/* too long to cache - still calculated */
+	for (i = 0; i < LONG_EXPR_TERMS; ++i)
+	{
+		strcpy(long_expr + 4 * i, "1 + ");
+	}
+	strcpy(long_expr + 4 * i, "1");
+	result = CalcCacheCalculate(cache, long_expr);
+	CalcCacheGetStats(cache, &stats);
+	is_ok = is_ok && (LONG_EXPR_TERMS + 1 == result.result) && 
+	        (1 == stats.bypasses);
+	
+	CalcCacheDestroy(cache);
+	
+	/* many threads on a cache smaller than their inputs */
+	job.cache = CalcCacheCreate(CACHE_CAPACITY);
+	atomic_init(&job.wrong, 0);
+	pool = CalcPoolCreate(8);
+	CalcPoolRun(pool, POOL_EXPRS, CacheTask, &job);
+	CalcCacheGetStats(job.cache, &stats);
+	is_ok = is_ok && (POOL_EXPRS == stats.hits + stats.misses) &&
+	        (0 == atomic_load(&job.wrong));
+	CalcPoolDestroy(pool);
+	CalcCacheDestroy(job.cache);
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ PoolTest ********************************************/
+static void CountTask(void *arg, size_t index, size_t worker)
+{
+	unsigned char *hits = (unsigned char *)arg;
+	
+	(void)worker;
+	++hits[index];
+}
+
+void PoolTest(void)
+{
+	static const char *exprs[POOL_EXPRS];
+	static result_t results[POOL_EXPRS];
+	static unsigned char hits[POOL_EXPRS];
+	const char *samples[] = {" 3 + 5x2/5*3 - 2:1", "(4 * (2 + 8) / (5 - 3))",
+	                         "3/0", "3 + * 1", "2^(-3) * 8 + 4 ^ 0.5 ^ 1"};
+	size_t n_threads[] = {1, 3, 8};
+	calc_pool_t *pool = NULL;
+	result_t expected = {0};
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Pool test:\t\t\t\t");
+	
+	for (i = 0; i < POOL_EXPRS; ++i)
+	{
+		exprs[i] = samples[i % (sizeof(samples) / sizeof(samples[0]))];
+	}
+	
+	for (j = 0; j < sizeof(n_threads) / sizeof(n_threads[0]); ++j)
+	{
+		pool = CalcPoolCreate(n_threads[j]);
+		is_ok = is_ok && (NULL != pool) && 
+		        (n_threads[j] == CalcPoolSize(pool));
+		
+		/* every item exactly once, however the stealing goes */
+		memset(hits, 0, sizeof(hits));
+		CalcPoolRun(pool, POOL_EXPRS, CountTask, hits);
+		for (i = 0; i < POOL_EXPRS; ++i)
+		{
+			is_ok = is_ok && (1 == hits[i]);
+		}
+		
+		/* twice - the pool is reusable */
+		CalcPoolCalculate(pool, exprs, results, POOL_EXPRS);
+		CalcPoolCalculate(pool, exprs, results, POOL_EXPRS);
+		for (i = 0; i < POOL_EXPRS; ++i)
+		{
+			expected = Calculate(exprs[i]);
+			is_ok = is_ok && (expected.result == results[i].result) &&
+			                 (expected.status == results[i].status);
+		}
+		
+		CalcPoolDestroy(pool);
+	}
+	
+	is_ok = is_ok && (NULL == CalcPoolCreate(0));
+	
+	(is_ok)
+	?
+	printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ LexTest *********************************************/
+void LexTest(void)
+{
+	/* rejected by the pre-pass - including the ')' that has no '(' */
+	const char *invalid[] = {"3)", "1) + (2", "(((1)", ")(", "2 + 3 $",
+	                         "1/0 + 2 #", "\xC3\xA9 + 1", "(1 + 2) * 3;"};
+	char long_expr[LONG_EXPR_TERMS * 4 + 2] = {0};
+	char spaced[2 * MAX_SPACE_RUN + 4] = {0};
+	result_t result = {0};
+	size_t allocs = 0;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Lex test:\t\t\t\t");
+	
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+	{
+		result = Calculate(invalid[i]);
+		is_ok &= (SYNTAX_ERROR == result.status && -1 == result.result);
+	}
+	
+	/* a bad byte at every position of a long input - every vector lane */
+	for (i = 0; i < LONG_EXPR_TERMS; ++i)
+	{
+		memcpy(long_expr + i * 4, (i + 1 < LONG_EXPR_TERMS) ? "1 + " : "1   ",
+		       4);
+	}
+	for (i = 0; i < LONG_EXPR_TERMS * 4; ++i)
+	{
+		long_expr[i] ^= (char)0x80;
+		result = Calculate(long_expr);
+		is_ok &= (SYNTAX_ERROR == result.status);
+		long_expr[i] ^= (char)0x80;
+	}
+	result = Calculate(long_expr);
+	is_ok &= (CALC_SUCCESS == result.status && LONG_EXPR_TERMS == result.result);
+	
+	/* rejected without the stacks - a long input allocates nothing */
+	long_expr[LONG_EXPR_TERMS * 4] = ')';
+	allocs = g_alloc_count;
+	result = Calculate(long_expr);
+	is_ok &= (SYNTAX_ERROR == result.status && allocs == g_alloc_count);
+	
+	/* runs of spaces of every length, across vector blocks */
+	for (i = 1; i <= MAX_SPACE_RUN; ++i)
+	{
+		memset(spaced, '\t', 2 * i + 3);
+		spaced[0] = '1';
+		spaced[i + 1] = '+';
+		spaced[2 * i + 2] = '2';
+		spaced[2 * i + 3] = '\0';
+		result = Calculate(spaced);
+		is_ok &= (CALC_SUCCESS == result.status && 3 == result.result);
+	}
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ MemoryPeakTest **************************************/
+void MemoryPeakTest(void)
+{
+	char *expr = NULL;
+	result_t result = {0};
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Memory peak test:\t\t\t");
+	
+	expr = (char *)malloc(PEAK_EXPR_TERMS * 2 + 1);
+	if (NULL == expr)
+	{
+		printf("FAIL");
+		return;
+	}
+	
+	/* "1+1+1..." - 4 MB of input, and stacks of 2 elements */
+	for (i = 0; i < PEAK_EXPR_TERMS; ++i)
+	{
+		expr[i * 2] = '1';
+		expr[i * 2 + 1] = '+';
+	}
+	expr[PEAK_EXPR_TERMS * 2 - 1] = '\0';
+	
+	g_largest_alloc = 0;
+	result = Calculate(expr);
+	is_ok &= (CALC_SUCCESS == result.status && 
+	          PEAK_EXPR_TERMS == result.result && 0 == g_largest_alloc);
+	
+	/* "1+(1+(1+..." - the stacks grow as deep as it nests, not as long as
+	   it is (9 bytes of stack per input char, before) */
+	for (i = 0; i < PEAK_DEPTH; ++i)
+	{
+		memcpy(expr + i * 3, "1+(", 3);
+	}
+	expr[PEAK_DEPTH * 3] = '1';
+	memset(expr + PEAK_DEPTH * 3 + 1, ')', PEAK_DEPTH);
+	expr[PEAK_DEPTH * 4 + 1] = '\0';
+	
+	g_largest_alloc = 0;
+	result = Calculate(expr);
+	is_ok &= (CALC_SUCCESS == result.status && 
+	          PEAK_DEPTH + 1 == result.result &&
+	          g_largest_alloc <= PEAK_DEPTH * 2 * 2 * sizeof(double));
+	
+	free(expr);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ LimitsTest ******************************************/
+void LimitsTest(void)
+{
+	const calc_limits_t limits = {6, 3};
+	char *expr = NULL;
+	result_t result_1 = {0};
+	result_t result_2 = {0};
+	result_t result_3 = {0};
+	result_t result_4 = {0};
+	result_t result_5 = {0};
+	result_t result_6 = {0};
+	result_t result_7 = {0};
+	size_t allocs = 0;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Limits test:\t\t\t\t");
+	
+	/* a lower priority op runs every pending op above it, not just one */
+	result_1 = Calculate("2*3^2-1");
+	result_2 = Calculate("1-2*3^2+4");
+	
+	result_3 = CalcNLimited("1+2+34", 6, &limits, NULL);
+	result_4 = CalcNLimited("1+2+345", 7, &limits, NULL);
+	result_5 = CalcNLimited("(((1)))", 7, NULL, NULL);
+	result_6 = CalcNLimited("((1))", 5, &limits, NULL);
+	result_7 = CalcNLimited("((((1))))", 9, NULL, NULL);
+	
+	is_ok = (17 == result_1.result) && (CALC_SUCCESS == result_1.status) &&
+	        (-13 == result_2.result) && (CALC_SUCCESS == result_2.status) &&
+	        (37 == result_3.result) && (CALC_SUCCESS == result_3.status) &&
+	        (-1 == result_4.result) && (LIMIT_ERROR == result_4.status) &&
+	        (1 == result_5.result) && (CALC_SUCCESS == result_5.status) &&
+	        (1 == result_6.result) && (CALC_SUCCESS == result_6.status) &&
+	        (1 == result_7.result) && (CALC_SUCCESS == result_7.status);
+	
+	result_7 = CalcNLimited("((((1))))", 9, &limits, NULL);
+	is_ok &= (-1 == result_7.result) && (LIMIT_ERROR == result_7.status);
+	
+	/* "2^1/2^1*2^1..." - mixed priorities, flat. the stacks stay short, so
+	   nothing is allocated however long it is */
+	expr = (char *)malloc(MIXED_TERMS * 4);
+	if (NULL == expr)
+	{
+		printf("FAIL");
+		return;
+	}
+	for (i = 0; i < MIXED_TERMS; ++i)
+	{
+		memcpy(expr + i * 4, (0 == i % 2) ? "2^1/" : "2^1*", 4);
+	}
+	expr[MIXED_TERMS * 4 - 1] = '\0';
+	
+	allocs = g_alloc_count;
+	result_1 = Calculate(expr);
+	is_ok &= (1 == result_1.result) && (CALC_SUCCESS == result_1.status) &&
+	         (allocs == g_alloc_count);
+	
+	free(expr);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ SplitTest *******************************************/
+void SplitTest(void)
+{
+	/* signs, exponents and parentheses that must not be split at */
+	const char *terms[] = {"%d.25 * -3", "(%d - 2.5) / 7", "1e-3 * %d",
+	                       "2 ^ (-%d : 1000)", " %d x (1 + -2) ", "-%d.5"};
+	size_t n_threads[] = {1, 3};
+	calc_pool_t *pool = NULL;
+	char *expr = NULL;
+	char *exact = NULL;
+	result_t expected = {0};
+	result_t ordered = {0};
+	result_t fast = {0};
+	size_t len = 0;
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Split test:\t\t\t\t");
+	
+	expr = (char *)malloc(SPLIT_TERMS * SPLIT_TERM_CHARS);
+	exact = (char *)malloc(SPLIT_TERMS * SPLIT_TERM_CHARS);
+	if (NULL == expr || NULL == exact)
+	{
+		free(exact);
+		free(expr);
+		printf("FAIL");
+		return;
+	}
+	
+	for (i = 0; i < SPLIT_TERMS; ++i)
+	{
+		len += sprintf(expr + len, terms[i % (sizeof(terms) / sizeof(terms[0]))],
+		               (int)(i % 1000));
+		len += sprintf(expr + len, "%s", (i + 1 == SPLIT_TERMS) ? "" :
+		                                 (0 == i % 3) ? " - " : "+");
+	}
+	expected = CalcN(expr, len);
+	is_ok &= (CALC_SUCCESS == expected.status);
+	
+	for (j = 0; j < sizeof(n_threads) / sizeof(n_threads[0]); ++j)
+	{
+		pool = CalcPoolCreate(n_threads[j]);
+		
+		/* ordered - CalcN's result to the bit. fast - close to it */
+		ordered = CalcPoolCalcN(pool, expr, len, CALC_REDUCE_ORDERED);
+		fast = CalcPoolCalcN(pool, expr, len, CALC_REDUCE_FAST);
+		is_ok &= (expected.result == ordered.result) &&
+		         (CALC_SUCCESS == ordered.status) &&
+		         (fabs(expected.result - fast.result) <=
+		          1e-9 * fabs(expected.result)) &&
+		         (CALC_SUCCESS == fast.status);
+		
+		/* deterministic on the same pool */
+		is_ok &= (fast.result ==
+		          CalcPoolCalcN(pool, expr, len, CALC_REDUCE_FAST).result);
+		
+		/* the first run starts its allocation - nothing before it is read
+		   (make sanitize=address reports it if it is) */
+		memcpy(exact, expr, len);
+		is_ok &= (fast.result == CalcPoolCalcN(pool, exact, len,
+		                                       CALC_REDUCE_FAST).result);
+		
+		/* short inputs aren't split */
+		ordered = CalcPoolCalcN(pool, "2 * 3 ^ 2 - 1", 13, CALC_REDUCE_ORDERED);
+		is_ok &= (17 == ordered.result) && (CALC_SUCCESS == ordered.status);
+		
+		CalcPoolDestroy(pool);
+	}
+	
+	/* errors - the one CalcN reports, wherever the failing term is */
+	pool = CalcPoolCreate(3);
+	memcpy(expr + len / 2, "1/0", 3);
+	for (j = 0; j < 3; ++j)
+	{
+		expected = CalcN(expr, len);
+		ordered = CalcPoolCalcN(pool, expr, len, CALC_REDUCE_ORDERED);
+		fast = CalcPoolCalcN(pool, expr, len, CALC_REDUCE_FAST);
+		is_ok &= (CALC_SUCCESS != expected.status) &&
+		         (expected.status == ordered.status) &&
+		         (expected.result == ordered.result) &&
+		         (expected.status == fast.status);
+		
+		/* then a syntax error after it, then an unbalanced input */
+		expr[len - 1] = (0 == j) ? '+' : '(';
+	}
+	CalcPoolDestroy(pool);
+	
+	free(exact);
+	free(expr);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ BundleTest ******************************************/
+void BundleTest(void)
+{
+	const char *exprs[BUNDLE_PROGRAMS] = {" 3 + 5x2/5*3 - 2:1",
+	                                      "price * qty - discount",
+	                                      "(2^10) * rate / 100 * 1",
+	                                      "a ^ 2 + (b + 2) ^ 0.5", "b / (a - a)",
+	                                      "((((((1 + x) * 2) - a) / 4) ^ 2))"};
+	const double vars[] = {2.5, 4, 7};
+	calc_program_t *programs[BUNDLE_PROGRAMS] = {NULL};
+	const calc_program_t *loaded = NULL;
+	calc_bundle_t *bundle = NULL;
+	char path[] = "/tmp/calc_test_bundle_XXXXXX";
+	unsigned char *image = NULL;
+	FILE *file = NULL;
+	result_t expected = {0};
+	result_t result = {0};
+	long size = 0;
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Bundle test:\t\t\t\t");
+	
+	if (-1 == close(mkstemp(path)))
+	{
+		printf("FAIL");
+		return;
+	}
+	
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		programs[i] = CalcCompile(exprs[i], NULL);
+		is_ok &= (NULL != programs[i]);
+	}
+	/* optimized ones too - folded constants, OPC_SQUARE */
+	is_ok &= (0 == CalcOptimize(programs[2], NULL)) &&
+	         (0 == CalcOptimize(programs[3], NULL));
+	
+	is_ok &= (0 == CalcBundleWrite(path,
+	                               (const calc_program_t *const *)programs,
+	                               BUNDLE_PROGRAMS));
+	bundle = CalcBundleOpen(path);
+	is_ok &= (NULL != bundle);
+	if (!is_ok)
+	{
+		printf("FAIL");
+		return;
+	}
+	
+	/* the same results, the same names */
+	is_ok &= (BUNDLE_PROGRAMS == CalcBundleCount(bundle)) &&
+	         (NULL == CalcBundleProgram(bundle, BUNDLE_PROGRAMS));
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		loaded = CalcBundleProgram(bundle, i);
+		expected = CalcEval(programs[i], vars);
+		result = CalcEval(loaded, vars);
+		is_ok &= (expected.result == result.result) &&
+		         (expected.status == result.status) &&
+		         (CalcVarCount(programs[i]) == CalcVarCount(loaded));
+		for (j = 0; j < CalcVarCount(loaded); ++j)
+		{
+			is_ok &= (0 == strcmp(CalcVarName(programs[i], j),
+			                      CalcVarName(loaded, j)));
+		}
+	}
+	
+	/* a bundle can be written from a bundle - over its own file, which it
+	   keeps reading, unchanged */
+	loaded = CalcBundleProgram(bundle, 1);
+	is_ok &= (0 == CalcBundleWrite(path, &loaded, 1));
+	is_ok &= (BUNDLE_PROGRAMS == CalcBundleCount(bundle)) &&
+	         (CalcEval(programs[0], vars).result ==
+	          CalcEval(CalcBundleProgram(bundle, 0), vars).result);
+	CalcBundleClose(bundle);
+	bundle = CalcBundleOpen(path);
+	is_ok &= (NULL != bundle) && (1 == CalcBundleCount(bundle)) &&
+	         (CalcEval(programs[1], vars).result ==
+	          CalcEval(CalcBundleProgram(bundle, 0), vars).result);
+	CalcBundleClose(bundle);
+	
+	/* damaged files aren't opened - a flipped bit anywhere, a truncated file */
+	is_ok &= (0 == CalcBundleWrite(path,
+	                               (const calc_program_t *const *)programs,
+	                               BUNDLE_PROGRAMS));
+	file = fopen(path, "rb");
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+	image = (unsigned char *)malloc(size);
+	is_ok &= (NULL != image) && (size == (long)fread(image, 1, size, file));
+	fclose(file);
+	
+	for (i = 0; is_ok && i < (size_t)size; ++i)
+	{
+		image[i] ^= 0x10;
+		file = fopen(path, "wb");
+		fwrite(image, 1, size, file);
+		fclose(file);
+		image[i] ^= 0x10;
+		
+		bundle = CalcBundleOpen(path);
+		is_ok &= (NULL == bundle);
+		CalcBundleClose(bundle);
+	}
+	
+	file = fopen(path, "wb");
+	fwrite(image, 1, size - 8, file);
+	fclose(file);
+	is_ok &= (NULL == CalcBundleOpen(path)) &&
+	         (NULL == CalcBundleOpen("/no/such/bundle"));
+	
+	/* no programs at all */
+	is_ok &= (0 == CalcBundleWrite(path, NULL, 0));
+	bundle = CalcBundleOpen(path);
+	is_ok &= (NULL != bundle) && (0 == CalcBundleCount(bundle)) &&
+	         (NULL == CalcBundleProgram(bundle, 0));
+	CalcBundleClose(bundle);
+	
+	free(image);
+	remove(path);
+	for (i = 0; i < BUNDLE_PROGRAMS; ++i)
+	{
+		CalcProgramDestroy(programs[i]);
+	}
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ JitTest *********************************************/
+void JitTest(void)
+{
+	const char *exprs[] = {"(a + 2) * b / (b - 3) - a ^ 0.5 + 2 - b",
+	                       "a / (b - c) * (c - a) - (a + b) / c",
+	                       "((a - b) ^ 2 + (b - c) ^ 2) ^ 0.5",
+	                       "2 ^ a ^ b - sqrt(c) / 3", "a * 1 + 0 - b ^ 1",
+	                       "(((((a + 1) * (b + 2)) - (c + 3)) / 4) ^ 3)"};
+	/* signs, zeros, NaN, overflow - every error and none */
+	const double vars[][3] = {{2.5, 4, 7}, {-3, 3, 0}, {16, 2, 2},
+	                          {NAN, 0, -0.0}, {1e308, -1e308, 1e-308},
+	                          {INFINITY, INFINITY, 0.5}};
+	calc_program_t *program = NULL;
+	calc_jit_t *jit = NULL;
+	char *deep = NULL;
+	result_t expected = {0};
+	result_t result = {0};
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	int is_ok = 1;
+	
+	printf("Jit test:\t\t\t\t");
+	
+	/* as interpreted, and optimized - OPC_SQUARE */
+	for (i = 0; i < 2 * sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		program = CalcCompile(exprs[i / 2], NULL);
+		if (1 == i % 2)
+		{
+			CalcOptimize(program, NULL);
+		}
+		jit = CalcJitCreate(program, JIT_THRESHOLD);
+		
+		/* interpreted up to the threshold, native from then on */
+		for (k = 0; k <= JIT_THRESHOLD; ++k)
+		{
+			is_ok &= (0 == CalcJitIsNative(jit));
+			CalcJitEval(jit, vars[0]);
+		}
+		is_ok &= CalcJitIsNative(jit);
+		
+		for (j = 0; j < sizeof(vars) / sizeof(vars[0]); ++j)
+		{
+			expected = CalcEval(program, vars[j]);
+			result = CalcJitEval(jit, vars[j]);
+			is_ok &= (expected.status == result.status) &&
+			         (0 == memcmp(&expected.result, &result.result,
+			                      sizeof(double)));
+		}
+		
+		CalcJitDestroy(jit);
+		CalcProgramDestroy(program);
+	}
+	
+	/* too deep for a native frame - interpreted, the same results */
+	deep = (char *)malloc(JIT_DEEP_TERMS * 4 + 2);
+	if (NULL == deep)
+	{
+		printf("FAIL");
+		return;
+	}
+	for (i = 0; i < JIT_DEEP_TERMS; ++i)
+	{
+		memcpy(deep + i * 3, "a+(", 3);
+	}
+	deep[JIT_DEEP_TERMS * 3] = '1';
+	memset(deep + JIT_DEEP_TERMS * 3 + 1, ')', JIT_DEEP_TERMS);
+	deep[JIT_DEEP_TERMS * 4 + 1] = '\0';
+	
+	program = CalcCompile(deep, NULL);
+	jit = CalcJitCreate(program, 0);
+	result = CalcJitEval(jit, vars[0]);
+	expected = CalcEval(program, vars[0]);
+	is_ok &= (NULL != program) && (0 == CalcJitIsNative(jit)) &&
+	         (CALC_SUCCESS == result.status) &&
+	         (expected.result == result.result);
+	CalcJitDestroy(jit);
+	CalcProgramDestroy(program);
+	free(deep);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ ExactTest *******************************************/
+void ExactTest(void)
+{
+	/* exact in integers, or promoted to double on the way */
+	const struct
+	{
+		const char *expr;
+		long long integer;
+		double result;
+		int is_integer;
+		int status;
+	}cases[] =
+	{
+		{"3 ^ 39", 4052555153018976267LL, 4052555153018976267.0, 1, 0},
+		{"(2 ^ 53 + 1) * 3", 27021597764222979LL, 27021597764222979.0, 1, 0},
+		{"8 / 2 * 3 - 20", -8, -8, 1, CALC_SUCCESS},
+		{"7 / 2", 0, 3.5, 0, CALC_SUCCESS},
+		{"2 ^ 63", 0, 9223372036854775808.0, 0, CALC_SUCCESS},
+		{"2 ^ 62 + 2 ^ 62 - 1", 0, 9223372036854775808.0, 0, CALC_SUCCESS},
+		{"2 ^ -1 + 1", 0, 1.5, 0, CALC_SUCCESS},
+		{"4 / (2 - 2)", -1, -1, 0, MATH_ERROR},
+		{"(1 - 3) ^ 0.5", -1, -1, 0, MATH_ERROR},
+		{"-0 ^ -1", 0, -INFINITY, 0, CALC_SUCCESS},
+		{"(0 * -3) ^ -1", 0, -INFINITY, 0, CALC_SUCCESS},
+		{"(0 / -3) ^ -1", 0, -INFINITY, 0, CALC_SUCCESS},
+		{"(0 - 0) ^ -1", 0, INFINITY, 0, CALC_SUCCESS}
+	};
+	const double zero_vars[] = {-0.0};
+	const double int_vars[] = {12, 3, 2};
+	const double vars[] = {12, 3, 2.5};
+	char expr[64] = {0};
+	calc_program_t *program = NULL;
+	calc_exact_t exact = {0};
+	result_t result = {0};
+	double expected = 0;
+	int base = 0;
+	int exponent = 0;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Exact test:\t\t\t\t");
+	
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		program = CalcCompile(cases[i].expr, NULL);
+		exact = CalcEvalExact(program, NULL);
+		is_ok &= (cases[i].is_integer == exact.is_integer) &&
+		         (cases[i].integer == exact.integer) &&
+		         (cases[i].result == exact.result) &&
+		         (cases[i].status == exact.status);
+		CalcProgramDestroy(program);
+	}
+	
+	program = CalcCompile("price * qty - discount", NULL);
+	exact = CalcEvalExact(program, int_vars);
+	is_ok &= (1 == exact.is_integer) && (34 == exact.integer);
+	exact = CalcEvalExact(program, vars);
+	is_ok &= (0 == exact.is_integer) && (33.5 == exact.result);
+	CalcProgramDestroy(program);
+	
+	/* a -0 variable stays -0, as in CalcEval */
+	program = CalcCompile("a ^ -1", NULL);
+	exact = CalcEvalExact(program, zero_vars);
+	is_ok &= (0 == exact.is_integer) && (-INFINITY == exact.result) &&
+	         (CalcEval(program, zero_vars).result == exact.result);
+	CalcProgramDestroy(program);
+	
+	/* the fast paths of '^' - pow's results, to the bit. halves from -6 to 6
+	   by halves from -35 to 35 */
+	for (base = -12; base <= 12; ++base)
+	{
+		for (exponent = -70; exponent <= 70; ++exponent)
+		{
+			sprintf(expr, "(%.17g) ^ (%.17g)", base / 2.0, exponent / 2.0);
+			result = Calculate(expr);
+			expected = pow(base / 2.0, exponent / 2.0);
+			is_ok &= (isnan(expected)) ? (MATH_ERROR == result.status) :
+			         (CALC_SUCCESS == result.status &&
+			          0 == memcmp(&expected, &result.result, sizeof(double)));
+		}
+	}
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+void FunctionsTest(void)
+{
+	const struct
+	{
+		const char *expr;
+		double result;
+		int status;
+	}cases[] =
+	{
+		{"sqrt(16)", 4, CALC_SUCCESS},
+		{"max(2, 3) * 2", 6, CALC_SUCCESS},
+		{"min(1, -2)", -2, CALC_SUCCESS},
+		{"abs(-3) + abs(2)", 5, CALC_SUCCESS},
+		{"max(min(1, 2), abs(-5)) ^ 2", 25, CALC_SUCCESS},
+		{"sqrt (3 * 3) + max(1 + 2 * 3, (4 - 1) ^ 2)", 12, CALC_SUCCESS},
+		{"2 x sqrt(4)", 4, CALC_SUCCESS},
+		{"exp(0) + log(1) + sin(0)", 1, CALC_SUCCESS},
+		{"log(0)", -INFINITY, CALC_SUCCESS},
+		{"sqrt(-1)", -1, MATH_ERROR},
+		{"log(0 - 1) + 1", -1, MATH_ERROR},
+		{"min(1 / 0, 2)", -1, MATH_ERROR},
+		{"min(1)", -1, SYNTAX_ERROR},
+		{"sqrt(1, 2)", -1, SYNTAX_ERROR},
+		{"min(1,)", -1, SYNTAX_ERROR},
+		{"(1, 2)", -1, SYNTAX_ERROR},
+		{"max(1, (2, 3))", -1, SYNTAX_ERROR},
+		{"1, 2", -1, SYNTAX_ERROR},
+		{"sqrt 4", -1, SYNTAX_ERROR},
+		{"sqrt()", -1, SYNTAX_ERROR},
+		{"cos(1)", -1, SYNTAX_ERROR}
+	};
+	const char *exprs[] = {"exp(x / 4) - log(abs(x) + 1) * sin(x)",
+	                       "max(x, min) ^ 2 + sqrt(abs(x))",
+	                       "min(x, 2) * max(x, 0 - 2) + log(16) * exp(x)"};
+	const double values[] = {-3.5, -1, 0, 0.25, 2, 7};
+	double vars[2] = {0};
+	calc_program_t *program = NULL;
+	calc_program_t *optimized = NULL;
+	calc_jit_t *jit = NULL;
+	calc_exact_t exact = {0};
+	result_t result = {0};
+	result_t expected = {0};
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Functions test:\t\t\t\t");
+	
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		result = Calculate(cases[i].expr);
+		is_ok &= (cases[i].result == result.result) &&
+		         (cases[i].status == result.status);
+		
+		program = CalcCompile(cases[i].expr, NULL);
+		is_ok &= (SYNTAX_ERROR == cases[i].status) ? (NULL == program) :
+		         (cases[i].status == CalcEval(program, NULL).status);
+		CalcProgramDestroy(program);
+	}
+	
+	/* a function's name, not called, is a variable */
+	program = CalcCompile(exprs[1], NULL);
+	is_ok &= (NULL != program) && (2 == CalcVarCount(program)) &&
+	         (1 == CalcVarIndex(program, "min"));
+	CalcProgramDestroy(program);
+	
+	/* CalcEval, optimized, native and the plain calculation - to the bit */
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		program = CalcCompile(exprs[i], NULL);
+		optimized = CalcCompile(exprs[i], NULL);
+		CalcOptimize(optimized, NULL);
+		jit = CalcJitCreate(program, 0);
+		
+		for (j = 0; j < sizeof(values) / sizeof(values[0]); ++j)
+		{
+			vars[0] = values[j];
+			vars[1] = 1.5;
+			expected = CalcEval(program, vars);
+			
+			result = CalcEval(optimized, vars);
+			is_ok &= (expected.status == result.status) &&
+			         (0 == memcmp(&expected.result, &result.result,
+			                      sizeof(double)));
+			
+			result = CalcJitEval(jit, vars);
+			is_ok &= (expected.status == result.status) &&
+			         (0 == memcmp(&expected.result, &result.result,
+			                      sizeof(double)));
+		}
+		
+		CalcJitDestroy(jit);
+		CalcProgramDestroy(optimized);
+		CalcProgramDestroy(program);
+	}
+	
+	result = Calculate("exp(0.25) - log(1 + 1) * sin(0.5)");
+	is_ok &= (exp(0.25) - log(2) * sin(0.5) == result.result);
+	
+	/* constant calls are folded */
+	program = CalcCompile("x + sqrt(16) * max(1, 2)", NULL);
+	CalcOptimize(program, NULL);
+	vars[0] = 1;
+	is_ok &= (9 == CalcEval(program, vars).result);
+	CalcProgramDestroy(program);
+	
+	/* abs, min and max keep to the integers */
+	program = CalcCompile("abs(0 - 3 ^ 39) + min(1, 2) * max(3, 4)", NULL);
+	exact = CalcEvalExact(program, NULL);
+	is_ok &= (1 == exact.is_integer) &&
+	         (4052555153018976267LL + 4 == exact.integer);
+	CalcProgramDestroy(program);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/* distance of two doubles in units in the last place */
+static int64_t UlpDistance(double a, double b)
+{
+	int64_t ia = 0;
+	int64_t ib = 0;
+	
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	ia = (ia < 0) ? INT64_MIN - ia : ia;
+	ib = (ib < 0) ? INT64_MIN - ib : ib;
+	
+	return ((ia > ib) ? ia - ib : ib - ia);
+}
+
+void MathBatchTest(void)
+{
+	const char *exprs[] = {"log(x)", "exp(x)", "sin(x)", "sin(x)"};
+	double (*const libm[])(double) = {log, exp, sin, sin};
+	const double ranges[][2] = {{-690, 690}, {-708, 709},
+	                            {-3.141592653589793, 3.141592653589793},
+	                            {-65536, 65536}};
+	const int64_t max_ulp[] = {1, 1, 1, SIN_WIDE_ULP};
+	const double special[] = {0, -0.0, 1, -1, 1e-320, INFINITY, -INFINITY,
+	                          NAN, 710, -746, 1e6, 3.141592653589793};
+	const enum calc_isa isas[] = {CALC_ISA_SSE2, CALC_ISA_AVX2};
+	const double *columns[1] = {NULL};
+	double *x = (double *)malloc(MATH_ROWS * sizeof(double));
+	double *scalar = (double *)malloc(MATH_ROWS * sizeof(double));
+	double *out = (double *)malloc(MATH_ROWS * sizeof(double));
+	signed char *status = (signed char *)malloc(MATH_ROWS);
+	calc_program_t *program = NULL;
+	result_t single = {0};
+	double expected = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	int is_ok = 1;
+	
+	printf("Math batch test:\t\t\t");
+	
+	columns[0] = x;
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); ++i)
+	{
+		program = CalcCompile(exprs[i], NULL);
+		
+		/* log on a log scale - from 1e-300 to 1e300 - the others evenly */
+		for (j = 0; j < MATH_ROWS; ++j)
+		{
+			x[j] = ranges[i][0] + (ranges[i][1] - ranges[i][0]) *
+			       ((double)rand() / RAND_MAX);
+			x[j] = (0 == i) ? exp(x[j]) : x[j];
+		}
+		memcpy(x, special, sizeof(special));
+		
+		CalcEvalBatchIsa(program, columns, MATH_ROWS, scalar, status,
+		                 CALC_ISA_SCALAR);
+		
+		/* within the bound of libm - what CalcEval returns - and failing
+		   where it fails */
+		for (j = 0; j < MATH_ROWS; ++j)
+		{
+			expected = libm[i](x[j]);
+			single = CalcEval(program, x + j);
+			is_ok &= (single.status == status[j]);
+			if (CALC_SUCCESS == status[j])
+			{
+				is_ok &= (UlpDistance(expected, scalar[j]) <= max_ulp[i]);
+			}
+		}
+		
+		/* and the vectors give the same results, to the bit */
+		for (k = 0; k < sizeof(isas) / sizeof(isas[0]); ++k)
+		{
+			CalcEvalBatchIsa(program, columns, MATH_ROWS, out, NULL, isas[k]);
+			is_ok &= (0 == memcmp(scalar, out, MATH_ROWS * sizeof(double)));
+		}
+		
+		CalcProgramDestroy(program);
+	}
+	
+	free(status);
+	free(out);
+	free(scalar);
+	free(x);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ StatsTest *******************************************/
+static void StatsTask(void *arg, size_t index, size_t worker)
+{
+	(void)arg;
+	(void)index;
+	(void)worker;
+	Calculate("2 * (3 + 4)");
+}
+
+void StatsTest(void)
+{
+	calc_stats_t stats = {0};
+	calc_pool_t *pool = NULL;
+	calc_program_t *program = NULL;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Stats test:\t\t\t\t");
+	
+	/* not compiled in - nothing is counted */
+	if (!CalcStatsEnabled())
+	{
+		Calculate("1 + 2");
+		CalcStatsGet(&stats);
+		is_ok = (0 == stats.calls[CALC_PHASE_TOTAL]) && (0 == stats.max);
+		
+		is_ok ? printf("SUCCESS") : printf("FAIL");
+		return;
+	}
+	
+	/* this thread, and threads that end before the counters are read */
+	CalcStatsReset();
+	for (i = 0; i < STATS_EXPRS; ++i)
+	{
+		Calculate("2 * (3 + 4)");
+	}
+	pool = CalcPoolCreate(4);
+	CalcPoolRun(pool, STATS_EXPRS, StatsTask, NULL);
+	CalcPoolDestroy(pool);
+	
+	CalcStatsGet(&stats);
+	is_ok &= (2 * STATS_EXPRS == stats.calls[CALC_PHASE_TOTAL]) &&
+	         (2 * STATS_EXPRS == stats.calls[CALC_PHASE_LEX]) &&
+	         (4 * STATS_EXPRS == stats.calls[CALC_PHASE_STACKS]) &&
+	         (6 * STATS_EXPRS == stats.calls[CALC_PHASE_NUMBER]) &&
+	         (4 * STATS_EXPRS == stats.calls[CALC_PHASE_EXECUTE]);
+	for (i = 1; i < CALC_PHASE_COUNT; ++i)
+	{
+		is_ok &= (stats.ticks[i] <= stats.ticks[CALC_PHASE_TOTAL]);
+	}
+	is_ok &= (0 < stats.ns_per_tick) && (0 < stats.p50) &&
+	         (stats.p50 <= stats.p90) && (stats.p90 <= stats.p99) &&
+	         (stats.p99 <= stats.p999) && (stats.p999 <= stats.max);
+	
+	/* an error stops the counting where it stops the parser - an
+	   unbalanced input doesn't get past the lexer */
+	CalcStatsReset();
+	Calculate("1 / 0 + 5");
+	Calculate("1 +");
+	Calculate("(1");
+	CalcStatsGet(&stats);
+	is_ok &= (3 == stats.calls[CALC_PHASE_TOTAL]) &&
+	         (3 == stats.calls[CALC_PHASE_LEX]) &&
+	         (4 == stats.calls[CALC_PHASE_STACKS]) &&
+	         (3 == stats.calls[CALC_PHASE_NUMBER]) &&
+	         (1 == stats.calls[CALC_PHASE_EXECUTE]);
+	
+	/* compiling runs the parser, but executes nothing */
+	CalcStatsReset();
+	program = CalcCompile("a * 2 + 1", NULL);
+	CalcEval(program, (double[]){3});
+	CalcProgramDestroy(program);
+	CalcStatsGet(&stats);
+	is_ok &= (1 == stats.calls[CALC_PHASE_TOTAL]) &&
+	         (2 == stats.calls[CALC_PHASE_NUMBER]) &&
+	         (0 == stats.calls[CALC_PHASE_EXECUTE]);
+	
+	/* a reset starts over */
+	CalcStatsReset();
+	CalcStatsGet(&stats);
+	is_ok &= (0 == stats.calls[CALC_PHASE_TOTAL]) &&
+	         (0 == stats.ticks[CALC_PHASE_NUMBER]) && (0 == stats.max);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ ServerTest ******************************************/
+/* what SendAll writes, on a thread of its own */
+typedef struct send_job_s
+{
+	int fd;
+	const char *data;
+	size_t len;
+}send_job_t;
+
+static void *SendAll(void *arg)
+{
+	send_job_t *job = (send_job_t *)arg;
+	ssize_t sent = 0;
+	size_t offset = 0;
+	
+	for (; offset < job->len; offset += sent)
+	{
+		sent = write(job->fd, job->data + offset, job->len - offset);
+		if (sent <= 0)
+		{
+			break;
+		}
+	}
+	
+	/* the server answers the last line, then closes */
+	shutdown(job->fd, SHUT_WR);
+	
+	return (NULL);
+}
+
+/* reads until the server closes - returns the bytes read */
+static size_t ReadAll(int fd, char *buffer, size_t size)
+{
+	ssize_t got = 0;
+	size_t used = 0;
+	
+	while (used < size && (got = read(fd, buffer + used, size - used)) > 0)
+	{
+		used += got;
+	}
+	
+	return (used);
+}
+
+/* sends 'data' while reading the answers, as a pipelining client does */
+static size_t Exchange(int fd, const char *data, size_t len, char *answers,
+                       size_t size)
+{
+	send_job_t job = {0};
+	pthread_t sender;
+	size_t used = 0;
+	
+	job.fd = fd;
+	job.data = data;
+	job.len = len;
+	if (0 != pthread_create(&sender, NULL, SendAll, &job))
+	{
+		return (0);
+	}
+	used = ReadAll(fd, answers, size);
+	pthread_join(sender, NULL);
+	
+	return (used);
+}
+
+void ServerTest(void)
+{
+	const char expected[] = "3\nSYNTAX ERROR\nMATH ERROR\n9\nLIMIT ERROR\n"
+	                        "LIMIT ERROR\n7\n16\n";
+	calc_server_config_t config = {0};
+	calc_server_stats_t stats = {0};
+	calc_server_t *server = NULL;
+	struct sockaddr_un unix_address = {0};
+	struct sockaddr_in tcp_address = {0};
+	char path[] = "/tmp/calc_test_socket_XXXXXX";
+	size_t size = SERVER_LINES * SERVER_LINE_CHARS + CALC_SERVER_MAX_LINE * 2;
+	char *input = (char *)malloc(size);
+	char *answers = (char *)malloc(size);
+	char *runner = NULL;
+	size_t len = 0;
+	size_t i = 0;
+	int fd = -1;
+	int is_ok = (NULL != input && NULL != answers);
+	
+	printf("Server test:\t\t\t\t");
+	
+	/* a stale file where the socket goes - replaced */
+	close(mkstemp(path));
+	config.unix_path = path;
+	config.use_tcp = 1;
+	config.n_workers = 2;
+	config.limits.max_length = 100;
+	server = CalcServerCreate(&config);
+	is_ok &= (NULL != server) && (0 != CalcServerTcpPort(server));
+	
+	/* every kind of answer, a line split between writes, a line over the
+	   limits, one over the buffer, and a last one with no newline */
+	if (is_ok)
+	{
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		unix_address.sun_family = AF_UNIX;
+		strcpy(unix_address.sun_path, path);
+		is_ok &= (0 == connect(fd, (struct sockaddr *)&unix_address,
+		                       sizeof(unix_address)));
+		
+		is_ok &= (20 == write(fd, "1 + 2\n2 * (3\n1/0\n4 +", 20));
+		runner = input;
+		runner += sprintf(runner, " 5\n");
+		for (i = 0; i < 60; ++i)
+		{
+			runner += sprintf(runner, "1+");
+		}
+		runner += sprintf(runner, "1\n");
+		memset(runner, ' ', CALC_SERVER_MAX_LINE + 10);
+		runner += CALC_SERVER_MAX_LINE + 10;
+		runner += sprintf(runner, "1\n7\n8 * 2");
+		
+		len = Exchange(fd, input, runner - input, answers, size);
+		is_ok &= (strlen(expected) == len) &&
+		         (0 == memcmp(expected, answers, len));
+		close(fd);
+	}
+	
+	/* many lines in flight over TCP - the answers come in their order */
+	if (is_ok)
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		tcp_address.sin_family = AF_INET;
+		tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		tcp_address.sin_port = htons(CalcServerTcpPort(server));
+		is_ok &= (0 == connect(fd, (struct sockaddr *)&tcp_address,
+		                       sizeof(tcp_address)));
+		
+		runner = input;
+		for (i = 0; i < SERVER_LINES; ++i)
+		{
+			runner += sprintf(runner, "%lu + 0.5\n", (unsigned long)i);
+		}
+		
+		len = Exchange(fd, input, runner - input, answers, size - 1);
+		answers[len] = '\0';
+		runner = answers;
+		for (i = 0; i < SERVER_LINES && is_ok; ++i)
+		{
+			is_ok &= (i + 0.5 == strtod(runner, &runner)) && 
+			         ('\n' == *runner);
+			++runner;
+		}
+		is_ok &= ('\0' == *runner);
+		close(fd);
+	}
+	
+	/* many lines answered per read */
+	if (is_ok)
+	{
+		CalcServerGetStats(server, &stats);
+		is_ok &= (2 == stats.connections) && 
+		         (SERVER_LINES + 8 == stats.expressions) &&
+		         (4 == stats.errors) && (stats.reads < stats.expressions / 4);
+	}
+	
+	/* the socket file goes with the server */
+	CalcServerDestroy(server);
+	is_ok &= (0 != access(path, F_OK));
+	
+	free(answers);
+	free(input);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ RingTest ********************************************/
+static void *RunRing(void *ring)
+{
+	CalcRingRun((calc_ring_t *)ring, RING_IDLE_SPINS);
+	
+	return (NULL);
+}
+
+/* 'count' calculations through the ring - returns 1 if all were right */
+static int RingClient(calc_ring_t *ring, size_t first, size_t count)
+{
+	result_t result = {0};
+	char str[RING_MAX_LENGTH] = {0};
+	size_t i = 0;
+	int len = 0;
+	int is_ok = 1;
+	
+	for (i = first; i < first + count; ++i)
+	{
+		len = sprintf(str, "%lu + 0.5", (unsigned long)i);
+		result = CalcRingCalcN(ring, str, len);
+		is_ok &= (CALC_SUCCESS == result.status) &&
+		         (i + 0.5 == result.result);
+	}
+	
+	return (is_ok);
+}
+
+/* a wait on its own thread - for a ring stopped meanwhile */
+typedef struct ring_wait_s
+{
+	calc_ring_t *ring;
+	unsigned int ticket;
+	result_t result;
+}ring_wait_t;
+
+static void *RingWaitThread(void *arg)
+{
+	ring_wait_t *wait = (ring_wait_t *)arg;
+	
+	wait->result = CalcRingWait(wait->ring, wait->ticket);
+	
+	return (NULL);
+}
+
+static void *RingClientThread(void *ring)
+{
+	static atomic_size_t next = 0;
+	size_t first = atomic_fetch_add(&next, 1) * RING_EXPRS;
+	
+	return (RingClient((calc_ring_t *)ring, first, RING_EXPRS) ?
+	        ring : NULL);
+}
+
+void RingTest(void)
+{
+	const char *exprs[] = {"1 + 2", "2 * (3", "1/0", "2^10", "", "4 - 8",
+	                       "3 * 3 * 3", "7 - 8"};
+	const double expected[] = {3, 0, 0, 1024, 0, -4, 27, -1};
+	const int statuses[] = {CALC_SUCCESS, SYNTAX_ERROR, MATH_ERROR,
+	                        CALC_SUCCESS, SYNTAX_ERROR, CALC_SUCCESS,
+	                        CALC_SUCCESS, CALC_SUCCESS};
+	calc_ring_t *ring = NULL;
+	calc_ring_t *child_ring = NULL;
+	calc_ring_t *replacement = NULL;
+	pthread_t server;
+	pthread_t clients[RING_THREADS];
+	void *client_result = NULL;
+	ring_wait_t stopped_wait = {0};
+	char path[] = "/tmp/calc_test_ring_XXXXXX";
+	char too_long[RING_MAX_LENGTH + 2] = {0};
+	unsigned int tickets[RING_CAPACITY] = {0};
+	unsigned int ticket = 0;
+	result_t result = {0};
+	pid_t child = 0;
+	int child_status = 0;
+	size_t i = 0;
+	int is_ok = 1;
+	
+	printf("Ring test:\t\t\t\t");
+	
+	close(mkstemp(path));
+	ring = CalcRingCreate(path, RING_CAPACITY - 1, RING_MAX_LENGTH,
+	                      CALC_RING_MPSC);
+	is_ok &= (NULL != ring) && (NULL == CalcRingOpen("/tmp/calc_no_ring"));
+	
+	/* no evaluator yet - the ring fills, then is answered in one go, in
+	   order. a request over max_length is refused */
+	if (is_ok)
+	{
+		memset(too_long, '1', RING_MAX_LENGTH + 1);
+		is_ok &= (-1 == CalcRingSubmit(ring, too_long, RING_MAX_LENGTH + 1,
+		                               &ticket));
+		result = CalcRingCalcN(ring, too_long, RING_MAX_LENGTH + 1);
+		is_ok &= (LIMIT_ERROR == result.status);
+		
+		for (i = 0; i < RING_CAPACITY; ++i)
+		{
+			is_ok &= (0 == CalcRingSubmit(ring, exprs[i], strlen(exprs[i]),
+			                              &tickets[i]));
+		}
+		is_ok &= (-1 == CalcRingSubmit(ring, "1", 1, &ticket));
+		is_ok &= (RING_CAPACITY == CalcRingServe(ring, RING_CAPACITY * 2));
+		is_ok &= (0 == CalcRingServe(ring, RING_CAPACITY));
+		
+		for (i = 0; i < RING_CAPACITY; ++i)
+		{
+			result = CalcRingWait(ring, tickets[i]);
+			is_ok &= (statuses[i] == result.status) &&
+			         (CALC_SUCCESS != result.status ||
+			          expected[i] == result.result);
+		}
+	}
+	
+	/* an evaluator that sleeps when idle - threads of this process and a
+	   child process submitting at once, on many laps of the ring */
+	if (is_ok && 0 == pthread_create(&server, NULL, RunRing, ring))
+	{
+		fflush(stdout);
+		child = fork();
+		if (0 == child)
+		{
+			child_ring = CalcRingOpen(path);
+			_exit((NULL != child_ring &&
+			       RingClient(child_ring, 0, RING_EXPRS)) ? 0 : 1);
+		}
+		
+		for (i = 0; i < RING_THREADS; ++i)
+		{
+			pthread_create(&clients[i], NULL, RingClientThread, ring);
+		}
+		for (i = 0; i < RING_THREADS; ++i)
+		{
+			pthread_join(clients[i], &client_result);
+			is_ok &= (NULL != client_result);
+		}
+		
+		/* 0 - exited, with 0 */
+		is_ok &= (0 < child) && (child == waitpid(child, &child_status, 0)) &&
+		         (0 == child_status);
+		
+		CalcRingStop(ring);
+		pthread_join(server, NULL);
+	}
+	
+	/* the file goes with its creator */
+	CalcRingClose(ring);
+	is_ok &= (0 != access(path, F_OK));
+	
+	/* a single client - no atomic read-modify-write on submit */
+	ring = CalcRingCreate(path, RING_CAPACITY, RING_MAX_LENGTH,
+	                      CALC_RING_SPSC);
+	is_ok &= (NULL != ring);
+	if (is_ok && 0 == pthread_create(&server, NULL, RunRing, ring))
+	{
+		is_ok &= RingClient(ring, 0, RING_EXPRS);
+		CalcRingStop(ring);
+		pthread_join(server, NULL);
+	}
+	CalcRingClose(ring);
+	
+	/* stopped with no evaluator - a client asleep on its result is woken,
+	   and a full ring refuses more, instead of blocking them for good */
+	ring = CalcRingCreate(path, RING_CAPACITY, RING_MAX_LENGTH,
+	                      CALC_RING_MPSC);
+	is_ok &= (NULL != ring);
+	if (is_ok)
+	{
+		for (i = 0; i < RING_CAPACITY; ++i)
+		{
+			is_ok &= (0 == CalcRingSubmit(ring, "1", 1, &tickets[i]));
+		}
+		
+		stopped_wait.ring = ring;
+		stopped_wait.ticket = tickets[0];
+		if (0 == pthread_create(&clients[0], NULL, RingWaitThread,
+		                        &stopped_wait))
+		{
+			usleep(50000);
+			CalcRingStop(ring);
+			pthread_join(clients[0], NULL);
+			is_ok &= (APPLICATION_ERROR == stopped_wait.result.status);
+		}
+		
+		is_ok &= (APPLICATION_ERROR == CalcRingCalcN(ring, "1", 1).status);
+		is_ok &= (-1 == CalcRingSubmit(ring, "1", 1, &ticket));
+		is_ok &= (APPLICATION_ERROR == CalcRingWait(ring, tickets[1]).status);
+	}
+	
+	/* a new ring at the same path doesn't touch the one still mapped - it
+	   stays stopped for those attached to it */
+	child_ring = CalcRingOpen(path);
+	is_ok &= (NULL != child_ring);
+	if (is_ok)
+	{
+		replacement = CalcRingCreate(path, RING_CAPACITY,
+		                             RING_MAX_LENGTH, CALC_RING_MPSC);
+		is_ok &= (NULL != replacement) &&
+		         (-1 == CalcRingSubmit(child_ring, "1", 1, &ticket)) &&
+		         (0 == CalcRingSubmit(replacement, "1", 1, &ticket));
+		CalcRingClose(replacement);
+	}
+	CalcRingClose(child_ring);
+	CalcRingClose(ring);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+
+/************************ FormulasTest ****************************************/
+/* layers of FORMULA_WIDTH - node j of a layer uses nodes j and j + 1 of the
+   one before. layer 0 are the inputs */
+static int DefineLayers(calc_formulas_t *formulas)
+{
+	char name[32] = {0};
+	char expr[64] = {0};
+	size_t layer = 0;
+	size_t j = 0;
+	int status = CALC_SUCCESS;
+	
+	for (j = 0; j < FORMULA_WIDTH; ++j)
+	{
+		sprintf(name, "n0_%lu", (unsigned long)j);
+		status |= CalcFormulasSet(formulas, name, j);
+	}
+	
+	for (layer = 1; layer < FORMULA_LAYERS; ++layer)
+	{
+		for (j = 0; j < FORMULA_WIDTH; ++j)
+		{
+			sprintf(name, "n%lu_%lu", (unsigned long)layer, (unsigned long)j);
+			sprintf(expr, "n%lu_%lu * 0.5 + n%lu_%lu - 1",
+			        (unsigned long)layer - 1, (unsigned long)j,
+			        (unsigned long)layer - 1,
+			        (unsigned long)(j + 1) % FORMULA_WIDTH);
+			status |= CalcFormulasDefine(formulas, name, expr);
+		}
+	}
+	
+	return (status);
+}
+
+void FormulasTest(void)
+{
+	calc_formulas_t *formulas = CalcFormulasCreate();
+	calc_formulas_t *parallel = CalcFormulasCreate();
+	calc_pool_t *pool = CalcPoolCreate(FORMULA_THREADS);
+	result_t result = {0};
+	result_t expected = {0};
+	char name[32] = {0};
+	char expr[32] = {0};
+	size_t i = 0;
+	int is_ok = (NULL != formulas && NULL != parallel && NULL != pool);
+	
+	printf("Formulas test:\t\t\t\t");
+	
+	/* defined before their inputs are set - inputs of 0 until then */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "ratio",
+		                                             "margin / revenue"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "margin",
+		                                             "revenue - cost"));
+		is_ok &= (MATH_ERROR == CalcFormulasGet(formulas, "ratio").status);
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "revenue", 100));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "cost", 60));
+		result = CalcFormulasGet(formulas, "ratio");
+		is_ok &= (CALC_SUCCESS == result.status) && (0.4 == result.result);
+		is_ok &= (40 == CalcFormulasGet(formulas, "margin").result);
+		is_ok &= (100 == CalcFormulasGet(formulas, "revenue").result);
+		
+		/* a failure goes downstream, with its status */
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "pct",
+		                                             "ratio * 100"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "revenue", 0));
+		is_ok &= (MATH_ERROR == CalcFormulasGet(formulas, "pct").status);
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "revenue", 200));
+		result = CalcFormulasGet(formulas, "pct");
+		is_ok &= (CALC_SUCCESS == result.status) && (70 == result.result);
+	}
+	
+	/* only what a change reaches is evaluated - and not past a formula
+	   whose value didn't change */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "zero",
+		                                             "cost * 0"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "one",
+		                                             "zero + 1"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "other",
+		                                             "revenue ^ 2"));
+		is_ok &= (3 == CalcFormulasRecalc(formulas, NULL));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "cost", 50));
+		is_ok &= (4 == CalcFormulasRecalc(formulas, NULL));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "cost", 50));
+		is_ok &= (0 == CalcFormulasRecalc(formulas, NULL));
+		is_ok &= (1 == CalcFormulasGet(formulas, "one").result);
+	}
+	
+	/* -0 to 0 is a change - to the bit, though -0 == 0 */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "x", -1));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "z", "x * 0"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "w",
+		                                             "z ^ -1"));
+		is_ok &= (-INFINITY == CalcFormulasGet(formulas, "w").result);
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "x", 1));
+		is_ok &= (INFINITY == CalcFormulasGet(formulas, "w").result);
+		
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "z", "x"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "x", -0.0));
+		is_ok &= (-INFINITY == CalcFormulasGet(formulas, "w").result);
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "x", 0.0));
+		is_ok &= (INFINITY == CalcFormulasGet(formulas, "w").result);
+	}
+	
+	/* cycles - of one formula, two, and through a chain - are refused,
+	   and change nothing */
+	if (is_ok)
+	{
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "c", "c + 1"));
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "c",
+		                                            "new_input + c"));
+		is_ok &= (APPLICATION_ERROR == CalcFormulasGet(formulas, "c").status);
+		is_ok &= (APPLICATION_ERROR ==
+		          CalcFormulasGet(formulas, "new_input").status);
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "revenue",
+		                                            "pct"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "a", "b + 1"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "b", "d * 2"));
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "d", "a"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "d", 3));
+		is_ok &= (7 == CalcFormulasGet(formulas, "a").result);
+		is_ok &= (75 == CalcFormulasGet(formulas, "pct").result);
+		
+		is_ok &= (SYNTAX_ERROR == CalcFormulasDefine(formulas, "e", "1 +"));
+		is_ok &= (SYNTAX_ERROR == CalcFormulasDefine(formulas, "2e", "1"));
+		is_ok &= (APPLICATION_ERROR == CalcFormulasSet(formulas, "a", 1));
+		is_ok &= (APPLICATION_ERROR == 
+		          CalcFormulasGet(formulas, "no_such_name").status);
+	}
+	
+	/* redefined - an input into a formula, deepening all after it */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "margin",
+		                                             "revenue - cost * 2"));
+		is_ok &= (50 == CalcFormulasGet(formulas, "pct").result);
+		is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, "revenue",
+		                                             "base * 10 + a"));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "base", 19.5));
+		result = CalcFormulasGet(formulas, "pct");
+		expected = Calculate("(202 - 50 * 2) / 202 * 100");
+		is_ok &= (expected.result == result.result);
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "d", "margin"));
+	}
+	
+	/* a chain as long as the set grows - walked without recursion */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "f0", 1));
+		for (i = 1; i < FORMULA_CHAIN && is_ok; ++i)
+		{
+			sprintf(name, "f%lu", (unsigned long)i);
+			sprintf(expr, "f%lu + 1", (unsigned long)i - 1);
+			is_ok &= (CALC_SUCCESS == CalcFormulasDefine(formulas, name,
+			                                             expr));
+		}
+		is_ok &= (FORMULA_CHAIN == CalcFormulasGet(formulas, name).result);
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "f0", 2));
+		is_ok &= (FORMULA_CHAIN - 1 == CalcFormulasRecalc(formulas, NULL));
+		is_ok &= (FORMULA_CHAIN + 1 == CalcFormulasGet(formulas, name).result);
+		is_ok &= (CYCLE_ERROR == CalcFormulasDefine(formulas, "f0", name));
+	}
+	
+	/* by levels on a pool - the same values as on one thread */
+	if (is_ok)
+	{
+		is_ok &= (CALC_SUCCESS == DefineLayers(formulas));
+		is_ok &= (CALC_SUCCESS == DefineLayers(parallel));
+		CalcFormulasRecalc(formulas, NULL);
+		is_ok &= ((FORMULA_LAYERS - 1) * FORMULA_WIDTH ==
+		          CalcFormulasRecalc(parallel, pool));
+		
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(formulas, "n0_7", -3));
+		is_ok &= (CALC_SUCCESS == CalcFormulasSet(parallel, "n0_7", -3));
+		for (i = 0; i < FORMULA_WIDTH && is_ok; ++i)
+		{
+			sprintf(name, "n%lu_%lu", (unsigned long)FORMULA_LAYERS - 1,
+			        (unsigned long)i);
+			CalcFormulasRecalc(parallel, pool);
+			result = CalcFormulasGet(parallel, name);
+			expected = CalcFormulasGet(formulas, name);
+			is_ok &= (CALC_SUCCESS == result.status) &&
+			         (expected.result == result.result);
+		}
+	}
+	
+	CalcPoolDestroy(pool);
+	CalcFormulasDestroy(parallel);
+	CalcFormulasDestroy(formulas);
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/************************ StackTest *******************************************/
+void StackTest(void)
+{
+	size_t capacities[] = {0, 1, 3};
+	double buffer[32] = {0};	/* aligned for the elements */
+	stack_t *stack = NULL;
+	double value = 0;
+	size_t i = 0;
+	size_t j = 0;
+	int is_ok = 1;
+	
+	printf("Stack test:\t\t\t\t");
+	
+	/* growable - pushed far past where it starts, every element kept, and
+	   the top where StackPeek points after each move */
+	for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]) && is_ok; ++j)
+	{
+		stack = StackCreateGrowable(capacities[j], sizeof(double));
+		is_ok &= (NULL != stack) && (NULL == StackPeek(stack));
+		for (i = 0; i < STACK_ELEMENTS && is_ok; ++i)
+		{
+			value = i * 0.5;
+			is_ok &= (0 == StackPush(stack, &value)) &&
+			         (i + 1 == StackSize(stack)) &&
+			         (value == *(double *)StackPeek(stack));
+		}
+		for (i = STACK_ELEMENTS; i > 0 && is_ok; --i)
+		{
+			is_ok &= ((i - 1) * 0.5 == *(double *)StackPeek(stack)) &&
+			         (0 == StackPop(stack));
+		}
+		is_ok &= (0 == StackSize(stack)) && (-1 == StackPop(stack));
+		
+		/* and grows again after it emptied */
+		value = -1;
+		is_ok &= (0 == StackPush(stack, &value)) &&
+		         (-1 == *(double *)StackPeek(stack));
+		StackDestroy(stack);
+	}
+	
+	/* the fixed ones still get full */
+	stack = StackCreate(2, sizeof(double));
+	is_ok &= (NULL != stack) && (0 == StackPush(stack, &value)) &&
+	         (0 == StackPush(stack, &value)) &&
+	         (-1 == StackPush(stack, &value)) && (2 == StackSize(stack));
+	StackDestroy(stack);
+	
+	stack = StackCreateIn(buffer, 2, sizeof(double));
+	is_ok &= (sizeof(buffer) >= StackRequiredSize(2, sizeof(double))) &&
+	         (0 == StackPush(stack, &value)) &&
+	         (0 == StackPush(stack, &value)) &&
+	         (-1 == StackPush(stack, &value));
+	
+	is_ok ? printf("SUCCESS") : printf("FAIL");
+}
+
+
+/******************************************************************************
+*						allocation counting wrappers
+*******************************************************************************/
+void *__wrap_malloc(size_t size)
+{
+	++g_alloc_count;
+	g_largest_alloc = (size > g_largest_alloc) ? size : g_largest_alloc;
+	return (__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	++g_alloc_count;
+	g_largest_alloc = (count * size > g_largest_alloc) ? count * size :
+	                                                     g_largest_alloc;
+	return (__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	++g_alloc_count;
+	g_largest_alloc = (size > g_largest_alloc) ? size : g_largest_alloc;
+	return (__real_realloc(ptr, size));
+}
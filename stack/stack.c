@@ -11,6 +11,13 @@
 #include "stack.h"
 
 
+/*** macros ***/
+/* alignment kept between stacks placed in one buffer */
+#define STACK_ALIGNMENT (sizeof(union { double d; void *p; long l; }))
+
+/* the first capacity of a growable stack created empty */
+#define MIN_GROWTH 16
+
 /*** structs ***/
 struct stack
 {
@@ -18,8 +25,12 @@ struct stack
 	void *base;
 	void *current;
 	void *top;
+	int is_growable;	/* 'base' is a block of its own, reallocated */
 };
 
+/*** internal functions ***/
+static int Grow(stack_t *stack);
+
 /******************************************************************************
 *								StackCreate
 *******************************************************************************/
@@ -28,12 +39,78 @@ stack_t *StackCreate(size_t capacity, size_t element_size)
 	stack_t *ptr_stack = NULL;
 	ptr_stack = (stack_t *) malloc (sizeof(stack_t) + capacity * element_size);
 	
+	if (NULL == ptr_stack)
+	{
+		return (NULL);
+	}
+	
 	/* initialize all the structure's members */
 	ptr_stack->element_size = element_size;
 	ptr_stack->base 		= (char *) ptr_stack + sizeof(stack_t);
 	ptr_stack->current 		= ptr_stack->base;
 	ptr_stack->top 			= (char *) ptr_stack 
 							+ (sizeof(stack_t) + capacity * element_size);
+	ptr_stack->is_growable 	= 0;
+	
+	return (ptr_stack);
+}
+
+
+/******************************************************************************
+*								StackCreateGrowable
+*******************************************************************************/
+stack_t *StackCreateGrowable(size_t capacity, size_t element_size)
+{
+	stack_t *ptr_stack = NULL;
+	ptr_stack = (stack_t *) malloc (sizeof(stack_t));
+	
+	if (NULL == ptr_stack)
+	{
+		return (NULL);
+	}
+	
+	/* the elements are apart from the struct - they move as the stack grows */
+	ptr_stack->base = (0 < capacity) ? malloc(capacity * element_size) : NULL;
+	if (0 < capacity && NULL == ptr_stack->base)
+	{
+		free(ptr_stack);
+		return (NULL);
+	}
+	
+	ptr_stack->element_size = element_size;
+	ptr_stack->current 		= ptr_stack->base;
+	ptr_stack->top 			= (char *) ptr_stack->base + capacity * element_size;
+	ptr_stack->is_growable 	= 1;
+	
+	return (ptr_stack);
+}
+
+
+/******************************************************************************
+*								StackRequiredSize
+*******************************************************************************/
+size_t StackRequiredSize(size_t capacity, size_t element_size)
+{
+	size_t size = sizeof(stack_t) + capacity * element_size;
+	
+	return ((size + STACK_ALIGNMENT - 1) / STACK_ALIGNMENT * STACK_ALIGNMENT);
+}
+
+
+/******************************************************************************
+*								StackCreateIn
+*******************************************************************************/
+stack_t *StackCreateIn(void *buffer, size_t capacity, size_t element_size)
+{
+	stack_t *ptr_stack = (stack_t *) buffer;
+	
+	assert(buffer);
+	
+	ptr_stack->element_size = element_size;
+	ptr_stack->base 		= (char *) ptr_stack + sizeof(stack_t);
+	ptr_stack->current 		= ptr_stack->base;
+	ptr_stack->top 			= (char *) ptr_stack->base + capacity * element_size;
+	ptr_stack->is_growable 	= 0;
 	
 	return (ptr_stack);
 }
@@ -44,6 +121,11 @@ stack_t *StackCreate(size_t capacity, size_t element_size)
 *******************************************************************************/
 void StackDestroy(stack_t *stack)
 {
+	if (NULL != stack && stack->is_growable)
+	{
+		free(stack->base);
+	}
+	
 	free(stack);
 }
 
@@ -55,7 +137,8 @@ int StackPush(stack_t *stack, const void *element)
 {
 	assert(stack);
 	
-	if (stack->current == stack->top)
+	if (stack->current == stack->top && 
+	    (!stack->is_growable || 0 != Grow(stack)))
 	{
 		return (-1);
 	}
@@ -118,12 +201,31 @@ size_t StackSize(const stack_t *stack)
 }
 
 
-
-
-
-
-
-
-
-
-
+/******************************************************************************
+*								Grow
+*******************************************************************************/
+static int Grow(stack_t *stack)
+{
+	size_t size = (char *) stack->current - (char *) stack->base;
+	size_t capacity = 2 * ((char *) stack->top - (char *) stack->base) / 
+	                  stack->element_size;
+	void *base = NULL;
+	
+	capacity = (capacity < MIN_GROWTH) ? MIN_GROWTH : capacity;
+	if (capacity > (size_t) -1 / stack->element_size)
+	{
+		return (-1);
+	}
+	
+	base = realloc(stack->base, capacity * stack->element_size);
+	if (NULL == base)
+	{
+		return (-1);
+	}
+	
+	stack->base 	= base;
+	stack->current 	= (char *) base + size;
+	stack->top 		= (char *) base + capacity * stack->element_size;
+	
+	return (0);
+}
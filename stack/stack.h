@@ -25,6 +25,29 @@ typedef struct stack stack_t;
  */
 stack_t *StackCreate(size_t capacity, size_t element_size);
 
+/*  StackCreateGrowable creates a stack that never gets full - a push to a
+ *  full stack reallocates it with twice the capacity (amortized O(1)), so
+ *  'capacity' is only where it starts. memory is used only as deep as the
+ *  stack gets.
+ *  Notice that a push may move the elements - a pointer returned by
+ *  StackPeek is valid only until the next push.
+ *  in case of failure NULL will be returned.
+ */
+stack_t *StackCreateGrowable(size_t capacity, size_t element_size);
+
+/*  StackRequiredSize returns the number of bytes StackCreateIn needs for a
+ *  stack of 'capacity' elements of 'element_size'. the size is rounded up so
+ *  a few stacks can be placed one after the other in the same buffer.
+ */
+size_t StackRequiredSize(size_t capacity, size_t element_size);
+
+/*  StackCreateIn creates a stack inside a buffer owned by the caller, with
+ *  no allocation. the buffer must be at least StackRequiredSize bytes and
+ *  aligned as malloc aligns memory. such a stack must NOT be passed to
+ *  StackDestroy - it lives as long as the buffer does.
+ */
+stack_t *StackCreateIn(void *buffer, size_t capacity, size_t element_size);
+
 /*
  * StackDestroy function will release the memory pointed to by stack.       
  * Notice that is order to avoid a dangling pointer it is the user's
@@ -34,7 +57,8 @@ void StackDestroy(stack_t *stack);
 
 /*  StackPush function inserts element into the top of stack. 
  *  the function will not alter the value of element.    
- *  the function returns 0 in case of success and -1 in case stack is full.
+ *  the function returns 0 in case of success and -1 in case stack is full
+ *  (a growable stack - in case it can't grow).
  */
 int StackPush(stack_t *stack, const void *element);
 
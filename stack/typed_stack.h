@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * File name  : typed_stack.h
+ * Developer  : Eyal Weizman
+ * Description: typed stacks, generated per element type
+ ******************************************************************************/
+
+#ifndef _TYPED_STACK_H_
+#define _TYPED_STACK_H_
+
+#include <stddef.h> /* size_t */
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memcpy */
+#include <assert.h> /* assert */
+
+/* the first heap capacity of a stack that outgrew its buffer */
+#define TYPED_STACK_MIN_GROWTH 16
+
+/*  DEFINE_TYPED_STACK generates a stack of 'type' elements - the struct
+ *  'name'_t and the functions 'Prefix'Init, 'Prefix'Push, 'Prefix'Pop,
+ *  'Prefix'Peek, 'Prefix'Size, 'Prefix'Capacity and 'Prefix'Destroy.
+ *  for example:
+ *
+ *  	DEFINE_TYPED_STACK(num_stack, NumStack, double)
+ *
+ *  generates num_stack_t, NumStackPush(num_stack_t *stack, double element)
+ *  and so on. unlike stack_t (stack.h) the element size is known at compile
+ *  time - a push is a single store, a peek a single load, and the functions
+ *  are static inline so they disappear into the caller.
+ *
+ *  the stack starts in a buffer owned by the caller - usually a small one,
+ *  on the call stack. a push to a full stack moves it to the heap, doubling
+ *  its capacity every time (a push is amortized O(1)), so memory is used only
+ *  as deep as the stack actually gets. 'Prefix'Destroy releases the heap
+ *  memory, if any - the caller's buffer is never freed.
+ *  popping / peeking an empty stack is a bug of the caller, caught by an
+ *  assert in debug builds only. use 'Prefix'Size where it may happen.
+ *
+ *  'Prefix'Init(stack, buffer, capacity) - 'buffer' holds 'capacity' elements
+ *  'Prefix'Push(stack, element)          - 0, or -1 if the stack is full and
+ *                                          can't grow (no memory)
+ *  'Prefix'Pop(stack)                    - removes and returns the top element
+ *  'Prefix'Peek(stack)                   - returns the top element
+ *  'Prefix'Size(stack)                   - the number of elements
+ *  'Prefix'Capacity(stack)               - elements it holds without growing
+ *  'Prefix'Destroy(stack)                - releases the heap memory
+ */
+#define DEFINE_TYPED_STACK(name, Prefix, type)                                \
+typedef struct name##_s                                                       \
+{                                                                             \
+	type *base;                                                               \
+	type *current;	/* one past the top element */                            \
+	type *top;		/* one past the last element */                           \
+	int is_on_heap;	/* 'base' is ours to free - the stack has grown */        \
+}name##_t;                                                                    \
+                                                                              \
+static inline void Prefix##Init(name##_t *stack, type *buffer,                \
+                                size_t capacity)                              \
+{                                                                             \
+	assert(stack);                                                            \
+	assert(buffer || 0 == capacity);                                          \
+	stack->base = buffer;                                                     \
+	stack->current = buffer;                                                  \
+	stack->top = buffer + capacity;                                           \
+	stack->is_on_heap = 0;                                                    \
+}                                                                             \
+                                                                              \
+static inline int Prefix##Grow(name##_t *stack)                               \
+{                                                                             \
+	size_t size = (size_t)(stack->current - stack->base);                     \
+	size_t capacity = 2 * (size_t)(stack->top - stack->base);                 \
+	type *base = NULL;                                                        \
+                                                                              \
+	capacity = (capacity < TYPED_STACK_MIN_GROWTH) ?                          \
+	           TYPED_STACK_MIN_GROWTH : capacity;                             \
+	if (capacity > (size_t)-1 / sizeof(type))                                 \
+	{                                                                         \
+		return (-1);                                                          \
+	}                                                                         \
+                                                                              \
+	/* the first growth leaves the caller's buffer - copied, not freed */     \
+	if (stack->is_on_heap)                                                    \
+	{                                                                         \
+		base = (type *)realloc(stack->base, capacity * sizeof(type));         \
+	}                                                                         \
+	else                                                                      \
+	{                                                                         \
+		base = (type *)malloc(capacity * sizeof(type));                       \
+		if (NULL != base && 0 != size)                                        \
+		{                                                                     \
+			memcpy(base, stack->base, size * sizeof(type));                   \
+		}                                                                     \
+	}                                                                         \
+                                                                              \
+	if (NULL == base)                                                         \
+	{                                                                         \
+		return (-1);                                                          \
+	}                                                                         \
+                                                                              \
+	stack->base = base;                                                       \
+	stack->current = base + size;                                             \
+	stack->top = base + capacity;                                             \
+	stack->is_on_heap = 1;                                                    \
+                                                                              \
+	return (0);                                                               \
+}                                                                             \
+                                                                              \
+static inline int Prefix##Push(name##_t *stack, type element)                 \
+{                                                                             \
+	if (stack->current == stack->top && 0 != Prefix##Grow(stack))             \
+	{                                                                         \
+		return (-1);                                                          \
+	}                                                                         \
+	*(stack->current)++ = element;                                            \
+                                                                              \
+	return (0);                                                               \
+}                                                                             \
+                                                                              \
+static inline type Prefix##Pop(name##_t *stack)                               \
+{                                                                             \
+	assert(stack->current > stack->base);                                     \
+	return (*--(stack->current));                                             \
+}                                                                             \
+                                                                              \
+static inline type Prefix##Peek(const name##_t *stack)                        \
+{                                                                             \
+	assert(stack->current > stack->base);                                     \
+	return (stack->current[-1]);                                              \
+}                                                                             \
+                                                                              \
+static inline size_t Prefix##Size(const name##_t *stack)                      \
+{                                                                             \
+	return ((size_t)(stack->current - stack->base));                          \
+}                                                                             \
+                                                                              \
+static inline size_t Prefix##Capacity(const name##_t *stack)                  \
+{                                                                             \
+	return ((size_t)(stack->top - stack->base));                              \
+}                                                                             \
+                                                                              \
+static inline void Prefix##Destroy(name##_t *stack)                           \
+{                                                                             \
+	if (stack->is_on_heap)                                                    \
+	{                                                                         \
+		free(stack->base);                                                    \
+	}                                                                         \
+	stack->base = NULL;                                                       \
+	stack->current = NULL;                                                    \
+	stack->top = NULL;                                                        \
+	stack->is_on_heap = 0;                                                    \
+}
+
+#endif     /* _TYPED_STACK_H_ */